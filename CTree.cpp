@@ -2,11 +2,13 @@
 // CTree - 目录树生成工具 v1.0.0
 // ============================================================================
 // 功能：生成文件夹结构树，支持 .gitignore 语法忽略，支持右键菜单，支持剪贴板
-// 兼容：Windows 7+ (MSVC 编译)
+// 兼容：Windows 7+ (MSVC 编译)；Linux / POSIX (g++ -std=c++17 -O2 -pthread)
 // ============================================================================
 
+#ifdef _WIN32
 #define WINVER 0x0601
 #define _WIN32_WINNT 0x0601  
+#endif
 
 #include <iostream>
 #include <fstream>
@@ -17,22 +19,79 @@
 #include <iomanip>
 #include <algorithm>
 #include <map>
+#include <set>
+#include <unordered_map>
 #include <sstream>
+#include <string_view>
+#include <cstdint>
+#include <cwctype>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <functional>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <cerrno>
+#include <ctime>
+#include <csignal>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#define CTREE_HAVE_SSE2 1
+#endif
 
+#ifdef _WIN32
 // Windows Headers
 #include <windows.h>
-#include <shlwapi.h>
 #include <shlobj.h> 
+#include <psapi.h>
+#include <io.h>
+#include <fcntl.h>
 
 // 链接库 (MSVC)
-#pragma comment(lib, "Shlwapi.lib")
 #pragma comment(lib, "Advapi32.lib")
 #pragma comment(lib, "Shell32.lib")
 #pragma comment(lib, "User32.lib")
 #pragma comment(lib, "Ole32.lib")
+#pragma comment(lib, "Psapi.lib")
+#else
+// POSIX Headers
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <iconv.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define CTREE_HAVE_IO_URING 1
+#endif
+#endif
+#endif
+
+#include "ctree.h"
 
 namespace fs = std::filesystem;
 
+namespace ctree::detail {
+
 // ============================================================================
 // [Section 1] 常量、语言包与配置
 // ============================================================================
@@ -46,717 +105,7095 @@ const std::wstring VERSION = L"1.0.0";
 enum class Lang { CN, EN };
 
 Lang detect_system_language() {
+#ifdef _WIN32
     LANGID langId = GetUserDefaultUILanguage();
     if ((langId & 0xFF) == LANG_CHINESE) return Lang::CN;
+#else
+    for (const char* var : { "LC_ALL", "LC_MESSAGES", "LANG" }) {
+        const char* v = std::getenv(var);
+        if (v && *v) return (std::strncmp(v, "zh", 2) == 0) ? Lang::CN : Lang::EN;
+    }
+#endif
     return Lang::EN;
 }
 
+// 消息编号：与 MESSAGES 逐项对应 (顺序由其后的 static_assert 检查)
+enum class Msg : uint16_t {
+    MENU_TITLE, MENU_OPT_1, MENU_OPT_2, MENU_OPT_ERROR, INPUT_PROMPT, SUCCESS_ADD, SUCCESS_REM, CTX_TREE_NAME,
+    CTX_COPY_NAME, ERR_PATH, ERR_ARGS, ERR_FILE_READ, ERR_FILE_OPEN, ERR_WATCH_UNSUPPORTED, ERR_WATCH_LIMIT,
+    MSG_WATCHING, MSG_WATCH_UPDATED, STATS_TITLE, STATS_PHASES, STATS_BREAKDOWN, STATS_COUNTERS, STATS_RULES,
+    STATS_NEVER, ERR_CACHE_WRITE, MSG_CLIPBOARD, ERR_CLIPBOARD, MSG_ENCODING, BUNDLE_TRUNCATED, BUNDLE_OMITTED,
+    BUNDLE_OMITTED_TAIL, BUNDLE_OMITTED_ONE, SIZE_FILES, SIZE_ONE_FILE, SIZE_TOP, DIFF_ADDED, DIFF_REMOVED, DIFF_MODIFIED,
+    DIFF_NONE, ERR_SNAPSHOT, MSG_SERVING, ERR_SERVE, ERR_NOT_GIT_REPO, ERR_GIT_INDEX, ERR_ARCHIVE, MSG_SAVED, MORE_ENTRIES, MORE_ENTRIES_TAIL, MORE_ENTRIES_ONE, MSG_TRUNCATED, NOT_SCANNED,
+    BUDGET_EXHAUSTED, BUDGET_EXHAUSTED_TAIL, GENERATED_TREEIGNORE,
+    INFO_REM_GLOBAL, PROCESSING, USING_IGNORE, HELP_MSG, DEFAULT_TREEIGNORE, COUNT,
+};
+
+// 消息表：两种语言都是编译期的 UTF-8 常量 (源码按 UTF-8 编译，MSVC 需 /utf-8)
+// 取用时既不分配也不转码，冷启动不再构造整张字符串表
+struct MsgText {
+    Msg id;
+    std::string_view cn, en;
+};
+
+inline constexpr MsgText MESSAGES[] = {
+    { Msg::MENU_TITLE, "[CTree 安装/卸载 - 当前用户]", "[CTree Install/Uninstall - Current User]" },
+    { Msg::MENU_OPT_1, "1. 添加到右键菜单 (文件夹生成树 + 文本文件复制)", "1. Add to Context Menu (Folder Tree + Text Copy)" },
+    { Msg::MENU_OPT_2, "2. 从右键菜单移除", "2. Remove from Context Menu" },
+    { Msg::MENU_OPT_ERROR, "输入有误，请重新输入", "Input is incorrect. Please re-enter." },
+    { Msg::INPUT_PROMPT, "请输入选项: ", "Enter choice: " },
+    { Msg::SUCCESS_ADD, "成功！已添加到右键菜单。", "Success! Added to context menu." },
+    { Msg::SUCCESS_REM, "成功！已清理相关右键菜单。", "Success! Cleaned up context menu." },
+
+    { Msg::CTX_TREE_NAME, "生成目录树文件", "Generate Tree File" },
+    { Msg::CTX_COPY_NAME, "复制文件内容", "Copy File Content" },
+
+    { Msg::ERR_PATH, "错误：路径不存在。", "Error: Path does not exist." },
+    { Msg::ERR_ARGS, "错误：参数不正确。", "Error: Invalid arguments." },
+    { Msg::ERR_FILE_READ, "错误：无法读取文件：", "Error: Cannot read file: " },
+    { Msg::ERR_FILE_OPEN, "错误：无法打开文件：", "Error: Cannot open file: " },
+    { Msg::ERR_WATCH_UNSUPPORTED, "错误：当前平台或目录不支持监视模式。", "Error: Watch mode is not supported for this platform or directory." },
+    { Msg::ERR_WATCH_LIMIT, "警告：无法监视部分目录 (可能已达到系统监视数量上限)：", "Warning: Cannot watch some directories (system watch limit may be reached): " },
+    { Msg::MSG_WATCHING, "正在监视变化，按 Ctrl+C 退出...", "Watching for changes, press Ctrl+C to exit..." },
+    { Msg::MSG_WATCH_UPDATED, "已更新，耗时 (ms)：", "Updated, time (ms): " },
+    { Msg::STATS_TITLE, "===== 运行统计 =====", "===== Run statistics =====" },
+    { Msg::STATS_PHASES, "阶段耗时 (墙钟 / CPU, ms)：", "Phase time (wall / CPU, ms):" },
+    { Msg::STATS_BREAKDOWN, "遍历细分 (各线程累计, ms)：", "Traversal breakdown (summed over threads, ms):" },
+    { Msg::STATS_COUNTERS, "计数：", "Counters:" },
+    { Msg::STATS_RULES, "忽略规则 (检查次数 / 命中 / 耗时 us)：", "Ignore rules (evaluations / hits / time us):" },
+    { Msg::STATS_NEVER, "  <- 从未命中", "  <- never fired" },
+    { Msg::ERR_CACHE_WRITE, "警告：无法写入索引缓存：", "Warning: Cannot write index cache: " },
+    { Msg::MSG_CLIPBOARD, "内容已复制到剪贴板。", "Content copied to clipboard." },
+#ifdef _WIN32
+    { Msg::ERR_CLIPBOARD, "错误：无法复制到剪贴板。", "Error: Cannot copy to clipboard." },
+#else
+    { Msg::ERR_CLIPBOARD, "错误：无法复制到剪贴板 (需要 wl-copy、xclip、xsel 或 pbcopy 之一)。",
+      "Error: Cannot copy to clipboard (requires one of wl-copy, xclip, xsel or pbcopy)." },
+#endif
+    { Msg::MSG_ENCODING, "文件编码：", "File encoding: " },
+    { Msg::BUNDLE_TRUNCATED, "…（已达到 --bundle-bytes / --bundle-lines 上限，此文件其余内容未输出）", "… (file cut off by --bundle-bytes / --bundle-lines)" },
+    { Msg::BUNDLE_OMITTED, "… 另有 ", "… " },
+    { Msg::BUNDLE_OMITTED_TAIL, " 个文件因超出打包上限未输出", " more files not bundled (budget exhausted)" },
+    { Msg::BUNDLE_OMITTED_ONE, " 个文件因超出打包上限未输出", " more file not bundled (budget exhausted)" },
+    { Msg::SIZE_FILES, " 个文件", " files" },
+    { Msg::SIZE_ONE_FILE, " 个文件", " file" },
+    { Msg::SIZE_TOP, "占用空间最大的目录：", "Largest directories:" },
+    { Msg::DIFF_ADDED, "新增 ", "added " },
+    { Msg::DIFF_REMOVED, "，删除 ", ", removed " },
+    { Msg::DIFF_MODIFIED, "，修改 ", ", modified " },
+    { Msg::DIFF_NONE, "没有差异。", "No differences." },
+    { Msg::ERR_SNAPSHOT, "错误：无法读取快照文件：", "Error: Cannot read snapshot file: " },
+    { Msg::MSG_SERVING, "正在监听：", "Listening on: " },
+    { Msg::ERR_SERVE, "错误：无法监听：", "Error: Cannot listen on: " },
+    { Msg::ERR_NOT_GIT_REPO, "错误：输入目录不在 Git 工作区中。", "Error: Input directory is not inside a Git work tree." },
+    { Msg::ERR_GIT_INDEX, "错误：无法解析 Git 索引 (.git/index)。", "Error: Cannot parse the Git index (.git/index)." },
+    { Msg::ERR_ARCHIVE, "错误：无法读取归档文件 (支持 .zip、.tar、.tar.gz)：", "Error: Cannot read archive (.zip, .tar and .tar.gz are supported): " },
+    { Msg::MSG_SAVED, "文件已保存至: ", "File saved to: " },
+    { Msg::MORE_ENTRIES, "… 另有 ", "… and " },
+    { Msg::MORE_ENTRIES_TAIL, " 项未列出", " more entries" },
+    { Msg::MORE_ENTRIES_ONE, " 项未列出", " more entry" },
+    { Msg::MSG_TRUNCATED, "… 已达到 --max-lines 上限，其余内容未列出", "… output truncated by --max-lines" },
+    { Msg::NOT_SCANNED, " [… 未扫描]", " [… not scanned]" },
+    { Msg::BUDGET_EXHAUSTED, "… 扫描预算已用尽，", "… scan budget exhausted, " },
+    { Msg::BUDGET_EXHAUSTED_TAIL, " 个目录未扫描", " directories not scanned" },
+    { Msg::GENERATED_TREEIGNORE, "创建完成：", "Created: " },
+    { Msg::INFO_REM_GLOBAL, "已删除全局 .treeignore", "Removed global .treeignore" },
+    { Msg::PROCESSING, "正在处理...", "Processing..." },
+
+    { Msg::USING_IGNORE, "忽略配置文件：", "Ignore config file: " },
+
+    { Msg::HELP_MSG,
+        // 中文版
+        "用法: CTree [命令] [参数]\n"
+        "  -h, --help                 显示此帮助消息\n"
+        "  -v, --version              显示软件版本\n"
+        "  -i, --input <path>         指定输入目录 <path>；也可以是 .zip / .tar / .tar.gz 归档文件，不解压直接列出其中的目录树\n"
+        "  -o, --output [path]        1. 输出到文件（可选路径；若省略，则生成带时间戳的文件）\n"
+        "                             2. 若未指定 -o，默认输出到终端\n"
+        "  -c, --copy [path]          1. 配合 -i 使用：不指定 [path] 时，将生成的目录树复制到剪贴板\n"
+        "                             2. 指定 [path] 时：将该文件内容复制到剪贴板\n"
+        "  -n, --ignore [pattern] ... 临时添加忽略规则（可多次使用）\n"
+        "  -f, --file <path>          使用指定的忽略配置文件（兼容 .gitignore 语法）\n"
+        "  -g, --global               创建全局 .treeignore 配置文件\n"
+        "  -l, --local                在当前目录创建本地 .treeignore 配置文件\n"
+        "  -d, --delete-global        删除全局 .treeignore 配置文件\n"
+        "  -t, --threads [N]          多线程并行遍历（N 为线程数，省略则使用 CPU 核心数），输出与单线程完全一致\n"
+        "      --cache <file>         使用持久化目录索引：仅重新读取修改时间变化的目录（忽略 -t）\n"
+        "      --watch                持续监视目录变化并增量更新输出文件（隐含 -o）\n"
+        "      --stats [json]         完成后向标准错误输出各阶段耗时、计数与每条忽略规则的开销\n"
+        "      --max-depth <N>        只展开前 N 层目录\n"
+        "      --max-entries-per-dir <N>  每个目录最多列出 N 项，其余以一行汇总\n"
+        "      --max-lines <N>        目录树最多输出 N 行（单线程遍历）\n"
+        "      --time-budget <ms>     限时遍历：按层广度优先并发读取，到期即输出已读到的部分，未读取的目录标注 [… 未扫描]\n"
+        "      --entry-budget <N>     同上，以读取的条目数为预算（结果与线程数无关）\n"
+        "      --gitignore            读取各级目录中的 .gitignore / .treeignore，规则仅作用于所在子树（.gitignore 按 Git 语义锚定）\n"
+        "      --git-tracked          只列出 Git 已跟踪的文件：直接读取 .git/index 建树，不遍历磁盘\n"
+        "      --others               同时列出未跟踪的条目：只读取已跟踪的目录本身，仅向下遍历完全未跟踪的目录（隐含 --git-tracked）\n"
+        "      --follow-links <mode>  指向目录的符号链接：safe（默认，只展开指向扫描目录之外的链接，同一目标只展开一次，不会成环）| never | always（可重复展开，回到自身祖先时停止）；未展开的显示为 名称 -> 目标\n"
+        "      --sort <mode>          排序方式：name（默认）| natural（数字按数值）| icase（忽略大小写）| mtime（最新在前）| size（最大在前）| none（不排序，边读边输出）\n"
+        "      --format <fmt>         输出格式：text（默认）| json（嵌套）| ndjson（每项一行）| bin（紧凑二进制）\n"
+        "      --sizes                在每项后标注大小，目录为整棵子树的总大小与文件数（硬链接只计一次）\n"
+        "      --top <N>              在末尾列出占用空间最大的 N 个目录（隐含 --sizes）\n"
+        "      --bundle               在目录树之后按顺序附上每个文本文件的内容（跳过二进制文件）\n"
+        "      --include <glob> ...   只打包匹配的文件（语法同忽略规则，可多次使用）\n"
+        "      --bundle-bytes <N>     打包内容最多 N 字节\n"
+        "      --bundle-lines <N>     打包内容最多 N 行\n"
+        "      --snapshot <file>      保存目录树快照（含每个文件的大小、修改时间与内容哈希），供 --diff 比较\n"
+        "      --diff <path>          与另一目录或快照文件比较，以树形列出新增 [+]、删除 [-] 与修改 [~] 的条目\n"
+        "      --serve <socket>       常驻运行，在本地套接字 (Windows 为命名管道) 上并发处理目录树 / 打包请求，缓存忽略规则与目录列表（-t 为处理线程数）\n"
+        "忽略配置文件优先级：指定 (-f) > 本地 > 全局\n",
+
+        // 英文版
+        "Usage: CTree [command] [args]\n"
+        "  -h, --help                 Display this help message\n"
+        "  -v, --version              Show software version\n"
+        "  -i, --input <path>         Specify input directory; a .zip / .tar / .tar.gz archive is listed without extracting it\n"
+        "  -o, --output [path]        1. Output to file (optional path; if omitted, a timestamped filename is generated)\n"
+        "                             2. If -o is not specified, output to terminal\n"
+        "  -c, --copy [path]          1. With -i: omit [path] to copy the generated tree to clipboard\n"
+        "                             2. If [path] is provided, copy its content to clipboard\n"
+        "  -n, --ignore [pattern] ... Add temporary ignore patterns (can be used multiple times)\n"
+        "  -f, --file <path>          Use an explicit ignore config file (compatible with .gitignore syntax)\n"
+        "  -g, --global               Create global .treeignore config file\n"
+        "  -l, --local                Create local .treeignore config file in current directory\n"
+        "  -d, --delete-global        Delete global .treeignore config file\n"
+        "  -t, --threads [N]          Parallel traversal with N threads (default: CPU cores); output is identical to single-threaded\n"
+        "      --cache <file>         Use a persistent directory index; only directories whose mtime changed are re-read (-t is ignored)\n"
+        "      --watch                Keep watching for changes and update the output file incrementally (implies -o)\n"
+        "      --stats [json]         Print phase timings, counters and per-ignore-rule cost to stderr when done\n"
+        "      --max-depth <N>        Only descend N directory levels\n"
+        "      --max-entries-per-dir <N>  List at most N entries per directory and summarize the rest in one line\n"
+        "      --max-lines <N>        Stop after N tree lines (single-threaded traversal)\n"
+        "      --time-budget <ms>     Deadline mode: read breadth-first in parallel and print what was gathered when time is up; unread directories are marked [… not scanned]\n"
+        "      --entry-budget <N>     Same, but budgeted by entries read (result does not depend on thread count)\n"
+        "      --gitignore            Honor .gitignore / .treeignore files in every directory, scoped to their subtree (.gitignore uses Git anchoring)\n"
+        "      --git-tracked          List only files tracked by Git: build the tree from .git/index without walking the disk\n"
+        "      --others               Also list untracked entries: tracked directories are read without recursing, only untracked directories are walked (implies --git-tracked)\n"
+        "      --follow-links <mode>  Directory symlinks: safe (default; only links pointing outside the scanned tree are expanded, each target once, never cycles) | never | always (targets may repeat; stops where a link leads back into its own ancestors); others show as name -> target\n"
+        "      --sort <mode>          Ordering: name (default) | natural (numbers by value) | icase | mtime (newest first) | size (largest first) | none (unsorted, streamed)\n"
+        "      --format <fmt>         Output format: text (default) | json (nested) | ndjson (one record per line) | bin (compact binary)\n"
+        "      --sizes                Annotate entries with sizes; directories show subtree total and file count (hard links counted once)\n"
+        "      --top <N>              List the N largest directories at the end (implies --sizes)\n"
+        "      --bundle               Append the contents of every text file after the tree (binary files are skipped)\n"
+        "      --include <glob> ...   Only bundle matching files (ignore-rule syntax, can be repeated)\n"
+        "      --bundle-bytes <N>     Bundle at most N bytes of file content\n"
+        "      --bundle-lines <N>     Bundle at most N lines of file content\n"
+        "      --snapshot <file>      Save a snapshot of the tree (size, mtime and content hash of every file) for --diff\n"
+        "      --diff <path>          Compare against another directory or a snapshot file; list added [+], removed [-] and modified [~] entries as a tree\n"
+        "      --serve <socket>       Run as a daemon serving concurrent tree / bundle requests on a local socket (named pipe on Windows), caching ignore rules and directory listings (-t sets handler threads)\n"
+        "Ignore config priority: explicit (-f) > local > global\n",
+    },
+    { Msg::DEFAULT_TREEIGNORE,
+        // 中文版
+        "# ========================================================\n"
+        "# CTree 忽略规则配置文件\n"
+        "# ========================================================\n"
+        "# 语法说明 (基于 .gitignore 逻辑):\n"
+        "#\n"
+        "#【注】本软件内部统一处理路径分隔符，/ 与 \\ 完全等价。\n"
+        "#\n"
+        "# 1. 注释与无效行\n"
+        "#    - 以 # 开头的行会被忽略。\n"
+        "#    - 存在连续斜杠（如 //、\\\\、/\\、\\/）的行会被视为无效而忽略。\n"
+        "#\n"
+        "# 2. 根目录锚定 (以 / 或 \\ 开头)\n"
+        "#    例如: /build\n"
+        "#    说明: 仅匹配项目根目录下的 build 文件夹。\n"
+        "#          (不匹配 sub/build)\n"
+        "#\n"
+        "# 3. 嵌套路径匹配 (中间包含 / 或 \\)\n"
+        "#    例如: src/temp\n"
+        "#    说明: 匹配任意深度下的 src/temp 路径。\n"
+        "#          (匹配 src/temp，也匹配 code/src/temp)\n"
+        "#\n"
+        "# 4. 目录限定 (以 / 或 \\ 结尾)\n"
+        "#    例如: log/\n"
+        "#    说明: 匹配任意位置名为 log 的目录，但不匹配名为 log 的文件。\n"
+        "#\n"
+        "# 5. 文件名/通用匹配 (不含路径分隔符)\n"
+        "#    例如: *.log 或 debug\n"
+        "#    说明: 匹配任意位置符合该名称的文件或目录。\n"
+        "#\n"
+        "# 6. 跨层通配 (**)\n"
+        "#    例如: docs/**/draft 或 cache/**\n"
+        "#    说明: ** 匹配零个或多个目录层级；a/** 匹配 a 内的全部内容。\n"
+        "#\n"
+        "# 7. 否定规则 (以 ! 开头)\n"
+        "#    例如: *.log 之后写 !keep.log\n"
+        "#    说明: 重新包含此前被忽略的条目，靠后的规则优先。\n"
+        "#          (已被忽略的目录不会再进入，其内容无法重新包含)\n"
+        "#\n"
+        "# ========================================================\n"
+        "\n"
+        "# --- 版本控制 ---\n"
+        ".git/\n"
+        ".svn/\n"
+        ".hg/\n"
+        "\n"
+        "# --- IDE 与 编辑器 ---\n"
+        ".vscode/\n"
+        ".idea/\n"
+        ".vs/\n"
+        "*.swp\n"
+        "\n"
+        "# --- 常用构建与输出目录 (建议锚定到根目录) ---\n"
+        "/build/\n"
+        "/dist/\n"
+        "/bin/\n"
+        "/obj/\n"
+        "/out/\n"
+        "/target/\n"
+        "\n"
+        "# --- 语言特定依赖 ---\n"
+        "node_modules/\n"
+        "__pycache__/\n"
+        "venv/\n"
+        "\n"
+        "# --- 临时文件与二进制 ---\n"
+        "*.log\n"
+        "*.tmp\n"
+        "*.exe\n"
+        "*.dll\n"
+        "*.so\n"
+        "*.dylib\n"
+        "*.o\n"
+        "*.obj\n"
+        "Thumbs.db\n"
+        ".DS_Store\n",
+
+        // 英文版
+        "# ========================================================\n"
+        "# CTree Ignore Rules Configuration\n"
+        "# ========================================================\n"
+        "# Syntax Guide (Based on .gitignore logic):\n"
+        "#\n"
+        "# [Note] / and \\ are treated as equivalent internally.\n"
+        "#\n"
+        "# 1. Comments & Invalid Lines\n"
+        "#    - Lines starting with # are ignored.\n"
+        "#    - Lines containing consecutive slashes (//, \\\\, /\\, \\/) are ignored.\n"
+        "#\n"
+        "# 2. Root Anchor (Starts with / or \\)\n"
+        "#    Example: /build\n"
+        "#    Effect:  Matches 'build' ONLY at the root level.\n"
+        "#             (Does NOT match sub/build)\n"
+        "#\n"
+        "# 3. Nested Path (Contains / or \\ in the middle)\n"
+        "#    Example: src/temp\n"
+        "#    Effect:  Matches 'src/temp' at ANY depth.\n"
+        "#             (Matches src/temp AND code/src/temp)\n"
+        "#\n"
+        "# 4. Directory Only (Ends with / or \\)\n"
+        "#    Example: log/\n"
+        "#    Effect:  Matches directories named 'log' anywhere,\n"
+        "#             but ignores files named 'log'.\n"
+        "#\n"
+        "# 5. Filename/General (No separators)\n"
+        "#    Example: *.log or debug\n"
+        "#    Effect:  Matches files or directories with this name\n"
+        "#             at any level.\n"
+        "#\n"
+        "# 6. Cross-level Wildcard (**)\n"
+        "#    Example: docs/**/draft or cache/**\n"
+        "#    Effect:  ** matches zero or more directory levels;\n"
+        "#             a/** matches everything inside a.\n"
+        "#\n"
+        "# 7. Negation (Starts with !)\n"
+        "#    Example: *.log followed by !keep.log\n"
+        "#    Effect:  Re-includes a previously ignored entry; later rules win.\n"
+        "#             (Contents of an ignored directory cannot be re-included)\n"
+        "#\n"
+        "# ========================================================\n"
+        "\n"
+        "# --- Version Control ---\n"
+        ".git/\n"
+        ".svn/\n"
+        ".hg/\n"
+        "\n"
+        "# --- IDEs & Editors ---\n"
+        ".vscode/\n"
+        ".idea/\n"
+        ".vs/\n"
+        "*.swp\n"
+        "\n"
+        "# --- Build & Output (Root anchored recommended) ---\n"
+        "/build/\n"
+        "/dist/\n"
+        "/bin/\n"
+        "/obj/\n"
+        "/out/\n"
+        "/target/\n"
+        "\n"
+        "# --- Language Dependencies ---\n"
+        "node_modules/\n"
+        "__pycache__/\n"
+        "venv/\n"
+        "\n"
+        "# --- Temporary & Binaries ---\n"
+        "*.log\n"
+        "*.tmp\n"
+        "*.exe\n"
+        "*.dll\n"
+        "*.so\n"
+        "*.dylib\n"
+        "*.o\n"
+        "*.obj\n"
+        "Thumbs.db\n"
+        ".DS_Store\n",
+    },
+};
+
+constexpr bool messages_in_order() {
+    constexpr size_t n = sizeof(MESSAGES) / sizeof(MESSAGES[0]);
+    if (n != (size_t)Msg::COUNT) return false;
+    for (size_t i = 0; i < n; ++i) {
+        if ((size_t)MESSAGES[i].id != i) return false;
+    }
+    return true;
+}
+static_assert(messages_in_order(), "MESSAGES must list every Msg in enum order");
+
 struct Strings {
-    static std::wstring get(const std::string& key) {
-        static Lang currentLang = detect_system_language();
-        static const std::map<std::string, std::pair<std::wstring, std::wstring>> dict = {
-            {"MENU_TITLE", {L"[CTree 安装/卸载 - 当前用户]", L"[CTree Install/Uninstall - Current User]"}},
-            {"MENU_OPT_1", {L"1. 添加到右键菜单 (文件夹生成树 + 文本文件复制)", L"1. Add to Context Menu (Folder Tree + Text Copy)"}},
-            {"MENU_OPT_2", {L"2. 从右键菜单移除", L"2. Remove from Context Menu"}},
-            {"MENU_OPT_ERROR",{L"输入有误，请重新输入", L"Input is incorrect. Please re-enter."}},
-            {"INPUT_PROMPT", {L"请输入选项: ", L"Enter choice: "}},
-            {"SUCCESS_ADD", {L"成功！已添加到右键菜单。", L"Success! Added to context menu."}},
-            {"SUCCESS_REM", {L"成功！已清理相关右键菜单。", L"Success! Cleaned up context menu."}},
-
-            {"CTX_TREE_NAME", {L"生成目录树文件", L"Generate Tree File"}},
-            {"CTX_COPY_NAME", {L"复制文件内容", L"Copy File Content"}},
-
-            {"ERR_PATH", {L"错误：路径不存在。", L"Error: Path does not exist."}},
-            {"ERR_Args", {L"错误：参数不正确。", L"Error: Invalid arguments."}},
-            {"ERR_FILE_READ", {L"错误：无法读取文件：", L"Error: Cannot read file: "}},
-            {"ERR_FILE_OPEN", {L"错误：无法打开文件：",L"Error: Cannot open file: "}},
-            {"MSG_CLIPBOARD", {L"内容已复制到剪贴板。", L"Content copied to clipboard."}},
-            {"MSG_SAVED", {L"文件已保存至: ", L"File saved to: "}},
-            {"GENERATED_TREEIGNORE",{L"创建完成：", L"Created: "}},
-            {"INFO_REM_GLOBAL", {L"已删除全局 .treeignore", L"Removed global .treeignore"}},
-            {"PROCESSING", {L"正在处理...", L"Processing..."}},
-
-            {"USING_IGNORE",{L"忽略配置文件：", L"Ignore config file: "}},
-
-            {"HELP_MSG", {
-                // 中文版
-                L"用法: CTree [命令] [参数]\n"
-                L"  -h, --help                 显示此帮助消息\n"
-                L"  -v, --version              显示软件版本\n"
-                L"  -i, --input <path>         指定输入目录 <path>\n"
-                L"  -o, --output [path]        1. 输出到文件（可选路径；若省略，则生成带时间戳的文件）\n"
-                L"                             2. 若未指定 -o，默认输出到终端\n"
-                L"  -c, --copy [path]          1. 配合 -i 使用：不指定 [path] 时，将生成的目录树复制到剪贴板\n"
-                L"                             2. 指定 [path] 时：将该文件内容复制到剪贴板\n"
-                L"  -n, --ignore [pattern] ... 临时添加忽略规则（可多次使用）\n"
-                L"  -f, --file <path>          使用指定的忽略配置文件（兼容 .gitignore 语法）\n"
-                L"  -g, --global               创建全局 .treeignore 配置文件\n"
-                L"  -l, --local                在当前目录创建本地 .treeignore 配置文件\n"
-                L"  -d, --delete-global        删除全局 .treeignore 配置文件\n"
-                L"忽略配置文件优先级：指定 (-f) > 本地 > 全局\n",
-
-                // 英文版
-                L"Usage: CTree [command] [args]\n"
-                L"  -h, --help                 Display this help message\n"
-                L"  -v, --version              Show software version\n"
-                L"  -i, --input <path>         Specify input directory\n"
-                L"  -o, --output [path]        1. Output to file (optional path; if omitted, a timestamped filename is generated)\n"
-                L"                             2. If -o is not specified, output to terminal\n"
-                L"  -c, --copy [path]          1. With -i: omit [path] to copy the generated tree to clipboard\n"
-                L"                             2. If [path] is provided, copy its content to clipboard\n"
-                L"  -n, --ignore [pattern] ... Add temporary ignore patterns (can be used multiple times)\n"
-                L"  -f, --file <path>          Use an explicit ignore config file (compatible with .gitignore syntax)\n"
-                L"  -g, --global               Create global .treeignore config file\n"
-                L"  -l, --local                Create local .treeignore config file in current directory\n"
-                L"  -d, --delete-global        Delete global .treeignore config file\n"
-                L"Ignore config priority: explicit (-f) > local > global\n",
-            }},
-            {"DEFAULT_TREEIGNORE", {
-                // 中文版
-                L"# ========================================================\n"
-                L"# CTree 忽略规则配置文件\n"
-                L"# ========================================================\n"
-                L"# 语法说明 (基于 .gitignore 逻辑):\n"
-                L"#\n"
-                L"#【注】本软件内部统一处理路径分隔符，/ 与 \\ 完全等价。\n"
-                L"#\n"
-                L"# 1. 注释与无效行\n"
-                L"#    - 以 # 开头的行会被忽略。\n"
-                L"#    - 存在连续斜杠（如 //、\\\\、/\\、\\/）的行会被视为无效而忽略。\n"
-                L"#\n"
-                L"# 2. 根目录锚定 (以 / 或 \\ 开头)\n"
-                L"#    例如: /build\n"
-                L"#    说明: 仅匹配项目根目录下的 build 文件夹。\n"
-                L"#          (不匹配 sub/build)\n"
-                L"#\n"
-                L"# 3. 嵌套路径匹配 (中间包含 / 或 \\)\n"
-                L"#    例如: src/temp\n"
-                L"#    说明: 匹配任意深度下的 src/temp 路径。\n"
-                L"#          (匹配 src/temp，也匹配 code/src/temp)\n"
-                L"#\n"
-                L"# 4. 目录限定 (以 / 或 \\ 结尾)\n"
-                L"#    例如: log/\n"
-                L"#    说明: 匹配任意位置名为 log 的目录，但不匹配名为 log 的文件。\n"
-                L"#\n"
-                L"# 5. 文件名/通用匹配 (不含路径分隔符)\n"
-                L"#    例如: *.log 或 debug\n"
-                L"#    说明: 匹配任意位置符合该名称的文件或目录。\n"
-                L"#\n"
-                L"# ========================================================\n"
-                L"\n"
-                L"# --- 版本控制 ---\n"
-                L".git/\n"
-                L".svn/\n"
-                L".hg/\n"
-                L"\n"
-                L"# --- IDE 与 编辑器 ---\n"
-                L".vscode/\n"
-                L".idea/\n"
-                L".vs/\n"
-                L"*.swp\n"
-                L"\n"
-                L"# --- 常用构建与输出目录 (建议锚定到根目录) ---\n"
-                L"/build/\n"
-                L"/dist/\n"
-                L"/bin/\n"
-                L"/obj/\n"
-                L"/out/\n"
-                L"/target/\n"
-                L"\n"
-                L"# --- 语言特定依赖 ---\n"
-                L"node_modules/\n"
-                L"__pycache__/\n"
-                L"venv/\n"
-                L"\n"
-                L"# --- 临时文件与二进制 ---\n"
-                L"*.log\n"
-                L"*.tmp\n"
-                L"*.exe\n"
-                L"*.dll\n"
-                L"*.so\n"
-                L"*.dylib\n"
-                L"*.o\n"
-                L"*.obj\n"
-                L"Thumbs.db\n"
-                L".DS_Store\n",
-
-                // 英文版
-                L"# ========================================================\n"
-                L"# CTree Ignore Rules Configuration\n"
-                L"# ========================================================\n"
-                L"# Syntax Guide (Based on .gitignore logic):\n"
-                L"#\n"
-                L"# [Note] / and \\ are treated as equivalent internally.\n"
-                L"#\n"
-                L"# 1. Comments & Invalid Lines\n"
-                L"#    - Lines starting with # are ignored.\n"
-                L"#    - Lines containing consecutive slashes (//, \\\\, /\\, \\/) are ignored.\n"
-                L"#\n"
-                L"# 2. Root Anchor (Starts with / or \\)\n"
-                L"#    Example: /build\n"
-                L"#    Effect:  Matches 'build' ONLY at the root level.\n"
-                L"#             (Does NOT match sub/build)\n"
-                L"#\n"
-                L"# 3. Nested Path (Contains / or \\ in the middle)\n"
-                L"#    Example: src/temp\n"
-                L"#    Effect:  Matches 'src/temp' at ANY depth.\n"
-                L"#             (Matches src/temp AND code/src/temp)\n"
-                L"#\n"
-                L"# 4. Directory Only (Ends with / or \\)\n"
-                L"#    Example: log/\n"
-                L"#    Effect:  Matches directories named 'log' anywhere,\n"
-                L"#             but ignores files named 'log'.\n"
-                L"#\n"
-                L"# 5. Filename/General (No separators)\n"
-                L"#    Example: *.log or debug\n"
-                L"#    Effect:  Matches files or directories with this name\n"
-                L"#             at any level.\n"
-                L"#\n"
-                L"# ========================================================\n"
-                L"\n"
-                L"# --- Version Control ---\n"
-                L".git/\n"
-                L".svn/\n"
-                L".hg/\n"
-                L"\n"
-                L"# --- IDEs & Editors ---\n"
-                L".vscode/\n"
-                L".idea/\n"
-                L".vs/\n"
-                L"*.swp\n"
-                L"\n"
-                L"# --- Build & Output (Root anchored recommended) ---\n"
-                L"/build/\n"
-                L"/dist/\n"
-                L"/bin/\n"
-                L"/obj/\n"
-                L"/out/\n"
-                L"/target/\n"
-                L"\n"
-                L"# --- Language Dependencies ---\n"
-                L"node_modules/\n"
-                L"__pycache__/\n"
-                L"venv/\n"
-                L"\n"
-                L"# --- Temporary & Binaries ---\n"
-                L"*.log\n"
-                L"*.tmp\n"
-                L"*.exe\n"
-                L"*.dll\n"
-                L"*.so\n"
-                L"*.dylib\n"
-                L"*.o\n"
-                L"*.obj\n"
-                L"Thumbs.db\n"
-                L".DS_Store\n",
-            }}
-        };
-        auto it = dict.find(key);
-        if (it == dict.end()) return L"";
-        return (currentLang == Lang::CN) ? it->second.first : it->second.second;
+    static std::string_view get(Msg id) {
+        static const Lang currentLang = detect_system_language();
+        const MsgText& m = MESSAGES[(size_t)id];
+        return (currentLang == Lang::CN) ? m.cn : m.en;
     }
 };
 
 // ============================================================================
-// [Section 2] 通用工具：编码转换、剪贴板、多路输出
+// [Section 2] 通用工具：编码转换、多路输出
 // ============================================================================
 
-std::string to_utf8(const std::wstring& wstr) {
-    if (wstr.empty()) return {};
-    int size_needed = WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), (int)wstr.size(), nullptr, 0, nullptr, nullptr);
-    std::string strTo(size_needed, 0);
-    WideCharToMultiByte(CP_UTF8, 0, wstr.c_str(), (int)wstr.size(), &strTo[0], size_needed, nullptr, nullptr);
-    return strTo;
-}
-
-std::wstring to_wide(const std::string& str) {
-    if (str.empty()) return {};
-    int size_needed = MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), nullptr, 0);
-    std::wstring wstrTo(size_needed, 0);
-    MultiByteToWideChar(CP_UTF8, 0, str.c_str(), (int)str.size(), &wstrTo[0], size_needed);
-    return wstrTo;
-}
-
-// 写入剪贴板 (宽字符优先)
-void CopyToClipboardW(const std::wstring& wContent) {
-    if (wContent.empty()) return;
-    if (!OpenClipboard(nullptr)) return;
-    EmptyClipboard();
-    size_t size = (wContent.size() + 1) * sizeof(wchar_t);
-    HGLOBAL hGlob = GlobalAlloc(GMEM_MOVEABLE, size);
-    if (hGlob) {
-        void* pLocked = GlobalLock(hGlob);
-        if (pLocked) {
-            memcpy(pLocked, wContent.c_str(), size);
-            GlobalUnlock(hGlob);
-            if (!SetClipboardData(CF_UNICODETEXT, hGlob)) GlobalFree(hGlob);
+// 宽字符编码后直接追加到 UTF-8 缓冲：单次遍历，ASCII 走快速路径
+// (Windows 下 wchar_t 为 UTF-16，需合并代理对；POSIX 下为 UTF-32；非法码点替换为 U+FFFD)
+inline void append_utf8(std::string& out, std::wstring_view w) {
+    const size_t pos = out.size();
+    out.resize(pos + w.size() * (sizeof(wchar_t) == 2 ? 3 : 4));
+    char* p = &out[pos];
+    const size_t n = w.size();
+    for (size_t i = 0; i < n;) {
+        uint32_t c = (uint32_t)w[i++];
+        if (c < 0x80) { *p++ = (char)c; continue; }
+        if (c >= 0xD800 && c <= 0xDFFF) {
+            if (sizeof(wchar_t) == 2 && c <= 0xDBFF && i < n && (uint32_t)w[i] >= 0xDC00 && (uint32_t)w[i] <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + ((uint32_t)w[i++] - 0xDC00);
+            }
+            else {
+                c = 0xFFFD;
+            }
+        }
+        if (c > 0x10FFFF) c = 0xFFFD;
+        if (c < 0x800) {
+            *p++ = (char)(0xC0 | (c >> 6));
+        }
+        else if (c < 0x10000) {
+            *p++ = (char)(0xE0 | (c >> 12));
+            *p++ = (char)(0x80 | ((c >> 6) & 0x3F));
         }
         else {
-            GlobalFree(hGlob);
+            *p++ = (char)(0xF0 | (c >> 18));
+            *p++ = (char)(0x80 | ((c >> 12) & 0x3F));
+            *p++ = (char)(0x80 | ((c >> 6) & 0x3F));
         }
+        *p++ = (char)(0x80 | (c & 0x3F));
     }
-    CloseClipboard();
-    std::cout << to_utf8(Strings::get("MSG_CLIPBOARD")) << std::endl;
+    out.resize(p - out.data());
 }
 
-// 写入剪贴板 (UTF-8 转 宽字符)
-void CopyToClipboard(const std::string& utf8Content) {
-    if (utf8Content.empty()) return;
-    CopyToClipboardW(to_wide(utf8Content));
+std::string to_utf8(std::wstring_view wstr) {
+    std::string out;
+    append_utf8(out, wstr);
+    return out;
 }
 
-// 多路输出控制器 (终端 + 文件 + 剪贴板流)
-class MultiWriter {
-    std::ostream* _console = nullptr;
-    std::ostream* _file = nullptr;
-    std::wstringstream* _clipboard = nullptr;
+// UTF-8 解码后追加到宽字符缓冲 (复用缓冲时不产生分配)
+#ifdef _WIN32
+void append_wide(std::wstring& out, std::string_view str) {
+    if (str.empty()) return;
+    int size_needed = MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), nullptr, 0);
+    const size_t pos = out.size();
+    out.resize(pos + size_needed);
+    MultiByteToWideChar(CP_UTF8, 0, str.data(), (int)str.size(), &out[pos], size_needed);
+}
+#else
+// 非法字节序列替换为 U+FFFD (文件名不保证是合法 UTF-8)
+void append_wide(std::wstring& out, std::string_view str) {
+    out.reserve(out.size() + str.size());
+    const unsigned char* s = (const unsigned char*)str.data();
+    size_t i = 0, n = str.size();
+    while (i < n) {
+        unsigned char b = s[i];
+        uint32_t c;
+        size_t len;
+        if (b < 0x80) { c = b; len = 1; }
+        else if ((b & 0xE0) == 0xC0) { c = b & 0x1F; len = 2; }
+        else if ((b & 0xF0) == 0xE0) { c = b & 0x0F; len = 3; }
+        else if ((b & 0xF8) == 0xF0) { c = b & 0x07; len = 4; }
+        else { out += (wchar_t)0xFFFD; ++i; continue; }
 
-    // 存储换行符（UTF-8 字节形式）
-    std::string _lineEnding = "\n";  // 默认 LF
+        bool ok = (i + len <= n);
+        for (size_t k = 1; ok && k < len; ++k) {
+            if ((s[i + k] & 0xC0) != 0x80) ok = false;
+            else c = (c << 6) | (s[i + k] & 0x3F);
+        }
+        static const uint32_t minValue[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+        if (!ok || c < minValue[len] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF)) { out += (wchar_t)0xFFFD; ++i; continue; }
+        out += (wchar_t)c;
+        i += len;
+    }
+}
+#endif
 
-public:
-    void setConsole(std::ostream& os) { _console = &os; }
-    void setFile(std::ostream& os) { _file = &os; }
-    void setClipboard(std::wstringstream& ss) { _clipboard = &ss; }
+std::wstring to_wide(std::string_view str) {
+    std::wstring out;
+    append_wide(out, str);
+    return out;
+}
 
-    // 配置换行符
-    void setLineEndingToCRLF() {
-        _lineEnding = "\r\n";
-    }
+// 路径与宽字符串互转 (Windows 原生路径为 UTF-16；POSIX 为字节串，按 UTF-8 解释)
+std::wstring path_to_wide(const fs::path& p) {
+#ifdef _WIN32
+    return p.wstring();
+#else
+    return to_wide(p.native());
+#endif
+}
 
-    void writeLine(const std::wstring& wLine) {
-        std::string u8Line = to_utf8(wLine);
-        if (_console) *_console << u8Line << _lineEnding;
-        if (_file)    *_file << u8Line << _lineEnding;
-        if (_clipboard) *_clipboard << wLine << L'\n';
-    }
-};
+fs::path wide_to_path(const std::wstring& w) {
+#ifdef _WIN32
+    return fs::path(w);
+#else
+    return fs::path(to_utf8(w));
+#endif
+}
 
-// ============================================================================
-// [Section 3] 核心逻辑：忽略规则 (Gitignore 风格)
-// ============================================================================
+// ----------------------------------------------------------------------------
+// 文本编码识别 (-c <file>)
+// ----------------------------------------------------------------------------
 
-class TreeIgnore {
-    struct Rule {
-        std::wstring pattern;
-        bool onlyDir;
-        bool isRootOnly;
-        bool hasSeparator;
-    };
-public:
-    std::vector<Rule> rules;
-    fs::path rootPath;
+enum TextEncoding { ENC_UTF8, ENC_UTF8_BOM, ENC_UTF16LE, ENC_UTF16BE, ENC_GB18030 };
 
-    void set_root(const fs::path& path) { rootPath = path; }
+inline const char* encoding_name(TextEncoding enc) {
+    static const char* names[] = { "UTF-8", "UTF-8-BOM", "UTF-16LE", "UTF-16BE", "GB18030" };
+    return names[enc];
+}
 
-    void add_rule(std::wstring raw) {
-        // 1. 去除前后空白
-        const wchar_t* ws = L" \t\n\r";
-        size_t start = raw.find_first_not_of(ws);
-        if (start == std::wstring::npos) return;
-        raw.erase(0, start);
-        size_t end = raw.find_last_not_of(ws);
-        if (end != std::wstring::npos) raw.erase(end + 1);
-        if (raw.empty()) return;
+// data 开头与 enc 对应的 BOM 长度 (无 BOM 的 UTF-16 返回 0)
+inline size_t bom_length(std::string_view data, TextEncoding enc) {
+    switch (enc) {
+    case ENC_UTF8_BOM: return 3;
+    case ENC_UTF16LE: return data.size() >= 2 && data.compare(0, 2, "\xFF\xFE") == 0 ? 2 : 0;
+    case ENC_UTF16BE: return data.size() >= 2 && data.compare(0, 2, "\xFE\xFF") == 0 ? 2 : 0;
+    default: return 0;
+    }
+}
 
-        // 2. 统一分隔符为反斜杠 (先归一化，简化后续判断)
-        std::replace(raw.begin(), raw.end(), L'/', L'\\');
+// 从 i 起跳过 ASCII 字节，返回第一个非 ASCII 字节的位置 (每次检查 16 或 8 字节的最高位)
+inline size_t skip_ascii(const unsigned char* s, size_t i, size_t n) {
+#ifdef CTREE_HAVE_SSE2
+    for (; i + 16 <= n; i += 16) {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(s + i))) != 0) break;
+    }
+#else
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, s + i, 8);
+        if (w & 0x8080808080808080ull) break;
+    }
+#endif
+    while (i < n && s[i] < 0x80) ++i;
+    return i;
+}
 
-        // 3. 检查注释和非法路径
-        //    - # 开头是 Git 标准注释
-        //    - 包含 \\ 说明原字符串有 // (注释) 或者路径写错了 (a//b)，直接跳过
-        if (raw[0] == L'#') return;
-        if (raw.find(L"\\\\") != std::wstring::npos) return;
+// 严格校验 UTF-8 (拒绝过长编码、代理区与超出 U+10FFFF 的码点)；文件末尾被截断的不完整字符仍视为 UTF-8
+bool is_valid_utf8(const unsigned char* s, size_t n) {
+    for (size_t i = skip_ascii(s, 0, n); i < n; i = skip_ascii(s, i, n)) {
+        unsigned char b = s[i];
+        size_t len;
+        unsigned char lo = 0x80, hi = 0xBF;  // 第二字节的合法范围
+        if (b >= 0xC2 && b <= 0xDF) len = 2;
+        else if (b >= 0xE0 && b <= 0xEF) { len = 3; if (b == 0xE0) lo = 0xA0; else if (b == 0xED) hi = 0x9F; }
+        else if (b >= 0xF0 && b <= 0xF4) { len = 4; if (b == 0xF0) lo = 0x90; else if (b == 0xF4) hi = 0x8F; }
+        else return false;
+        size_t avail = std::min(len, n - i);
+        if (avail > 1 && (s[i + 1] < lo || s[i + 1] > hi)) return false;
+        for (size_t k = 2; k < avail; ++k) {
+            if ((s[i + k] & 0xC0) != 0x80) return false;
+        }
+        i += avail;
+    }
+    return true;
+}
 
-        // 4. 判断是否为根路径规则（以 \ 开头）
-        bool isRootOnly = false;
-        if (raw[0] == L'\\') {
-            isRootOnly = true;
-            raw.erase(0, 1);
+// BOM > 无 BOM 的 UTF-16 (开头的 ASCII 字符在奇/偶字节位置留下大量 0) > 合法 UTF-8 > GB18030 (GBK 的超集)
+TextEncoding detect_encoding(std::string_view data) {
+    const unsigned char* s = (const unsigned char*)data.data();
+    const size_t n = data.size();
+    if (n >= 3 && s[0] == 0xEF && s[1] == 0xBB && s[2] == 0xBF) return ENC_UTF8_BOM;
+    if (n >= 2 && s[0] == 0xFF && s[1] == 0xFE) return ENC_UTF16LE;
+    if (n >= 2 && s[0] == 0xFE && s[1] == 0xFF) return ENC_UTF16BE;
+
+    const size_t pairs = std::min<size_t>(n, 4096) / 2;
+    size_t evenZeros = 0, oddZeros = 0;
+    for (size_t i = 0; i < pairs; ++i) {
+        evenZeros += s[2 * i] == 0;
+        oddZeros += s[2 * i + 1] == 0;
+    }
+    if (pairs >= 2 && n % 2 == 0) {
+        if (oddZeros * 4 >= pairs && evenZeros * 16 < pairs) return ENC_UTF16LE;
+        if (evenZeros * 4 >= pairs && oddZeros * 16 < pairs) return ENC_UTF16BE;
+    }
+    return is_valid_utf8(s, n) ? ENC_UTF8 : ENC_GB18030;
+}
+
+// UTF-16 转 UTF-8 追加到 out (孤立代理替换为 U+FFFD)；返回消耗的码元数，非 final 时末尾的高代理留给下一块
+size_t append_utf16_as_utf8(std::string& out, const unsigned char* s, size_t units, bool bigEndian, bool final) {
+    const int hiByte = bigEndian ? 0 : 1;
+    auto unit = [&](size_t i) -> uint32_t { return ((uint32_t)s[2 * i + hiByte] << 8) | s[2 * i + 1 - hiByte]; };
+    size_t old = out.size();
+    out.resize(old + units * 3);
+    char* p = &out[old];
+    size_t i = 0;
+    while (i < units) {
+        uint32_t c = unit(i);
+        if (c < 0x80) { *p++ = (char)c; ++i; continue; }
+        if (c >= 0xD800 && c <= 0xDBFF) {
+            if (i + 1 == units && !final) break;
+            uint32_t c2 = (i + 1 < units) ? unit(i + 1) : 0;
+            if (c2 >= 0xDC00 && c2 <= 0xDFFF) { c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00); ++i; }
+            else c = 0xFFFD;
+        }
+        else if (c >= 0xDC00 && c <= 0xDFFF) c = 0xFFFD;
+        ++i;
+        if (c < 0x800) {
+            *p++ = (char)(0xC0 | (c >> 6));
+        }
+        else if (c < 0x10000) {
+            *p++ = (char)(0xE0 | (c >> 12));
+            *p++ = (char)(0x80 | ((c >> 6) & 0x3F));
+        }
+        else {
+            // 代理对在输入中占 2 个码元 (4 字节)，输出 4 字节，不会超出预留空间
+            *p++ = (char)(0xF0 | (c >> 18));
+            *p++ = (char)(0x80 | ((c >> 12) & 0x3F));
+            *p++ = (char)(0x80 | ((c >> 6) & 0x3F));
         }
+        *p++ = (char)(0x80 | (c & 0x3F));
+    }
+    out.resize(p - out.data());
+    return i;
+}
 
-        // 5. 移除前导 .\ (当前目录)
-        while (raw.size() >= 2 && raw[0] == L'.' && raw[1] == L'\\') {
-            raw.erase(0, 2);
+#ifndef _WIN32
+// GB18030 经 iconv 分块转为 UTF-8；非法字节输出 U+FFFD 后跳过
+template <class Sink>
+bool gb18030_to_utf8(std::string_view data, Sink&& sink) {
+    iconv_t cd = iconv_open("UTF-8", "GB18030");
+    if (cd == (iconv_t)-1) return false;
+    std::string buf(1 << 20, '\0');
+    char* in = const_cast<char*>(data.data());
+    size_t inLeft = data.size();
+    bool ok = true;
+    while (ok && inLeft > 0) {
+        char* out = &buf[0];
+        size_t outLeft = buf.size();
+        size_t r = iconv(cd, &in, &inLeft, &out, &outLeft);
+        if (r == (size_t)-1 && errno != E2BIG) {
+            if (outLeft < 3) { ok = sink(buf.data(), buf.size() - outLeft); continue; }
+            std::memcpy(out, "\xEF\xBF\xBD", 3);
+            out += 3;
+            outLeft -= 3;
+            ++in;
+            --inLeft;
         }
-        if (raw.empty()) return;
+        ok = sink(buf.data(), buf.size() - outLeft);
+    }
+    iconv_close(cd);
+    return ok;
+}
+#endif
 
-        // 6. 解析目录限定符 (以 \ 结尾)
-        bool onlyDir = false;
-        if (!raw.empty() && raw.back() == L'\\') {
-            onlyDir = true;
-            raw.pop_back();
-            if (raw.empty()) return;
+// 按 enc 把原始字节 (已去除 BOM) 转为 UTF-8 分块交给 sink；UTF-8 内容原样交出
+template <class Sink>
+bool transcode_to_utf8(std::string_view content, TextEncoding enc, Sink&& sink) {
+    switch (enc) {
+    case ENC_UTF16LE:
+    case ENC_UTF16BE: {
+        const unsigned char* s = (const unsigned char*)content.data();
+        const size_t units = content.size() / 2;
+        constexpr size_t CHUNK_UNITS = 1 << 19;
+        std::string buf;
+        for (size_t pos = 0; pos < units;) {
+            size_t take = std::min(CHUNK_UNITS, units - pos);
+            buf.clear();
+            pos += append_utf16_as_utf8(buf, s + 2 * pos, take, enc == ENC_UTF16BE, pos + take == units);
+            if (!sink(buf.data(), buf.size())) return false;
         }
+        return true;
+    }
+    case ENC_GB18030: {
+#ifdef _WIN32
+        if (content.size() > (size_t)INT_MAX) return false;
+        int wlen = MultiByteToWideChar(54936, 0, content.data(), (int)content.size(), nullptr, 0);
+        if (wlen <= 0) return false;
+        std::wstring wide((size_t)wlen, L'\0');
+        MultiByteToWideChar(54936, 0, content.data(), (int)content.size(), &wide[0], wlen);
+        std::string utf8;
+        append_utf8(utf8, wide);
+        return sink(utf8.data(), utf8.size());
+#else
+        return gb18030_to_utf8(content, sink);
+#endif
+    }
+    default:
+        return sink(content.data(), content.size());
+    }
+}
 
-        // 7. 检查是否有中间分隔符 (Git语义: 有分隔符则匹配路径，无则匹配文件名)
-        bool hasSeparator = (raw.find(L'\\') != std::wstring::npos);
+// ----------------------------------------------------------------------------
+// 多路输出：每行只编码一次到可复用的 UTF-8 大缓冲，积满后整块写出到各输出端
+// 输出端在编译期组合 (MultiWriter<Sinks...>)，写行路径上没有逐端的空指针判断
+// ----------------------------------------------------------------------------
 
-        rules.push_back({ raw, onlyDir, isRootOnly, hasSeparator });
-    }
+#ifdef _WIN32
+constexpr std::string_view LINE_ENDING = "\r\n";
+#else
+constexpr std::string_view LINE_ENDING = "\n";
+#endif
 
-    void load_file(const fs::path& path) {
-        if (!fs::exists(path)) return;
-        std::cout << to_utf8(Strings::get("USING_IGNORE") + path.wstring()) << '\n';
-        std::ifstream file(path, std::ios::binary);
-        if (!file.is_open()) return;
+constexpr size_t OUTPUT_FLUSH_SIZE = 1 << 20;
 
-        // BOM Check
-        char bom[3] = { 0 }; file.read(bom, 3);
-        if (!(bom[0] == '\xEF' && bom[1] == '\xBB' && bom[2] == '\xBF')) file.seekg(0);
+// 终端
+struct ConsoleSink {
+    void write(std::string_view data) { std::cout.write(data.data(), (std::streamsize)data.size()); }
+    void close() { std::cout.flush(); }
+};
 
-        std::string line;
-        while (std::getline(file, line)) {
-            if (!line.empty() && line.back() == '\r') line.pop_back();
-            add_rule(to_wide(line));
-        }
-    }
+// 文件 (调用方负责打开并写入 BOM)
+struct FileSink {
+    std::ostream* os;
+    void write(std::string_view data) { os->write(data.data(), (std::streamsize)data.size()); }
+    void close() { os->flush(); }
+};
 
-    bool should_ignore(const fs::path& fullPath, bool isDirectory) const {
-        // 计算相对路径
-        std::wstring relPathStr;
-        if (!rootPath.empty()) {
-            std::error_code ec;
-            fs::path rel = fs::relative(fullPath, rootPath, ec);
-            if (!ec && rel != L".") relPathStr = rel.wstring();
-            else relPathStr = fullPath.filename().wstring();
-        }
-        else {
-            relPathStr = fullPath.wstring();
-        }
+// 剪贴板：直接保留最终的 UTF-8 文本，结束后一次性交给 CopyToClipboard
+struct ClipboardSink {
+    std::string* text;
+    void write(std::string_view data) { text->append(data); }
+    void close() {}
+};
 
-        std::wstring filenameStr = fullPath.filename().wstring();
+// 后台写线程：生产者只追加到待写缓冲，写线程交换出整块后写入内层输出端
+template <class Inner>
+class AsyncSink {
+    static constexpr size_t MAX_PENDING = 8 * OUTPUT_FLUSH_SIZE;
 
-        for (const auto& rule : rules) {
-            if (rule.onlyDir && !isDirectory) continue;
+    Inner _inner;
+    std::string _pending;
+    std::mutex _m;
+    std::condition_variable _cv;
+    bool _closing = false;
+    std::thread _thread;
 
-            if (rule.isRootOnly) {
-                // 情况 1: 根锚定 (/foo) -> 完全匹配相对路径
-                if (PathMatchSpecW(relPathStr.c_str(), rule.pattern.c_str())) return true;
-            }
-            else if (rule.hasSeparator) {
-                // 情况 2: 含路径符 (src/foo) -> 匹配相对路径 或 深层路径
-                if (PathMatchSpecW(relPathStr.c_str(), rule.pattern.c_str())) return true;
-                std::wstring deepPattern = L"*\\" + rule.pattern;
-                if (PathMatchSpecW(relPathStr.c_str(), deepPattern.c_str())) return true;
-            }
-            else {
-                // 情况 3: 纯文件名 (*.log) -> 匹配任意层级的文件名
-                if (PathMatchSpecW(filenameStr.c_str(), rule.pattern.c_str())) return true;
+    void run() {
+        std::string local;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lk(_m);
+                _cv.wait(lk, [this] { return _closing || !_pending.empty(); });
+                if (_pending.empty()) return;
+                local.swap(_pending);
             }
+            _cv.notify_all();
+            _inner.write(local);
+            local.clear();
         }
-        return false;
     }
-};
 
-fs::path get_global_ignore_path() {
-    wchar_t path[MAX_PATH];
-    if (SUCCEEDED(SHGetFolderPathW(NULL, CSIDL_PROFILE, NULL, 0, path)))
-        return fs::path(path) / IGNORE_FILENAME;
-    return {};
-}
+public:
+    explicit AsyncSink(Inner inner) : _inner(std::move(inner)), _thread([this] { run(); }) {}
+    ~AsyncSink() { close(); }
 
-void create_ignore_template(const fs::path& path) {
-    std::ofstream out(path);
-    if (out.is_open()) {
-        out << "\xEF\xBB\xBF"; // UTF-8 BOM
-        out << to_utf8(Strings::get("DEFAULT_TREEIGNORE"));
-        out.close();
-        std::cout << to_utf8(Strings::get("GENERATED_TREEIGNORE")) << to_utf8(path.wstring()) << std::endl;
+    void write(std::string_view data) {
+        {
+            std::unique_lock<std::mutex> lk(_m);
+            _cv.wait(lk, [this] { return _pending.size() < MAX_PENDING; });
+            _pending.append(data);
+        }
+        _cv.notify_all();
     }
-}
 
-// ============================================================================
-// [Section 4] 核心业务：树结构递归生成
-// ============================================================================
+    void close() {
+        if (!_thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lk(_m);
+            _closing = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+        _inner.close();
+    }
+};
 
-void generate_tree_recursive(
-    const fs::path& path,
-    const std::wstring& prefix,
-    MultiWriter& writer,
-    const TreeIgnore& ignore
-) {
-    static const std::wstring U_FOLDER = L"\\";
-    static const std::wstring U_BRANCH = L"├── ";
-    static const std::wstring U_LAST = L"└── ";
-    static const std::wstring U_SPACE = L"    ";
-    static const std::wstring U_PIPE = L"│   ";
+template <class... Sinks>
+class MultiWriter {
+    std::tuple<Sinks...> _sinks;
+    std::string _buf;
 
-    struct Entry { fs::path p; std::wstring name; bool isDir; };
-    std::vector<Entry> entries;
-    entries.reserve(50);
+    void append(std::wstring_view part) { append_utf8(_buf, part); }
+    void append(std::string_view part) { _buf.append(part); }
 
-    std::error_code ec;
-    for (const auto& e : fs::directory_iterator(path, ec)) {
-        if (!ignore.should_ignore(e.path(), e.is_directory())) {
-            entries.push_back({ e.path(), e.path().filename().wstring(), e.is_directory() });
-        }
+public:
+    template <class... Args>
+    explicit MultiWriter(Args&&... sinks) : _sinks(std::forward<Args>(sinks)...) { _buf.reserve(OUTPUT_FLUSH_SIZE + 4096); }
+    ~MultiWriter() { finish(); }
+
+    MultiWriter(const MultiWriter&) = delete;
+    MultiWriter& operator=(const MultiWriter&) = delete;
+
+    // 一行由若干片段拼成 (宽字符片段就地编码，std::string_view 视为已编码的 UTF-8)
+    template <class... Parts>
+    void writeLine(const Parts&... parts) {
+        (append(parts), ...);
+        _buf.append(LINE_ENDING);
+        if (_buf.size() >= OUTPUT_FLUSH_SIZE) flush();
     }
 
-    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
-        if (a.isDir != b.isDir) return a.isDir > b.isDir;
-        return a.name < b.name;
-        });
+    // 已编码的整块数据 (并行遍历的子树结果、结构化格式的记录)
+    void writeRaw(std::string_view lines) {
+        _buf.append(lines);
+        if (_buf.size() >= OUTPUT_FLUSH_SIZE) flush();
+    }
 
-    for (size_t i = 0; i < entries.size(); ++i) {
-        bool isLast = (i == entries.size() - 1);
-        std::wstring wLine;
-        wLine.reserve(prefix.size() + 10 + entries[i].name.size());
-        wLine = prefix;
-        wLine += (isLast ? U_LAST : U_BRANCH);
-        wLine += entries[i].name;
-        if (entries[i].isDir) wLine += U_FOLDER;
-
-        writer.writeLine(wLine);
-
-        if (entries[i].isDir) {
-            generate_tree_recursive(
-                entries[i].p,
-                prefix + (isLast ? U_SPACE : U_PIPE),
-                writer,
-                ignore
-            );
-        }
+    void flush() {
+        if (_buf.empty()) return;
+        std::apply([this](auto&... sink) { (sink.write(_buf), ...); }, _sinks);
+        _buf.clear();
     }
-}
 
-// ============================================================================
-// [Section 5] 系统集成：Windows 注册表菜单管理
-// ============================================================================
+    // 写出剩余数据并关闭所有输出端 (可重复调用)
+    void finish() {
+        flush();
+        std::apply([](auto&... sink) { (sink.close(), ...); }, _sinks);
+    }
+};
 
-std::wstring GetExePath() {
-    wchar_t buf[MAX_PATH];
-    GetModuleFileNameW(NULL, buf, MAX_PATH);
-    return std::wstring(buf);
-}
+// ----------------------------------------------------------------------------
+// 只读内存映射文件
+// ----------------------------------------------------------------------------
 
-void RegMenuKey(HKEY hRoot, const std::wstring& parentPath, const std::wstring& keyName, const std::wstring& menuName, const std::wstring& cmd) {
-    HKEY hParent, hKey, hCmd;
-    std::wstring fullParent = parentPath + L"\\" + PARENT_MENU_NAME;
+class MappedFile {
+    const char* _data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    HANDLE _file = INVALID_HANDLE_VALUE;
+    HANDLE _mapping = nullptr;
+#endif
 
-    if (RegCreateKeyExW(hRoot, fullParent.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hParent, NULL) == ERROR_SUCCESS) {
-        std::wstring title = PARENT_MENU_NAME;
-        RegSetValueExW(hParent, L"MUIVerb", 0, REG_SZ, (BYTE*)title.c_str(), (DWORD)(title.size() + 1) * 2);
-        RegSetValueExW(hParent, L"SubCommands", 0, REG_SZ, (BYTE*)L"", 2);
+public:
+    MappedFile() = default;
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
 
-        std::wstring subKeyPath = L"shell\\" + keyName;
-        if (RegCreateKeyExW(hParent, subKeyPath.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL) == ERROR_SUCCESS) {
-            RegSetValueExW(hKey, L"MUIVerb", 0, REG_SZ, (BYTE*)menuName.c_str(), (DWORD)(menuName.size() + 1) * 2);
-            if (RegCreateKeyExW(hKey, L"command", 0, NULL, 0, KEY_WRITE, NULL, &hCmd, NULL) == ERROR_SUCCESS) {
-                RegSetValueExW(hCmd, NULL, 0, REG_SZ, (BYTE*)cmd.c_str(), (DWORD)(cmd.size() + 1) * 2);
-                RegCloseKey(hCmd);
-            }
-            RegCloseKey(hKey);
+    bool open(const fs::path& path) {
+        close();
+#ifdef _WIN32
+        _file = CreateFileW(path.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (_file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(_file, &size)) { close(); return false; }
+        _size = (size_t)size.QuadPart;
+        if (_size == 0) return true;
+        _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!_mapping) { close(); return false; }
+        _data = (const char*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!_data) { close(); return false; }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+        _size = (size_t)st.st_size;
+        if (_size > 0) {
+            void* p = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED) { ::close(fd); _size = 0; return false; }
+            _data = (const char*)p;
         }
-        RegCloseKey(hParent);
+        ::close(fd);
+#endif
+        return true;
     }
-}
-
-void DeleteMenuKeySafe(HKEY hRoot, const std::wstring& parentRoot) {
-    std::wstring fullParent = parentRoot + L"\\" + PARENT_MENU_NAME;
-    std::wstring shellPath = fullParent + L"\\shell";
-    RegDeleteTreeW(hRoot, (shellPath + L"\\" + MENU_TREE_KEY).c_str());
-    RegDeleteTreeW(hRoot, (shellPath + L"\\" + MENU_COPY_KEY).c_str());
 
-    HKEY hShell; // 检查是否为空，若空则删除父菜单
-    if (RegOpenKeyExW(hRoot, shellPath.c_str(), 0, KEY_READ, &hShell) == ERROR_SUCCESS) {
-        DWORD subKeyCount = 0;
-        RegQueryInfoKeyW(hShell, NULL, NULL, NULL, &subKeyCount, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
-        RegCloseKey(hShell);
-        if (subKeyCount == 0) RegDeleteTreeW(hRoot, fullParent.c_str());
-    }
-    else {
-        RegDeleteTreeW(hRoot, fullParent.c_str());
+    void close() {
+#ifdef _WIN32
+        if (_data) UnmapViewOfFile(_data);
+        if (_mapping) CloseHandle(_mapping);
+        if (_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+        _mapping = nullptr;
+        _file = INVALID_HANDLE_VALUE;
+#else
+        if (_data) munmap((void*)_data, _size);
+#endif
+        _data = nullptr;
+        _size = 0;
     }
-}
 
-void InstallMenus() {
-    std::wstring exe = L"\"" + GetExePath() + L"\"";
-    std::wstring cmdTree = exe + L" -i \"%V\" -o";
-    std::wstring nameTree = Strings::get("CTX_TREE_NAME");
-    RegMenuKey(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\Background\\shell", MENU_TREE_KEY, nameTree, cmdTree);
-    RegMenuKey(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\shell", MENU_TREE_KEY, nameTree, cmdTree);
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+};
+
+// 文件修改时间 (Windows: FILETIME 100ns 单位；POSIX: 纳秒)，与当前时间使用相同单位
+#ifdef _WIN32
+constexpr int64_t FILE_TIME_TICKS_PER_SEC = 10000000;
+#else
+constexpr int64_t FILE_TIME_TICKS_PER_SEC = 1000000000;
+#endif
 
-    std::wstring cmdCopy = exe + L" -c \"%1\"";
-    std::wstring nameCopy = Strings::get("CTX_COPY_NAME");
-    RegMenuKey(HKEY_CURRENT_USER, L"Software\\Classes\\SystemFileAssociations\\text\\shell", MENU_COPY_KEY, nameCopy, cmdCopy);
+// 转为 Unix 纪元起的纳秒 (结构化输出使用，与平台无关)
+inline int64_t unix_time_ns(int64_t fileTime) {
+#ifdef _WIN32
+    return (fileTime - 116444736000000000LL) * 100;
+#else
+    return fileTime;
+#endif
 }
 
-void UninstallMenus() {
-    DeleteMenuKeySafe(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\Background\\shell");
-    DeleteMenuKeySafe(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\shell");
-    DeleteMenuKeySafe(HKEY_CURRENT_USER, L"Software\\Classes\\SystemFileAssociations\\text\\shell");
+// 上式的逆变换 (Git 索引与归档文件中的时间戳)
+inline int64_t file_time_from_unix_ns(int64_t ns) {
+#ifdef _WIN32
+    return ns / 100 + 116444736000000000LL;
+#else
+    return ns;
+#endif
 }
 
-void ShowInteractiveMenu() {
-    system("cls");
-    std::cout << to_utf8(Strings::get("MENU_TITLE")) << "\n-------------------------\n";
-    std::cout << to_utf8(Strings::get("MENU_OPT_1")) << '\n' << to_utf8(Strings::get("MENU_OPT_2")) << "\n-------------------------\n";
-    std::cout << to_utf8(Strings::get("INPUT_PROMPT"));
-    char choice;
-    while (std::cin >> choice) {
-        if (choice == '1') { InstallMenus(); std::cout << to_utf8(Strings::get("SUCCESS_ADD")) << std::endl; system("pause"); break; }
-        else if (choice == '2') { UninstallMenus(); std::cout << to_utf8(Strings::get("SUCCESS_REM")) << std::endl; system("pause"); break; }
-        else std::cout << to_utf8(Strings::get("MENU_OPT_ERROR")) << std::endl;
-    }
+#ifdef _WIN32
+inline int64_t file_time_of(const FILETIME& ft) { return ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime; }
+#else
+inline int64_t stat_mtime(const struct stat& st) {
+#if defined(__APPLE__)
+    return (int64_t)st.st_mtimespec.tv_sec * FILE_TIME_TICKS_PER_SEC + st.st_mtimespec.tv_nsec;
+#else
+    return (int64_t)st.st_mtim.tv_sec * FILE_TIME_TICKS_PER_SEC + st.st_mtim.tv_nsec;
+#endif
 }
+#endif
 
-// ============================================================================
-// [Section 6] 流程控制：配置解析与业务分发
-// ============================================================================
+int64_t now_file_time() {
+#ifdef _WIN32
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    return ((int64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * FILE_TIME_TICKS_PER_SEC + ts.tv_nsec;
+#endif
+}
 
-struct AppConfig {
-    bool showMenu = false;
-    bool showHelp = false;
-    bool showVersion = false;
-    bool isValid = true;
-    bool createGlobal = false;
-    bool deleteGlobal = false;
-    bool createLocal = false;
-
-    fs::path inputPath;
-    bool OutputFlag = false;
-    fs::path outputPath;
-
-    bool CopyFlag = false;
-    fs::path copyFilePath;
-
-    fs::path specifiedIgnoreFile;
-    std::vector<std::wstring> tempIgnores;
-
-    void parse(int argc, wchar_t* argv[]) {
-        if (argc < 2) { showMenu = true; return; }
-        for (int i = 1; i < argc; ++i) {
-            std::wstring arg = argv[i];
-            if (arg == L"-h" || arg == L"--help") { showHelp = true; return; }
-            if (arg == L"-v" || arg == L"--version") { showVersion = true; return; }
-
-            if (arg == L"-i" || arg == L"--input") {
-                if (i + 1 < argc) inputPath = argv[++i]; else isValid = false;
-            }
-            else if (arg == L"-o" || arg == L"--output") {
-                OutputFlag = true;
-                if (i + 1 < argc && argv[i + 1][0] != L'-') outputPath = argv[++i];
-            }
-            else if (arg == L"-c" || arg == L"--copy") {
-                CopyFlag = true;
-                if (i + 1 < argc && argv[i + 1][0] != L'-') copyFilePath = argv[++i];
-            }
-            else if (arg == L"-n" || arg == L"--ignore") {
-                while (i + 1 < argc) {
-                    std::wstring next = argv[i + 1];
-                    if (!next.empty() && next[0] == L'-') break;
-                    tempIgnores.push_back(next);
-                    i++;
-                }
-            }
-            else if (arg == L"-f" || arg == L"--file") {
-                if (i + 1 < argc) specifiedIgnoreFile = argv[++i];
-            }
-            else if (arg == L"-g" || arg == L"--global") createGlobal = true;
-            else if (arg == L"-d" || arg == L"--delete-global") deleteGlobal = true;
-            else if (arg == L"-l" || arg == L"--local") createLocal = true;
-        }
+// ----------------------------------------------------------------------------
+// 运行统计 (--stats)
+// ----------------------------------------------------------------------------
 
-        std::error_code ec;
-        if (!inputPath.empty()) { fs::path abs = fs::absolute(inputPath, ec); if (!ec) inputPath = abs; }
-        if (OutputFlag && !outputPath.empty()) { fs::path abs = fs::absolute(outputPath, ec); if (!ec) outputPath = abs; }
-    }
+// 关闭时每个统计点只多一次可预测的分支判断；遍历开始前设置，之后只读
+inline bool g_statsEnabled = false;
+
+enum StatPhase { PHASE_ENUMERATE, PHASE_IGNORE, PHASE_SORT, PHASE_COUNT };
+
+enum StatCounter {
+    STAT_DIRS,             // 读取的目录数
+    STAT_ENTRIES,          // 枚举到的目录项数
+    STAT_PRUNED_ENTRIES,   // 被忽略的文件
+    STAT_PRUNED_SUBTREES,  // 被忽略的目录 (整棵子树不再读取)
+    STAT_CACHED_DIRS,      // 索引缓存 (或 --serve 的目录列表缓存) 中直接复用的目录
+    STAT_CACHE_REVALIDATIONS, // 为判断缓存是否可复用而取目录修改时间的次数 (同时计入 stat 调用)
+    STAT_DIR_OPENS,        // 打开目录的系统调用
+    STAT_DIR_READS,        // 批量读取目录项的系统调用
+    STAT_STAT_CALLS,       // 补充 stat 调用 (类型未知或按时间/大小排序)
+    STAT_URING_SUBMITS,    // --sizes 批量提交 statx 的 io_uring_enter 调用
+    STAT_BUNDLE_FILES,     // --bundle 写出的文件
+    STAT_BUNDLE_BINARY,    // --bundle 跳过的二进制文件
+    STAT_BUNDLE_BYTES,     // --bundle 写出的内容字节数
+    STAT_LINKS_SKIPPED,    // 未展开的目录链接 (--follow-links)
+    STAT_DIRS_UNSCANNED,   // 预算用尽时未读取的目录 (--time-budget / --entry-budget)
+    STAT_ARENA_BLOCKS,     // 遍历内存池向堆申请的块数
+    STAT_ARENA_BYTES,      // 遍历内存池向堆申请的字节数
+    STAT_GIT_INDEX_ENTRIES, // 读取的 Git 索引条目 (--git-tracked)
+    STAT_ARCHIVE_ENTRIES,  // 读取的归档条目 (-i 为归档文件)
+#ifdef CTREE_COUNT_ALLOCATIONS
+    STAT_WALK_HEAP_ALLOCS, // 单线程遍历期间 (遍历线程上) 的通用堆分配次数，含内存池的块
+    STAT_WALK_HEAP_BYTES,  // 同上，字节数
+#endif
+    STAT_COUNTER_COUNT
 };
 
-void RunTreeGeneration(const AppConfig& cfg) {
-    if (!fs::exists(cfg.inputPath)) { std::cout << to_utf8(Strings::get("ERR_PATH")) << std::endl; return; }
+// 忽略规则在编译后的匹配器中所属的查找阶段；同一阶段的规则共用一次查找
+enum RuleStage { STAGE_LITERAL, STAGE_SUFFIX, STAGE_ANCHORED, STAGE_FLOATING, STAGE_GLOB, STAGE_COUNT };
 
-    // 1. 加载忽略规则
-    TreeIgnore ignoreMgr;
-    bool loaded = false;
-    if (!cfg.specifiedIgnoreFile.empty()) { ignoreMgr.load_file(cfg.specifiedIgnoreFile); loaded = true; }
-    if (!loaded) {
-        if (fs::exists(cfg.inputPath / IGNORE_FILENAME)) ignoreMgr.load_file(cfg.inputPath / IGNORE_FILENAME);
-        else if (fs::exists(fs::current_path() / IGNORE_FILENAME)) ignoreMgr.load_file(fs::current_path() / IGNORE_FILENAME);
-        else ignoreMgr.load_file(get_global_ignore_path());
-    }
-    for (const auto& r : cfg.tempIgnores) ignoreMgr.add_rule(r);
-    ignoreMgr.set_root(cfg.inputPath);
+struct RuleCounter {
+    uint64_t evals = 0;
+    uint64_t hits = 0;
+    uint64_t ns = 0;
+};
+
+// 每个线程独占一份，结束后合并，计数无需原子操作
+struct StatsShard {
+    uint64_t counters[STAT_COUNTER_COUNT] = {};
+    uint64_t phaseNs[PHASE_COUNT] = {};
+    uint64_t stageEvals[STAGE_COUNT] = {};
+    uint64_t stageNs[STAGE_COUNT] = {};
+    std::vector<RuleCounter> rules;  // 按规则序号；glob 规则单独计时，其余规则的耗时记在所属阶段
+};
+
+class RunStats {
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<StatsShard>> _shards;
 
-    // 2. 准备输出
-    fs::path finalOutPath = cfg.outputPath;
-    if (cfg.OutputFlag && finalOutPath.empty()) {
-        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-        std::tm tm; localtime_s(&tm, &now);
-        std::wstringstream wss; wss << L"tree_" << std::put_time(&tm, L"%Y%m%d_%H%M%S") << L".txt";
-        finalOutPath = fs::current_path() / wss.str();
+public:
+    static RunStats& instance() {
+        static RunStats stats;
+        return stats;
     }
-    if (!finalOutPath.empty()) ignoreMgr.add_rule(finalOutPath.filename().wstring());
 
-    std::cout << to_utf8(Strings::get("PROCESSING")) << std::endl;
+    StatsShard& local() {
+        thread_local StatsShard* shard = nullptr;
+        if (!shard) {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _shards.push_back(std::make_unique<StatsShard>());
+            shard = _shards.back().get();
+        }
+        return *shard;
+    }
 
-    MultiWriter writer;
-    std::ofstream outFile;
-    if (!cfg.OutputFlag) writer.setConsole(std::cout);
-    if (cfg.OutputFlag) {
-        outFile.open(finalOutPath, std::ios::binary);
-        if (outFile.is_open()) { outFile << "\xEF\xBB\xBF"; writer.setFile(outFile); }
-        else std::cerr << to_utf8(Strings::get("ERR_FILE_OPEN") + finalOutPath.wstring()) << std::endl;
+    // 所有工作线程结束后调用
+    StatsShard merged(size_t ruleCount) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        StatsShard total;
+        total.rules.resize(ruleCount);
+        for (const auto& s : _shards) {
+            for (int i = 0; i < STAT_COUNTER_COUNT; ++i) total.counters[i] += s->counters[i];
+            for (int i = 0; i < PHASE_COUNT; ++i) total.phaseNs[i] += s->phaseNs[i];
+            for (int i = 0; i < STAGE_COUNT; ++i) { total.stageEvals[i] += s->stageEvals[i]; total.stageNs[i] += s->stageNs[i]; }
+            for (size_t r = 0; r < s->rules.size() && r < ruleCount; ++r) {
+                total.rules[r].evals += s->rules[r].evals;
+                total.rules[r].hits += s->rules[r].hits;
+                total.rules[r].ns += s->rules[r].ns;
+            }
+        }
+        return total;
     }
-    std::wstringstream wClipBuffer;
-    if (cfg.CopyFlag) writer.setClipboard(wClipBuffer);
+};
 
+inline uint64_t now_ns() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void stat_add(StatCounter c, uint64_t n = 1) {
+    if (g_statsEnabled) RunStats::instance().local().counters[c] += n;
+}
+
+bool get_mtime(const fs::path& path, int64_t& mtime) {
+    stat_add(STAT_STAT_CALLS);
 #ifdef _WIN32
-    writer.setLineEndingToCRLF();
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExW(path.wstring().c_str(), GetFileExInfoStandard, &data)) return false;
+    mtime = file_time_of(data.ftLastWriteTime);
+#else
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return false;
+    mtime = stat_mtime(st);
 #endif
+    return true;
+}
 
-    // 3. 执行
-    std::wstring rootName = cfg.inputPath.filename().wstring();
-    if (rootName.empty()) rootName = cfg.inputPath.wstring();
-    writer.writeLine(rootName + L"\\");
-
-    generate_tree_recursive(cfg.inputPath, L"", writer, ignoreMgr);
+#ifdef CTREE_COUNT_ALLOCATIONS
+// 通用堆分配计数 (CMake 选项 CTREE_COUNT_ALLOCATIONS)：替换全部全局 operator new / delete (含数组、nothrow 与对齐形式)，按线程累计次数与字节数
+// 用于确认遍历进入稳态后不再向堆申请内存；默认关闭，库不替换嵌入方的全局分配函数
+struct HeapCount {
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;
+};
+thread_local HeapCount t_heapCount;
 
-    if (cfg.OutputFlag && outFile.is_open()) {
-        outFile.close();
-        std::cout << to_utf8(Strings::get("MSG_SAVED")) << to_utf8(finalOutPath.wstring()) << std::endl;
-    }
-    if (cfg.CopyFlag) CopyToClipboardW(wClipBuffer.str());
+// 超出默认对齐的分配在 Windows 上须用 _aligned_free 释放，其余一律 free
+inline void* heap_alloc(std::size_t n, std::size_t align) noexcept {
+    HeapCount& c = t_heapCount;
+    ++c.allocs;
+    c.bytes += n;
+    if (n == 0) n = 1;
+    if (align <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) return std::malloc(n);
+#ifdef _WIN32
+    return _aligned_malloc(n, align);
+#else
+    void* p = nullptr;
+    return posix_memalign(&p, align, n) == 0 ? p : nullptr;
+#endif
 }
 
-void RunFileContentCopy(const fs::path& filePath) {
-    if (!fs::exists(filePath)) { std::cout << to_utf8(Strings::get("ERR_PATH")) << std::endl; return; }
-    std::ifstream in(filePath, std::ios::binary);
-    if (!in.is_open()) { std::cout << to_utf8(Strings::get("ERR_FILE_READ") + filePath.wstring()) << std::endl; return; }
+inline void heap_free(void* p, std::size_t align) noexcept {
+#ifdef _WIN32
+    if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__) { _aligned_free(p); return; }
+#else
+    (void)align;
+#endif
+    std::free(p);
+}
 
-    char bom[3] = { 0 }; in.read(bom, 3);
-    if (!(bom[0] == '\xEF' && bom[1] == '\xBB' && bom[2] == '\xBF')) in.seekg(0);
-    std::ostringstream ss; ss << in.rdbuf();
-    CopyToClipboard(ss.str());
+inline void* heap_alloc_or_throw(std::size_t n, std::size_t align) {
+    if (void* p = heap_alloc(n, align)) return p;
+    throw std::bad_alloc();
 }
 
-// ============================================================================
-// [Section 7] 入口点
-// ============================================================================
+constexpr std::size_t HEAP_DEFAULT_ALIGN = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
 
-int wmain(int argc, wchar_t* argv[]) {
-    // 启用 UTF-8 全流程支持
-    SetConsoleOutputCP(CP_UTF8);
-    SetConsoleCP(CP_UTF8);
+}  // namespace ctree::detail
 
-    AppConfig config;
-    config.parse(argc, argv);
+using ctree::detail::heap_alloc;
+using ctree::detail::heap_alloc_or_throw;
+using ctree::detail::heap_free;
+using ctree::detail::HEAP_DEFAULT_ALIGN;
 
-    if (config.showHelp) { std::cout << to_utf8(Strings::get("HELP_MSG")); return 0; }
-    if (config.showVersion) { std::cout << to_utf8(VERSION); return 0; }
-    if (!config.isValid) { std::cout << to_utf8(Strings::get("ERR_Args")) << std::endl; return 1; }
-    if (config.showMenu) { ShowInteractiveMenu(); return 0; }
+// 不内联：否则 GCC 在调用处看到 malloc 的结果交给 operator delete (或 operator new 的结果交给 free) 会误报不匹配
+[[gnu::noinline]] void* operator new(std::size_t n) { return heap_alloc_or_throw(n, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void* operator new[](std::size_t n) { return heap_alloc_or_throw(n, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void* operator new(std::size_t n, const std::nothrow_t&) noexcept { return heap_alloc(n, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void* operator new[](std::size_t n, const std::nothrow_t&) noexcept { return heap_alloc(n, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void* operator new(std::size_t n, std::align_val_t a) { return heap_alloc_or_throw(n, (std::size_t)a); }
+[[gnu::noinline]] void* operator new[](std::size_t n, std::align_val_t a) { return heap_alloc_or_throw(n, (std::size_t)a); }
+[[gnu::noinline]] void* operator new(std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return heap_alloc(n, (std::size_t)a); }
+[[gnu::noinline]] void* operator new[](std::size_t n, std::align_val_t a, const std::nothrow_t&) noexcept { return heap_alloc(n, (std::size_t)a); }
 
-    if (config.createGlobal) create_ignore_template(get_global_ignore_path());
-    if (config.deleteGlobal) { fs::path p = get_global_ignore_path(); if (fs::exists(p)) fs::remove(p); else std::cout << to_utf8(Strings::get("INFO_REM_GLOBAL")) << std::endl; }
-    if (config.createLocal) create_ignore_template((config.inputPath.empty() ? fs::current_path() : config.inputPath) / IGNORE_FILENAME);
+[[gnu::noinline]] void operator delete(void* p) noexcept { heap_free(p, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void operator delete[](void* p) noexcept { heap_free(p, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept { heap_free(p, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void operator delete[](void* p, std::size_t) noexcept { heap_free(p, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void operator delete(void* p, const std::nothrow_t&) noexcept { heap_free(p, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void operator delete[](void* p, const std::nothrow_t&) noexcept { heap_free(p, HEAP_DEFAULT_ALIGN); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t a) noexcept { heap_free(p, (std::size_t)a); }
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t a) noexcept { heap_free(p, (std::size_t)a); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t, std::align_val_t a) noexcept { heap_free(p, (std::size_t)a); }
+[[gnu::noinline]] void operator delete[](void* p, std::size_t, std::align_val_t a) noexcept { heap_free(p, (std::size_t)a); }
+[[gnu::noinline]] void operator delete(void* p, std::align_val_t a, const std::nothrow_t&) noexcept { heap_free(p, (std::size_t)a); }
+[[gnu::noinline]] void operator delete[](void* p, std::align_val_t a, const std::nothrow_t&) noexcept { heap_free(p, (std::size_t)a); }
 
-    if (config.CopyFlag && !config.copyFilePath.empty() && config.inputPath.empty()) {
-        RunFileContentCopy(config.copyFilePath);
-    }
-    else if (!config.inputPath.empty()) {
-        RunTreeGeneration(config);
+namespace ctree::detail {
+
+// 作用域内本线程的堆分配次数与字节数，结束时记入统计
+class HeapProbe {
+    StatCounter _allocs, _bytes;
+    HeapCount _start = t_heapCount;
+
+public:
+    HeapProbe(StatCounter allocs, StatCounter bytes) : _allocs(allocs), _bytes(bytes) {}
+    ~HeapProbe() {
+        const HeapCount end = t_heapCount;
+        stat_add(_allocs, end.allocs - _start.allocs);
+        stat_add(_bytes, end.bytes - _start.bytes);
+    }
+};
+#endif
+
+// 作用域计时：累加到当前线程的阶段耗时
+class ScopedPhase {
+    StatPhase _phase;
+    uint64_t _start;
+
+public:
+    explicit ScopedPhase(StatPhase phase) : _phase(phase), _start(g_statsEnabled ? now_ns() : 0) {}
+    ~ScopedPhase() { if (g_statsEnabled) RunStats::instance().local().phaseNs[_phase] += now_ns() - _start; }
+    ScopedPhase(const ScopedPhase&) = delete;
+    ScopedPhase& operator=(const ScopedPhase&) = delete;
+};
+
+// 进程 CPU 时间 (用户态 + 内核态，秒)
+double process_cpu_seconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+    auto ticks = [](const FILETIME& ft) { return ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime; };
+    return (double)(ticks(kernel) + ticks(user)) / 1e7;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+#endif
+}
+
+// 进程峰值常驻内存 (KB)
+uint64_t peak_rss_kb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+    return (uint64_t)pmc.PeakWorkingSetSize / 1024;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#if defined(__APPLE__)
+    return (uint64_t)ru.ru_maxrss / 1024;  // macOS 单位为字节
+#else
+    return (uint64_t)ru.ru_maxrss;
+#endif
+#endif
+}
+
+// ============================================================================
+// [Section 3] 核心逻辑：忽略规则 (Gitignore 风格)
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// 规则编译器：add_rule 时一次性编译，匹配阶段不分配内存，不依赖 shlwapi
+// ----------------------------------------------------------------------------
+
+#ifdef _WIN32
+constexpr bool IGNORE_CASE_INSENSITIVE = true;   // 与 NTFS / PathMatchSpecW 行为一致
+#else
+constexpr bool IGNORE_CASE_INSENSITIVE = false;
+#endif
+
+constexpr uint32_t NO_RULE = 0xFFFFFFFFu;
+
+inline wchar_t fold_char(wchar_t c) {
+    if (!IGNORE_CASE_INSENSITIVE) return c;
+    if (c < 0x80) return (c >= L'A' && c <= L'Z') ? (wchar_t)(c + 32) : c;
+    return (wchar_t)std::towlower((wint_t)c);
+}
+
+inline bool is_sep(wchar_t c) { return c == L'\\' || c == L'/'; }
+
+inline bool equals_folded(std::wstring_view a, std::wstring_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i] != b[i] && fold_char(a[i]) != fold_char(b[i])) return false;
+    }
+    return true;
+}
+
+inline uint64_t hash_folded(uint32_t scope, std::wstring_view s) {
+    uint64_t h = 1469598103934665603ull ^ ((uint64_t)scope * 0x9E3779B97F4A7C15ull);
+    for (wchar_t c : s) {
+        h ^= (uint64_t)fold_char(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// 两个命中结果中序号较大者 (规则越靠后优先级越高)
+inline uint32_t later_rule(uint32_t a, uint32_t b) {
+    if (a == NO_RULE) return b;
+    if (b == NO_RULE) return a;
+    return std::max(a, b);
+}
+
+// 每条编译后的匹配项记录命中的最大规则序号；dirRule 仅对目录生效 (规则以 / 结尾)
+
+struct RuleRef {
+    uint32_t anyRule = NO_RULE;
+    uint32_t dirRule = NO_RULE;
+
+    void add(uint32_t ruleIdx, bool onlyDir) {
+        uint32_t& slot = onlyDir ? dirRule : anyRule;
+        slot = later_rule(slot, ruleIdx);
+    }
+    uint32_t hit(bool isDir) const { return isDir ? later_rule(anyRule, dirRule) : anyRule; }
+};
+
+// 开放寻址哈希表：键为 (作用域, 名称)，按 fold_char 折叠后比较；查找不分配内存
+class NameTable {
+    struct Slot {
+        uint64_t hash = 0;
+        uint32_t scope = 0;
+        uint32_t keyOff = 0;
+        uint32_t keyLen = 0;
+        uint32_t value = 0;
+        bool used = false;
+    };
+    std::vector<Slot> _slots;
+    std::wstring _keys;
+    size_t _count = 0;
+
+    std::wstring_view key_of(const Slot& s) const { return std::wstring_view(_keys).substr(s.keyOff, s.keyLen); }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old = std::move(_slots);
+        _slots.assign(capacity, Slot{});
+        for (const Slot& s : old) {
+            if (!s.used) continue;
+            size_t i = s.hash & (capacity - 1);
+            while (_slots[i].used) i = (i + 1) & (capacity - 1);
+            _slots[i] = s;
+        }
+    }
+
+public:
+    bool empty() const { return _count == 0; }
+
+    const uint32_t* find(uint32_t scope, std::wstring_view key) const {
+        if (_count == 0) return nullptr;
+        uint64_t h = hash_folded(scope, key);
+        size_t mask = _slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            const Slot& s = _slots[i];
+            if (!s.used) return nullptr;
+            if (s.hash == h && s.scope == scope && equals_folded(key_of(s), key)) return &s.value;
+        }
+    }
+
+    // 插入或返回已有值的引用
+    uint32_t& insert(uint32_t scope, std::wstring_view key, uint32_t initial) {
+        if ((_count + 1) * 2 > _slots.size()) rehash(_slots.empty() ? 16 : _slots.size() * 2);
+        uint64_t h = hash_folded(scope, key);
+        size_t mask = _slots.size() - 1;
+        size_t i = h & mask;
+        for (; _slots[i].used; i = (i + 1) & mask) {
+            Slot& s = _slots[i];
+            if (s.hash == h && s.scope == scope && equals_folded(key_of(s), key)) return s.value;
+        }
+        Slot& s = _slots[i];
+        s.hash = h;
+        s.scope = scope;
+        s.keyOff = (uint32_t)_keys.size();
+        s.keyLen = (uint32_t)key.size();
+        s.value = initial;
+        s.used = true;
+        _keys.append(key);
+        ++_count;
+        return s.value;
+    }
+};
+
+// 通配符小型虚拟机：* 匹配段内任意字符序列，? 匹配单个字符，其余按字面量 (折叠大小写) 比较
+class GlobProgram {
+    enum class Op : uint8_t { Lit, Any, Star };
+    struct Instr { Op op; uint32_t off; uint32_t len; };
+
+    std::vector<Instr> _code;
+    std::wstring _lits;
+    size_t _minLen = 0;
+    wchar_t _first = 0;   // 以字面量开头时的首字符 (已折叠)，用于快速排除
+
+public:
+    static bool has_wildcard(std::wstring_view p) { return p.find_first_of(L"*?") != std::wstring_view::npos; }
+
+    explicit GlobProgram(std::wstring_view pattern) {
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            wchar_t c = pattern[i];
+            if (c == L'*') {
+                if (_code.empty() || _code.back().op != Op::Star) _code.push_back({ Op::Star, 0, 0 });
+            }
+            else if (c == L'?') {
+                _code.push_back({ Op::Any, 0, 0 });
+                ++_minLen;
+            }
+            else {
+                if (_code.empty() || _code.back().op != Op::Lit) _code.push_back({ Op::Lit, (uint32_t)_lits.size(), 0 });
+                _lits += fold_char(c);
+                ++_code.back().len;
+                ++_minLen;
+            }
+        }
+        if (!_code.empty() && _code[0].op == Op::Lit) _first = _lits[_code[0].off];
+    }
+
+    bool match(std::wstring_view s) const {
+        if (s.size() < _minLen) return false;
+        if (_first && fold_char(s[0]) != _first) return false;
+
+        const size_t n = s.size();
+        size_t pc = 0, si = 0;
+        size_t starPc = SIZE_MAX, starSi = 0;
+        while (true) {
+            if (pc < _code.size()) {
+                const Instr& in = _code[pc];
+                if (in.op == Op::Star) {
+                    if (pc + 1 == _code.size()) return true;   // 结尾的 * 吞掉剩余字符
+                    starPc = ++pc;
+                    starSi = si;
+                    continue;
+                }
+                if (in.op == Op::Any && si < n) { ++pc; ++si; continue; }
+                if (in.op == Op::Lit && si + in.len <= n) {
+                    size_t k = 0;
+                    while (k < in.len && fold_char(s[si + k]) == _lits[in.off + k]) ++k;
+                    if (k == in.len) { ++pc; si += in.len; continue; }
+                }
+            }
+            else if (si == n) {
+                return true;
+            }
+            // 失配：回溯到最近的 *，让其多吞一个字符
+            if (starPc == SIZE_MAX || starSi >= n) return false;
+            si = ++starSi;
+            pc = starPc;
+        }
+    }
+};
+
+// 路径前缀树：按路径段逐级匹配，字面量段走哈希边，含通配符的段走 glob 边，** 段走跨层边
+// all 为 false 时找到任一命中即返回；为 true 时返回序号最大的命中 (用于否定规则的"最后匹配生效")
+class PathTrie {
+    struct StarEdge { uint32_t child; uint32_t minSegments; };
+    struct Node {
+        RuleRef terminal;
+        std::vector<std::pair<GlobProgram, uint32_t>> globEdges;
+        std::vector<StarEdge> starEdges;  // ** 跳过任意多段 (位于模式末尾时至少一段)
+    };
+    std::vector<Node> _nodes = std::vector<Node>(1);
+    NameTable _edges;   // (父节点, 段名) -> 子节点
+
+    // 正向：path[pos..] 的全部段依次匹配，最终落在终止节点上
+    uint32_t walk_forward(uint32_t node, std::wstring_view path, size_t pos, bool isDir, bool all) const {
+        if (pos > path.size()) return _nodes[node].terminal.hit(isDir);
+        size_t end = pos;
+        while (end < path.size() && !is_sep(path[end])) ++end;
+        std::wstring_view seg = path.substr(pos, end - pos);
+
+        uint32_t best = NO_RULE;
+        if (const uint32_t* child = _edges.find(node, seg)) best = walk_forward(*child, path, end + 1, isDir, all);
+        for (const auto& [glob, child] : _nodes[node].globEdges) {
+            if (best != NO_RULE && !all) return best;
+            if (glob.match(seg)) best = later_rule(best, walk_forward(child, path, end + 1, isDir, all));
+        }
+        for (const StarEdge& star : _nodes[node].starEdges) {
+            size_t p = pos;
+            for (uint32_t skipped = 0;; ++skipped) {
+                if (best != NO_RULE && !all) return best;
+                if (skipped >= star.minSegments) best = later_rule(best, walk_forward(star.child, path, p, isDir, all));
+                if (p > path.size()) break;
+                while (p < path.size() && !is_sep(path[p])) ++p;
+                ++p;
+            }
+        }
+        return best;
+    }
+
+    // 反向：从 path[..end) 的最后一段向前匹配，途经任一终止节点即命中 (后缀匹配)
+    uint32_t walk_backward(uint32_t node, std::wstring_view path, size_t end, bool isDir, bool all) const {
+        if (end == SIZE_MAX) return NO_RULE;
+        size_t start = end;
+        while (start > 0 && !is_sep(path[start - 1])) --start;
+        std::wstring_view seg = path.substr(start, end - start);
+        size_t next = (start == 0) ? SIZE_MAX : start - 1;
+
+        auto visit = [&](uint32_t child, size_t from) {
+            uint32_t r = _nodes[child].terminal.hit(isDir);
+            return (r != NO_RULE && !all) ? r : later_rule(r, walk_backward(child, path, from, isDir, all));
+        };
+        uint32_t best = NO_RULE;
+        if (const uint32_t* child = _edges.find(node, seg)) best = visit(*child, next);
+        for (const auto& [glob, child] : _nodes[node].globEdges) {
+            if (best != NO_RULE && !all) return best;
+            if (glob.match(seg)) best = later_rule(best, visit(child, next));
+        }
+        for (const StarEdge& star : _nodes[node].starEdges) {
+            size_t e = end;
+            for (uint32_t skipped = 0;; ++skipped) {
+                if (best != NO_RULE && !all) return best;
+                if (skipped >= star.minSegments) {
+                    best = later_rule(best, skipped > 0 ? visit(star.child, e) : walk_backward(star.child, path, e, isDir, all));
+                }
+                if (e == SIZE_MAX) break;
+                size_t s = e;
+                while (s > 0 && !is_sep(path[s - 1])) --s;
+                e = (s == 0) ? SIZE_MAX : s - 1;
+            }
+        }
+        return best;
+    }
+
+public:
+    bool empty() const { return _nodes.size() == 1; }
+
+    void insert(const std::vector<std::wstring_view>& segments, uint32_t ruleIdx, bool onlyDir, bool reversed) {
+        uint32_t node = 0;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            std::wstring_view seg = segments[i];
+            uint32_t next;
+            if (seg == L"**") {
+                // 模式末尾的 ** (如 a/**) 只匹配其内部，至少跳过一段
+                uint32_t minSegments = (reversed ? i == 0 : i + 1 == segments.size()) ? 1 : 0;
+                next = (uint32_t)_nodes.size();
+                _nodes.emplace_back();
+                _nodes[node].starEdges.push_back({ next, minSegments });
+            }
+            else if (GlobProgram::has_wildcard(seg)) {
+                next = (uint32_t)_nodes.size();
+                _nodes.emplace_back();
+                _nodes[node].globEdges.emplace_back(GlobProgram(seg), next);
+            }
+            else {
+                uint32_t& slot = _edges.insert(node, seg, NO_RULE);
+                if (slot == NO_RULE) {
+                    slot = (uint32_t)_nodes.size();
+                    _nodes.emplace_back();
+                }
+                next = slot;
+            }
+            node = next;
+        }
+        _nodes[node].terminal.add(ruleIdx, onlyDir);
+    }
+
+    uint32_t match_forward(std::wstring_view path, bool isDir, bool all) const { return walk_forward(0, path, 0, isDir, all); }
+    uint32_t match_backward(std::wstring_view path, bool isDir, bool all) const {
+        return path.empty() ? NO_RULE : walk_backward(0, path, path.size(), isDir, all);
+    }
+};
+
+// 编译后的忽略规则集合：
+//   纯文件名字面量 -> 哈希表；*.ext 类后缀 -> 后缀表；其余文件名通配 -> glob 虚拟机
+//   根锚定路径 -> 正向前缀树；含分隔符路径 -> 反向前缀树 (任意深度的后缀匹配)
+class IgnoreMatcher {
+    struct GlobRule { GlobProgram prog; uint32_t ruleIdx; bool onlyDir; };
+
+    std::vector<RuleRef> _refs;
+    NameTable _literalNames;
+    NameTable _suffixes;
+    std::vector<size_t> _suffixLens;
+    std::vector<GlobRule> _globNames;
+    PathTrie _anchored;
+    PathTrie _floating;
+    std::vector<uint8_t> _stages;  // 按规则序号记录所属阶段 (RuleStage)
+
+    void set_stage(uint32_t ruleIdx, RuleStage stage) {
+        if (_stages.size() <= ruleIdx) _stages.resize(ruleIdx + 1, STAGE_LITERAL);
+        _stages[ruleIdx] = (uint8_t)stage;
+    }
+
+    void add_ref(NameTable& table, std::wstring_view key, uint32_t ruleIdx, bool onlyDir) {
+        uint32_t& ref = table.insert(0, key, NO_RULE);
+        if (ref == NO_RULE) {
+            ref = (uint32_t)_refs.size();
+            _refs.emplace_back();
+        }
+        _refs[ref].add(ruleIdx, onlyDir);
+    }
+
+public:
+    // pattern 已归一化：分隔符统一为反斜杠，且已去除前导与结尾的分隔符
+    void add(std::wstring_view pattern, bool onlyDir, bool isRootOnly, bool hasSeparator, uint32_t ruleIdx) {
+        if (isRootOnly || hasSeparator) {
+            std::vector<std::wstring_view> segments;
+            size_t pos = 0;
+            while (pos <= pattern.size()) {
+                size_t end = pattern.find(L'\\', pos);
+                if (end == std::wstring_view::npos) end = pattern.size();
+                segments.push_back(pattern.substr(pos, end - pos));
+                pos = end + 1;
+            }
+            if (isRootOnly) {
+                _anchored.insert(segments, ruleIdx, onlyDir, false);
+                set_stage(ruleIdx, STAGE_ANCHORED);
+            }
+            else {
+                // 反向树中原模式末尾的 ** 位于第一段
+                std::reverse(segments.begin(), segments.end());
+                _floating.insert(segments, ruleIdx, onlyDir, true);
+                set_stage(ruleIdx, STAGE_FLOATING);
+            }
+            return;
+        }
+
+        if (!GlobProgram::has_wildcard(pattern)) {
+            add_ref(_literalNames, pattern, ruleIdx, onlyDir);
+            set_stage(ruleIdx, STAGE_LITERAL);
+        }
+        else if (pattern[0] == L'*' && !GlobProgram::has_wildcard(pattern.substr(1)) && pattern.size() > 1) {
+            std::wstring_view suffix = pattern.substr(1);
+            add_ref(_suffixes, suffix, ruleIdx, onlyDir);
+            set_stage(ruleIdx, STAGE_SUFFIX);
+            if (std::find(_suffixLens.begin(), _suffixLens.end(), suffix.size()) == _suffixLens.end()) {
+                _suffixLens.push_back(suffix.size());
+                std::sort(_suffixLens.begin(), _suffixLens.end());
+            }
+        }
+        else {
+            _globNames.push_back({ GlobProgram(pattern), ruleIdx, onlyDir });
+            set_stage(ruleIdx, STAGE_GLOB);
+        }
+    }
+
+    RuleStage stage_of(uint32_t ruleIdx) const { return ruleIdx < _stages.size() ? (RuleStage)_stages[ruleIdx] : STAGE_LITERAL; }
+
+    // 不做任何统计的探针，调用全部内联消失
+    struct NoProfile {
+        void stage(RuleStage) {}
+        void glob_begin() {}
+        void glob_end(uint32_t) {}
+    };
+
+    // 返回命中的规则序号，未命中返回 NO_RULE；Profile 用于 --stats 统计各阶段与各 glob 规则的开销
+    // last 为 false 时返回任一命中 (最快)；为 true 时返回序号最大的命中，供含否定规则的规则集使用
+    template <class Profile = NoProfile>
+    uint32_t match(std::wstring_view relPath, std::wstring_view name, bool isDir, bool last = false, Profile&& prof = Profile()) const {
+        uint32_t best = NO_RULE;
+        if (const uint32_t* ref = _literalNames.find(0, name)) best = _refs[*ref].hit(isDir);
+        prof.stage(STAGE_LITERAL);
+        if (best != NO_RULE && !last) return best;
+
+        if (!_suffixLens.empty()) {
+            for (size_t len : _suffixLens) {
+                if (len > name.size()) break;
+                if (const uint32_t* ref = _suffixes.find(0, name.substr(name.size() - len))) {
+                    best = later_rule(best, _refs[*ref].hit(isDir));
+                    if (best != NO_RULE && !last) break;
+                }
+            }
+            prof.stage(STAGE_SUFFIX);
+            if (best != NO_RULE && !last) return best;
+        }
+        if (!_anchored.empty()) {
+            best = later_rule(best, _anchored.match_forward(relPath, isDir, last));
+            prof.stage(STAGE_ANCHORED);
+            if (best != NO_RULE && !last) return best;
+        }
+        if (!_floating.empty()) {
+            best = later_rule(best, _floating.match_backward(relPath, isDir, last));
+            prof.stage(STAGE_FLOATING);
+            if (best != NO_RULE && !last) return best;
+        }
+        // glob 规则按序号升序存放：求最大命中时倒序检查，遇到序号不大于当前结果即可停止
+        for (size_t k = 0; k < _globNames.size(); ++k) {
+            const GlobRule& g = _globNames[last ? _globNames.size() - 1 - k : k];
+            if (last && best != NO_RULE && g.ruleIdx <= best) break;
+            if (g.onlyDir && !isDir) continue;
+            prof.glob_begin();
+            bool hit = g.prog.match(name);
+            prof.glob_end(g.ruleIdx);
+            if (hit) return g.ruleIdx;
+        }
+        return best;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 分层忽略作用域：每个含忽略文件的目录压入一层，规则只对该目录的子树生效
+// 作用域链不可变且共享，进入子目录即压栈、离开即出栈，并行遍历的各任务可直接持有
+// ----------------------------------------------------------------------------
+
+class TreeIgnore;
+class IgnoreFileCache;
+class DirListingCache;
+
+struct IgnoreScope {
+    std::shared_ptr<const TreeIgnore> rules;
+    std::wstring base;                         // 忽略文件所在目录 (相对扫描根目录)
+    uint64_t key;                              // 整条作用域链的内容指纹 (用于校验索引缓存)
+    std::shared_ptr<const IgnoreScope> parent;
+};
+using IgnoreScopePtr = std::shared_ptr<const IgnoreScope>;
+
+// 目录中出现的嵌套忽略文件
+constexpr uint32_t IGNORE_FILE_GIT = 1;   // .gitignore
+constexpr uint32_t IGNORE_FILE_TREE = 2;  // .treeignore (根目录的由 -f/本地/全局 优先级逻辑加载，不再重复)
+
+class TreeIgnore {
+    struct Rule {
+        std::wstring pattern;
+        bool onlyDir;
+        bool isRootOnly;
+        bool hasSeparator;
+        bool negate;   // ! 开头：重新包含此前被忽略的条目
+    };
+    IgnoreMatcher _matcher;
+    bool _hasNegation = false;  // 无否定规则时任一命中即可判定，不必求最后一条
+    std::shared_ptr<IgnoreFileCache> _nestedFiles;  // 非空表示启用按目录加载的嵌套忽略文件
+    std::shared_ptr<DirListingCache> _listings;     // 非空表示保留本规则集过滤过的目录列表 (--serve)
+
+    // 精确排除的文件 (本次输出文件、索引文件)：(所在目录相对路径, 文件名)，不属于规则，不参与 fingerprint
+    std::vector<std::pair<std::wstring, std::wstring>> _excluded;
+
+public:
+    std::vector<Rule> rules;
+
+    // 规则集指纹：规则内容或顺序变化时改变 (用于校验索引缓存)
+    uint64_t fingerprint() const {
+        uint64_t h = hash_folded(IGNORE_CASE_INSENSITIVE ? 1 : 0, L"");
+        for (const auto& r : rules) {
+            h ^= hash_folded((r.onlyDir ? 1u : 0u) | (r.isRootOnly ? 2u : 0u) | (r.hasSeparator ? 4u : 0u) | (r.negate ? 8u : 0u), r.pattern);
+            h *= 1099511628211ull;
+        }
+        if (nested()) h = ~h;
+        return h;
+    }
+
+    // relDir 为空表示扫描根目录
+    void exclude_file(std::wstring relDir, std::wstring name) { _excluded.emplace_back(std::move(relDir), std::move(name)); }
+
+    bool has_excluded_in(std::wstring_view relDir) const {
+        for (const auto& [dir, name] : _excluded) if (equals_folded(relDir, dir)) return true;
+        return false;
+    }
+    bool is_excluded(std::wstring_view relDir, std::wstring_view name) const {
+        for (const auto& [dir, file] : _excluded) if (equals_folded(relDir, dir) && equals_folded(name, file)) return true;
+        return false;
+    }
+
+    // gitSyntax：按 Git 语义解析 (含中间分隔符的规则锚定到忽略文件所在目录)，用于嵌套的 .gitignore
+    void add_rule(std::wstring raw, bool gitSyntax = false) {
+        // 1. 去除前后空白
+        const wchar_t* ws = L" \t\n\r";
+        size_t start = raw.find_first_not_of(ws);
+        if (start == std::wstring::npos) return;
+        raw.erase(0, start);
+        size_t end = raw.find_last_not_of(ws);
+        if (end != std::wstring::npos) raw.erase(end + 1);
+        if (raw.empty()) return;
+
+        // 2. 统一分隔符为反斜杠 (先归一化，简化后续判断)
+        std::replace(raw.begin(), raw.end(), L'/', L'\\');
+
+        // 3. 检查注释和非法路径
+        //    - # 开头是 Git 标准注释
+        //    - 包含 \\ 说明原字符串有 // (注释) 或者路径写错了 (a//b)，直接跳过
+        if (raw[0] == L'#') return;
+        if (raw.find(L"\\\\") != std::wstring::npos) return;
+
+        // 3.1 ! 开头为否定规则 (最后匹配的规则生效)
+        bool negate = false;
+        if (raw[0] == L'!') {
+            negate = true;
+            raw.erase(0, 1);
+            if (raw.empty()) return;
+        }
+
+        // 4. 判断是否为根路径规则（以 \ 开头）
+        bool isRootOnly = false;
+        if (raw[0] == L'\\') {
+            isRootOnly = true;
+            raw.erase(0, 1);
+        }
+
+        // 5. 移除前导 .\ (当前目录)
+        while (raw.size() >= 2 && raw[0] == L'.' && raw[1] == L'\\') {
+            raw.erase(0, 2);
+        }
+        if (raw.empty()) return;
+
+        // 6. 解析目录限定符 (以 \ 结尾)
+        bool onlyDir = false;
+        if (!raw.empty() && raw.back() == L'\\') {
+            onlyDir = true;
+            raw.pop_back();
+            if (raw.empty()) return;
+        }
+
+        // 6.1 前导 **\ 表示任意深度 (即无根路径规则)；单独的 ** 匹配一切
+        bool anyDepth = false;
+        while (raw.size() > 3 && raw.compare(0, 3, L"**\\") == 0) {
+            raw.erase(0, 3);
+            isRootOnly = false;
+            anyDepth = true;
+        }
+        if (raw == L"**") raw = L"*";
+
+        // 7. 检查是否有中间分隔符 (Git语义: 有分隔符则匹配路径，无则匹配文件名)
+        bool hasSeparator = (raw.find(L'\\') != std::wstring::npos);
+        if (gitSyntax && hasSeparator && !anyDepth) isRootOnly = true;
+
+        _hasNegation = _hasNegation || negate;
+        rules.push_back({ raw, onlyDir, isRootOnly, hasSeparator, negate });
+        _matcher.add(rules.back().pattern, onlyDir, isRootOnly, hasSeparator, (uint32_t)(rules.size() - 1));
+    }
+
+    // 逐行解析忽略文件内容 (可带 UTF-8 BOM)
+    void add_rules_from(std::string_view text, bool gitSyntax = false) {
+        if (text.size() >= 3 && text.compare(0, 3, "\xEF\xBB\xBF") == 0) text.remove_prefix(3);
+        while (!text.empty()) {
+            size_t eol = text.find('\n');
+            std::string_view line = text.substr(0, eol);
+            if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+            add_rule(to_wide(std::string(line)), gitSyntax);
+            if (eol == std::string_view::npos) break;
+            text.remove_prefix(eol + 1);
+        }
+    }
+
+    // 文件不存在或无法读取时返回 false
+    bool load_file(const fs::path& path) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
+        std::ostringstream text;
+        text << file.rdbuf();
+        add_rules_from(text.str());
+        return true;
+    }
+
+    // 启用后各级目录中的 .gitignore / .treeignore 作为嵌套作用域加载
+    void set_nested(bool enabled);
+    bool nested() const { return _nestedFiles != nullptr; }
+
+    // 常驻进程中复用规则集时，一并保留最近读取的至多 maxDirs 个目录的过滤结果 (0 为关闭)
+    void keep_listings(size_t maxDirs);
+    DirListingCache* listings() const { return _listings.get(); }
+
+    // 本规则集内的判定：无否定规则时返回任一命中，否则返回最后命中的规则
+    uint32_t match_rule(std::wstring_view relPath, std::wstring_view name, bool isDirectory) const {
+        return _matcher.match(relPath, name, isDirectory, _hasNegation);
+    }
+
+    // relPath: 相对扫描根目录的路径 (\ 或 / 分隔)；name: 文件名
+    bool should_ignore(std::wstring_view relPath, std::wstring_view name, bool isDirectory) const {
+        if (g_statsEnabled) return should_ignore_profiled(relPath, name, isDirectory);
+        uint32_t r = match_rule(relPath, name, isDirectory);
+        return r != NO_RULE && !rules[r].negate;
+    }
+
+    // 带作用域链的判定：由内向外，第一个有命中的作用域决定结果 (深层文件的规则相当于追加在后)，都未命中再看全局规则
+    bool should_ignore(const IgnoreScope* scope, std::wstring_view relPath, std::wstring_view name, bool isDirectory) const {
+        for (const IgnoreScope* s = scope; s; s = s->parent.get()) {
+            std::wstring_view sub = s->base.empty() ? relPath : relPath.substr(s->base.size() + 1);
+            uint32_t r = s->rules->match_rule(sub, name, isDirectory);
+            if (r != NO_RULE) return !s->rules->rules[r].negate;
+        }
+        return should_ignore(relPath, name, isDirectory);
+    }
+
+    // 进入目录：目录含嵌套忽略文件 (ignoreFiles 为 IGNORE_FILE_* 组合) 时压入新作用域，否则沿用父作用域
+    IgnoreScopePtr enter_dir(const IgnoreScopePtr& parent, const fs::path& dir, const std::wstring& relDir, uint32_t ignoreFiles) const;
+
+    RuleStage rule_stage(size_t idx) const { return _matcher.stage_of((uint32_t)idx); }
+
+    // 规则的书写形式 (分隔符统一为 /)
+    std::wstring describe_rule(size_t idx) const {
+        const Rule& r = rules[idx];
+        std::wstring s = r.negate ? L"!" : L"";
+        if (r.isRootOnly) s += L'/';
+        s += r.pattern;
+        if (r.onlyDir) s += L'/';
+        std::replace(s.begin(), s.end(), L'\\', L'/');
+        return s;
+    }
+
+private:
+    // 统计探针：阶段耗时与次数记入当前线程，glob 规则逐条计时
+    struct StageProfile {
+        StatsShard& shard;
+        uint64_t last;
+        uint64_t globStart = 0;
+        void stage(RuleStage s) {
+            uint64_t t = now_ns();
+            shard.stageEvals[s]++;
+            shard.stageNs[s] += t - last;
+            last = t;
+        }
+        void glob_begin() { globStart = now_ns(); }
+        void glob_end(uint32_t rule) {
+            uint64_t t = now_ns();
+            shard.rules[rule].evals++;
+            shard.rules[rule].ns += t - globStart;
+            shard.stageEvals[STAGE_GLOB]++;
+            shard.stageNs[STAGE_GLOB] += t - globStart;
+            last = t;
+        }
+    };
+
+    bool should_ignore_profiled(std::wstring_view relPath, std::wstring_view name, bool isDirectory) const {
+        StatsShard& shard = RunStats::instance().local();
+        if (shard.rules.size() < rules.size()) shard.rules.resize(rules.size());
+        uint64_t start = now_ns();
+        uint32_t r = _matcher.match(relPath, name, isDirectory, _hasNegation, StageProfile{ shard, start });
+        if (r != NO_RULE) shard.rules[r].hits++;
+        shard.phaseNs[PHASE_IGNORE] += now_ns() - start;
+        return r != NO_RULE && !rules[r].negate;
+    }
+};
+
+// 嵌套忽略文件的解析缓存：按文件内容共享编译结果，内容相同的文件 (如各子包中雷同的 .gitignore) 只解析一次
+// key 为 .gitignore 内容 + '\0' + .treeignore 内容 (两者语法不同，需分别解析)
+class IgnoreFileCache {
+    std::mutex _mutex;
+    std::unordered_map<std::string, std::shared_ptr<const TreeIgnore>> _sets;
+
+public:
+    std::shared_ptr<const TreeIgnore> get(const std::string& key) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto& slot = _sets[key];
+        if (!slot) {
+            auto set = std::make_shared<TreeIgnore>();
+            size_t split = key.find('\0');
+            set->add_rules_from(std::string_view(key).substr(0, split), true);
+            set->add_rules_from(std::string_view(key).substr(split + 1));
+            slot = std::move(set);
+        }
+        return slot;
+    }
+};
+
+inline void TreeIgnore::set_nested(bool enabled) {
+    _nestedFiles = enabled ? std::make_shared<IgnoreFileCache>() : nullptr;
+}
+
+inline IgnoreScopePtr TreeIgnore::enter_dir(const IgnoreScopePtr& parent, const fs::path& dir, const std::wstring& relDir, uint32_t ignoreFiles) const {
+    if (!_nestedFiles || ignoreFiles == 0) return parent;
+
+    // 同一目录的两个文件合并为一层，.treeignore 在后 (优先)
+    std::string text;
+    auto append = [&](const std::wstring& fileName) {
+        std::ifstream file(dir / fileName, std::ios::binary);
+        if (!file.is_open()) return;
+        std::ostringstream content;
+        content << file.rdbuf();
+        text += content.str();
+    };
+    if (ignoreFiles & IGNORE_FILE_GIT) append(L".gitignore");
+    text += '\0';
+    if (ignoreFiles & IGNORE_FILE_TREE) append(IGNORE_FILENAME);
+
+    std::shared_ptr<const TreeIgnore> set = _nestedFiles->get(text);
+    if (set->rules.empty()) return parent;
+
+    uint64_t key = parent ? parent->key : 14695981039346656037ull;
+    for (unsigned char c : text) key = (key ^ c) * 1099511628211ull;
+    key = (key ^ hash_folded(0, relDir)) * 1099511628211ull;
+    return std::make_shared<IgnoreScope>(IgnoreScope{ std::move(set), relDir, key, parent });
+}
+
+fs::path get_global_ignore_path() {
+#ifdef _WIN32
+    wchar_t path[MAX_PATH];
+    if (SUCCEEDED(SHGetFolderPathW(NULL, CSIDL_PROFILE, NULL, 0, path)))
+        return fs::path(path) / IGNORE_FILENAME;
+#else
+    const char* home = std::getenv("HOME");
+    if (home && *home) return fs::path(home) / IGNORE_FILENAME;
+#endif
+    return {};
+}
+
+void create_ignore_template(const fs::path& path) {
+    std::ofstream out(path);
+    if (out.is_open()) {
+        out << "\xEF\xBB\xBF"; // UTF-8 BOM
+        out << Strings::get(Msg::DEFAULT_TREEIGNORE);
+        out.close();
+        std::cout << Strings::get(Msg::GENERATED_TREEIGNORE) << to_utf8(path_to_wide(path)) << std::endl;
+    }
+}
+
+// ============================================================================
+// [Section 4] 核心业务：树结构递归生成
+// ============================================================================
+
+// ----------------------------------------------------------------------------
+// 目录枚举层：按平台使用批量读取接口，直接从目录项取得类型，避免逐项查询元数据
+// ----------------------------------------------------------------------------
+
+using NativeStringView = std::basic_string_view<fs::path::value_type>;
+
+// 文件的身份：POSIX 为 (st_dev, st_ino)，Windows 为 (卷序列号, 文件索引)；全零表示未知
+struct FileKey {
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+
+    bool known() const { return (dev | ino) != 0; }
+    bool operator==(const FileKey& o) const { return dev == o.dev && ino == o.ino; }
+    bool operator!=(const FileKey& o) const { return !(*this == o); }
+};
+
+// 枚举回调收到的目录项 (name 仅在回调期间有效)
+// isDir 跟随符号链接 (指向目录的链接为 true，isLink 标明其为链接)
+// mtime/size 仅在 Windows 或请求了 withStat 时有效
+// target 为链接目标的身份，取自判断其是否为目录时的 stat (仅 POSIX；Windows 下由 LinkTargets 按需获取)
+struct DirEntryInfo {
+    NativeStringView name;
+    bool isDir;
+    int64_t mtime = 0;
+    uint64_t size = 0;
+    bool isLink = false;
+    FileKey target = {};
+};
+
+inline bool is_dot_or_dotdot(NativeStringView name) {
+    return (name.size() == 1 && name[0] == '.') || (name.size() == 2 && name[0] == '.' && name[1] == '.');
+}
+
+// 枚举回调可返回 bool：false 表示提前结束枚举 (返回 void 的回调总是继续)
+template <class Fn>
+inline bool visit_entry(Fn& fn, const DirEntryInfo& info) {
+    if constexpr (std::is_same_v<std::invoke_result_t<Fn&, const DirEntryInfo&>, bool>) return fn(info);
+    else { fn(info); return true; }
+}
+
+#ifdef _WIN32
+// Windows：FindFirstFileExW + FindExInfoBasic (不取短文件名) + FIND_FIRST_EX_LARGE_FETCH (大缓冲批量返回)
+// 查找数据本身已带修改时间与大小，withStat 无额外开销
+template <class Fn>
+bool enumerate_directory(const wchar_t* dir, Fn&& fn, bool withStat = false) {
+    (void)withStat;
+    thread_local std::wstring pattern;  // 只在打开时使用，回调中递归枚举也不受影响
+    pattern.assign(dir);
+    if (!pattern.empty() && pattern.back() != L'\\' && pattern.back() != L'/') pattern += L'\\';
+    pattern += L'*';
+
+    WIN32_FIND_DATAW data;
+    HANDLE h = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    stat_add(STAT_DIR_OPENS);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    do {
+        NativeStringView name(data.cFileName);
+        if (is_dot_or_dotdot(name)) continue;
+        // 目录联接与目录符号链接同样带有 DIRECTORY 属性，与 fs::is_directory 的跟随语义一致
+        // 其他重解析点 (云文件占位符、重复数据删除等) 不是链接
+        const bool isLink = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0 &&
+                            (data.dwReserved0 == IO_REPARSE_TAG_SYMLINK || data.dwReserved0 == IO_REPARSE_TAG_MOUNT_POINT);
+        const bool more = visit_entry(fn, DirEntryInfo{ name, (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0, file_time_of(data.ftLastWriteTime),
+                                                         ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow, isLink });
+        stat_add(STAT_DIR_READS);
+        if (!more) break;
+    } while (FindNextFileW(h, &data));
+    FindClose(h);
+    return true;
+}
+#else
+// d_type 缺失 (DT_UNKNOWN) 时才回退到 fstatat (不跟随，以识别链接)
+inline unsigned char resolve_type(int dirFd, const char* name, unsigned char type) {
+    if (type != DT_UNKNOWN) return type;
+    struct stat st;
+    stat_add(STAT_STAT_CALLS);
+    if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) return DT_UNKNOWN;
+    return S_ISLNK(st.st_mode) ? DT_LNK : S_ISDIR(st.st_mode) ? DT_DIR : DT_REG;
+}
+
+// 符号链接需跟随到目标以判断是否为目录
+// withStat：逐项 fstatat 取修改时间与大小 (跟随符号链接，失败时取链接自身)，类型也以此为准
+inline DirEntryInfo stat_entry(int dirFd, NativeStringView name, const char* cname, unsigned char type, bool withStat) {
+    type = resolve_type(dirFd, cname, type);
+    DirEntryInfo info{ name, type == DT_DIR };
+    info.isLink = type == DT_LNK;
+    if (!withStat && !info.isLink) return info;
+    struct stat st;
+    stat_add(STAT_STAT_CALLS);
+    if (fstatat(dirFd, cname, &st, 0) != 0 && (!withStat || fstatat(dirFd, cname, &st, AT_SYMLINK_NOFOLLOW) != 0)) return info;
+    info.isDir = S_ISDIR(st.st_mode);
+    if (info.isLink) info.target = FileKey{ (uint64_t)st.st_dev, (uint64_t)st.st_ino };
+    if (withStat) {
+        info.mtime = stat_mtime(st);
+        info.size = (uint64_t)st.st_size;
+    }
+    return info;
+}
+
+#if defined(__linux__)
+// Linux：getdents64 一次读取大批目录项，类型直接取自 d_type
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+
+template <class Fn>
+bool enumerate_directory(const char* dir, Fn&& fn, bool withStat = false) {
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    stat_add(STAT_DIR_OPENS);
+    if (fd < 0) return false;
+
+    // 缓冲按嵌套深度复用：--sort none 流式输出时会在回调中递归枚举子目录
+    constexpr size_t BUF_SIZE = 64 * 1024;
+    thread_local std::vector<std::unique_ptr<char[]>> buffers;
+    thread_local size_t depth = 0;
+    if (buffers.size() <= depth) buffers.emplace_back(new char[BUF_SIZE]);
+    char* buf = buffers[depth].get();
+    // 回调抛出异常时也须恢复深度并关闭 fd，否则本线程 (如 --serve 工作线程) 后续复用缓冲会错位
+    struct Scope {
+        int fd;
+        size_t& depth;
+        Scope(int f, size_t& d) : fd(f), depth(d) { ++depth; }
+        ~Scope() { --depth; close(fd); }
+    } scope(fd, depth);
+    for (bool more = true; more;) {
+        long n = syscall(SYS_getdents64, fd, buf, BUF_SIZE);
+        stat_add(STAT_DIR_READS);
+        if (n <= 0) break;
+        for (long off = 0; off < n && more;) {
+            auto* d = reinterpret_cast<LinuxDirent64*>(buf + off);
+            off += d->d_reclen;
+            NativeStringView name(d->d_name);
+            if (is_dot_or_dotdot(name)) continue;
+            more = visit_entry(fn, stat_entry(fd, name, d->d_name, d->d_type, withStat));
+        }
+    }
+    return true;
+}
+#else
+// 其他 POSIX 系统：readdir 同样提供 d_type
+template <class Fn>
+bool enumerate_directory(const char* dir, Fn&& fn, bool withStat = false) {
+    DIR* d = opendir(dir);
+    stat_add(STAT_DIR_OPENS);
+    if (!d) return false;
+    while (struct dirent* e = readdir(d)) {
+        stat_add(STAT_DIR_READS);
+        NativeStringView name(e->d_name);
+        if (is_dot_or_dotdot(name)) continue;
+        if (!visit_entry(fn, stat_entry(dirfd(d), name, e->d_name, e->d_type, withStat))) break;
+    }
+    closedir(d);
+    return true;
+}
+#endif
+#endif
+
+// dir 为原生路径串 (以 NUL 结尾)；调用方持有复用的路径缓冲时不必为每个目录构造 fs::path
+template <class Fn>
+bool enumerate_directory(const fs::path& dir, Fn&& fn, bool withStat = false) {
+    return enumerate_directory(dir.c_str(), std::forward<Fn>(fn), withStat);
+}
+
+// 原生文件名转宽字符 (Windows 下无需转换)
+inline std::wstring native_to_wide(NativeStringView name) {
+#ifdef _WIN32
+    return std::wstring(name);
+#else
+    return to_wide(name);
+#endif
+}
+
+inline void append_native_wide(std::wstring& out, NativeStringView name) {
+#ifdef _WIN32
+    out += name;
+#else
+    append_wide(out, name);
+#endif
+}
+
+// 树形符号
+const std::wstring U_FOLDER = L"\\";
+const std::wstring U_BRANCH = L"├── ";
+const std::wstring U_LAST = L"└── ";
+const std::wstring U_SPACE = L"    ";
+const std::wstring U_PIPE = L"│   ";
+
+// key 为枚举时一次性生成的排序键 (见 build_sort_key)，按字节比较即为输出顺序
+// mtime/size 为枚举时取得的属性 (仅在 Windows 或枚举时请求了属性时有效)
+// linkShown：未展开的目录链接 (按文件输出，name 附带链接目标，见 --follow-links)
+// isLink：可展开的目录链接，输出方按输出顺序经 claim_link 确认后才展开
+struct TreeEntry { fs::path p; std::wstring name; bool isDir; std::string key; int64_t mtime = 0; uint64_t size = 0; bool linkShown = false; bool isLink = false; FileKey target = {}; };
+
+// 子项相对路径：relDir 为空表示扫描根目录
+std::wstring child_rel_path(const std::wstring& relDir, const std::wstring& name) {
+    return relDir.empty() ? name : relDir + L'\\' + name;
+}
+
+// 原生路径分隔符 (Windows 下 / 与 \ 均可)
+inline bool is_path_separator(fs::path::value_type c) {
+#ifdef _WIN32
+    return c == L'\\' || c == L'/';
+#else
+    return c == '/';
+#endif
+}
+
+// 显示给用户的相对路径 (打包标题、大小排行) 使用本平台的分隔符
+inline std::wstring display_rel_path(std::wstring relPath) {
+#ifndef _WIN32
+    std::replace(relPath.begin(), relPath.end(), L'\\', L'/');
+#endif
+    return relPath;
+}
+
+// 追加一行已编码的树形输出 (含换行)
+void append_tree_line(std::string& out, const std::wstring& prefix, bool isLast, const std::wstring& name, bool isDir) {
+    append_utf8(out, prefix);
+    append_utf8(out, isLast ? U_LAST : U_BRANCH);
+    append_utf8(out, name);
+    if (isDir) append_utf8(out, U_FOLDER);
+    out += LINE_ENDING;
+}
+
+// ----------------------------------------------------------------------------
+// 批量获取文件属性 (--sizes)
+// ----------------------------------------------------------------------------
+
+// 单个目录项的属性 (不跟随符号链接)；ino 仅在硬链接数大于 1 时记录，供统计时去重
+struct EntryMeta {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t dev = 0;
+    uint64_t ino = 0;
+};
+
+#ifdef CTREE_HAVE_IO_URING
+// 只做 statx 的最小 io_uring：直接使用系统调用与共享环形队列 (不依赖 liburing)
+// 每个线程一个实例；一个目录的全部条目分批填入提交队列，每批只需一次 io_uring_enter
+class StatxRing {
+    int _fd = -1;
+    unsigned _entries = 0;
+    void* _sqRing = MAP_FAILED;
+    void* _cqRing = MAP_FAILED;
+    void* _sqeMem = MAP_FAILED;
+    size_t _sqRingSize = 0, _cqRingSize = 0, _sqeSize = 0;
+    unsigned *_sqTail = nullptr, *_sqMask = nullptr, *_sqArray = nullptr;
+    unsigned *_cqHead = nullptr, *_cqTail = nullptr, *_cqMask = nullptr;
+    io_uring_sqe* _sqes = nullptr;
+    io_uring_cqe* _cqes = nullptr;
+    bool _broken = false;
+
+public:
+    StatxRing() = default;
+    StatxRing(const StatxRing&) = delete;
+    StatxRing& operator=(const StatxRing&) = delete;
+
+    ~StatxRing() {
+        if (_sqeMem != MAP_FAILED) munmap(_sqeMem, _sqeSize);
+        if (_cqRing != MAP_FAILED && _cqRing != _sqRing) munmap(_cqRing, _cqRingSize);
+        if (_sqRing != MAP_FAILED) munmap(_sqRing, _sqRingSize);
+        if (_fd >= 0) close(_fd);
+    }
+
+    bool open(unsigned entries) {
+        io_uring_params p;
+        std::memset(&p, 0, sizeof(p));
+        _fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (_fd < 0) return false;
+        _entries = p.sq_entries;
+        _sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        _cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        const bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+        _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+        if (_sqRing == MAP_FAILED) return false;
+        _cqRing = single ? _sqRing : mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cqRing == MAP_FAILED) return false;
+        _sqeSize = p.sq_entries * sizeof(io_uring_sqe);
+        _sqeMem = mmap(nullptr, _sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+        if (_sqeMem == MAP_FAILED) return false;
+
+        char* sq = static_cast<char*>(_sqRing);
+        char* cq = static_cast<char*>(_cqRing);
+        _sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        _sqMask = reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        _sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        _cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        _cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        _cqMask = reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+        _sqes = static_cast<io_uring_sqe*>(_sqeMem);
+        return true;
+    }
+
+    // 对 dirFd 下的 names[0..n) 执行 statx，results[i] 为对应的返回值 (0 或 -errno)
+    // 返回 false 表示队列本身出错 (此后不再使用)，调用方改用 fstatat
+    bool statx_all(int dirFd, const char* const* names, size_t n, struct statx* bufs, int* results) {
+        if (_broken) return false;
+        for (size_t base = 0; base < n; base += _entries) {
+            const unsigned count = (unsigned)std::min<size_t>(_entries, n - base);
+            const unsigned tail = *_sqTail;
+            for (unsigned k = 0; k < count; ++k) {
+                const unsigned idx = (tail + k) & *_sqMask;
+                io_uring_sqe& sqe = _sqes[idx];
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_STATX;
+                sqe.fd = dirFd;
+                sqe.addr = (uint64_t)(uintptr_t)names[base + k];
+                sqe.len = STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_MTIME;
+                sqe.off = (uint64_t)(uintptr_t)&bufs[base + k];
+                sqe.statx_flags = AT_SYMLINK_NOFOLLOW;
+                sqe.user_data = base + k;
+                _sqArray[idx] = idx;
+            }
+            __atomic_store_n(_sqTail, tail + count, __ATOMIC_RELEASE);
+
+            unsigned submitted = 0, done = 0;
+            while (done < count) {
+                long r = syscall(__NR_io_uring_enter, _fd, count - submitted, count - done, IORING_ENTER_GETEVENTS, nullptr, 0);
+                stat_add(STAT_URING_SUBMITS);
+                if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) { _broken = true; return false; }
+                if (r > 0) submitted += (unsigned)r;
+                unsigned head = *_cqHead;
+                const unsigned cqTail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+                for (; head != cqTail; ++head, ++done) {
+                    const io_uring_cqe& cqe = _cqes[head & *_cqMask];
+                    results[cqe.user_data] = cqe.res;
+                }
+                __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+            }
+        }
+        return true;
+    }
+};
+
+// 每个线程首次使用时建立队列；内核不支持 (或被容器禁止) 时全局关闭，之后直接走 fstatat
+inline std::atomic<bool> g_uringDisabled{ false };
+
+inline StatxRing* thread_statx_ring() {
+    if (g_uringDisabled.load(std::memory_order_relaxed)) return nullptr;
+    thread_local std::unique_ptr<StatxRing> ring;
+    thread_local bool tried = false;
+    if (!tried) {
+        tried = true;
+        auto r = std::make_unique<StatxRing>();
+        if (r->open(256)) ring = std::move(r);
+        else g_uringDisabled.store(true, std::memory_order_relaxed);
+    }
+    return ring.get();
+}
+#endif
+
+// 批量取 entries 的属性 (meta 与 entries 一一对应)
+// Windows 直接沿用枚举时查找数据中的大小与时间 (不提供硬链接信息)
+// Linux 通过 io_uring 批量提交 statx，不可用或单项失败时改用 fstatat；其他 POSIX 系统逐项 fstatat
+void fetch_metadata(const fs::path& dir, const std::vector<TreeEntry>& entries, std::vector<EntryMeta>& meta) {
+    meta.assign(entries.size(), EntryMeta{});
+#ifdef _WIN32
+    (void)dir;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        meta[i].size = entries[i].isDir ? 0 : entries[i].size;
+        meta[i].mtime = entries[i].mtime;
+    }
+#else
+    if (entries.empty()) return;
+    int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    stat_add(STAT_DIR_OPENS);
+    if (dirFd < 0) return;
+
+    // 条目名取自完整路径的最后一段 (以 NUL 结尾，可直接交给系统调用)
+    std::vector<const char*> names(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const std::string& full = entries[i].p.native();
+        names[i] = full.c_str() + full.rfind('/') + 1;
+    }
+    std::vector<char> fallback(entries.size(), 1);
+
+#ifdef CTREE_HAVE_IO_URING
+    if (StatxRing* ring = thread_statx_ring()) {
+        thread_local std::vector<struct statx> bufs;
+        thread_local std::vector<int> results;
+        bufs.resize(entries.size());
+        results.assign(entries.size(), -EINVAL);
+        if (ring->statx_all(dirFd, names.data(), names.size(), bufs.data(), results.data())) {
+            stat_add(STAT_STAT_CALLS, entries.size());
+            for (size_t i = 0; i < entries.size(); ++i) {
+                if (results[i] < 0) continue;
+                const struct statx& sx = bufs[i];
+                EntryMeta& m = meta[i];
+                m.size = S_ISDIR(sx.stx_mode) ? 0 : sx.stx_size;
+                m.mtime = (int64_t)sx.stx_mtime.tv_sec * FILE_TIME_TICKS_PER_SEC + sx.stx_mtime.tv_nsec;
+                if (sx.stx_nlink > 1) { m.dev = ((uint64_t)sx.stx_dev_major << 32) | sx.stx_dev_minor; m.ino = sx.stx_ino; }
+                fallback[i] = 0;
+            }
+        }
+    }
+#endif
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!fallback[i]) continue;
+        struct stat st;
+        stat_add(STAT_STAT_CALLS);
+        if (fstatat(dirFd, names[i], &st, AT_SYMLINK_NOFOLLOW) != 0) continue;
+        EntryMeta& m = meta[i];
+        m.size = S_ISDIR(st.st_mode) ? 0 : (uint64_t)st.st_size;
+        m.mtime = stat_mtime(st);
+        if (st.st_nlink > 1) { m.dev = (uint64_t)st.st_dev; m.ino = (uint64_t)st.st_ino; }
+    }
+    close(dirFd);
+#endif
+}
+
+// ----------------------------------------------------------------------------
+// 输出限制 (--max-depth / --max-entries-per-dir / --max-lines)
+// ----------------------------------------------------------------------------
+
+// 0 表示不限制；运行前设置一次，遍历期间只读
+// 按线程保存：--serve 下各请求的限制互不影响，线程池的工作线程继承创建者的设置
+struct TreeLimits {
+    size_t maxDepth = 0;    // 第 1 层为扫描根目录的直接子项
+    size_t maxEntries = 0;  // 每个目录最多列出的条目数
+    size_t maxLines = 0;    // 树形部分的总行数 (不含根目录行)
+};
+inline thread_local TreeLimits g_limits;
+
+// --max-lines 的剩余行数 (仅单线程遍历使用)；用尽后遍历立即结束
+struct LineBudget {
+    size_t left;
+    bool truncated = false;
+
+    bool take() {
+        if (left == 0) { truncated = true; return false; }
+        --left;
+        return true;
+    }
+};
+
+// 第 depth 层条目 (扫描根目录的直接子项为第 1 层) 中的目录是否继续展开
+inline bool expand_at_depth(size_t depth) {
+    return g_limits.maxDepth == 0 || depth < g_limits.maxDepth;
+}
+
+// relDir 所在目录的子项是否继续展开
+inline bool expand_children(const std::wstring& relDir) {
+    if (g_limits.maxDepth == 0) return true;
+    return expand_at_depth(relDir.empty() ? 1 : (size_t)std::count(relDir.begin(), relDir.end(), L'\\') + 2);
+}
+
+// 单个目录最多需要保留的条目数 (0 为不限)：受每目录上限与剩余行数共同约束
+inline size_t entry_limit(const LineBudget* budget) {
+    size_t limit = g_limits.maxEntries ? g_limits.maxEntries : SIZE_MAX;
+    if (budget) limit = std::min(limit, std::max<size_t>(budget->left, 1));
+    return limit == SIZE_MAX ? 0 : limit;
+}
+
+// 198734 -> "198,734"
+inline std::wstring group_thousands(size_t n) {
+    std::wstring digits = std::to_wstring(n), out;
+    for (size_t i = 0; i < digits.size(); ++i) {
+        if (i > 0 && (digits.size() - i) % 3 == 0) out += L',';
+        out += digits[i];
+    }
+    return out;
+}
+
+// 目录被截断时的末行文字："… and 198,734 more entries" (被省略的也可能是目录)
+inline std::string more_entries_text(size_t omitted) {
+    std::string out(Strings::get(Msg::MORE_ENTRIES));
+    append_utf8(out, group_thousands(omitted));
+    out += Strings::get(omitted == 1 ? Msg::MORE_ENTRIES_ONE : Msg::MORE_ENTRIES_TAIL);
+    return out;
+}
+
+void append_more_line(std::string& out, const std::wstring& prefix, size_t omitted) {
+    append_utf8(out, prefix);
+    append_utf8(out, U_LAST);
+    out += more_entries_text(omitted);
+    out += LINE_ENDING;
+}
+
+// ----------------------------------------------------------------------------
+// 符号链接 (--follow-links)
+// ----------------------------------------------------------------------------
+
+// 指向目录的符号链接 (Windows 下含目录联接) 是否展开：
+//   never：一律不展开
+//   safe (默认)：只展开目标在扫描目录之外的链接，每个目标至多展开一次
+//     链接文本按词法落在扫描目录之内的不展开，其目标已按真实位置列出 (只看文本，不逐段解析真实路径)
+//     目标按 (dev, ino) 识别：指向扫描根目录或已展开目标的链接按链接输出，多个链接指向同一目标时只在输出顺序中的第一个处展开 (见 LinkTargets)
+//     因此不会成环，读取的目录数以不同目录的个数为上限；多线程遍历在串行输出阶段决定展开与否，输出仍与单线程一致
+//   always：展开所有链接，同一目标可重复展开；链接的目标为扫描根目录、或回到本分支上已展开链接的目标 (自身的祖先) 时不再展开
+//     指向真实祖先目录的链接因此最多重复一层即停止，不会无限成环
+// 未展开的链接按文件输出为 "名称 -> 目标"；与 g_sortMode 一样按线程保存
+enum LinkPolicy { LINKS_NEVER, LINKS_SAFE, LINKS_ALWAYS };
+inline thread_local LinkPolicy g_linkPolicy = LINKS_SAFE;
+
+bool parse_link_policy(const std::wstring& s, LinkPolicy& policy) {
+    static const std::pair<const wchar_t*, LinkPolicy> names[] = {
+        { L"never", LINKS_NEVER }, { L"safe", LINKS_SAFE }, { L"always", LINKS_ALWAYS },
+    };
+    for (const auto& [name, p] : names) {
+        if (s == name) { policy = p; return true; }
+    }
+    return false;
+}
+
+// 路径 (跟随链接) 所指文件的身份；失败时返回 false
+inline bool file_key_of(const fs::path& p, FileKey& key) {
+#ifdef _WIN32
+    HANDLE h = CreateFileW(p.c_str(), FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING,
+                           FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    BY_HANDLE_FILE_INFORMATION info;
+    const bool ok = GetFileInformationByHandle(h, &info) != 0;
+    CloseHandle(h);
+    if (!ok) return false;
+    key = FileKey{ info.dwVolumeSerialNumber, ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow };
+#else
+    struct stat st;
+    stat_add(STAT_STAT_CALLS);
+    if (stat(p.c_str(), &st) != 0) return false;
+    key = FileKey{ (uint64_t)st.st_dev, (uint64_t)st.st_ino };
+#endif
+    return true;
+}
+
+// 读取链接文本到复用缓冲；失败时返回 false
+inline bool read_link_text(const fs::path::value_type* link, std::basic_string<fs::path::value_type>& out) {
+#ifdef _WIN32
+    std::error_code ec;
+    fs::path target = fs::read_symlink(link, ec);
+    if (ec) return false;
+    out = target.native();
+    return true;
+#else
+    if (out.size() < 256) out.resize(256);
+    for (;;) {
+        const ssize_t n = readlink(link, out.data(), out.size());
+        if (n < 0) return false;
+        if ((size_t)n < out.size()) {
+            out.resize((size_t)n);
+            return true;
+        }
+        out.resize(out.size() * 2);
+    }
+#endif
+}
+
+inline bool is_absolute_text(NativeStringView text) {
+#ifdef _WIN32
+    if (text.size() > 1 && text[1] == L':') return true;
+#endif
+    return !text.empty() && is_path_separator(text[0]);
+}
+
+// 相对路径文本按词法逐段解析后是否仍在起点 depth 层之下的目录内 (不低于第 0 层)
+inline bool lexically_below(NativeStringView text, size_t depth) {
+    for (size_t i = 0; i <= text.size();) {
+        size_t j = i;
+        while (j < text.size() && !is_path_separator(text[j])) ++j;
+        const NativeStringView part = text.substr(i, j - i);
+        if (part.size() == 2 && part[0] == '.' && part[1] == '.') {
+            if (depth == 0) return false;
+            --depth;
+        }
+        else if (!part.empty() && !(part.size() == 1 && part[0] == '.')) {
+            ++depth;
+        }
+        i = j + 1;
+    }
+    return true;
+}
+
+// 开放寻址散列表 (线性探测，容量为 2 的幂，装载不超过一半)；Key{} 用作空槽标记，不能作为键
+template <class Key, class Value, class Hash>
+class OpenAddressMap {
+    struct Slot {
+        Key key{};
+        Value value{};
+    };
+    std::vector<Slot> _slots;
+    size_t _count = 0;
+
+    size_t mask() const { return _slots.size() - 1; }
+
+    void grow() {
+        std::vector<Slot> old(_slots.empty() ? 64 : _slots.size() * 2);
+        old.swap(_slots);
+        for (const Slot& s : old) {
+            if (s.key == Key{}) continue;
+            size_t i = Hash()(s.key) & mask();
+            while (!(_slots[i].key == Key{})) i = (i + 1) & mask();
+            _slots[i] = s;
+        }
+    }
+
+public:
+    const Value* find(const Key& key) const {
+        if (_slots.empty()) return nullptr;
+        for (size_t i = Hash()(key) & mask(); !(_slots[i].key == Key{}); i = (i + 1) & mask()) {
+            if (_slots[i].key == key) return &_slots[i].value;
+        }
+        return nullptr;
+    }
+
+    // 键不存在时插入并返回 true；已存在时保持原值并返回 false
+    bool insert(const Key& key, const Value& value) {
+        if ((_count + 1) * 2 > _slots.size()) grow();
+        size_t i = Hash()(key) & mask();
+        for (; !(_slots[i].key == Key{}); i = (i + 1) & mask()) {
+            if (_slots[i].key == key) return false;
+        }
+        _slots[i] = Slot{ key, value };
+        ++_count;
+        return true;
+    }
+};
+
+struct FileKeyHash {
+    size_t operator()(const FileKey& k) const {
+        const uint64_t h = (k.ino ^ (k.dev << 32 | k.dev >> 32)) * 0x9E3779B97F4A7C15ull;
+        return (size_t)(h ^ (h >> 32));
+    }
+};
+
+// 路径串的散列已足够分散，直接作为槽位下标 (0 保留为空槽标记)
+struct PathHash {
+    size_t operator()(size_t h) const { return h; }
+    static size_t of(NativeStringView path) { return std::max<size_t>(std::hash<NativeStringView>()(path), 1); }
+};
+
+// 一次遍历的目录链接状态：扫描根目录的身份在开始时取一次，各目录的判定 (DirLinkCheck) 共用
+// 目标身份取自枚举时判断链接是否指向目录的那次 stat，没有时 (Windows、复用的列表) 才另取一次
+// 已展开的链接按其路径的散列记录：经由它到达的链接路径以它为前缀，逐个前缀查表即得出链接所在的分支
+//   safe：同一目标只展开一次，claim 按输出顺序调用，目标第一次出现时才展开，其余链接按 "名称 -> 目标" 输出；经由链接到达的链接不再展开
+//   always：允许重复展开，但目标为扫描根目录、或与本分支上某个已展开链接的目标相同 (回到自身的祖先) 时停止
+// root_path() 可由多个读取线程共享；claim 只在产生输出的线程上调用 (多线程遍历的串行拼接阶段)
+// 先读取后输出的模式 (--sizes、--diff、--cache、--watch、预算扫描) 按各自确定的读取顺序确认
+class LinkTargets {
+    LinkPolicy _policy;
+    FileKey _root;                                      // 扫描根目录的身份 (获取失败时未知，safe 模式不展开任何链接)
+    std::basic_string<fs::path::value_type> _rootPath;  // 扫描根目录的原生路径 (DirLinkCheck 据此得出目录深度)
+    std::basic_string<fs::path::value_type> _absRoot, _realRoot;  // 扫描根目录的绝对路径与真实路径 (比对绝对路径的链接文本)
+    OpenAddressMap<FileKey, bool, FileKeyHash> _expanded;  // safe：已展开的目标
+    OpenAddressMap<size_t, FileKey, PathHash> _links;      // 已展开的链接 (路径的散列) -> 其目标
+
+    static std::basic_string<fs::path::value_type> without_trailing_separator(const fs::path& p) {
+        std::basic_string<fs::path::value_type> s = p.native();
+        while (s.size() > 1 && is_path_separator(s.back())) s.pop_back();
+        return s;
+    }
+
+public:
+    explicit LinkTargets(const fs::path& root, LinkPolicy policy = g_linkPolicy) : _policy(policy), _rootPath(root.native()) {
+        if (policy == LINKS_NEVER || !file_key_of(root, _root) || policy != LINKS_SAFE) return;
+        std::error_code ec;
+        _absRoot = without_trailing_separator(fs::absolute(root, ec).lexically_normal());
+        _realRoot = without_trailing_separator(fs::canonical(root, ec));
+    }
+
+    LinkPolicy policy() const { return _policy; }
+    bool root_known() const { return _root.known(); }
+    NativeStringView root_path() const { return _rootPath; }
+
+    // 链接文本按词法解析后是否落在扫描目录之内 (depth 为链接所在目录在扫描目录下的层数)
+    // 只看文本、不跟随其中的链接：判为在内时按链接输出 (保守)，判为在外的由 claim 按目标身份去重
+    bool text_inside(NativeStringView text, size_t depth) const {
+        if (!is_absolute_text(text)) return lexically_below(text, depth);
+        for (NativeStringView root : { NativeStringView(_absRoot), NativeStringView(_realRoot) }) {
+            if (root.empty() || text.substr(0, root.size()) != root) continue;
+            if (text.size() == root.size() || is_path_separator(text[root.size()]) || is_path_separator(root.back())) {
+                return lexically_below(text.substr(root.size()), 0);
+            }
+        }
+        return false;
+    }
+
+    // link 为可展开的链接 (见 DirLinkCheck)，target 为其目标身份 (未知时按路径获取)；返回是否展开
+    // 同一链接再次确认 (--watch 重新读取) 时沿用上次的结果
+    bool claim(const fs::path& link, FileKey target = {}) {
+        if (_policy == LINKS_NEVER) return false;
+        if (!target.known() && !file_key_of(link, target)) return false;
+        if (target == _root) return false;
+        const NativeStringView path = link.native();
+        const size_t self = PathHash::of(path);
+        if (const FileKey* t = _links.find(self)) return *t == target;
+        for (size_t i = path.size(); i-- > _rootPath.size();) {
+            if (!is_path_separator(path[i])) continue;
+            const FileKey* t = _links.find(PathHash::of(path.substr(0, i)));
+            if (t && (_policy == LINKS_SAFE || *t == target)) return false;
+        }
+        if (_policy == LINKS_SAFE && !_expanded.insert(target, true)) return false;
+        _links.insert(self, target);
+        return true;
+    }
+};
+
+// 逐目录判定其中的目录链接是否可展开；safe 模式下首次遇到链接时才计算本目录在扫描目录下的深度
+// 不含链接的目录 (绝大多数) 没有任何额外开销；没有遍历状态 (targets 为空) 时 safe 模式不展开链接
+class DirLinkCheck {
+    NativeStringView _dir;
+    const LinkTargets* _targets;
+    size_t _depth = 0;
+    int _inTree = -1;   // 本目录路径是否以扫描根目录开头 (-1 为尚未计算)
+    std::basic_string<fs::path::value_type> _link, _text;
+
+    void locate() {
+        const NativeStringView root = _targets->root_path();
+        _inTree = _dir.substr(0, root.size()) == root;
+        if (!_inTree) return;
+        const NativeStringView rest = _dir.substr(root.size());
+        for (size_t i = 0; i < rest.size();) {
+            size_t j = i;
+            while (j < rest.size() && !is_path_separator(rest[j])) ++j;
+            const NativeStringView part = rest.substr(i, j - i);
+            if (!part.empty() && !(part.size() == 1 && part[0] == '.')) ++_depth;
+            i = j + 1;
+        }
+    }
+
+public:
+    DirLinkCheck(NativeStringView dir, const LinkTargets* targets) : _dir(dir), _targets(targets) {}
+
+    bool follow(NativeStringView name) {
+        const LinkPolicy policy = _targets ? _targets->policy() : g_linkPolicy;
+        if (policy != LINKS_SAFE) return policy == LINKS_ALWAYS;
+        if (!_targets || !_targets->root_known()) return false;
+        if (_inTree < 0) locate();
+        if (!_inTree) return true;
+        _link.assign(_dir);
+        if (!_link.empty() && !is_path_separator(_link.back())) _link += fs::path::preferred_separator;
+        _link += name;
+        return !read_link_text(_link.c_str(), _text) || !_targets->text_inside(_text, _depth);
+    }
+};
+
+// 未展开的链接在名称后附加的文字：" -> 目标" (目标无法读取时只有箭头)
+inline std::wstring link_suffix(const fs::path& link) {
+    stat_add(STAT_LINKS_SKIPPED);
+    std::error_code ec;
+    fs::path target = fs::read_symlink(link, ec);
+    if (ec) target = fs::canonical(link, ec);
+    return ec ? std::wstring(L" -> ") : L" -> " + path_to_wide(target);
+}
+
+// 未展开的目录链接：按文件输出，名称后附链接目标 (排序键仍按目录生成，位置与展开时相同)
+inline void mark_unfollowed_link(TreeEntry& e, const fs::path& link) {
+    e.isDir = false;
+    e.isLink = false;
+    e.linkShown = true;
+    e.name += link_suffix(link);
+}
+
+// 按输出顺序遇到条目 e 时调用 (link 为其完整路径)：可展开的链接若目标已由前面的链接展开，改按链接输出
+inline void claim_link(TreeEntry& e, const fs::path& link, LinkTargets& targets) {
+    if (e.isLink && !targets.claim(link, e.target)) mark_unfollowed_link(e, link);
+}
+
+// ----------------------------------------------------------------------------
+// 排序 (--sort)
+// ----------------------------------------------------------------------------
+
+// 所有模式均目录优先；SORT_NONE 保持枚举顺序
+// 与 g_limits 一样按线程保存
+enum SortMode { SORT_NAME, SORT_NATURAL, SORT_ICASE, SORT_MTIME, SORT_SIZE, SORT_NONE };
+inline thread_local SortMode g_sortMode = SORT_NAME;
+
+// 按修改时间/大小排序时枚举需要额外取文件属性
+inline bool sort_needs_stat() { return g_sortMode == SORT_MTIME || g_sortMode == SORT_SIZE; }
+
+bool parse_sort_mode(const std::wstring& s, SortMode& mode) {
+    static const std::pair<const wchar_t*, SortMode> names[] = {
+        { L"name", SORT_NAME }, { L"natural", SORT_NATURAL }, { L"icase", SORT_ICASE },
+        { L"mtime", SORT_MTIME }, { L"size", SORT_SIZE }, { L"none", SORT_NONE },
+    };
+    for (const auto& [name, m] : names) {
+        if (s == name) { mode = m; return true; }
+    }
+    return false;
+}
+
+// 保序变长编码：与 UTF-8 同构，编码后的字节序与码元数值序一致
+inline void append_ordered(std::string& key, uint32_t c) {
+    if (c < 0x80) key += (char)c;
+    else if (c < 0x800) {
+        key += (char)(0xC0 | (c >> 6));
+        key += (char)(0x80 | (c & 0x3F));
+    }
+    else if (c < 0x10000) {
+        key += (char)(0xE0 | (c >> 12));
+        key += (char)(0x80 | ((c >> 6) & 0x3F));
+        key += (char)(0x80 | (c & 0x3F));
+    }
+    else {
+        key += (char)(0xF0 | (c >> 18));
+        key += (char)(0x80 | ((c >> 12) & 0x3F));
+        key += (char)(0x80 | ((c >> 6) & 0x3F));
+        key += (char)(0x80 | (c & 0x3F));
+    }
+}
+
+inline void append_be64(std::string& key, uint64_t v) {
+    for (int shift = 56; shift >= 0; shift -= 8) key += (char)(v >> shift);
+}
+
+// 与 fold_char 相同但不区分平台；C locale 下 towlower 不处理非 ASCII 字符，Latin-1 大写字母单独折叠
+inline wchar_t fold_case(wchar_t c) {
+    if (c < 0x80) return (c >= L'A' && c <= L'Z') ? (wchar_t)(c + 32) : c;
+    if (c >= 0xC0 && c <= 0xDE && c != 0xD7) return (wchar_t)(c + 32);
+    return (wchar_t)std::towlower((wint_t)c);
+}
+
+// 排序键：首字节区分目录/文件，其后按模式拼接，字节序比较即得最终顺序
+//   name           原始码元
+//   icase/natural  折叠大小写后的主键 + 0x00 + 原始码元 (主键相同时按原名稳定区分)
+//                  natural 下连续数字编码为 '0' + 有效位数 + 去前导零的数字，使数值小者靠前
+//   mtime/size     8 字节大端 (取反使新/大者靠前) + 原始码元；目录不参与大小比较
+// mode 默认取 --sort；库接口按每次遍历的选项传入
+void build_sort_key(std::string& key, const std::wstring& name, bool isDir, int64_t mtime, uint64_t size, SortMode mode = g_sortMode) {
+    key.clear();
+    key.reserve(name.size() * 2 + 10);
+    key += isDir ? '\0' : '\1';
+    switch (mode) {
+    case SORT_NATURAL:
+    case SORT_ICASE:
+        for (size_t i = 0; i < name.size();) {
+            wchar_t c = name[i];
+            if (mode == SORT_NATURAL && c >= L'0' && c <= L'9') {
+                while (i < name.size() && name[i] == L'0') ++i;
+                size_t digits = i;
+                while (digits < name.size() && name[digits] >= L'0' && name[digits] <= L'9') ++digits;
+                key += '0';
+                append_ordered(key, (uint32_t)(digits - i));
+                for (; i < digits; ++i) key += (char)name[i];
+                continue;
+            }
+            append_ordered(key, (uint32_t)fold_case(c));
+            ++i;
+        }
+        key += '\0';
+        break;
+    case SORT_MTIME:
+        append_be64(key, ~((uint64_t)mtime ^ (1ull << 63)));
+        break;
+    case SORT_SIZE:
+        append_be64(key, isDir ? ~0ull : ~size);
+        break;
+    default:
+        break;
+    }
+    for (wchar_t c : name) append_ordered(key, (uint32_t)c);
+}
+
+inline TreeEntry make_entry(fs::path p, std::wstring name, bool isDir, int64_t mtime = 0, uint64_t size = 0) {
+    TreeEntry e{ std::move(p), std::move(name), isDir, {}, mtime, size };
+    build_sort_key(e.key, e.name, isDir, mtime, size);
+    return e;
+}
+
+inline bool entry_before(const TreeEntry& a, const TreeEntry& b) {
+    return a.key < b.key;
+}
+
+// 键自 offset 起的 8 字节 (大端，不足补零)；绝大多数比较只需比较该整数
+inline uint64_t key_head(std::string_view key, size_t offset = 0) {
+    uint64_t h = 0;
+    size_t n = key.size() > offset ? std::min<size_t>(key.size() - offset, 8) : 0;
+    for (size_t i = 0; i < n; ++i) h |= (uint64_t)(unsigned char)key[offset + i] << (56 - 8 * i);
+    return h;
+}
+
+struct SortSlot { uint64_t head; uint32_t idx; };
+
+// 按键头排序 slots：条目较多时用 LSD 基数排序 (跳过所有键头都相同的字节)；
+// 键头相同的区间取下一个 8 字节窗口继续排序 (如 --sort size 下大小相同的文件)，区间较小时直接比较完整键
+// key_of(idx) 返回第 idx 项的排序键 (std::string_view)
+template <class KeyOf>
+void sort_slots(const KeyOf& key_of, SortSlot* slots, size_t n, size_t offset, std::vector<SortSlot>& tmp) {
+    if (n < 256) {
+        std::sort(slots, slots + n, [](const SortSlot& a, const SortSlot& b) { return a.head < b.head; });
+    }
+    else {
+        uint32_t counts[8][256] = {};
+        for (size_t i = 0; i < n; ++i) {
+            for (int b = 0; b < 8; ++b) ++counts[b][(slots[i].head >> (8 * b)) & 0xFF];
+        }
+        tmp.resize(std::max(tmp.size(), n));
+        SortSlot* src = slots;
+        SortSlot* dst = tmp.data();
+        for (int b = 0; b < 8; ++b) {
+            uint32_t* c = counts[b];
+            if (c[(src[0].head >> (8 * b)) & 0xFF] == n) continue;
+            uint32_t sum = 0;
+            for (int v = 0; v < 256; ++v) { uint32_t k = c[v]; c[v] = sum; sum += k; }
+            for (size_t i = 0; i < n; ++i) dst[c[(src[i].head >> (8 * b)) & 0xFF]++] = src[i];
+            std::swap(src, dst);
+        }
+        if (src != slots) std::copy(src, src + n, slots);
+    }
+
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && slots[j].head == slots[i].head) ++j;
+        SortSlot* run = slots + i;
+        const size_t len = j - i;
+        bool longer = false;
+        for (size_t k = 0; k < len && !longer; ++k) longer = key_of(run[k].idx).size() > offset + 8;
+        if (len >= 16 && longer) {
+            for (size_t k = 0; k < len; ++k) run[k].head = key_head(key_of(run[k].idx), offset + 8);
+            sort_slots(key_of, run, len, offset + 8, tmp);
+        }
+        else if (len > 1) {
+            std::sort(run, run + len, [&](const SortSlot& a, const SortSlot& b) { return key_of(a.idx) < key_of(b.idx); });
+        }
+        i = j;
+    }
+}
+
+// 只对 16 字节的 (键头, 下标) 数组排序，最后沿置换环原地搬移条目 (每项只移动一次，无需第二份列表)
+void sort_entries(std::vector<TreeEntry>& entries) {
+    if (g_sortMode == SORT_NONE || entries.size() < 2) return;
+    const size_t n = entries.size();
+    std::vector<SortSlot> slots(n), tmp;
+    for (size_t i = 0; i < n; ++i) slots[i] = SortSlot{ key_head(entries[i].key), (uint32_t)i };
+    sort_slots([&](uint32_t i) { return std::string_view(entries[i].key); }, slots.data(), n, 0, tmp);
+
+    for (size_t i = 0; i < n; ++i) {
+        if (slots[i].idx == i) continue;
+        TreeEntry held = std::move(entries[i]);
+        size_t j = i;
+        for (size_t from = slots[j].idx; from != i; from = slots[j].idx) {
+            entries[j] = std::move(entries[from]);
+            slots[j].idx = (uint32_t)j;
+            j = from;
+        }
+        entries[j] = std::move(held);
+        slots[j].idx = (uint32_t)j;
+    }
+}
+
+// 嵌套忽略文件识别：返回 IGNORE_FILE_* 或 0 (Windows 下文件名不区分大小写)
+// 两个文件名都是 ASCII，逐个编码单元比较即可，不必转码 (非 ASCII 字节不可能匹配)
+inline uint32_t nested_ignore_file(NativeStringView name, bool atRoot) {
+    if (name.size() != 10 && name.size() != 11) return 0;
+    wchar_t buf[11];
+    for (size_t i = 0; i < name.size(); ++i) buf[i] = (wchar_t)(std::make_unsigned_t<fs::path::value_type>)name[i];
+    const std::wstring_view wide(buf, name.size());
+    if (equals_folded(wide, L".gitignore")) return IGNORE_FILE_GIT;
+    if (!atRoot && equals_folded(wide, IGNORE_FILENAME)) return IGNORE_FILE_TREE;
+    return 0;
+}
+
+// 目录扫描上下文
+struct DirScan {
+    IgnoreScopePtr scope;      // 入参为父目录的作用域，返回后为本目录的作用域 (供子目录继承)
+    uint32_t ignoreFiles = 0;  // 本目录出现的嵌套忽略文件 (IGNORE_FILE_* 组合)
+    size_t limit = 0;          // 只保留排序最靠前的 limit 项 (0 为不限)
+    size_t omitted = 0;        // 因 limit 未保留的条目数
+    bool deferStat = false;    // 属性由调用方批量获取 (--sizes)，枚举时不逐项 stat
+    bool namesOnly = false;    // 条目的 p 只保存文件名，完整路径由调用方拼接 (避免每项解析一条长路径)
+    bool withStat = false;     // 即使排序不需要也在枚举时取属性 (--diff 比较大小)
+    const std::atomic<bool>* cancel = nullptr;  // 置位后停止枚举尽快返回，结果不完整 (--time-budget 到期)
+    const LinkTargets* links = nullptr;         // 本次遍历的链接状态 (为空时 safe 模式不展开链接)
+};
+
+// 读取单个目录：枚举 + 忽略过滤 + 排序 (顺序由 --sort 决定)
+// relDir 为该目录相对扫描根目录的路径，逐项拼接到复用缓冲中交给忽略规则匹配
+// scan 非空且启用了嵌套忽略时，先完整枚举本目录以找出其中的忽略文件，压入作用域后再过滤
+// scan->limit 非零时用大小为 limit 的堆做部分选择：其余条目只计数不保存，内存与排序开销只取决于上限
+// (--sort none 下直接保留先枚举到的 limit 项)
+std::vector<TreeEntry> read_entries(const fs::path& path, const std::wstring& relDir, const TreeIgnore& ignore, DirScan* scan = nullptr) {
+    std::vector<TreeEntry> entries;
+    const size_t limit = scan ? scan->limit : 0;
+    const bool sorted = g_sortMode != SORT_NONE;
+    const bool withStat = (sort_needs_stat() || (scan && scan->withStat)) && !(scan && scan->deferStat);
+    entries.reserve(limit ? std::min<size_t>(limit, 50) : 50);
+    if (scan) scan->omitted = 0;
+    auto cancelled = [&] { return scan && scan->cancel && scan->cancel->load(std::memory_order_relaxed); };
+
+    // 堆顶为已保留条目中排序最靠后者，新条目不比它靠前时只计数
+    std::string key;
+    const bool namesOnly = scan && scan->namesOnly;
+    auto entry_path = [&](NativeStringView native) { return namesOnly ? fs::path(native) : path / native; };
+    DirLinkCheck links(path.native(), scan ? scan->links : nullptr);
+    auto check_link = [&](TreeEntry& e, NativeStringView native, const DirEntryInfo& info) {
+        if (!info.isLink || !info.isDir) return;
+        if (links.follow(native)) {
+            e.isLink = true;
+            e.target = info.target;
+        }
+        else mark_unfollowed_link(e, path / native);
+    };
+    auto accept = [&](NativeStringView native, std::wstring&& name, const DirEntryInfo& info) {
+        if (limit && entries.size() == limit) {
+            ++scan->omitted;
+            if (!sorted) return;
+            build_sort_key(key, name, info.isDir, info.mtime, info.size);
+            if (!(key < entries.front().key)) return;
+            std::pop_heap(entries.begin(), entries.end(), entry_before);
+            entries.back() = TreeEntry{ entry_path(native), std::move(name), info.isDir, std::move(key), info.mtime, info.size };
+            check_link(entries.back(), native, info);
+            std::push_heap(entries.begin(), entries.end(), entry_before);
+            return;
+        }
+        entries.push_back(make_entry(entry_path(native), std::move(name), info.isDir, info.mtime, info.size));
+        check_link(entries.back(), native, info);
+        if (sorted && limit && entries.size() == limit) std::make_heap(entries.begin(), entries.end(), entry_before);
+    };
+
+    std::wstring relPath = relDir;
+    if (!relPath.empty()) relPath += L'\\';
+    const size_t base = relPath.size();
+    const bool checkExcluded = ignore.has_excluded_in(relDir);
+
+    stat_add(STAT_DIRS);
+    if (scan && ignore.nested()) {
+        ScopedPhase phase(PHASE_ENUMERATE);
+        std::vector<std::pair<std::basic_string<fs::path::value_type>, DirEntryInfo>> raw;
+        scan->ignoreFiles = 0;
+        enumerate_directory(path, [&](const DirEntryInfo& e) {
+            if (cancelled()) return false;
+            stat_add(STAT_ENTRIES);
+            if (!e.isDir) scan->ignoreFiles |= nested_ignore_file(e.name, relDir.empty());
+            raw.emplace_back(e.name, e);
+            return true;
+        }, withStat);
+        scan->scope = ignore.enter_dir(scan->scope, path, relDir, scan->ignoreFiles);
+        for (auto& [native, info] : raw) {
+            if (cancelled()) break;
+            std::wstring name = native_to_wide(native);
+            if (checkExcluded && !info.isDir && ignore.is_excluded(relDir, name)) continue;
+            relPath.resize(base);
+            relPath += name;
+            if (!ignore.should_ignore(scan->scope.get(), relPath, name, info.isDir)) {
+                accept(native, std::move(name), info);
+            }
+            else {
+                stat_add(info.isDir ? STAT_PRUNED_SUBTREES : STAT_PRUNED_ENTRIES);
+            }
+        }
+    }
+    else {
+        ScopedPhase phase(PHASE_ENUMERATE);
+        enumerate_directory(path, [&](const DirEntryInfo& e) {
+            if (cancelled()) return false;
+            stat_add(STAT_ENTRIES);
+            std::wstring name = native_to_wide(e.name);
+            if (checkExcluded && !e.isDir && ignore.is_excluded(relDir, name)) return true;
+            relPath.resize(base);
+            relPath += name;
+            if (!ignore.should_ignore(relPath, name, e.isDir)) {
+                accept(e.name, std::move(name), e);
+            }
+            else {
+                stat_add(e.isDir ? STAT_PRUNED_SUBTREES : STAT_PRUNED_ENTRIES);
+            }
+            return true;
+        }, withStat);
+    }
+
+    if (cancelled()) return entries;
+    ScopedPhase phase(PHASE_SORT);
+    if (sorted && limit && entries.size() == limit) std::sort_heap(entries.begin(), entries.end(), entry_before);
+    else sort_entries(entries);
+    return entries;
+}
+
+// ----------------------------------------------------------------------------
+// 目录列表缓存 (--serve)
+// ----------------------------------------------------------------------------
+
+// 常驻进程中保存过滤、排序后的目录列表，按最近使用淘汰
+// 挂在产生它的规则集上 (列表只对这组规则有效)，随规则集一同释放
+// 目录修改时间未变且已稳定 (超过 2 秒) 时直接复用，与 --cache 的校验方式相同；嵌套忽略作用域另按指纹校验
+class DirListingCache {
+    struct Listing {
+        int64_t mtime;
+        uint64_t scopeKey;
+        uint32_t ignoreFiles;
+        std::vector<TreeEntry> entries;  // 完整列表，p 只含文件名
+    };
+    using Key = std::basic_string<fs::path::value_type>;
+    using LruList = std::list<std::pair<Key, std::shared_ptr<const Listing>>>;
+
+    std::mutex _mutex;
+    LruList _lru;  // 最近使用的在前
+    std::unordered_map<Key, LruList::iterator> _index;
+    size_t _maxDirs;
+
+    std::shared_ptr<const Listing> find(const Key& key) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _index.find(key);
+        if (it == _index.end()) return nullptr;
+        _lru.splice(_lru.begin(), _lru, it->second);
+        return it->second->second;
+    }
+
+    void store(Key key, std::shared_ptr<const Listing> listing) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _index.find(key);
+        if (it != _index.end()) {
+            it->second->second = std::move(listing);
+            _lru.splice(_lru.begin(), _lru, it->second);
+            return;
+        }
+        _lru.emplace_front(key, std::move(listing));
+        _index.emplace(std::move(key), _lru.begin());
+        if (_lru.size() > _maxDirs) {
+            _index.erase(_lru.back().first);
+            _lru.pop_back();
+        }
+    }
+
+    // 按 scan 的要求交出副本：补全路径，截取前 limit 项
+    static std::vector<TreeEntry> copy_out(const Listing& listing, const fs::path& path, DirScan& scan) {
+        const size_t total = listing.entries.size();
+        const size_t n = scan.limit ? std::min(scan.limit, total) : total;
+        scan.omitted = total - n;
+        scan.ignoreFiles = listing.ignoreFiles;
+        std::vector<TreeEntry> entries;
+        entries.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            const TreeEntry& e = listing.entries[i];
+            entries.push_back(TreeEntry{ scan.namesOnly ? e.p : path / e.p, e.name, e.isDir, e.key, e.mtime, e.size, e.linkShown, e.isLink, e.target });
+        }
+        return entries;
+    }
+
+public:
+    explicit DirListingCache(size_t maxDirs) : _maxDirs(maxDirs) {}
+
+    std::vector<TreeEntry> collect(const fs::path& path, const std::wstring& relDir, const TreeIgnore& ignore, DirScan& scan) {
+        int64_t mtime = 0;
+        stat_add(STAT_CACHE_REVALIDATIONS);
+        if (!get_mtime(path, mtime) || now_file_time() - mtime <= 2 * FILE_TIME_TICKS_PER_SEC) return read_entries(path, relDir, ignore, &scan);
+
+        // 同一目录从不同的扫描根目录到达时相对路径不同 (锚定规则与链接判定的结果可能不同)，键中加入相对路径长度、排序方式与链接策略
+        Key key = path.native();
+        key += fs::path::value_type(0);
+        for (char c : std::to_string((relDir.size() * 8 + g_sortMode) * 4 + g_linkPolicy)) key += fs::path::value_type(c);
+
+        if (std::shared_ptr<const Listing> hit = find(key); hit && hit->mtime == mtime) {
+            IgnoreScopePtr scope = ignore.enter_dir(scan.scope, path, relDir, hit->ignoreFiles);
+            if ((scope ? scope->key : 0) == hit->scopeKey) {
+                stat_add(STAT_CACHED_DIRS);
+                scan.scope = std::move(scope);
+                return copy_out(*hit, path, scan);
+            }
+        }
+
+        DirScan full{ scan.scope };
+        full.namesOnly = true;
+        full.cancel = scan.cancel;
+        full.links = scan.links;
+        auto listing = std::make_shared<Listing>();
+        listing->entries = read_entries(path, relDir, ignore, &full);
+        if (scan.cancel && scan.cancel->load(std::memory_order_relaxed)) return {};
+        listing->mtime = mtime;
+        listing->scopeKey = full.scope ? full.scope->key : 0;
+        listing->ignoreFiles = full.ignoreFiles;
+        scan.scope = std::move(full.scope);
+        std::vector<TreeEntry> entries = copy_out(*listing, path, scan);
+        store(std::move(key), std::move(listing));
+        return entries;
+    }
+};
+
+inline void TreeIgnore::keep_listings(size_t maxDirs) {
+    _listings = maxDirs ? std::make_shared<DirListingCache>(maxDirs) : nullptr;
+}
+
+// 读取单个目录 (见 read_entries)；规则集保留了目录列表时先查缓存
+// 需要逐项属性的扫描 (按时间/大小排序、--sizes、--diff) 不走缓存：文件被写入不改变目录修改时间
+std::vector<TreeEntry> collect_entries(const fs::path& path, const std::wstring& relDir, const TreeIgnore& ignore, DirScan* scan = nullptr) {
+    DirListingCache* cache = ignore.listings();
+    if (!cache || !scan || scan->deferStat || scan->withStat || sort_needs_stat() || ignore.has_excluded_in(relDir)) {
+        return read_entries(path, relDir, ignore, scan);
+    }
+    return cache->collect(path, relDir, ignore, *scan);
+}
+
+// ----------------------------------------------------------------------------
+// 结构化输出 (--format)
+// ----------------------------------------------------------------------------
+
+enum OutputFormat { FORMAT_TEXT, FORMAT_JSON, FORMAT_NDJSON, FORMAT_BIN };
+
+bool parse_output_format(const std::wstring& s, OutputFormat& format) {
+    static const std::pair<const wchar_t*, OutputFormat> NAMES[] = {
+        { L"text", FORMAT_TEXT }, { L"json", FORMAT_JSON }, { L"ndjson", FORMAT_NDJSON }, { L"bin", FORMAT_BIN },
+    };
+    for (const auto& [name, value] : NAMES) {
+        if (s == name) { format = value; return true; }
+    }
+    return false;
+}
+
+// 1536 -> "1.5 KB" (1024 进制，保留一位小数)
+inline void append_size(std::string& out, uint64_t bytes) {
+    static const char* const UNITS[] = { "KB", "MB", "GB", "TB", "PB", "EB" };
+    char buf[32];
+    if (bytes < 1024) {
+        std::snprintf(buf, sizeof(buf), "%llu B", (unsigned long long)bytes);
+    }
+    else {
+        double v = bytes / 1024.0;
+        int unit = 0;
+        while (v >= 1023.95 && unit < 5) { v /= 1024; ++unit; }
+        std::snprintf(buf, sizeof(buf), "%.1f %s", v, UNITS[unit]);
+    }
+    out += buf;
+}
+
+// "1,234 files"
+inline void append_file_count(std::string& out, uint64_t files) {
+    append_utf8(out, group_thousands((size_t)files));
+    out += Strings::get(files == 1 ? Msg::SIZE_ONE_FILE : Msg::SIZE_FILES);
+}
+
+// 行尾注记：文件为 " (12.3 KB)"，目录为 " (340.5 MB, 1,234 files)"
+inline void size_note(std::string& out, uint64_t size, const uint64_t* files) {
+    out.assign(" (");
+    append_size(out, size);
+    if (files) {
+        out += ", ";
+        append_file_count(out, *files);
+    }
+    out += ')';
+}
+
+// 交给各格式输出器的一项；size/mtime/files 仅在对应标志置位时有效
+struct NodeInfo {
+    std::wstring_view name;
+    bool isDir = false;
+    bool hasSize = false;
+    bool hasMtime = false;
+    bool hasFiles = false;  // 目录子树文件数 (--sizes)
+    bool hasHash = false;   // 内容哈希 (--snapshot)
+    bool unscanned = false; // 预算用尽前未读取的目录 (--time-budget / --entry-budget)
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t files = 0;
+    uint64_t hash = 0;
+    NativeStringView native{};  // 原生文件名 (仅 walk_tree 填写)
+};
+
+// 输出器接口 (各格式相同)：遍历按输出顺序调用
+//   open_dir(info, isLast) ... close_dir()  展开的目录 (根目录为最外层的一对)
+//   leaf(info, isLast)                       文件或未展开的目录 (info.unscanned 为未读取的目录)
+//   more(omitted)                            当前目录因 --max-entries-per-dir 未列出的条目数
+//   finish(truncated)                        输出结束 (truncated 为 --max-lines 已用尽)
+
+// 文本树，带属性时在行尾附加大小注记
+// 前缀只有一个共享缓冲：进入目录时追加一段缩进，离开时截断 (U_SPACE 与 U_PIPE 等长)
+// rootOpen 为 true 表示根目录行已由调用方写出
+template <class Writer>
+class TextEmitter {
+    Writer& _w;
+    std::wstring _prefix;
+    size_t _depth;
+    std::string _note;
+
+    void line(const NodeInfo& info, bool isLast) {
+        _note.clear();
+        if (info.hasSize) size_note(_note, info.size, info.hasFiles ? &info.files : nullptr);
+        if (info.unscanned) _note += Strings::get(Msg::NOT_SCANNED);
+        const std::wstring_view folder = info.isDir ? std::wstring_view(U_FOLDER) : std::wstring_view();
+        if (_depth == 0) {
+            _w.writeLine(info.name, folder, std::string_view(_note));
+            return;
+        }
+        _w.writeLine(std::wstring_view(_prefix), std::wstring_view(isLast ? U_LAST : U_BRANCH), info.name, folder, std::string_view(_note));
+    }
+
+public:
+    explicit TextEmitter(Writer& w, bool rootOpen = false) : _w(w), _depth(rootOpen ? 1 : 0) {}
+
+    void leaf(const NodeInfo& info, bool isLast) { line(info, isLast); }
+    void open_dir(const NodeInfo& info, bool isLast) {
+        line(info, isLast);
+        if (_depth++ > 0) _prefix += isLast ? U_SPACE : U_PIPE;
+    }
+    void close_dir() {
+        if (--_depth > 0) _prefix.resize(_prefix.size() - U_SPACE.size());
+    }
+    void more(size_t omitted) {
+        _w.writeLine(std::wstring_view(_prefix), std::wstring_view(U_LAST), std::string_view(more_entries_text(omitted)));
+    }
+    void finish(bool truncated) {
+        if (truncated) _w.writeLine(Strings::get(Msg::MSG_TRUNCATED));
+    }
+};
+
+// 返回 s[i..n) 中第一个需要转义的字节位置 ("、\ 或控制字符)：SSE2 每次检查 16 字节，否则按 8 字节 SWAR
+inline size_t json_plain_run(const char* s, size_t i, size_t n) {
+#ifdef CTREE_HAVE_SSE2
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i slash = _mm_set1_epi8('\\');
+    const __m128i ctl = _mm_set1_epi8(0x1F);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, slash)),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+        if (_mm_movemask_epi8(hit) != 0) break;
+    }
+#else
+    constexpr uint64_t ONES = 0x0101010101010101ull, HIGHS = 0x8080808080808080ull;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, s + i, 8);
+        uint64_t q = w ^ (ONES * '"'), b = w ^ (ONES * '\\');
+        if ((((w - ONES * 0x20) & ~w) | ((q - ONES) & ~q) | ((b - ONES) & ~b)) & HIGHS) break;
+    }
+#endif
+    while (i < n) {
+        unsigned char c = (unsigned char)s[i];
+        if (c < 0x20 || c == '"' || c == '\\') break;
+        ++i;
+    }
+    return i;
+}
+
+// 追加带引号的 JSON 字符串 (s 为 UTF-8)：无需转义的片段整段复制
+inline void append_json_string(std::string& out, std::string_view s) {
+    out += '"';
+    size_t i = 0;
+    while (i < s.size()) {
+        size_t j = json_plain_run(s.data(), i, s.size());
+        out.append(s.data() + i, j - i);
+        if (j == s.size()) break;
+        const unsigned char c = (unsigned char)s[j];
+        switch (c) {
+        case '"': out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        default: {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        }
+        i = j + 1;
+    }
+    out += '"';
+}
+
+// 各 JSON 格式共用的属性字段 (mtime 为 Unix 秒)
+inline void append_json_meta(std::string& out, const NodeInfo& info) {
+    out += info.isDir ? ",\"type\":\"dir\"" : ",\"type\":\"file\"";
+    if (info.hasSize) { out += ",\"size\":"; out += std::to_string(info.size); }
+    if (info.hasFiles) { out += ",\"files\":"; out += std::to_string(info.files); }
+    if (info.hasMtime) {
+        int64_t ns = unix_time_ns(info.mtime);
+        int64_t sec = ns / 1000000000 - (ns % 1000000000 < 0 ? 1 : 0);
+        out += ",\"mtime\":";
+        out += std::to_string(sec);
+    }
+    if (info.unscanned) out += ",\"scanned\":false";
+}
+
+// 嵌套 JSON：{"name":…,"type":"dir","children":[…]}，未展开的目录没有 children，未扫描的目录另带 "scanned":false
+// 截断的目录以 {"type":"more","count":N} 作为最后一个子项；--max-lines 截断时根对象带 "truncated":true
+template <class Writer>
+class JsonEmitter {
+    Writer& _w;
+    std::string _buf, _name;
+    std::vector<char> _first;  // 每层是否尚未写出子项
+
+    void begin_item() {
+        _buf.clear();
+        if (_first.empty()) return;
+        if (!_first.back()) _buf += ',';
+        _first.back() = 0;
+    }
+    void object(const NodeInfo& info) {
+        _name.clear();
+        append_utf8(_name, info.name);
+        _buf += "{\"name\":";
+        append_json_string(_buf, _name);
+        append_json_meta(_buf, info);
+    }
+
+public:
+    explicit JsonEmitter(Writer& w) : _w(w) {}
+
+    void leaf(const NodeInfo& info, bool) {
+        begin_item();
+        object(info);
+        _buf += '}';
+        _w.writeRaw(_buf);
+    }
+    void open_dir(const NodeInfo& info, bool) {
+        begin_item();
+        object(info);
+        _buf += ",\"children\":[";
+        _w.writeRaw(_buf);
+        _first.push_back(1);
+    }
+    void close_dir() {
+        _first.pop_back();
+        _w.writeRaw(_first.empty() ? std::string_view("]") : std::string_view("]}"));
+    }
+    void more(size_t omitted) {
+        begin_item();
+        _buf += "{\"type\":\"more\",\"count\":";
+        _buf += std::to_string(omitted);
+        _buf += '}';
+        _w.writeRaw(_buf);
+    }
+    void finish(bool truncated) {
+        _w.writeRaw(truncated ? std::string_view(",\"truncated\":true}\n") : std::string_view("}\n"));
+    }
+};
+
+// NDJSON：每项一行 {"path":"a/b","depth":2,"type":"file",…}，路径分隔符恒为 /
+// 根目录为 path 为空、depth 为 0 的一行 (附 name)；截断记录为 {"type":"more",…} 与末行 {"type":"truncated"}
+template <class Writer>
+class NdjsonEmitter {
+    Writer& _w;
+    std::string _buf;
+    std::string _path;          // 当前目录的相对路径 (UTF-8)
+    std::vector<size_t> _lens;  // 各层进入前的 _path 长度
+
+    void record(const NodeInfo& info) {
+        const size_t base = _path.size();
+        if (!_lens.empty()) {
+            if (base) _path += '/';
+            append_utf8(_path, info.name);
+        }
+        _buf.assign("{\"path\":");
+        append_json_string(_buf, _path);
+        _buf += ",\"depth\":";
+        _buf += std::to_string(_lens.size());
+        if (_lens.empty()) {
+            _buf += ",\"name\":";
+            std::string name;
+            append_utf8(name, info.name);
+            append_json_string(_buf, name);
+        }
+        append_json_meta(_buf, info);
+        _buf += "}\n";
+        _w.writeRaw(_buf);
+        _path.resize(base);
+    }
+
+public:
+    explicit NdjsonEmitter(Writer& w) : _w(w) {}
+
+    void leaf(const NodeInfo& info, bool) { record(info); }
+    void open_dir(const NodeInfo& info, bool) {
+        record(info);
+        if (!_lens.empty()) {
+            _lens.push_back(_path.size());
+            if (!_path.empty()) _path += '/';
+            append_utf8(_path, info.name);
+        }
+        else {
+            _lens.push_back(0);
+        }
+    }
+    void close_dir() {
+        _path.resize(_lens.back());
+        _lens.pop_back();
+    }
+    void more(size_t omitted) {
+        _buf.assign("{\"path\":");
+        append_json_string(_buf, _path);
+        _buf += ",\"depth\":";
+        _buf += std::to_string(_lens.size());
+        _buf += ",\"type\":\"more\",\"count\":";
+        _buf += std::to_string(omitted);
+        _buf += "}\n";
+        _w.writeRaw(_buf);
+    }
+    void finish(bool truncated) {
+        if (truncated) _w.writeRaw("{\"type\":\"truncated\"}\n");
+    }
+};
+
+// 紧凑二进制格式 (小端)，便于 mmap 后顺序跳读：
+//   文件头 16 字节：magic "CTREEBIN"、u32 版本 (1)、u32 文件头长度 (16)
+//   记录：u32 记录总长 (8 的倍数)、u8 类型、u8 标志、u16 保留、u32 深度、u32 名称字节数，
+//         随后按标志依次为 u64 大小、i64 修改时间 (Unix 纳秒)、u64 计数、u64 内容哈希 (XXH64)，最后是 UTF-8 名称并补零到 8 字节对齐
+//   类型：1 文件、2 目录、3 未列出条目 (计数为条目数)、4 已截断、5 结束
+//   标志：1 大小、2 修改时间、4 计数 (目录为子树文件数)、8 目录已展开 (其后为深度 +1 的子项)、16 哈希、32 目录未扫描
+enum BinRecordType : uint8_t { BIN_FILE = 1, BIN_DIR = 2, BIN_MORE = 3, BIN_TRUNCATED = 4, BIN_END = 5 };
+enum BinRecordFlag : uint8_t { BIN_HAS_SIZE = 1, BIN_HAS_MTIME = 2, BIN_HAS_COUNT = 4, BIN_EXPANDED = 8, BIN_HAS_HASH = 16, BIN_NOT_SCANNED = 32 };
+constexpr size_t BIN_HEADER_SIZE = 16;
+
+inline void append_le(std::string& out, uint64_t v, int bytes) {
+    for (int i = 0; i < bytes; ++i) out += (char)((v >> (8 * i)) & 0xFF);
+}
+
+template <class Writer>
+class BinEmitter {
+    Writer& _w;
+    std::string _buf, _name;
+    uint32_t _depth = 0;
+
+    void record(uint8_t type, uint8_t flags, const NodeInfo* info, uint64_t count) {
+        _name.clear();
+        if (info) append_utf8(_name, info->name);
+        size_t len = 16 + _name.size();
+        if (flags & BIN_HAS_SIZE) len += 8;
+        if (flags & BIN_HAS_MTIME) len += 8;
+        if (flags & BIN_HAS_COUNT) len += 8;
+        if (flags & BIN_HAS_HASH) len += 8;
+        len = (len + 7) & ~(size_t)7;
+
+        _buf.clear();
+        append_le(_buf, len, 4);
+        _buf += (char)type;
+        _buf += (char)flags;
+        append_le(_buf, 0, 2);
+        append_le(_buf, _depth, 4);
+        append_le(_buf, _name.size(), 4);
+        if (flags & BIN_HAS_SIZE) append_le(_buf, info->size, 8);
+        if (flags & BIN_HAS_MTIME) append_le(_buf, (uint64_t)unix_time_ns(info->mtime), 8);
+        if (flags & BIN_HAS_COUNT) append_le(_buf, count, 8);
+        if (flags & BIN_HAS_HASH) append_le(_buf, info->hash, 8);
+        _buf += _name;
+        _buf.resize(len, '\0');
+        _w.writeRaw(_buf);
+    }
+
+    void entry(const NodeInfo& info, uint8_t extra) {
+        uint8_t flags = extra;
+        if (info.hasSize) flags |= BIN_HAS_SIZE;
+        if (info.hasMtime) flags |= BIN_HAS_MTIME;
+        if (info.hasFiles) flags |= BIN_HAS_COUNT;
+        if (info.hasHash) flags |= BIN_HAS_HASH;
+        if (info.unscanned) flags |= BIN_NOT_SCANNED;
+        record(info.isDir ? BIN_DIR : BIN_FILE, flags, &info, info.files);
+    }
+
+public:
+    explicit BinEmitter(Writer& w) : _w(w) {
+        std::string header("CTREEBIN");
+        append_le(header, 1, 4);
+        append_le(header, BIN_HEADER_SIZE, 4);
+        _w.writeRaw(header);
+    }
+
+    void leaf(const NodeInfo& info, bool) { entry(info, 0); }
+    void open_dir(const NodeInfo& info, bool) {
+        entry(info, BIN_EXPANDED);
+        ++_depth;
+    }
+    void close_dir() { --_depth; }
+    void more(size_t omitted) { record(BIN_MORE, BIN_HAS_COUNT, nullptr, omitted); }
+    void finish(bool truncated) {
+        if (truncated) record(BIN_TRUNCATED, 0, nullptr, 0);
+        record(BIN_END, 0, nullptr, 0);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 遍历内存池
+// ----------------------------------------------------------------------------
+
+// 单调内存池：按块向堆申请，块内顺序分配，不逐个释放
+// mark / rewind 按栈的次序整体回收 (显式栈遍历中各层目录后进先出)，回收的块留作后用
+// 同时打开的各层目录所占总量不再增长后 (稳态)，遍历不再向堆申请内存；申请的块数与字节数记入 --stats
+class EntryArena {
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size = 0;
+    };
+    static constexpr size_t MIN_BLOCK = 64 * 1024;
+
+    std::vector<Block> _blocks;
+    size_t _block = 0;  // 当前块
+    size_t _used = 0;   // 当前块已用字节
+
+public:
+    struct Mark { size_t block, used; };
+
+    Mark mark() const { return { _block, _used }; }
+    void rewind(Mark m) {
+        _block = m.block;
+        _used = m.used;
+    }
+
+    // align 不超过 16 (new char[] 的对齐)
+    void* allocate(size_t bytes, size_t align) {
+        if (_block < _blocks.size()) {
+            const size_t at = (_used + align - 1) & ~(align - 1);
+            if (at + bytes <= _blocks[_block].size) {
+                _used = at + bytes;
+                return _blocks[_block].data.get() + at;
+            }
+            ++_block;
+        }
+        // 当前块之后的块都已回收，直接复用；不够大时换成更大的块 (按块序号倍增)
+        if (_block == _blocks.size()) _blocks.emplace_back();
+        Block& b = _blocks[_block];
+        if (b.size < bytes) {
+            b.size = std::max(bytes, MIN_BLOCK << std::min<size_t>(_block, 6));
+            b.data.reset(new char[b.size]);
+            stat_add(STAT_ARENA_BLOCKS);
+            stat_add(STAT_ARENA_BYTES, b.size);
+        }
+        _used = bytes;
+        return b.data.get();
+    }
+
+    template <class T>
+    T* alloc_array(size_t n) { return static_cast<T*>(allocate(sizeof(T) * n, alignof(T))); }
+
+    // 以 u32 长度前缀加内容的形式保存 s (见 PackedStr)
+    template <class Char>
+    const uint32_t* store(std::basic_string_view<Char> s) {
+        auto* p = static_cast<uint32_t*>(allocate(sizeof(uint32_t) + s.size() * sizeof(Char), alignof(uint32_t)));
+        *p = (uint32_t)s.size();
+        if (!s.empty()) std::memcpy(p + 1, s.data(), s.size() * sizeof(Char));
+        return p;
+    }
+};
+
+// 内存池中的变长串：u32 长度前缀之后紧跟内容，引用方只保存一个指针
+template <class Char>
+struct PackedStr {
+    const uint32_t* p = nullptr;
+
+    std::basic_string_view<Char> view() const {
+        return p ? std::basic_string_view<Char>(reinterpret_cast<const Char*>(p + 1), *p) : std::basic_string_view<Char>();
+    }
+};
+
+// 内存池中的一个条目：名称只以原生编码保存一份，输出时再转为宽字符
+// 不保存路径：完整路径与相对路径由遍历栈上各层 (按下标即父目录) 的名称依次拼出
+struct ArenaEntry {
+    PackedStr<fs::path::value_type> name;
+    PackedStr<wchar_t> link;  // 未展开的目录链接名称后附加的 " -> 目标"
+    int64_t mtime;
+    uint64_t size;
+    bool isDir;
+    bool isLink = false;      // 可展开的目录链接 (同 TreeEntry::isLink，遍历到时再确认)
+    FileKey target = {};      // 可展开链接的目标身份
+};
+
+// 把一个目录读入内存池：过滤、排序、--max-entries-per-dir 与链接处理的语义同 read_entries
+// 只有通过忽略过滤并最终保留的条目进入内存池；排序键、枚举结果与 limit 堆的槽位在各目录间复用
+// 链接目标只对保留下来的条目解析
+class ArenaDirReader {
+public:
+    EntryArena arena;
+
+    // dir 为原生路径 (NUL 结尾)，relDir 相对扫描根目录；scan 的 scope / limit / omitted 同 read_entries
+    // 返回条目数，条目数组写入 out (有效期至内存池回退到读取前的位置)
+    size_t read(const fs::path::value_type* dir, const std::wstring& relDir, const TreeIgnore& ignore, DirScan& scan, ArenaEntry*& out) {
+        scan.omitted = 0;
+        // 常驻服务的目录列表缓存保存的是 TreeEntry 列表，经缓存读取后照搬到内存池
+        if (ignore.listings()) return copy_in(collect_entries(fs::path(dir), relDir, ignore, &scan), out);
+
+        const bool sorted = g_sortMode != SORT_NONE;
+        const bool nested = ignore.nested();
+        const bool withStat = sort_needs_stat() || scan.withStat;
+        const size_t limit = scan.limit;
+        _kept.clear();
+        _keys.clear();
+        _held = 0;
+        _relPath = relDir;
+        if (!_relPath.empty()) _relPath += L'\\';
+        const size_t base = _relPath.size();
+        const bool checkExcluded = ignore.has_excluded_in(relDir);
+
+        // 通过过滤的条目：无上限时名称进入内存池、排序键追加到复用缓冲
+        // 有上限时放入大小为 limit 的堆 (堆顶为保留条目中排序最靠后者)，其余只计数，同 read_entries
+        auto consider = [&](const DirEntryInfo& e) {
+            _name.clear();
+            append_native_wide(_name, e.name);
+            if (checkExcluded && !e.isDir && ignore.is_excluded(relDir, _name)) return;
+            _relPath.resize(base);
+            _relPath += _name;
+            if (nested ? ignore.should_ignore(scan.scope.get(), _relPath, _name, e.isDir) : ignore.should_ignore(_relPath, _name, e.isDir)) {
+                stat_add(e.isDir ? STAT_PRUNED_SUBTREES : STAT_PRUNED_ENTRIES);
+                return;
+            }
+            if (!limit) {
+                Kept k{ ArenaEntry{ { arena.store(e.name) }, {}, e.mtime, e.size, e.isDir, false, e.target }, _keys.size(), 0, e.isLink };
+                if (sorted) {
+                    build_sort_key(_key, _name, e.isDir, e.mtime, e.size);
+                    _keys += _key;
+                    k.keyLen = _key.size();
+                }
+                _kept.push_back(k);
+                return;
+            }
+            if (_held == limit) {
+                ++scan.omitted;
+                if (!sorted) return;
+                build_sort_key(_key, _name, e.isDir, e.mtime, e.size);
+                if (!(_key < _slots.front().key)) return;
+                std::pop_heap(_slots.begin(), _slots.begin() + _held, slot_before);
+                fill(_slots[_held - 1], e);
+                std::push_heap(_slots.begin(), _slots.begin() + _held, slot_before);
+                return;
+            }
+            if (sorted) build_sort_key(_key, _name, e.isDir, e.mtime, e.size);
+            if (_held == _slots.size()) _slots.emplace_back();
+            fill(_slots[_held++], e);
+            if (sorted && _held == limit) std::make_heap(_slots.begin(), _slots.begin() + _held, slot_before);
+        };
+
+        stat_add(STAT_DIRS);
+        {
+            ScopedPhase phase(PHASE_ENUMERATE);
+            if (nested) {
+                // 嵌套忽略需先知道本目录的忽略文件：名称暂存在复用缓冲中，压入作用域后再过滤
+                const bool atRoot = relDir.empty();
+                uint32_t ignoreFiles = 0;
+                _raw.clear();
+                _rawNames.clear();
+                enumerate_directory(dir, [&](const DirEntryInfo& e) {
+                    stat_add(STAT_ENTRIES);
+                    if (!e.isDir) ignoreFiles |= nested_ignore_file(e.name, atRoot);
+                    _raw.push_back({ _rawNames.size(), e.name.size(), e.mtime, e.size, e.isDir, e.isLink, e.target });
+                    _rawNames += e.name;
+                }, withStat);
+                if (ignoreFiles) scan.scope = ignore.enter_dir(scan.scope, fs::path(dir), relDir, ignoreFiles);
+                for (const RawEntry& r : _raw) {
+                    consider(DirEntryInfo{ NativeStringView(_rawNames).substr(r.offset, r.length), r.isDir, r.mtime, r.size, r.isLink, r.target });
+                }
+            }
+            else {
+                enumerate_directory(dir, [&](const DirEntryInfo& e) {
+                    stat_add(STAT_ENTRIES);
+                    consider(e);
+                }, withStat);
+            }
+        }
+
+        DirLinkCheck links(dir, scan.links);
+        auto emit = [&](ArenaEntry* slot, ArenaEntry e, bool isLink) {
+            if (isLink && e.isDir) {
+                if (links.follow(e.name.view())) e.isLink = true;
+                else {
+                    e.isDir = false;
+                    e.target = FileKey{};
+                    e.link.p = arena.store(std::wstring_view(link_suffix(fs::path(dir) / e.name.view())));
+                }
+            }
+            new (slot) ArenaEntry(e);
+        };
+
+        if (limit) {
+            ScopedPhase phase(PHASE_SORT);
+            if (sorted) {
+                if (_held == limit) std::sort_heap(_slots.begin(), _slots.begin() + _held, slot_before);
+                else std::sort(_slots.begin(), _slots.begin() + _held, slot_before);
+            }
+            out = arena.alloc_array<ArenaEntry>(_held);
+            for (size_t i = 0; i < _held; ++i) {
+                const Slot& c = _slots[i];
+                emit(&out[i], ArenaEntry{ { arena.store(NativeStringView(c.name)) }, {}, c.mtime, c.size, c.isDir, false, c.target }, c.isLink);
+            }
+            return _held;
+        }
+
+        const size_t n = _kept.size();
+        out = arena.alloc_array<ArenaEntry>(n);
+        if (!sorted) {
+            for (size_t i = 0; i < n; ++i) emit(&out[i], _kept[i].entry, _kept[i].isLink);
+            return n;
+        }
+        ScopedPhase phase(PHASE_SORT);
+        auto key_of = [&](uint32_t i) { return std::string_view(_keys).substr(_kept[i].keyOffset, _kept[i].keyLen); };
+        _order.resize(n);
+        for (size_t i = 0; i < n; ++i) _order[i] = SortSlot{ key_head(key_of((uint32_t)i)), (uint32_t)i };
+        sort_slots(key_of, _order.data(), n, 0, _tmp);
+        for (size_t i = 0; i < n; ++i) emit(&out[i], _kept[_order[i].idx].entry, _kept[_order[i].idx].isLink);
+        return n;
+    }
+
+private:
+    struct RawEntry {
+        size_t offset, length;  // 名称在 _rawNames 中的位置
+        int64_t mtime;
+        uint64_t size;
+        bool isDir, isLink;
+        FileKey target;
+    };
+    struct Kept {
+        ArenaEntry entry;
+        size_t keyOffset, keyLen;  // 排序键在 _keys 中的位置
+        bool isLink;
+    };
+    // limit 堆的槽位：名称与键在被淘汰时原地覆盖，字符串容量随槽位复用
+    struct Slot {
+        std::basic_string<fs::path::value_type> name;
+        std::string key;
+        int64_t mtime;
+        uint64_t size;
+        bool isDir, isLink;
+        FileKey target;
+    };
+    static bool slot_before(const Slot& a, const Slot& b) { return a.key < b.key; }
+
+    void fill(Slot& c, const DirEntryInfo& e) {
+        c.name.assign(e.name);
+        c.key.swap(_key);
+        c.mtime = e.mtime;
+        c.size = e.size;
+        c.isDir = e.isDir;
+        c.isLink = e.isLink;
+        c.target = e.target;
+    }
+
+    std::vector<RawEntry> _raw;  // 启用嵌套忽略时本目录枚举到的全部条目
+    std::basic_string<fs::path::value_type> _rawNames;
+    std::vector<Kept> _kept;
+    std::vector<Slot> _slots;    // 前 _held 个有效
+    size_t _held = 0;
+    std::vector<SortSlot> _order, _tmp;
+    std::wstring _name, _relPath;
+    std::string _key, _keys;
+
+    size_t copy_in(std::vector<TreeEntry> entries, ArenaEntry*& out) {
+        out = arena.alloc_array<ArenaEntry>(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            const TreeEntry& e = entries[i];
+            ArenaEntry a{ { arena.store(NativeStringView(e.p.native())) }, {}, e.mtime, e.size, e.isDir };
+            if (e.linkShown) {
+                _name.clear();
+                append_native_wide(_name, e.p.native());
+                a.link.p = arena.store(std::wstring_view(e.name).substr(_name.size()));
+            }
+            a.isLink = e.isLink;
+            a.target = e.target;
+            new (&out[i]) ArenaEntry(a);
+        }
+        return entries.size();
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 单线程遍历
+// ----------------------------------------------------------------------------
+
+// 显式栈中的一层目录：条目与名称位于内存池中，整层在其子项全部输出后随内存池回退一并释放
+struct WalkFrame {
+    ArenaEntry* entries = nullptr;
+    size_t count = 0;
+    size_t next = 0;
+    size_t omitted = 0;      // 因条目上限未保留的条目数
+    IgnoreScopePtr scope;    // 本目录的忽略作用域 (供子目录继承)
+    size_t relLen = 0;       // 进入本目录前共享 relDir 缓冲的长度
+    size_t pathLen = 0;      // 进入本目录前共享完整路径缓冲的长度
+    EntryArena::Mark mark{}; // 读入本目录前的内存池位置
+    bool expand = true;
+};
+
+// 显式栈遍历 root 的子项，按输出顺序交给输出器 (根目录本身由调用方输出)
+// 完整路径与相对路径各只有一个共享缓冲，随进入/离开目录追加与截断；条目只保存文件名，忽略规则匹配时在相对路径后拼接条目名
+// 条目与名称分配在本次遍历的内存池中 (见 ArenaDirReader)，内存只与各层尚未输出的条目数有关，不随深度 × 路径长度增长
+// 不递归，目录深度不受调用栈限制；budget 非空时受 --max-lines 约束，行数用尽即关闭所有已打开的目录并结束
+// withMeta 为 true 时附带枚举时取得的属性 (按 mtime / size 排序时有效)
+template <class Emitter>
+void walk_tree(const fs::path& root, Emitter& out, const TreeIgnore& ignore, LineBudget* budget = nullptr, bool withMeta = false) {
+#ifdef CTREE_COUNT_ALLOCATIONS
+    HeapProbe heapProbe(STAT_WALK_HEAP_ALLOCS, STAT_WALK_HEAP_BYTES);
+#endif
+    std::wstring relDir, name;
+    std::basic_string<fs::path::value_type> pathBuf = root.native();
+    std::vector<WalkFrame> stack;
+    ArenaDirReader reader;
+    LinkTargets links(root);
+    auto push = [&](IgnoreScopePtr scope, size_t relLen, size_t pathLen) {
+        DirScan scan{ std::move(scope) };
+        scan.limit = entry_limit(budget);
+        scan.namesOnly = true;
+        scan.links = &links;
+        WalkFrame frame;
+        frame.mark = reader.arena.mark();
+        frame.count = reader.read(pathBuf.c_str(), relDir, ignore, scan, frame.entries);
+        frame.omitted = scan.omitted;
+        frame.scope = std::move(scan.scope);
+        frame.relLen = relLen;
+        frame.pathLen = pathLen;
+        frame.expand = expand_at_depth(stack.size() + 1);
+        stack.push_back(std::move(frame));
+    };
+
+    push(nullptr, 0, pathBuf.size());
+    while (!stack.empty()) {
+        WalkFrame& frame = stack.back();
+        if (frame.next == frame.count) {
+            if (frame.omitted > 0 && (!budget || budget->take())) out.more(frame.omitted);
+            relDir.resize(frame.relLen);
+            pathBuf.resize(frame.pathLen);
+            reader.arena.rewind(frame.mark);
+            stack.pop_back();
+            if (!stack.empty()) out.close_dir();
+            continue;
+        }
+        if (budget && !budget->take()) {
+            for (stack.pop_back(); !stack.empty(); stack.pop_back()) out.close_dir();
+            return;
+        }
+
+        const ArenaEntry& e = frame.entries[frame.next];
+        const bool isLast = (frame.next == frame.count - 1 && frame.omitted == 0);
+        ++frame.next;
+        const NativeStringView native = e.name.view();
+        name.clear();
+        append_native_wide(name, native);
+        name += e.link.view();
+        bool isDir = e.isDir;
+        // 可展开的链接：目标已由输出顺序中更早的链接展开时改按链接输出
+        if (e.isLink && frame.expand) {
+            const fs::path link = fs::path(pathBuf) / native;
+            if (!links.claim(link, e.target)) {
+                isDir = false;
+                name += link_suffix(link);
+            }
+        }
+        NodeInfo info{ name, isDir };
+        info.native = native;
+        if (withMeta) {
+            info.hasMtime = true;
+            info.mtime = e.mtime;
+            info.hasSize = !isDir;
+            info.size = e.size;
+        }
+        if (!isDir || !frame.expand) {
+            out.leaf(info, isLast);
+            continue;
+        }
+        out.open_dir(info, isLast);
+        const size_t relLen = relDir.size(), pathLen = pathBuf.size();
+        if (!relDir.empty()) relDir += L'\\';
+        relDir += name;
+        if (!pathBuf.empty() && !is_path_separator(pathBuf.back())) pathBuf += fs::path::preferred_separator;
+        pathBuf += native;
+        push(frame.scope, relLen, pathLen);
+    }
+}
+
+// 文本树的单线程遍历 (根目录行由调用方写出)
+template <class Writer>
+void generate_tree_serial(const fs::path& root, Writer& writer, const TreeIgnore& ignore, LineBudget* budget = nullptr) {
+    TextEmitter<Writer> out(writer, true);
+    walk_tree(root, out, ignore, budget);
+}
+
+// 结构化格式 (--format) 的单线程遍历：过滤、排序与各项限制均与文本输出相同，边遍历边写出
+// 按 mtime / size 排序时枚举已取得属性，顺带写出 (文件的大小与各项的修改时间)
+template <class Emitter>
+void generate_tree_records(const fs::path& root, Emitter& out, const TreeIgnore& ignore, LineBudget* budget = nullptr) {
+    walk_tree(root, out, ignore, budget, sort_needs_stat());
+}
+
+// --sort none 的单线程遍历：不缓冲整个目录，条目边枚举边输出 (子目录在枚举回调中递归展开)
+// 只需多持有一项以判断当前项是否为目录的最后一项；不支持嵌套忽略文件 (需先读完整个目录)
+// links 为本次遍历的链接状态 (各层共用)
+template <class Writer>
+void generate_tree_streaming(
+    const fs::path& path,
+    const std::wstring& relDir,
+    const std::wstring& prefix,
+    Writer& writer,
+    const TreeIgnore& ignore,
+    LinkTargets& links,
+    LineBudget* budget = nullptr
+) {
+    const size_t limit = entry_limit(budget);
+    const bool expand = expand_children(relDir);
+    const bool checkExcluded = ignore.has_excluded_in(relDir);
+    std::wstring relPath = relDir;
+    if (!relPath.empty()) relPath += L'\\';
+    const size_t base = relPath.size();
+
+    DirLinkCheck linkCheck(path.native(), &links);
+    TreeEntry pending;
+    bool havePending = false;
+    size_t shown = 0, omitted = 0;
+    auto emit = [&](bool isLast) {
+        if (budget && !budget->take()) return;
+        if (expand) claim_link(pending, pending.p, links);
+        writer.writeLine(
+            std::wstring_view(prefix),
+            std::wstring_view(isLast ? U_LAST : U_BRANCH),
+            std::wstring_view(pending.name),
+            pending.isDir ? std::wstring_view(U_FOLDER) : std::wstring_view());
+        if (pending.isDir && expand) {
+            generate_tree_streaming(pending.p, child_rel_path(relDir, pending.name), prefix + (isLast ? U_SPACE : U_PIPE), writer, ignore, links, budget);
+        }
+    };
+
+    stat_add(STAT_DIRS);
+    enumerate_directory(path, [&](const DirEntryInfo& e) {
+        if (budget && budget->truncated) return;
+        stat_add(STAT_ENTRIES);
+        std::wstring name = native_to_wide(e.name);
+        if (checkExcluded && !e.isDir && ignore.is_excluded(relDir, name)) return;
+        relPath.resize(base);
+        relPath += name;
+        if (ignore.should_ignore(relPath, name, e.isDir)) {
+            stat_add(e.isDir ? STAT_PRUNED_SUBTREES : STAT_PRUNED_ENTRIES);
+            return;
+        }
+        if (limit && shown == limit) { ++omitted; return; }
+        if (havePending) emit(false);
+        pending = TreeEntry{ path / e.name, std::move(name), e.isDir, {} };
+        if (e.isLink && e.isDir) {
+            if (linkCheck.follow(e.name)) {
+                pending.isLink = true;
+                pending.target = e.target;
+            }
+            else mark_unfollowed_link(pending, pending.p);
+        }
+        havePending = true;
+        ++shown;
+    });
+    if (havePending) emit(omitted == 0);
+    if (omitted > 0 && (!budget || budget->take())) {
+        writer.writeLine(std::wstring_view(prefix), std::wstring_view(U_LAST), std::string_view(more_entries_text(omitted)));
+    }
+}
+
+// ----------------------------------------------------------------------------
+// 多线程遍历 (--threads N)
+// ----------------------------------------------------------------------------
+
+// 工作窃取线程池：每个工作线程拥有独立队列，本地 LIFO 取任务，空闲时从其他队列头部 FIFO 窃取
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    // 工作线程沿用创建线程的 --sort、--follow-links 与输出限制
+    explicit WorkStealingPool(unsigned threadCount) {
+        if (threadCount == 0) threadCount = 1;
+        for (unsigned i = 0; i < threadCount; ++i) _queues.push_back(std::make_unique<Queue>());
+        for (unsigned i = 0; i < threadCount; ++i) {
+            _workers.emplace_back([this, i, sortMode = g_sortMode, links = g_linkPolicy, limits = g_limits] {
+                g_sortMode = sortMode;
+                g_linkPolicy = links;
+                g_limits = limits;
+                worker_loop(i);
+            });
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lk(_sleepMutex);
+            _stop = true;
+        }
+        _wakeCv.notify_all();
+        for (auto& t : _workers) t.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // 工作线程提交到自己的队列 (保持局部性)，外部线程轮询分发
+    void submit(Task task) {
+        size_t idx = (t_owner == this) ? t_index : (_nextQueue.fetch_add(1, std::memory_order_relaxed) % _queues.size());
+        {
+            std::lock_guard<std::mutex> lk(_queues[idx]->m);
+            _queues[idx]->q.push_back(std::move(task));
+        }
+        _pending.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lk(_sleepMutex);
+        }
+        _wakeCv.notify_one();
+    }
+
+    // 等待 done() 成立；等待期间当前线程协助执行任务，避免空转
+    template <class Pred>
+    void wait_until(Pred done) {
+        while (!done()) {
+            if (run_one()) continue;
+            std::unique_lock<std::mutex> lk(_sleepMutex);
+            _doneCv.wait_for(lk, std::chrono::milliseconds(1), [&] {
+                return done() || _pending.load(std::memory_order_acquire) > 0;
+            });
+        }
+    }
+
+    // 任务完成后调用，唤醒 wait_until 中的线程
+    void notify_done() {
+        {
+            std::lock_guard<std::mutex> lk(_sleepMutex);
+        }
+        _doneCv.notify_all();
+    }
+
+private:
+    struct Queue { std::mutex m; std::deque<Task> q; };
+
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _workers;
+    std::atomic<size_t> _pending{ 0 };
+    std::atomic<size_t> _nextQueue{ 0 };
+    std::mutex _sleepMutex;
+    std::condition_variable _wakeCv;
+    std::condition_variable _doneCv;
+    bool _stop = false;
+
+    static thread_local WorkStealingPool* t_owner;
+    static thread_local size_t t_index;
+
+    bool try_pop(size_t idx, bool steal, Task& out) {
+        Queue& q = *_queues[idx];
+        std::lock_guard<std::mutex> lk(q.m);
+        if (q.q.empty()) return false;
+        if (steal) { out = std::move(q.q.front()); q.q.pop_front(); }
+        else { out = std::move(q.q.back()); q.q.pop_back(); }
+        _pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 工作线程先取本地队列尾部，再窃取其他队列头部；外部线程只窃取
+    bool run_one() {
+        Task task;
+        bool isWorker = (t_owner == this);
+        size_t home = isWorker ? t_index : 0;
+        bool found = isWorker && try_pop(home, false, task);
+        for (size_t k = isWorker ? 1 : 0; !found && k < _queues.size(); ++k) {
+            found = try_pop((home + k) % _queues.size(), true, task);
+        }
+        if (!found) return false;
+        task();
+        return true;
+    }
+
+    void worker_loop(size_t idx) {
+        t_owner = this;
+        t_index = idx;
+        for (;;) {
+            if (run_one()) continue;
+            std::unique_lock<std::mutex> lk(_sleepMutex);
+            _wakeCv.wait(lk, [this] { return _stop || _pending.load(std::memory_order_acquire) > 0; });
+            if (_stop && _pending.load(std::memory_order_acquire) == 0) return;
+        }
+    }
+};
+
+thread_local WorkStealingPool* WorkStealingPool::t_owner = nullptr;
+thread_local size_t WorkStealingPool::t_index = 0;
+
+// 可展开的目录链接：其行与子树推迟到串行拼接阶段，按输出顺序确认 (LinkTargets::claim) 后才读取
+struct PendingLink {
+    fs::path path;
+    FileKey target;
+    std::wstring name, relDir, prefix;  // prefix 为该行本身的前缀
+    bool isLast;
+    IgnoreScopePtr scope;               // 所在目录的忽略作用域
+};
+
+// 子树渲染结果：text 为本目录渲染出的行 (已编码为 UTF-8 并带换行符)，children 记录子目录结果 (或待确认的链接) 应插入的位置
+struct SubtreeResult {
+    struct Child {
+        size_t at;
+        std::shared_ptr<SubtreeResult> result;
+        std::shared_ptr<PendingLink> link;  // 非空时 result 为空，行尚未写入 text
+    };
+    std::string text;
+    std::vector<Child> children;
+    std::atomic<bool> done{ false };
+};
+
+void render_subtree_task(
+    WorkStealingPool& pool,
+    std::shared_ptr<SubtreeResult> result,
+    fs::path path,
+    std::wstring relDir,
+    std::wstring prefix,
+    const TreeIgnore& ignore,
+    const LinkTargets& links,
+    IgnoreScopePtr scope
+) {
+    DirScan scan{ std::move(scope) };
+    scan.limit = entry_limit(nullptr);
+    scan.links = &links;
+    std::vector<TreeEntry> entries = collect_entries(path, relDir, ignore, &scan);
+    const bool expand = expand_children(relDir);
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        bool isLast = (i == entries.size() - 1 && scan.omitted == 0);
+        if (entries[i].isLink && expand) {
+            result->children.push_back({ result->text.size(), nullptr, std::make_shared<PendingLink>(PendingLink{
+                std::move(entries[i].p), entries[i].target, entries[i].name, child_rel_path(relDir, entries[i].name), prefix, isLast, scan.scope }) });
+            continue;
+        }
+        append_tree_line(result->text, prefix, isLast, entries[i].name, entries[i].isDir);
+
+        if (entries[i].isDir && expand) {
+            auto child = std::make_shared<SubtreeResult>();
+            result->children.push_back({ result->text.size(), child, nullptr });
+            pool.submit([&pool, &ignore, &links, child, p = std::move(entries[i].p), rel = child_rel_path(relDir, entries[i].name),
+                         pre = prefix + (isLast ? U_SPACE : U_PIPE), scope = scan.scope]() mutable {
+                render_subtree_task(pool, std::move(child), std::move(p), std::move(rel), std::move(pre), ignore, links, std::move(scope));
+            });
+        }
+    }
+    if (scan.omitted > 0) append_more_line(result->text, prefix, scan.omitted);
+
+    result->done.store(true, std::memory_order_release);
+    pool.notify_done();
+}
+
+// 按目录优先、名称排序的原始顺序拼接各子树结果，保证与单线程输出逐字节一致
+// 拼接按输出顺序进行，链接在此确认：目标第一次出现时写出目录行并读取其子树，否则按 "名称 -> 目标" 输出
+template <class Writer>
+void join_subtree(WorkStealingPool& pool, SubtreeResult& result, Writer& writer, const TreeIgnore& ignore, LinkTargets& links) {
+    pool.wait_until([&] { return result.done.load(std::memory_order_acquire); });
+
+    std::string_view text(result.text);
+    size_t pos = 0;
+    for (auto& c : result.children) {
+        writer.writeRaw(text.substr(pos, c.at - pos));
+        pos = c.at;
+        if (c.link) {
+            const PendingLink& link = *c.link;
+            const bool follow = links.claim(link.path, link.target);
+            std::string line;
+            append_tree_line(line, link.prefix, link.isLast, follow ? link.name : link.name + link_suffix(link.path), follow);
+            writer.writeRaw(std::string_view(line));
+            if (!follow) continue;
+            c.result = std::make_shared<SubtreeResult>();
+            pool.submit([&pool, &ignore, &links, child = c.result, link = c.link] {
+                render_subtree_task(pool, child, link->path, link->relDir, link->prefix + (link->isLast ? U_SPACE : U_PIPE), ignore, links, link->scope);
+            });
+        }
+        join_subtree(pool, *c.result, writer, ignore, links);
+        c.result.reset();  // 子树输出后立即释放
+        c.link.reset();
+    }
+    writer.writeRaw(text.substr(pos));
+}
+
+template <class Writer>
+void generate_tree_parallel(
+    const fs::path& path,
+    Writer& writer,
+    const TreeIgnore& ignore,
+    unsigned threadCount
+) {
+    LinkTargets links(path);
+    WorkStealingPool pool(threadCount);
+    auto root = std::make_shared<SubtreeResult>();
+    pool.submit([&pool, &ignore, &links, root, path] {
+        render_subtree_task(pool, root, path, L"", L"", ignore, links, nullptr);
+    });
+    join_subtree(pool, *root, writer, ignore, links);
+}
+
+// ----------------------------------------------------------------------------
+// 限时遍历 (--time-budget / --entry-budget)
+// ----------------------------------------------------------------------------
+
+// 两项均为 0 表示不启用
+struct ScanBudget {
+    uint64_t timeMs = 0;  // 从开始扫描起的期限 (毫秒)
+    size_t entries = 0;   // 最多读取的目录项数 (含因 --max-entries-per-dir 未列出的)
+
+    bool enabled() const { return timeMs || entries; }
+};
+
+constexpr uint32_t NO_BUDGET_DIR = 0xFFFFFFFFu;
+
+struct BudgetDir {
+    std::vector<TreeEntry> entries;
+    std::vector<uint32_t> sub;  // 与 entries 对应：展开的子目录编号，NO_BUDGET_DIR 为文件或不展开的目录
+    size_t omitted = 0;
+    bool scanned = false;
+};
+
+// 一次目录读取：由线程池执行，done 置位后由扫描线程并入树中
+struct BudgetRead {
+    uint32_t dir;
+    fs::path path;
+    std::wstring relDir;
+    IgnoreScopePtr scope;
+    std::vector<TreeEntry> entries;
+    size_t omitted = 0;
+    bool scanned = false;  // 取消后跳过的读取为 false
+    std::atomic<bool> done{ false };
+};
+
+// 按层广度优先扫描，先读完浅层再深入，预算用尽时已读到的部分仍是一棵完整的上层目录树
+// 前沿按 (深度, 输出顺序) 排列：线程池同时读取前沿最前的若干目录，读完的目录并入树中，其子目录追加到前沿末尾
+// 预算用尽 (到达期限，或并入下一目录会超出条目数) 即停止，未读取的目录在输出中标注 [… not scanned]
+// 条目预算下结果与线程数无关：按前沿顺序逐个并入，并入顺序固定为层序，停止位置只取决于各目录的条目数
+// 到达期限后排队中的读取直接跳过，正在读取的目录停止枚举后返回 (结果丢弃)
+class BudgetTree {
+public:
+    BudgetTree(const TreeIgnore& ignore, const ScanBudget& budget) : _ignore(ignore), _budget(budget) {}
+
+    void scan(const fs::path& root, unsigned threads) {
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(_budget.timeMs);
+        _links = std::make_unique<LinkTargets>(root);
+        std::deque<std::shared_ptr<BudgetRead>> frontier, reading;
+        _dirs.emplace_back();
+        frontier.push_back(make_read(0, root, L"", nullptr));
+        const bool ordered = _budget.entries != 0;
+        bool timedOut = false;
+        {
+            WorkStealingPool pool(threads);
+            const size_t window = (size_t)std::max(1u, threads) * 2;
+            for (;;) {
+                while (!frontier.empty() && reading.size() < window) {
+                    submit(pool, frontier.front());
+                    reading.push_back(std::move(frontier.front()));
+                    frontier.pop_front();
+                }
+                if (reading.empty()) break;
+                // 有条目预算时严格按前沿顺序并入；只有期限时任一读取完成即并入，慢目录不阻塞其后的目录
+                auto ready = [&] {
+                    if (ordered) return reading.front()->done.load(std::memory_order_acquire);
+                    return std::any_of(reading.begin(), reading.end(), [](const auto& r) { return r->done.load(std::memory_order_acquire); });
+                };
+                {
+                    std::unique_lock<std::mutex> lk(_mutex);
+                    if (_budget.timeMs) timedOut = !_cv.wait_until(lk, deadline, ready);
+                    else _cv.wait(lk, ready);
+                }
+                if (timedOut) break;
+                if (ordered) {
+                    if (!commit(*reading.front(), &frontier)) break;
+                    reading.pop_front();
+                    continue;
+                }
+                for (auto it = reading.begin(); it != reading.end();) {
+                    if (!(*it)->done.load(std::memory_order_acquire)) { ++it; continue; }
+                    commit(**it, &frontier);
+                    it = reading.erase(it);
+                }
+            }
+            _cancelled.store(true, std::memory_order_relaxed);
+            // 到达期限时已读完的目录照常并入 (其子目录不再读取)
+            if (timedOut) {
+                for (auto& r : reading) {
+                    if (!r->done.load(std::memory_order_acquire) || !r->scanned) continue;
+                    if (!commit(*r, nullptr)) break;
+                }
+            }
+        }
+        for (const BudgetDir& d : _dirs) {
+            if (!d.scanned) ++_unscanned;
+        }
+        stat_add(STAT_DIRS_UNSCANNED, _unscanned);
+    }
+
+    // 按输出顺序交给输出器 (见 TextEmitter)；未读取的目录作为带 unscanned 标记的叶子
+    template <class Emitter>
+    void emit(const std::wstring& rootName, Emitter& out, LineBudget* budget) {
+        NodeInfo root{ rootName, true };
+        root.unscanned = !_dirs[0].scanned;
+        out.open_dir(root, true);
+        emit_dir(0, out, budget);
+        out.close_dir();
+        out.finish(budget && budget->truncated);
+    }
+
+    // 文本输出的末行："… scan budget exhausted, 1,234 directories not scanned"
+    template <class Writer>
+    void write_summary(Writer& writer) {
+        if (_unscanned == 0) return;
+        std::string line(Strings::get(Msg::BUDGET_EXHAUSTED));
+        append_utf8(line, group_thousands(_unscanned));
+        line += Strings::get(Msg::BUDGET_EXHAUSTED_TAIL);
+        writer.writeLine(std::string_view(line));
+    }
+
+private:
+    const TreeIgnore& _ignore;
+    ScanBudget _budget;
+    std::deque<BudgetDir> _dirs;  // 只由扫描线程追加
+    size_t _entryCount = 0;
+    size_t _unscanned = 0;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::atomic<bool> _cancelled{ false };
+    std::unique_ptr<LinkTargets> _links;  // 本次扫描的链接状态 (读取线程只读其根目录，确认链接在扫描线程上进行)
+
+    static std::shared_ptr<BudgetRead> make_read(uint32_t dir, fs::path path, std::wstring relDir, IgnoreScopePtr scope) {
+        auto r = std::make_shared<BudgetRead>();
+        r->dir = dir;
+        r->path = std::move(path);
+        r->relDir = std::move(relDir);
+        r->scope = std::move(scope);
+        return r;
+    }
+
+    void submit(WorkStealingPool& pool, std::shared_ptr<BudgetRead> read) {
+        pool.submit([this, read = std::move(read)] {
+            if (!_cancelled.load(std::memory_order_relaxed)) {
+                DirScan scan{ std::move(read->scope) };
+                scan.limit = entry_limit(nullptr);
+                scan.cancel = &_cancelled;
+                scan.links = _links.get();
+                read->entries = collect_entries(read->path, read->relDir, _ignore, &scan);
+                read->omitted = scan.omitted;
+                read->scope = std::move(scan.scope);
+                read->scanned = !_cancelled.load(std::memory_order_relaxed);
+            }
+            {
+                std::lock_guard<std::mutex> lk(_mutex);
+                read->done.store(true, std::memory_order_release);
+            }
+            _cv.notify_all();
+        });
+    }
+
+    // 并入一次读取的结果；超出条目预算时返回 false (根目录总是并入)
+    // frontier 非空时把要展开的子目录按输出顺序追加到前沿末尾
+    // 链接在并入时确认：同一目标只在并入顺序 (层序) 中第一个指向它的链接处展开
+    bool commit(BudgetRead& r, std::deque<std::shared_ptr<BudgetRead>>* frontier) {
+        const size_t n = r.entries.size() + r.omitted;
+        if (_budget.entries && r.dir != 0 && _entryCount + n > _budget.entries) return false;
+        _entryCount += n;
+
+        BudgetDir& d = _dirs[r.dir];
+        d.scanned = true;
+        d.omitted = r.omitted;
+        d.sub.assign(r.entries.size(), NO_BUDGET_DIR);
+        const bool expand = expand_children(r.relDir);
+        for (size_t i = 0; i < r.entries.size(); ++i) {
+            TreeEntry& e = r.entries[i];
+            if (!expand) continue;
+            claim_link(e, e.p, *_links);
+            if (!e.isDir) continue;
+            d.sub[i] = (uint32_t)_dirs.size();
+            _dirs.emplace_back();
+            if (frontier) frontier->push_back(make_read(d.sub[i], std::move(e.p), child_rel_path(r.relDir, e.name), r.scope));
+        }
+        d.entries = std::move(r.entries);
+        return true;
+    }
+
+    template <class Emitter>
+    void emit_dir(uint32_t id, Emitter& out, LineBudget* budget) {
+        const BudgetDir& d = _dirs[id];
+        const size_t n = d.entries.size();
+        for (size_t i = 0; i < n; ++i) {
+            if (budget && !budget->take()) return;
+            const TreeEntry& e = d.entries[i];
+            const bool isLast = (i == n - 1 && d.omitted == 0);
+            NodeInfo info{ e.name, e.isDir };
+            if (d.sub[i] != NO_BUDGET_DIR && _dirs[d.sub[i]].scanned) {
+                out.open_dir(info, isLast);
+                emit_dir(d.sub[i], out, budget);
+                out.close_dir();
+                continue;
+            }
+            info.unscanned = d.sub[i] != NO_BUDGET_DIR;
+            out.leaf(info, isLast);
+        }
+        if (d.omitted > 0 && (!budget || budget->take())) out.more(d.omitted);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 由路径列表建树 (--git-tracked、归档文件)
+// ----------------------------------------------------------------------------
+
+constexpr uint32_t NO_LISTED_DIR = 0xFFFFFFFFu;
+
+struct ListedDir {
+    std::vector<TreeEntry> entries;  // 目录的 p 为文件名 (需要读取磁盘时据此拼接路径)，文件的 p 为空
+    std::vector<uint32_t> sub;       // 与 entries 对应：展开的子目录编号，NO_LISTED_DIR 为文件或不展开的目录
+};
+
+// 不遍历目录，由一份路径列表建树，按与遍历相同的规则过滤、排序和截断后交给输出器
+// 路径须按字节序排列：共享前缀的路径必然相邻，只需维护当前打开的目录栈，退出不再是前缀的目录、逐级进入新目录
+// 被忽略或超出 --max-depth 的目录记为跳过前缀，其下的条目直接跳过
+class ListedTree {
+public:
+    explicit ListedTree(const TreeIgnore& ignore) : _ignore(ignore) {}
+
+    // 按输出顺序交给输出器 (见 TextEmitter)；withMeta 同 walk_tree
+    template <class Emitter>
+    void emit(const std::wstring& rootName, Emitter& out, LineBudget* budget, bool withMeta = false) {
+        out.open_dir(NodeInfo{ rootName, true }, true);
+        emit_dir(0, out, budget, withMeta);
+        out.close_dir();
+        out.finish(budget && budget->truncated);
+    }
+
+protected:
+    const TreeIgnore& _ignore;
+    std::deque<ListedDir> _dirs;
+
+    void reset() {
+        _dirs.assign(1, ListedDir{});
+        _stack.assign(1, Open{ 0, 0, 0 });
+        _path.clear();
+        _rel.clear();
+        _skip.clear();
+    }
+
+    // path 相对树根 (UTF-8、/ 分隔)；以 / 结尾的是目录本身 (可能没有子项)，leafDir 为不展开的目录 (如子模块)
+    void add(std::string_view path, bool leafDir, int64_t mtime, uint64_t size) {
+        if (!_skip.empty() && starts_with(path, _skip)) return;
+        while (_stack.size() > 1 && !starts_with(path, std::string_view(_path).substr(0, _stack.back().bytes))) _stack.pop_back();
+        _path.resize(_stack.back().bytes);
+        _rel.resize(_stack.back().wide);
+
+        // 目录本身的条目总在其子项之前，即建立该目录的那一次，其属性随之记下
+        size_t start = _path.size();
+        for (size_t slash; (slash = path.find('/', start)) != std::string_view::npos; start = slash + 1) {
+            if (!enter(path.substr(start, slash - start), slash + 1 == path.size() ? mtime : 0)) {
+                _skip.assign(path.substr(0, slash + 1));
+                return;
+            }
+        }
+        if (start == path.size()) return;
+        set_name(path.substr(start));
+        if (!leafDir && _ignore.has_excluded_in(_rel) && _ignore.is_excluded(_rel, _name)) return;
+        if (_ignore.should_ignore(_relPath, _name, leafDir)) {
+            stat_add(leafDir ? STAT_PRUNED_SUBTREES : STAT_PRUNED_ENTRIES);
+            return;
+        }
+        ListedDir& d = _dirs[_stack.back().dir];
+        d.entries.push_back(TreeEntry{ leafDir ? wide_to_path(_name) : fs::path(), _name, leafDir, {}, mtime, size });
+        d.sub.push_back(NO_LISTED_DIR);
+    }
+
+    // 按已生成的排序键排列目录的子项 (--sort none 保持列表顺序)
+    static void sort_dir(ListedDir& d) {
+        if (g_sortMode == SORT_NONE || d.entries.size() < 2) return;
+        ScopedPhase phase(PHASE_SORT);
+        const size_t n = d.entries.size();
+        std::vector<SortSlot> slots(n), tmp;
+        for (size_t i = 0; i < n; ++i) slots[i] = SortSlot{ key_head(d.entries[i].key), (uint32_t)i };
+        sort_slots([&](uint32_t i) { return std::string_view(d.entries[i].key); }, slots.data(), n, 0, tmp);
+        std::vector<TreeEntry> entries;
+        std::vector<uint32_t> sub;
+        entries.reserve(n);
+        sub.reserve(n);
+        for (const SortSlot& s : slots) {
+            entries.push_back(std::move(d.entries[s.idx]));
+            sub.push_back(d.sub[s.idx]);
+        }
+        d.entries.swap(entries);
+        d.sub.swap(sub);
+    }
+
+private:
+    // 建树时打开的目录：编号，及其路径在 _path (UTF-8，带结尾的 /) 与 _rel (忽略规则使用的相对路径) 中的长度
+    struct Open { uint32_t dir; size_t bytes; size_t wide; };
+
+    std::vector<Open> _stack;
+    std::string _path;
+    std::wstring _rel, _relPath, _name;
+    std::string _skip;
+
+    static bool starts_with(std::string_view s, std::string_view prefix) {
+        return s.size() >= prefix.size() && s.compare(0, prefix.size(), prefix) == 0;
+    }
+
+    // name 转为宽字符存入 _name，完整相对路径存入 _relPath
+    void set_name(std::string_view name) {
+        _name.clear();
+        append_wide(_name, name);
+        _relPath.assign(_rel);
+        if (!_relPath.empty()) _relPath += L'\\';
+        _relPath += _name;
+    }
+
+    // 在当前目录下建立并进入子目录 name；被忽略或超出 --max-depth (此时仍列出目录本身) 时返回 false
+    bool enter(std::string_view name, int64_t mtime) {
+        set_name(name);
+        if (_ignore.should_ignore(_relPath, _name, true)) {
+            stat_add(STAT_PRUNED_SUBTREES);
+            return false;
+        }
+        ListedDir& d = _dirs[_stack.back().dir];
+        d.entries.push_back(TreeEntry{ wide_to_path(_name), _name, true, {}, mtime });
+        if (!expand_at_depth(_stack.size())) {
+            d.sub.push_back(NO_LISTED_DIR);
+            return false;
+        }
+        const uint32_t id = (uint32_t)_dirs.size();
+        d.sub.push_back(id);
+        _dirs.emplace_back();
+        _path += name;
+        _path += '/';
+        _rel.swap(_relPath);
+        _stack.push_back(Open{ id, _path.size(), _rel.size() });
+        return true;
+    }
+
+    template <class Emitter>
+    void emit_dir(uint32_t id, Emitter& out, LineBudget* budget, bool withMeta) {
+        const ListedDir& d = _dirs[id];
+        const size_t total = d.entries.size();
+        const size_t n = g_limits.maxEntries ? std::min(total, g_limits.maxEntries) : total;
+        for (size_t i = 0; i < n; ++i) {
+            if (budget && !budget->take()) return;
+            const TreeEntry& e = d.entries[i];
+            const bool isLast = (i == total - 1);
+            NodeInfo info{ e.name, e.isDir };
+            if (withMeta) {
+                info.hasMtime = true;
+                info.mtime = e.mtime;
+                info.hasSize = !e.isDir;
+                info.size = e.size;
+            }
+            if (d.sub[i] == NO_LISTED_DIR) {
+                out.leaf(info, isLast);
+                continue;
+            }
+            out.open_dir(info, isLast);
+            emit_dir(d.sub[i], out, budget, withMeta);
+            out.close_dir();
+        }
+        if (n < total && (!budget || budget->take())) out.more(total - n);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// Git 索引 (--git-tracked)
+// ----------------------------------------------------------------------------
+
+// .git/index (版本 2-4) 的只读解析：已跟踪路径按字节序排列，一次顺序读取即得整棵树，不必遍历磁盘
+// 文件头为 "DIRC"、u32 版本、u32 条目数 (整数均为大端)，其后依次为条目、扩展与整个文件的校验和
+//   条目：ctime、mtime (各为 u32 秒 + u32 纳秒)、dev、ino、mode、uid、gid、size (u32，超过 4 GB 时截断)、
+//         对象哈希 (SHA-1 20 字节 / SHA-256 32 字节)、u16 标志 (v3 起含扩展位时再跟 u16 扩展标志)，最后是路径
+//   路径：v2/v3 以 NUL 结尾并补零到 8 字节对齐；v4 为 varint (从上一条路径末尾删去的字节数) + 以 NUL 结尾的新增后缀
+namespace GitIndex {
+    constexpr uint32_t MODE_TYPE = 0170000;
+    constexpr uint32_t MODE_DIR = 0040000;      // 稀疏索引中未展开的目录 (路径以 / 结尾)
+    constexpr uint32_t MODE_GITLINK = 0160000;  // 子模块
+    constexpr uint16_t FLAG_EXTENDED = 0x4000;
+
+    struct Entry {
+        std::string_view path;  // UTF-8，分隔符为 /；仅在回调期间有效
+        uint32_t mode;
+        int64_t mtime;          // 与 get_mtime 相同的单位
+        uint64_t size;
+    };
+
+    inline uint32_t be32(const unsigned char* p) { return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]; }
+    inline uint16_t be16(const unsigned char* p) { return (uint16_t)(p[0] << 8 | p[1]); }
+
+    // 按索引顺序把每个路径交给 fn(const Entry&)；合并冲突中同一路径的各阶段只交出一次
+    // hashSize 为对象哈希的字节数；格式不符、越界或为拆分索引 (link 扩展，其余条目在共享索引中) 时返回 false
+    template <class Fn>
+    bool parse(const char* data, size_t size, size_t hashSize, Fn&& fn) {
+        const unsigned char* p = (const unsigned char*)data;
+        if (size < 12 + hashSize || std::memcmp(p, "DIRC", 4) != 0) return false;
+        const uint32_t version = be32(p + 4);
+        if (version < 2 || version > 4) return false;
+        const uint32_t count = be32(p + 8);
+        const size_t end = size - hashSize;
+        const size_t fixed = 40 + hashSize + 2;  // 路径之前的定长部分 (不含扩展标志)
+        std::string path;                        // v4 的当前路径 (前缀压缩需要上一条的完整路径)
+        std::string conflict;                    // 上一个冲突条目的路径
+        size_t off = 12;
+        for (uint32_t i = 0; i < count; ++i) {
+            if (end - off < fixed) return false;
+            const unsigned char* e = p + off;
+            const uint16_t flags = be16(e + 40 + hashSize);
+            size_t nameOff = fixed;
+            if (flags & FLAG_EXTENDED) {
+                if (version < 3) return false;
+                nameOff += 2;
+            }
+            if (end - off < nameOff) return false;
+            const char* name = data + off + nameOff;
+            const size_t avail = end - off - nameOff;
+
+            std::string_view entryPath;
+            if (version == 4) {
+                size_t k = 0;
+                uint64_t strip = 0;
+                for (unsigned char c = 0x80; c & 0x80;) {
+                    if (k == avail || strip > (UINT64_MAX >> 8)) return false;
+                    if (k > 0) ++strip;
+                    c = (unsigned char)name[k++];
+                    strip = (strip << 7) | (c & 0x7F);
+                }
+                const char* nul = (const char*)std::memchr(name + k, 0, avail - k);
+                if (!nul || strip > path.size()) return false;
+                path.resize(path.size() - (size_t)strip);
+                path.append(name + k, nul);
+                entryPath = path;
+                off = (size_t)(nul + 1 - data);
+            }
+            else {
+                const char* nul = (const char*)std::memchr(name, 0, avail);
+                if (!nul) return false;
+                entryPath = std::string_view(name, (size_t)(nul - name));
+                off += (nameOff + entryPath.size() + 8) & ~(size_t)7;
+                if (off > end) return false;
+            }
+
+            // 阶段 1-3 为未解决的冲突，同一路径的各阶段相邻
+            if ((flags >> 12) & 3) {
+                if (entryPath == conflict) continue;
+                conflict.assign(entryPath);
+            }
+            fn(Entry{ entryPath, be32(e + 24), file_time_from_unix_ns((int64_t)be32(e + 8) * 1000000000 + be32(e + 12)), be32(e + 36) });
+        }
+        while (end - off >= 8) {
+            if (std::memcmp(p + off, "link", 4) == 0) return false;
+            const size_t len = be32(p + off + 4);
+            if (end - off - 8 < len) return false;
+            off += 8 + len;
+        }
+        return off == end;
+    }
+
+    // 对象哈希长度：仓库配置了 extensions.objectFormat = sha256 时为 32，否则为 20
+    inline size_t hash_size(const fs::path& gitDir) {
+        std::ifstream file(gitDir / "config", std::ios::binary);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::string s;
+            for (char c : line) {
+                if (c != ' ' && c != '\t' && c != '\r') s += (char)std::tolower((unsigned char)c);
+            }
+            if (s == "objectformat=sha256") return 32;
+        }
+        return 20;
+    }
+
+    // 自 dir 向上查找工作区：worktree 为含 .git 的目录，gitDir 为仓库目录
+    // .git 为文件 (工作树、子模块) 时按其中的 "gitdir: <path>" 定位，相对路径相对于该文件所在目录
+    inline bool find_repo(const fs::path& dir, fs::path& worktree, fs::path& gitDir) {
+        std::error_code ec;
+        for (fs::path d = dir.lexically_normal();; d = d.parent_path()) {
+            const fs::path dotGit = d / ".git";
+            if (fs::is_directory(dotGit, ec)) {
+                worktree = d;
+                gitDir = dotGit;
+                return true;
+            }
+            if (fs::is_regular_file(dotGit, ec)) {
+                std::ifstream file(dotGit, std::ios::binary);
+                std::string line;
+                std::getline(file, line);
+                while (!line.empty() && (line.back() == '\r' || line.back() == ' ')) line.pop_back();
+                if (line.compare(0, 8, "gitdir: ") != 0) return false;
+                worktree = d;
+                gitDir = (d / wide_to_path(to_wide(line.substr(8)))).lexically_normal();
+                return true;
+            }
+            if (d == d.parent_path() || d.parent_path().empty()) return false;
+        }
+    }
+}
+
+// 由索引中的已跟踪路径建树 (见 ListedTree)
+// 文件的大小与修改时间取自索引 (暂存时的状态)，目录只在按修改时间/大小排序时读取其修改时间
+// others 为 true 时再逐个读取已跟踪的目录 (非递归)，补入未跟踪的条目；只有完全未跟踪的目录才向下遍历
+class GitTree : public ListedTree {
+public:
+    using ListedTree::ListedTree;
+
+    // root 不在 Git 工作区中或索引无法解析时返回 false，error 为对应的消息
+    bool build(const fs::path& root, bool others, Msg& error) {
+        fs::path worktree, gitDir;
+        if (!GitIndex::find_repo(root, worktree, gitDir)) { error = Msg::ERR_NOT_GIT_REPO; return false; }
+        // 扫描目录在工作区中的路径 (UTF-8、/ 分隔、带结尾的 /)，只取其下的条目
+        std::string prefix;
+        for (const auto& part : root.lexically_normal().lexically_relative(worktree)) {
+            std::wstring s = path_to_wide(part);
+            if (s.empty() || s == L".") continue;
+            append_utf8(prefix, s);
+            prefix += '/';
+        }
+
+        reset();
+        const fs::path indexFile = gitDir / "index";
+        std::error_code ec;
+        if (fs::exists(indexFile, ec)) {  // 新仓库在首次暂存前没有索引
+            ScopedPhase phase(PHASE_ENUMERATE);
+            MappedFile index;
+            bool ok = index.open(indexFile) && GitIndex::parse(index.data(), index.size(), GitIndex::hash_size(gitDir), [&](const GitIndex::Entry& e) {
+                stat_add(STAT_GIT_INDEX_ENTRIES);
+                if (e.path.size() <= prefix.size() || e.path.compare(0, prefix.size(), prefix) != 0) return;
+                // 子模块与稀疏索引中的目录作为不展开的目录
+                const uint32_t type = e.mode & GitIndex::MODE_TYPE;
+                std::string_view path = e.path.substr(prefix.size());
+                if (type == GitIndex::MODE_DIR && path.back() == '/') path.remove_suffix(1);
+                add(path, type == GitIndex::MODE_DIR || type == GitIndex::MODE_GITLINK, e.mtime, e.size);
+            });
+            if (!ok) { error = Msg::ERR_GIT_INDEX; return false; }
+        }
+        _links = std::make_unique<LinkTargets>(root);
+        finish(0, root, L"", nullptr, others);
+        return true;
+    }
+
+private:
+    std::unique_ptr<LinkTargets> _links;  // --others 读取磁盘时的链接状态
+
+    // 补全属性与排序键 (others 时先补入未跟踪的条目)，递归处理子目录后排序
+    void finish(uint32_t id, const fs::path& path, const std::wstring& relDir, IgnoreScopePtr scope, bool others) {
+        ListedDir& d = _dirs[id];
+        for (TreeEntry& e : d.entries) {
+            if (e.isDir && sort_needs_stat()) get_mtime(path / e.p, e.mtime);
+            build_sort_key(e.key, e.name, e.isDir, e.mtime, e.size);
+        }
+        if (others) add_untracked(d, path, relDir, scope);
+        for (size_t i = 0; i < d.entries.size(); ++i) {
+            if (d.sub[i] != NO_LISTED_DIR) finish(d.sub[i], path / d.entries[i].p, child_rel_path(relDir, d.entries[i].name), scope, others);
+        }
+        sort_dir(d);
+    }
+
+    // 读取磁盘上的目录，补入索引中没有的条目 (按忽略规则过滤)；未跟踪的目录在 finish 中继续向下读取
+    // 与 git ls-files --others 相同：跳过 .git，嵌套的仓库只列出目录本身
+    // scope 传入父目录的嵌套忽略作用域，返回后为本目录的
+    void add_untracked(ListedDir& d, const fs::path& path, const std::wstring& relDir, IgnoreScopePtr& scope) {
+        DirScan scan{ std::move(scope) };
+        scan.namesOnly = true;
+        scan.links = _links.get();
+        std::vector<TreeEntry> disk = collect_entries(path, relDir, _ignore, &scan);
+        scope = std::move(scan.scope);
+
+        std::vector<std::wstring_view> tracked;
+        tracked.reserve(d.entries.size());
+        for (const TreeEntry& e : d.entries) tracked.push_back(e.name);
+        std::sort(tracked.begin(), tracked.end());
+        const size_t trackedCount = d.entries.size();
+        const bool expand = expand_children(relDir);
+        std::vector<TreeEntry> added;
+        for (TreeEntry& e : disk) {
+            // 未展开的链接名称带有 " -> 目标"，按文件名比较
+            const std::wstring name = e.linkShown ? native_to_wide(e.p.native()) : std::wstring();
+            if (e.name == L".git" || std::binary_search(tracked.begin(), tracked.end(), e.linkShown ? std::wstring_view(name) : std::wstring_view(e.name))) continue;
+            added.push_back(std::move(e));
+        }
+        d.entries.reserve(trackedCount + added.size());
+        std::error_code ec;
+        for (TreeEntry& e : added) {
+            // 链接按读取顺序确认：同一目标只展开第一个
+            if (expand) claim_link(e, path / e.p, *_links);
+            const bool sub = e.isDir && expand && !fs::exists(path / e.p / ".git", ec);
+            d.entries.push_back(std::move(e));
+            d.sub.push_back(sub ? (uint32_t)_dirs.size() : NO_LISTED_DIR);
+            if (sub) _dirs.emplace_back();
+        }
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 归档文件 (-i <file.zip|file.tar|file.tar.gz>)
+// ----------------------------------------------------------------------------
+
+// DEFLATE 解码 (RFC 1951)，只用于顺序扫描 .tar.gz 的头部：输出按段交给 sink，超出 32 KB 回溯窗口的部分随即丢弃
+// 码长不超过 FAST_BITS 的符号 (绝大多数) 查表一次解得，更长的码按规范 Huffman 逐位解码
+class Inflater {
+public:
+    enum Result { DONE, STOPPED, CORRUPT };
+
+    // 解码 in 开头的一个 DEFLATE 流，used 为消耗的输入字节数；sink(const char*, size_t) 返回 false 时提前结束
+    template <class Sink>
+    Result run(const unsigned char* in, size_t size, size_t& used, Sink&& sink) {
+        _in = in;
+        _size = size;
+        _pos = 0;
+        _bits = 0;
+        _bitCount = 0;
+        _fill = 0;
+        _flushed = 0;
+        _stopped = false;
+        Result r = blocks(sink);
+        if (r == DONE && !flush(sink)) r = STOPPED;
+        used = _pos - _bitCount / 8;  // 预读而未用到的整字节退回
+        return r;
+    }
+
+private:
+    static constexpr int MAX_BITS = 15;
+    static constexpr int FAST_BITS = 10;
+    static constexpr size_t WINDOW = 32768;
+    static constexpr size_t OUT_SIZE = WINDOW * 4;
+
+    struct Huffman {
+        uint16_t fast[1 << FAST_BITS];  // 按位倒序的前 FAST_BITS 位 -> (符号 << 4) | 码长，0 表示码长超过 FAST_BITS
+        uint16_t count[MAX_BITS + 1];
+        uint16_t symbol[288];
+
+        // 码长不合法 (超额订阅) 时返回 false；不完整的码表允许 (只有一个距离码的流)
+        bool build(const uint8_t* lengths, int n) {
+            std::memset(count, 0, sizeof(count));
+            for (int i = 0; i < n; ++i) ++count[lengths[i]];
+            count[0] = 0;
+            int left = 1;
+            for (int len = 1; len <= MAX_BITS; ++len) {
+                left = (left << 1) - count[len];
+                if (left < 0) return false;
+            }
+            uint16_t offs[MAX_BITS + 2];
+            offs[1] = 0;
+            for (int len = 1; len <= MAX_BITS; ++len) offs[len + 1] = offs[len] + count[len];
+            for (int i = 0; i < n; ++i) {
+                if (lengths[i]) symbol[offs[lengths[i]]++] = (uint16_t)i;
+            }
+            std::memset(fast, 0, sizeof(fast));
+            int code = 0, index = 0;
+            for (int len = 1; len <= FAST_BITS; ++len) {
+                for (int k = 0; k < count[len]; ++k, ++code, ++index) {
+                    int rev = 0;
+                    for (int b = 0; b < len; ++b) rev |= ((code >> b) & 1) << (len - 1 - b);
+                    for (int fill = rev; fill < (1 << FAST_BITS); fill += 1 << len) fast[fill] = (uint16_t)(symbol[index] << 4 | len);
+                }
+                code <<= 1;
+            }
+            return true;
+        }
+    };
+
+    const unsigned char* _in = nullptr;
+    size_t _size = 0, _pos = 0;
+    uint64_t _bits = 0;
+    int _bitCount = 0;
+    bool _overrun = false;
+    std::vector<unsigned char> _out = std::vector<unsigned char>(OUT_SIZE);
+    size_t _fill = 0, _flushed = 0;
+    bool _stopped = false;
+    Huffman _lit, _dist;
+
+    void refill() {
+        while (_bitCount <= 56) {
+            if (_pos < _size) _bits |= (uint64_t)_in[_pos] << _bitCount;
+            else if (_bitCount > 0 && _pos >= _size + 8) break;  // 输入已尽：补零位，读到补零部分即为截断
+            ++_pos;
+            _bitCount += 8;
+        }
+    }
+    uint32_t take(int n) {
+        if (_bitCount < n) refill();
+        uint32_t v = (uint32_t)(_bits & ((1ull << n) - 1));
+        _bits >>= n;
+        _bitCount -= n;
+        return v;
+    }
+    bool truncated() const { return _pos - _bitCount / 8 > _size; }
+
+    int decode(const Huffman& h) {
+        if (_bitCount < MAX_BITS) refill();
+        const uint16_t f = h.fast[_bits & ((1u << FAST_BITS) - 1)];
+        if (f) {
+            take(f & 15);
+            return f >> 4;
+        }
+        int code = 0, first = 0, index = 0;
+        for (int len = 1; len <= MAX_BITS; ++len) {
+            code |= (int)take(1);
+            const int count = h.count[len];
+            if (code - count < first) return h.symbol[index + (code - first)];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+
+    template <class Sink>
+    bool flush(Sink& sink) {
+        if (_fill > _flushed && !sink((const char*)_out.data() + _flushed, _fill - _flushed)) { _stopped = true; return false; }
+        _flushed = _fill;
+        return true;
+    }
+    // 缓冲已满：交出未交出的部分，只保留最后 32 KB 供回溯
+    template <class Sink>
+    bool put(unsigned char c, Sink& sink) {
+        if (_fill == OUT_SIZE) {
+            if (!flush(sink)) return false;
+            std::memmove(_out.data(), _out.data() + OUT_SIZE - WINDOW, WINDOW);
+            _fill = _flushed = WINDOW;
+        }
+        _out[_fill++] = c;
+        return true;
+    }
+
+    template <class Sink>
+    Result blocks(Sink& sink) {
+        static const uint16_t LEN_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+        static const uint8_t LEN_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+        static const uint16_t DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+        static const uint8_t DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+        size_t total = 0;  // 已输出的字节数 (距离不能超出)
+        for (bool last = false; !last;) {
+            last = take(1) != 0;
+            const uint32_t type = take(2);
+            if (type == 0) {
+                // 存储块：丢弃到字节边界的位，随后是 LEN、NLEN 与原样数据
+                take(_bitCount % 8);
+                const uint32_t len = take(16), nlen = take(16);
+                if (truncated() || (len ^ 0xFFFF) != nlen) return CORRUPT;
+                for (uint32_t i = 0; i < len; ++i) {
+                    if (!put((unsigned char)take(8), sink)) return STOPPED;
+                }
+                if (truncated()) return CORRUPT;
+                total += len;
+                continue;
+            }
+            if (type == 1) {
+                uint8_t lengths[320];
+                std::memset(lengths, 8, 144);
+                std::memset(lengths + 144, 9, 112);
+                std::memset(lengths + 256, 7, 24);
+                std::memset(lengths + 280, 8, 8);
+                _lit.build(lengths, 288);
+                std::memset(lengths, 5, 30);
+                _dist.build(lengths, 30);
+            }
+            else if (type == 2) {
+                if (!dynamic_tables()) return CORRUPT;
+            }
+            else {
+                return CORRUPT;
+            }
+            for (;;) {
+                const int sym = decode(_lit);
+                if (sym < 0 || truncated()) return CORRUPT;
+                if (sym < 256) {
+                    if (!put((unsigned char)sym, sink)) return STOPPED;
+                    ++total;
+                    continue;
+                }
+                if (sym == 256) break;
+                if (sym > 285) return CORRUPT;
+                const uint32_t len = LEN_BASE[sym - 257] + take(LEN_EXTRA[sym - 257]);
+                const int d = decode(_dist);
+                if (d < 0 || d > 29) return CORRUPT;
+                const uint32_t dist = DIST_BASE[d] + take(DIST_EXTRA[d]);
+                if (dist > total || truncated()) return CORRUPT;
+                for (uint32_t i = 0; i < len; ++i) {
+                    if (!put(_out[_fill - dist], sink)) return STOPPED;
+                }
+                total += len;
+            }
+        }
+        return DONE;
+    }
+
+    bool dynamic_tables() {
+        static const uint8_t ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+        const int nlen = (int)take(5) + 257, ndist = (int)take(5) + 1, ncode = (int)take(4) + 4;
+        if (nlen > 286 || ndist > 30) return false;
+        uint8_t lengths[320] = {};
+        for (int i = 0; i < ncode; ++i) lengths[ORDER[i]] = (uint8_t)take(3);
+        if (!_lit.build(lengths, 19)) return false;
+        for (int i = 0; i < nlen + ndist;) {
+            const int sym = decode(_lit);
+            if (sym < 0 || truncated()) return false;
+            if (sym < 16) { lengths[i++] = (uint8_t)sym; continue; }
+            uint8_t value = 0;
+            int repeat;
+            if (sym == 16) {
+                if (i == 0) return false;
+                value = lengths[i - 1];
+                repeat = 3 + (int)take(2);
+            }
+            else if (sym == 17) repeat = 3 + (int)take(3);
+            else repeat = 11 + (int)take(7);
+            if (i + repeat > nlen + ndist) return false;
+            while (repeat--) lengths[i++] = value;
+        }
+        if (lengths[256] == 0) return false;  // 必须有块结束符
+        return _lit.build(lengths, nlen) && _dist.build(lengths + nlen, ndist);
+    }
+};
+
+// gzip (RFC 1952)：跳过成员头，解压其中的 DEFLATE 流；多个成员首尾相接时依次解压
+template <class Sink>
+Inflater::Result gunzip(const char* data, size_t size, Sink&& sink) {
+    const unsigned char* p = (const unsigned char*)data;
+    Inflater inflater;
+    size_t off = 0;
+    do {
+        if (size - off < 18 || p[off] != 0x1F || p[off + 1] != 0x8B || p[off + 2] != 8) return Inflater::CORRUPT;
+        const unsigned flags = p[off + 3];
+        size_t pos = off + 10;
+        if (flags & 4) {  // FEXTRA
+            if (size - pos < 2) return Inflater::CORRUPT;
+            pos += 2 + (p[pos] | (size_t)p[pos + 1] << 8);
+        }
+        for (unsigned bit : { 8u, 16u }) {  // FNAME、FCOMMENT：以 NUL 结尾
+            if (!(flags & bit)) continue;
+            while (pos < size && p[pos] != 0) ++pos;
+            ++pos;
+        }
+        if (flags & 2) pos += 2;  // FHCRC
+        if (pos >= size) return Inflater::CORRUPT;
+        size_t used = 0;
+        Inflater::Result r = inflater.run(p + pos, size - pos, used, sink);
+        if (r != Inflater::DONE) return r;
+        off = pos + used + 8;  // CRC32 与原始长度 (列目录不校验内容)
+    } while (off + 2 <= size && p[off] == 0x1F && p[off + 1] == 0x8B);
+    return Inflater::DONE;
+}
+
+// 归档中的一项；path 为 UTF-8、/ 分隔，目录以 / 结尾
+struct ArchiveItem {
+    std::string path;
+    int64_t mtime;
+    uint64_t size;
+};
+
+// 规范化归档中的路径：\ 视为分隔符，去掉开头的 /、盘符、空段与 . 段 (.. 原样保留为名称)；目录补上结尾的 /
+inline std::string archive_path(std::string_view raw, bool isDir) {
+    std::string out;
+    if (raw.size() >= 2 && raw[1] == ':') raw.remove_prefix(2);
+    size_t start = 0;
+    while (start <= raw.size()) {
+        size_t end = raw.find_first_of("/\\", start);
+        if (end == std::string_view::npos) end = raw.size();
+        std::string_view part = raw.substr(start, end - start);
+        if (!part.empty() && part != ".") {
+            if (!out.empty()) out += '/';
+            out.append(part);
+        }
+        start = end + 1;
+    }
+    if (isDir && !out.empty()) out += '/';
+    return out;
+}
+
+// tar 头部的顺序扫描 (ustar、GNU 长文件名与 pax 扩展头)：每个 512 字节的头部之后按大小跳过内容
+// 数据可分段送入 (.tar.gz 边解压边扫描)；整个映射一次送入时跳过内容只是移动偏移，不会读到内容所在的页
+class TarScanner {
+public:
+    explicit TarScanner(std::vector<ArchiveItem>& items) : _items(items) {}
+
+    // 到达结束标记 (两个全零块) 或头部校验失败时返回 false
+    bool feed(const char* p, size_t n) {
+        while (n > 0) {
+            if (_skip > 0) {
+                const uint64_t k = std::min<uint64_t>(_skip, n);
+                if (_collect) _extra.append(p, std::min<uint64_t>(k, _collect));
+                _collect -= std::min<uint64_t>(k, _collect);
+                _skip -= k;
+                p += k;
+                n -= (size_t)k;
+                if (_skip == 0 && _pending) extended();
+                continue;
+            }
+            const size_t k = std::min(n, BLOCK - _fill);
+            std::memcpy(_block + _fill, p, k);
+            _fill += k;
+            p += k;
+            n -= k;
+            if (_fill < BLOCK) break;
+            _fill = 0;
+            if (!header()) return false;
+        }
+        return true;
+    }
+
+    // 至少读到一个合法头部且没有校验失败
+    bool valid() const { return _headers > 0 && !_corrupt; }
+
+private:
+    static constexpr size_t BLOCK = 512;
+
+    std::vector<ArchiveItem>& _items;
+    char _block[BLOCK];
+    size_t _fill = 0;
+    uint64_t _skip = 0;      // 当前内容 (含补齐) 尚需跳过的字节
+    uint64_t _collect = 0;   // 其中需要收集到 _extra 的字节 (长文件名、pax 扩展头)
+    char _pending = 0;       // 正在收集的扩展头类型
+    std::string _extra;
+    std::string _longName;   // GNU 'L' 或 pax path，作用于下一项
+    bool _paxSize = false, _paxMtime = false;
+    uint64_t _size = 0;
+    int64_t _mtime = 0;
+    int _zeros = 0;
+    size_t _headers = 0;
+    bool _corrupt = false;
+
+    // 数值字段：八进制 (可有前导空格，以空格或 NUL 结尾)，或首字节最高位置位的大端二进制 (GNU)
+    static uint64_t number(const char* f, size_t len) {
+        uint64_t v = 0;
+        if ((unsigned char)f[0] & 0x80) {
+            for (size_t i = 1; i < len; ++i) v = (v << 8) | (unsigned char)f[i];
+            return v;
+        }
+        size_t i = 0;
+        while (i < len && f[i] == ' ') ++i;
+        for (; i < len && f[i] >= '0' && f[i] <= '7'; ++i) v = (v << 3) | (uint64_t)(f[i] - '0');
+        return v;
+    }
+
+    static std::string_view field(const char* f, size_t len) {
+        const void* nul = std::memchr(f, 0, len);
+        return std::string_view(f, nul ? (size_t)((const char*)nul - f) : len);
+    }
+
+    bool header() {
+        if (std::all_of(_block, _block + BLOCK, [](char c) { return c == 0; })) return ++_zeros < 2;
+        _zeros = 0;
+        uint64_t sum = 8 * ' ';
+        for (size_t i = 0; i < BLOCK; ++i) {
+            if (i < 148 || i >= 156) sum += (unsigned char)_block[i];
+        }
+        if (sum != number(_block + 148, 8)) { _corrupt = true; return false; }
+        ++_headers;
+
+        const char type = _block[156];
+        const uint64_t size = number(_block + 124, 12);
+        _skip = (size + BLOCK - 1) / BLOCK * BLOCK;
+        if (type == 'L' || type == 'x') {
+            _pending = type;
+            _collect = size;
+            _extra.clear();
+            if (_skip == 0) extended();
+            return true;
+        }
+        if (type == 'K' || type == 'g') return true;  // 长链接目标、全局 pax 头
+
+        std::string name;
+        if (!_longName.empty()) {
+            name.swap(_longName);
+        }
+        else {
+            if (std::memcmp(_block + 257, "ustar", 5) == 0 && _block[345] != 0) {
+                name.assign(field(_block + 345, 155));
+                name += '/';
+            }
+            name.append(field(_block, 100));
+        }
+        const bool isDir = type == '5' || type == 'D' || (!name.empty() && name.back() == '/');
+        const uint64_t itemSize = _paxSize ? _size : (type == '0' || type == '\0' || type == '7' || type == 'S') ? size : 0;
+        const int64_t mtime = _paxMtime ? _mtime : file_time_from_unix_ns((int64_t)number(_block + 136, 12) * 1000000000);
+        _paxSize = _paxMtime = false;
+        std::string path = archive_path(name, isDir);
+        if (!path.empty()) _items.push_back(ArchiveItem{ std::move(path), mtime, isDir ? 0 : itemSize });
+        return true;
+    }
+
+    // 扩展头的内容收集完毕：GNU 长文件名，或 pax 记录 "<长度> <键>=<值>\n" 中的 path、size、mtime
+    void extended() {
+        const char type = _pending;
+        _pending = 0;
+        if (type == 'L') {
+            _longName.assign(field(_extra.data(), _extra.size()));
+            return;
+        }
+        std::string_view rec(_extra);
+        while (!rec.empty()) {
+            size_t len = 0, i = 0;
+            while (i < rec.size() && rec[i] >= '0' && rec[i] <= '9') len = len * 10 + (size_t)(rec[i++] - '0');
+            if (len <= i || len > rec.size()) break;
+            std::string_view kv = rec.substr(i + 1, len - i - 2);
+            rec.remove_prefix(len);
+            const size_t eq = kv.find('=');
+            if (eq == std::string_view::npos) continue;
+            const std::string_view key = kv.substr(0, eq), value = kv.substr(eq + 1);
+            if (key == "path") _longName.assign(value);
+            else if (key == "size") {
+                _size = std::strtoull(std::string(value).c_str(), nullptr, 10);
+                _paxSize = true;
+            }
+            else if (key == "mtime") {
+                // 十进制秒，可带小数部分
+                const double sec = std::strtod(std::string(value).c_str(), nullptr);
+                _mtime = file_time_from_unix_ns((int64_t)(sec * 1e9));
+                _paxMtime = true;
+            }
+        }
+    }
+};
+
+// zip：只读中央目录 (文件末尾的目录记录)，不读取也不解压任何条目的内容
+// 支持 ZIP64 (条目数、偏移或大小超过 32 位)；未标记 UTF-8 且不是合法 UTF-8 的文件名按 GB18030 解码 (中文 Windows 创建的归档)
+namespace ZipDir {
+    inline uint16_t le16(const unsigned char* p) { return (uint16_t)(p[0] | p[1] << 8); }
+    inline uint32_t le32(const unsigned char* p) { return (uint32_t)le16(p) | (uint32_t)le16(p + 2) << 16; }
+    inline uint64_t le64(const unsigned char* p) { return (uint64_t)le32(p) | (uint64_t)le32(p + 4) << 32; }
+
+    // DOS 日期时间 (本地时间，2 秒精度)
+    inline int64_t dos_time(uint16_t date, uint16_t time) {
+        std::tm tm{};
+        tm.tm_year = (date >> 9) + 80;
+        tm.tm_mon = ((date >> 5) & 15) - 1;
+        tm.tm_mday = date & 31;
+        tm.tm_hour = time >> 11;
+        tm.tm_min = (time >> 5) & 63;
+        tm.tm_sec = (time & 31) * 2;
+        tm.tm_isdst = -1;
+        return file_time_from_unix_ns((int64_t)std::mktime(&tm) * 1000000000);
+    }
+
+    inline bool read(const char* data, size_t size, std::vector<ArchiveItem>& items) {
+        const unsigned char* p = (const unsigned char*)data;
+        if (size < 22) return false;
+        // 目录结束记录在末尾 22 字节 + 至多 64 KB 注释之内
+        size_t eocd = size - 22;
+        const size_t lowest = size > 22 + 65535 ? size - 22 - 65535 : 0;
+        while (std::memcmp(p + eocd, "PK\x05\x06", 4) != 0) {
+            if (eocd == lowest) return false;
+            --eocd;
+        }
+        uint64_t count = le16(p + eocd + 10), dirSize = le32(p + eocd + 12), dirOff = le32(p + eocd + 16);
+        if ((count == 0xFFFF || dirSize == 0xFFFFFFFF || dirOff == 0xFFFFFFFF) && eocd >= 20 && std::memcmp(p + eocd - 20, "PK\x06\x07", 4) == 0) {
+            const uint64_t rec = le64(p + eocd - 20 + 8);
+            if (rec > size - 56 || std::memcmp(p + rec, "PK\x06\x06", 4) != 0) return false;
+            count = le64(p + rec + 32);
+            dirSize = le64(p + rec + 40);
+            dirOff = le64(p + rec + 48);
+        }
+        if (dirOff > size || dirSize > size - dirOff) return false;
+
+        std::vector<size_t> legacy;  // 需按 GB18030 转码的条目
+        size_t off = (size_t)dirOff;
+        const size_t end = (size_t)(dirOff + dirSize);
+        items.reserve(items.size() + (size_t)std::min<uint64_t>(count, dirSize / 46));
+        for (uint64_t i = 0; i < count; ++i) {
+            if (end - off < 46 || std::memcmp(p + off, "PK\x01\x02", 4) != 0) return false;
+            const unsigned char* h = p + off;
+            const uint16_t flags = le16(h + 8);
+            const size_t nameLen = le16(h + 28), extraLen = le16(h + 30), commentLen = le16(h + 32);
+            if (end - off - 46 < nameLen + extraLen + commentLen) return false;
+            std::string_view name(data + off + 46, nameLen);
+            uint64_t usize = le32(h + 24);
+            int64_t mtime = dos_time(le16(h + 14), le16(h + 12));
+            // 扩展字段：0x0001 ZIP64 (原始大小在最前)、0x5455 扩展时间戳 (Unix 秒)
+            for (const unsigned char* x = h + 46 + nameLen, *xe = x + extraLen; xe - x >= 4;) {
+                const uint16_t id = le16(x), len = le16(x + 2);
+                if ((size_t)(xe - x - 4) < len) break;
+                if (id == 0x0001 && usize == 0xFFFFFFFF && len >= 8) usize = le64(x + 4);
+                if (id == 0x5455 && len >= 5 && (x[4] & 1)) mtime = file_time_from_unix_ns((int64_t)(int32_t)le32(x + 5) * 1000000000);
+                x += 4 + len;
+            }
+            // 目录：名称以 / 结尾，或 MS-DOS 属性中的目录位
+            const bool isDir = (!name.empty() && (name.back() == '/' || name.back() == '\\')) || ((h[5] == 0 || h[5] == 11 || h[5] == 14) && (le32(h + 38) & 0x10));
+            if (!(flags & 0x800) && !is_valid_utf8((const unsigned char*)name.data(), name.size())) legacy.push_back(items.size());
+            items.push_back(ArchiveItem{ std::string(name), mtime, isDir ? 0 : usize });
+            if (isDir) items.back().path += '/';
+            off += 46 + nameLen + extraLen + commentLen;
+        }
+
+        // 旧式文件名一次转码 (以 NUL 分隔拼接)，避免每项各做一次
+        if (!legacy.empty()) {
+            std::string joined, utf8;
+            for (size_t idx : legacy) { joined += items[idx].path; joined += '\0'; }
+            transcode_to_utf8(joined, ENC_GB18030, [&](const char* s, size_t n) { utf8.append(s, n); return true; });
+            size_t pos = 0;
+            for (size_t idx : legacy) {
+                const size_t nul = std::min(utf8.find('\0', pos), utf8.size());
+                items[idx].path.assign(utf8, pos, nul - pos);
+                pos = nul + 1;
+            }
+        }
+        for (ArchiveItem& item : items) {
+            const bool isDir = item.path.back() == '/';
+            item.path = archive_path(item.path, isDir);
+        }
+        return true;
+    }
+}
+
+// 由归档的条目列表建树 (见 ListedTree)：zip 读中央目录，tar 顺序扫描头部，.tar.gz 边解压边扫描 (按内容识别，不看扩展名)
+// 重复的路径以最后一项为准 (与解压结果一致)；归档中只有目录结构，--gitignore 等依赖磁盘的嵌套规则不生效
+class ArchiveTree : public ListedTree {
+public:
+    using ListedTree::ListedTree;
+
+    // 无法读取或不是支持的归档格式时返回 false
+    bool build(const fs::path& file) {
+        MappedFile map;
+        if (!map.open(file)) return false;
+        std::vector<ArchiveItem> items;
+        {
+            ScopedPhase phase(PHASE_ENUMERATE);
+            const char* data = map.data();
+            const size_t size = map.size();
+            bool ok;
+            if (size >= 4 && (std::memcmp(data, "PK\x03\x04", 4) == 0 || std::memcmp(data, "PK\x05\x06", 4) == 0)) {
+                ok = ZipDir::read(data, size, items);
+            }
+            else {
+                TarScanner tar(items);
+                // 截断或损坏时与未压缩的 tar 一样，列出损坏处之前读到的条目
+                if (size >= 2 && (unsigned char)data[0] == 0x1F && (unsigned char)data[1] == 0x8B) gunzip(data, size, [&](const char* p, size_t n) { return tar.feed(p, n); });
+                else tar.feed(data, size);
+                ok = tar.valid();
+            }
+            if (!ok) return false;
+            stat_add(STAT_ARCHIVE_ENTRIES, items.size());
+        }
+
+        std::stable_sort(items.begin(), items.end(), [](const ArchiveItem& a, const ArchiveItem& b) { return a.path < b.path; });
+        reset();
+        for (size_t i = 0; i < items.size(); ++i) {
+            if (i + 1 < items.size() && items[i + 1].path == items[i].path) continue;
+            add(items[i].path, false, items[i].mtime, items[i].size);
+        }
+        finish(0);
+        return true;
+    }
+
+private:
+    // 生成排序键并排序；归档中没有单独条目的目录取其内容中最新的修改时间，返回本目录内容的最新修改时间
+    int64_t finish(uint32_t id) {
+        ListedDir& d = _dirs[id];
+        int64_t latest = 0;
+        for (size_t i = 0; i < d.entries.size(); ++i) {
+            TreeEntry& e = d.entries[i];
+            if (d.sub[i] != NO_LISTED_DIR) {
+                const int64_t inner = finish(d.sub[i]);
+                if (e.mtime == 0) e.mtime = inner;
+            }
+            latest = std::max(latest, e.mtime);
+            build_sort_key(e.key, e.name, e.isDir, e.mtime, e.size);
+        }
+        sort_dir(d);
+        return latest;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 持久化目录索引 (--cache)
+// ----------------------------------------------------------------------------
+
+// 索引文件为本机格式：Header | DirRecord[] | EntryRecord[] | 名称区 (原生字符)
+// 目录按先序编号，0 为根目录；子目录编号总是大于父目录，因此不可能成环
+namespace TreeIndex {
+    constexpr char MAGIC[8] = { 'C', 'T', 'R', 'E', 'E', 'I', 'D', 'X' };
+    constexpr uint32_t VERSION = 2;
+    constexpr uint32_t NO_DIR = 0xFFFFFFFFu;
+    constexpr uint32_t ENTRY_DIR = 1;
+    constexpr uint32_t ENTRY_UTF8 = 2;  // 名称字节即合法 UTF-8，可直接写出
+    // 修改时间距写入时刻过近 (同一时间粒度内可能再被修改)，下次必须重新读取
+    constexpr int64_t UNSTABLE_MTIME = INT64_MIN;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t charSize;
+        uint64_t listingKey;
+        uint32_t dirCount;
+        uint32_t entryCount;
+        uint64_t namesLength;
+        uint32_t rootOff;
+        uint32_t rootLen;
+    };
+
+    struct DirRecord {
+        int64_t mtime;
+        uint64_t scopeKey;     // 过滤本目录时生效的嵌套忽略作用域指纹 (未启用时为 0)
+        uint32_t ignoreFiles;  // 本目录中的嵌套忽略文件 (IGNORE_FILE_*)，复用时据此重建作用域
+        uint32_t firstEntry;
+        uint32_t entryCount;
+        uint32_t reserved;
+    };
+
+    struct EntryRecord {
+        uint32_t nameOff;
+        uint32_t nameLen;
+        uint32_t childDir;
+        uint32_t flags;
+    };
+
+    using NativeChar = fs::path::value_type;
+
+    // 只读视图：打开时完整校验，之后的访问无需再做边界检查
+    class Reader {
+        MappedFile _file;
+        const DirRecord* _dirs = nullptr;
+        const EntryRecord* _entries = nullptr;
+        const NativeChar* _names = nullptr;
+        uint32_t _dirCount = 0;
+
+    public:
+        bool open(const fs::path& file, uint64_t listingKey, NativeStringView root) {
+            _dirCount = 0;
+            if (!_file.open(file) || _file.size() < sizeof(Header)) return false;
+
+            Header h;
+            std::memcpy(&h, _file.data(), sizeof(h));
+            if (std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.version != VERSION ||
+                h.charSize != sizeof(NativeChar) || h.listingKey != listingKey || h.dirCount == 0) return false;
+
+            uint64_t dirsBytes = (uint64_t)h.dirCount * sizeof(DirRecord);
+            uint64_t entriesBytes = (uint64_t)h.entryCount * sizeof(EntryRecord);
+            uint64_t namesBytes = h.namesLength * sizeof(NativeChar);
+            if (sizeof(Header) + dirsBytes + entriesBytes + namesBytes != _file.size()) return false;
+            if ((uint64_t)h.rootOff + h.rootLen > h.namesLength) return false;
+
+            _dirs = reinterpret_cast<const DirRecord*>(_file.data() + sizeof(Header));
+            _entries = reinterpret_cast<const EntryRecord*>(_file.data() + sizeof(Header) + dirsBytes);
+            _names = reinterpret_cast<const NativeChar*>(_file.data() + sizeof(Header) + dirsBytes + entriesBytes);
+            if (NativeStringView(_names + h.rootOff, h.rootLen) != root) return false;
+
+            // 每个目录最多被引用一次，且只能被编号更小的目录引用
+            std::vector<bool> referenced(h.dirCount, false);
+            for (uint32_t d = 0; d < h.dirCount; ++d) {
+                const DirRecord& dir = _dirs[d];
+                if ((uint64_t)dir.firstEntry + dir.entryCount > h.entryCount) return false;
+                for (uint32_t i = 0; i < dir.entryCount; ++i) {
+                    const EntryRecord& e = _entries[dir.firstEntry + i];
+                    if ((uint64_t)e.nameOff + e.nameLen > h.namesLength || e.nameLen == 0) return false;
+                    if (e.childDir == NO_DIR) continue;
+                    if (!(e.flags & ENTRY_DIR) || e.childDir <= d || e.childDir >= h.dirCount || referenced[e.childDir]) return false;
+                    referenced[e.childDir] = true;
+                }
+            }
+            _dirCount = h.dirCount;
+            return true;
+        }
+
+        void close() { _file.close(); _dirCount = 0; }
+        bool valid() const { return _dirCount > 0; }
+        const DirRecord& dir(uint32_t d) const { return _dirs[d]; }
+        const EntryRecord& entry(uint32_t i) const { return _entries[i]; }
+        NativeStringView name(const EntryRecord& e) const { return NativeStringView(_names + e.nameOff, e.nameLen); }
+    };
+
+    // 新索引在遍历过程中按先序构建，结束后整体写入临时文件再替换旧文件
+    class Builder {
+        std::vector<DirRecord> _dirs;
+        std::vector<EntryRecord> _entries;
+        std::basic_string<NativeChar> _names;
+        uint32_t _rootOff = 0;
+        uint32_t _rootLen = 0;
+
+    public:
+        explicit Builder(NativeStringView root) {
+            _rootLen = (uint32_t)root.size();
+            _names.append(root);
+        }
+
+        uint32_t add_dir(int64_t mtime, uint64_t scopeKey, uint32_t ignoreFiles) {
+            _dirs.push_back({ mtime, scopeKey, ignoreFiles, (uint32_t)_entries.size(), 0, 0 });
+            return (uint32_t)_dirs.size() - 1;
+        }
+
+        // 目录的全部子项必须连续追加
+        void add_entry(uint32_t dir, NativeStringView name, bool isDir, bool isUtf8) {
+            _entries.push_back({ (uint32_t)_names.size(), (uint32_t)name.size(), NO_DIR,
+                                 (isDir ? ENTRY_DIR : 0u) | (isUtf8 ? ENTRY_UTF8 : 0u) });
+            _names.append(name);
+            _dirs[dir].entryCount++;
+        }
+
+        void set_child(uint32_t entryIndex, uint32_t childDir) { _entries[entryIndex].childDir = childDir; }
+        uint32_t next_dir() const { return (uint32_t)_dirs.size(); }
+        uint32_t first_entry(uint32_t dir) const { return _dirs[dir].firstEntry; }
+
+        bool write(const fs::path& file, uint64_t listingKey) const {
+            Header h{};
+            std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+            h.version = VERSION;
+            h.charSize = sizeof(NativeChar);
+            h.listingKey = listingKey;
+            h.dirCount = (uint32_t)_dirs.size();
+            h.entryCount = (uint32_t)_entries.size();
+            h.namesLength = _names.size();
+            h.rootOff = _rootOff;
+            h.rootLen = _rootLen;
+
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(_dirs.data()), _dirs.size() * sizeof(DirRecord));
+            out.write(reinterpret_cast<const char*>(_entries.data()), _entries.size() * sizeof(EntryRecord));
+            out.write(reinterpret_cast<const char*>(_names.data()), _names.size() * sizeof(NativeChar));
+            return out.good();
+        }
+    };
+}
+
+// 带索引的遍历上下文：old 为上次的索引 (可能无效)，fresh 为本次构建的新索引
+struct CachedWalk {
+    const TreeIndex::Reader& old;
+    TreeIndex::Builder& fresh;
+    const TreeIgnore& ignore;
+    int64_t now;
+    LineBudget* budget;  // --max-lines，未限制时为空
+    LinkTargets& links;  // 重新枚举的目录中的链接按读取顺序确认 (复用的列表沿用上次的结果)
+};
+
+// 写出一行：POSIX 下已确认为 UTF-8 的名称直接写出原始字节，省去转换
+template <class Writer>
+void write_native_line(Writer& writer, const std::wstring& prefix, bool isLast, NativeStringView name, bool isDir, bool isUtf8) {
+    std::wstring_view branch(isLast ? U_LAST : U_BRANCH);
+    std::wstring_view folder = isDir ? std::wstring_view(U_FOLDER) : std::wstring_view();
+#ifdef _WIN32
+    (void)isUtf8;
+    writer.writeLine(std::wstring_view(prefix), branch, name, folder);
+#else
+    if (isUtf8) writer.writeLine(std::wstring_view(prefix), branch, std::string_view(name), folder);
+    else writer.writeLine(std::wstring_view(prefix), branch, std::wstring_view(to_wide(name)), folder);
+#endif
+}
+
+inline bool native_is_utf8(NativeStringView native, const std::wstring& wide) {
+#ifdef _WIN32
+    (void)native; (void)wide;
+    return false;
+#else
+    return to_utf8(wide) == native;
+#endif
+}
+
+// oldDir 为该目录在旧索引中的编号 (NO_DIR 表示没有可复用的记录)；scope 为父目录的嵌套忽略作用域
+// 目录修改时间未变 (且嵌套忽略规则未变) 时直接复用旧索引中的子项列表，否则重新枚举并过滤
+template <class Writer>
+void generate_tree_cached(
+    CachedWalk& walk,
+    uint32_t oldDir,
+    const fs::path& path,
+    const std::wstring& relDir,
+    const std::wstring& prefix,
+    Writer& writer,
+    IgnoreScopePtr scope
+) {
+    using namespace TreeIndex;
+
+    int64_t mtime = 0;
+    stat_add(STAT_CACHE_REVALIDATIONS);
+    bool haveMtime = get_mtime(path, mtime);
+    // 输出文件所在目录每次都重新读取：本次写出的文件不应出现在结果中，下次也不能直接复用
+    bool stable = haveMtime && walk.now - mtime > 2 * FILE_TIME_TICKS_PER_SEC && !walk.ignore.has_excluded_in(relDir);
+    // 文件被写入不改变目录修改时间，按时间/大小排序时列表顺序无法凭此校验
+    bool reuse = stable && !sort_needs_stat() && oldDir != NO_DIR && walk.old.dir(oldDir).mtime == mtime;
+
+    // 忽略文件的内容修改不会改变目录修改时间，需按作用域指纹另行校验
+    DirScan scan{ scope };
+    if (reuse && walk.ignore.nested()) {
+        scan.ignoreFiles = walk.old.dir(oldDir).ignoreFiles;
+        scan.scope = walk.ignore.enter_dir(scan.scope, path, relDir, scan.ignoreFiles);
+        reuse = walk.old.dir(oldDir).scopeKey == (scan.scope ? scan.scope->key : 0);
+        if (!reuse) scan.scope = scope;
+    }
+
+    struct Item { NativeStringView name; bool isDir; bool isUtf8; uint32_t oldChild; };
+    std::vector<Item> items;
+    std::vector<TreeEntry> entries;  // 重新枚举时持有名称存储
+    std::deque<std::basic_string<fs::path::value_type>> linkNames;
+
+    if (reuse) {
+        stat_add(STAT_CACHED_DIRS);
+        const DirRecord& rec = walk.old.dir(oldDir);
+        items.reserve(rec.entryCount);
+        for (uint32_t i = 0; i < rec.entryCount; ++i) {
+            const EntryRecord& e = walk.old.entry(rec.firstEntry + i);
+            items.push_back({ walk.old.name(e), (e.flags & ENTRY_DIR) != 0, (e.flags & ENTRY_UTF8) != 0, e.childDir });
+        }
+    }
+    else {
+        scan.links = &walk.links;
+        entries = collect_entries(path, relDir, walk.ignore, &scan);
+
+        // 子目录按名称对应到旧索引，使未变化的下层目录仍可复用
+        std::unordered_map<NativeStringView, uint32_t> oldChildren;
+        if (oldDir != NO_DIR) {
+            const DirRecord& rec = walk.old.dir(oldDir);
+            for (uint32_t i = 0; i < rec.entryCount; ++i) {
+                const EntryRecord& e = walk.old.entry(rec.firstEntry + i);
+                if (e.childDir != NO_DIR) oldChildren.emplace(walk.old.name(e), e.childDir);
+            }
+        }
+
+        items.reserve(entries.size());
+        // 只有写出的条目参与链接确认 (索引保存完整列表)
+        const size_t claimed = expand_children(relDir) ? (g_limits.maxEntries ? std::min(entries.size(), g_limits.maxEntries) : entries.size()) : 0;
+        for (size_t i = 0; i < entries.size(); ++i) {
+            TreeEntry& e = entries[i];
+            if (i < claimed) claim_link(e, e.p, walk.links);
+            NativeStringView name(e.p.native());
+            name = name.substr(name.size() - e.p.filename().native().size());
+            uint32_t oldChild = NO_DIR;
+            if (e.isDir) {
+                auto it = oldChildren.find(name);
+                if (it != oldChildren.end()) oldChild = it->second;
+            }
+            bool isUtf8 = native_is_utf8(name, e.name);
+            // 未展开的目录链接：名称附带了链接目标，索引中保存显示名称
+            if (e.linkShown) {
+#ifdef _WIN32
+                linkNames.push_back(e.name);
+#else
+                linkNames.push_back(to_utf8(e.name));
+                isUtf8 = true;
+#endif
+                name = linkNames.back();
+            }
+            items.push_back({ name, e.isDir, isUtf8, oldChild });
+        }
+    }
+
+    uint32_t newDir = walk.fresh.add_dir(stable ? mtime : UNSTABLE_MTIME, scan.scope ? scan.scope->key : 0, scan.ignoreFiles);
+    uint32_t first = walk.fresh.first_entry(newDir);
+    for (const auto& it : items) walk.fresh.add_entry(newDir, it.name, it.isDir, it.isUtf8);
+
+    // 索引保存完整列表，输出限制只作用于写出部分
+    const size_t shown = g_limits.maxEntries ? std::min(items.size(), g_limits.maxEntries) : items.size();
+    const bool expand = expand_children(relDir);
+    for (size_t i = 0; i < shown; ++i) {
+        if (walk.budget && !walk.budget->take()) return;
+        const Item& it = items[i];
+        bool isLast = (i == items.size() - 1);
+        write_native_line(writer, prefix, isLast, it.name, it.isDir, it.isUtf8);
+
+        if (it.isDir && expand) {
+            walk.fresh.set_child(first + (uint32_t)i, walk.fresh.next_dir());
+            generate_tree_cached(
+                walk,
+                it.oldChild,
+                path / fs::path(it.name),
+                child_rel_path(relDir, native_to_wide(it.name)),
+                prefix + (isLast ? U_SPACE : U_PIPE),
+                writer,
+                scan.scope
+            );
+        }
+    }
+    if (shown < items.size() && (!walk.budget || walk.budget->take())) {
+        writer.writeLine(std::wstring_view(prefix), std::wstring_view(U_LAST), std::string_view(more_entries_text(items.size() - shown)));
+    }
+}
+
+// 读取旧索引 -> 增量遍历 -> 写入临时文件并替换；索引失效或损坏时等同于全量遍历
+// 输出受限时未访问的目录不会写入新索引，下次完整运行时重新读取
+template <class Writer>
+void generate_tree_with_cache(const fs::path& root, const fs::path& cacheFile, Writer& writer, const TreeIgnore& ignore, LineBudget* budget = nullptr) {
+    // 列表按 --sort 顺序保存，排序方式不同的索引不能复用 (默认名称排序与旧索引兼容)
+    // 链接策略决定哪些目录链接被展开 (always 即加入该选项前的行为，与旧索引兼容)
+    const uint64_t listingKey = ignore.fingerprint() ^ ((uint64_t)g_sortMode * 0x9E3779B97F4A7C15ull) ^
+                                ((uint64_t)(g_linkPolicy ^ LINKS_ALWAYS) * 0xC2B2AE3D27D4EB4Full);
+    NativeStringView rootName(root.native());
+
+    TreeIndex::Reader old;
+    bool haveOld = old.open(cacheFile, listingKey, rootName);
+
+    TreeIndex::Builder fresh(rootName);
+    LinkTargets links(root);
+    CachedWalk walk{ old, fresh, ignore, now_file_time(), budget, links };
+    generate_tree_cached(walk, haveOld ? 0 : TreeIndex::NO_DIR, root, L"", L"", writer, nullptr);
+
+    old.close();
+    fs::path tmp = cacheFile;
+    tmp += ".tmp";
+    std::error_code ec;
+    if (fresh.write(tmp, listingKey)) fs::rename(tmp, cacheFile, ec);
+    else ec = std::make_error_code(std::errc::io_error);
+    if (ec) {
+        fs::remove(tmp, ec);
+        std::cerr << Strings::get(Msg::ERR_CACHE_WRITE) << to_utf8(path_to_wide(cacheFile)) << std::endl;
+    }
+}
+
+// ----------------------------------------------------------------------------
+// 监视模式 (--watch)
+// ----------------------------------------------------------------------------
+
+constexpr uint32_t NO_NODE = 0xFFFFFFFFu;
+
+// 文件系统变化通知：node 为发生变化的目录节点 (Windows 下为 NO_NODE，path 为相对根目录的完整路径)
+// Linux 下 path 仅为目录内的名称；overflow 表示事件丢失，需要全量重建
+// modified 表示文件内容被写入 (仅在关注嵌套忽略文件时上报)
+struct WatchEvent {
+    uint32_t node;
+    std::wstring path;
+    bool overflow;
+    bool modified = false;
+};
+
+#if defined(_WIN32)
+// Windows：对根目录发起一次递归 ReadDirectoryChangesW，无需逐目录注册
+class DirWatcher {
+    HANDLE _dir = INVALID_HANDLE_VALUE;
+    HANDLE _event = nullptr;
+    OVERLAPPED _ov{};
+    DWORD _filter = FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME;
+    std::vector<DWORD> _buf = std::vector<DWORD>(64 * 1024 / sizeof(DWORD));
+
+    bool issue() {
+        ResetEvent(_event);
+        _ov = OVERLAPPED{};
+        _ov.hEvent = _event;
+        return ReadDirectoryChangesW(_dir, _buf.data(), (DWORD)(_buf.size() * sizeof(DWORD)), TRUE,
+                                     _filter, nullptr, &_ov, nullptr) != 0;
+    }
+
+public:
+    ~DirWatcher() {
+        if (_dir != INVALID_HANDLE_VALUE) { CancelIo(_dir); CloseHandle(_dir); }
+        if (_event) CloseHandle(_event);
+    }
+
+    // watchWrites：同时关注文件内容写入 (嵌套忽略文件被编辑时需要重新过滤)
+    bool open(const fs::path& root, bool watchWrites) {
+        if (watchWrites) _filter |= FILE_NOTIFY_CHANGE_LAST_WRITE;
+        _dir = CreateFileW(root.wstring().c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, nullptr);
+        if (_dir == INVALID_HANDLE_VALUE) return false;
+        _event = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        return _event && issue();
+    }
+
+    int add(const fs::path&, uint32_t) { return 0; }
+    void remove(int, uint32_t) {}
+
+    // 等待至多 timeoutMs 毫秒 (-1 为无限)；收到事件返回 true
+    template <class Fn>
+    bool wait(int timeoutMs, Fn&& onEvent) {
+        if (WaitForSingleObject(_event, timeoutMs < 0 ? INFINITE : (DWORD)timeoutMs) != WAIT_OBJECT_0) return false;
+        DWORD bytes = 0;
+        if (!GetOverlappedResult(_dir, &_ov, &bytes, FALSE) || bytes == 0) {
+            onEvent(WatchEvent{ NO_NODE, L"", true });  // 缓冲区溢出
+        }
+        else {
+            const char* p = reinterpret_cast<const char*>(_buf.data());
+            for (;;) {
+                auto* info = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(p);
+                onEvent(WatchEvent{ NO_NODE, std::wstring(info->FileName, info->FileNameLength / sizeof(wchar_t)), false,
+                                    info->Action == FILE_ACTION_MODIFIED });
+                if (info->NextEntryOffset == 0) break;
+                p += info->NextEntryOffset;
+            }
+        }
+        issue();
+        return true;
+    }
+};
+#elif defined(__linux__)
+// Linux：inotify 需逐目录注册；同一 inode 可能经符号链接出现多次，因此一个 wd 对应多个节点
+class DirWatcher {
+    int _fd = -1;
+    uint32_t _mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    std::unordered_map<int, std::vector<uint32_t>> _nodes;
+    bool _warned = false;
+    std::vector<char> _buf = std::vector<char>(64 * 1024);
+
+public:
+    ~DirWatcher() { if (_fd >= 0) close(_fd); }
+
+    bool open(const fs::path&, bool watchWrites) {
+        if (watchWrites) _mask |= IN_CLOSE_WRITE;
+        _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        return _fd >= 0;
+    }
+
+    int add(const fs::path& dir, uint32_t node) {
+        int wd = inotify_add_watch(_fd, dir.c_str(), _mask);
+        if (wd < 0) {
+            if (!_warned) std::cerr << Strings::get(Msg::ERR_WATCH_LIMIT) << to_utf8(path_to_wide(dir)) << std::endl;
+            _warned = true;
+            return -1;
+        }
+        _nodes[wd].push_back(node);
+        return wd;
+    }
+
+    void remove(int wd, uint32_t node) {
+        auto it = _nodes.find(wd);
+        if (it == _nodes.end()) return;
+        auto& v = it->second;
+        v.erase(std::remove(v.begin(), v.end(), node), v.end());
+        if (v.empty()) { inotify_rm_watch(_fd, wd); _nodes.erase(it); }
+    }
+
+    template <class Fn>
+    bool wait(int timeoutMs, Fn&& onEvent) {
+        struct pollfd pfd{ _fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeoutMs) <= 0) return false;
+        bool any = false;
+        for (;;) {
+            ssize_t n = read(_fd, _buf.data(), _buf.size());
+            if (n <= 0) break;
+            for (ssize_t off = 0; off < n;) {
+                auto* ev = reinterpret_cast<const struct inotify_event*>(_buf.data() + off);
+                off += sizeof(struct inotify_event) + ev->len;
+                any = true;
+                if (ev->mask & IN_Q_OVERFLOW) { onEvent(WatchEvent{ NO_NODE, L"", true }); continue; }
+                if (ev->mask & IN_IGNORED) { _nodes.erase(ev->wd); continue; }
+                auto it = _nodes.find(ev->wd);
+                if (it == _nodes.end()) continue;
+                std::wstring name = ev->len ? to_wide(std::string_view(ev->name)) : std::wstring();
+                bool modified = (ev->mask & IN_CLOSE_WRITE) != 0;
+                for (uint32_t node : it->second) onEvent(WatchEvent{ node, name, false, modified });
+            }
+        }
+        return any;
+    }
+};
+#else
+// 其他平台暂无通知机制
+class DirWatcher {
+public:
+    bool open(const fs::path&, bool) { return false; }
+    int add(const fs::path&, uint32_t) { return -1; }
+    void remove(int, uint32_t) {}
+    template <class Fn>
+    bool wait(int, Fn&&) { return false; }
+};
+#endif
+
+// 常驻内存的目录节点：text 为本目录自身的行 (不含子树)，childOffsets 为各子目录子树的插入位置
+// 前缀只取决于祖先的 isLast 状态，因此目录变化时只需重绘该目录，以及前缀发生变化的子树
+struct WatchNode {
+    fs::path path;
+    std::wstring relDir;
+    std::wstring prefix;
+    std::vector<TreeEntry> entries;
+    std::vector<uint32_t> children;  // 与 entries 中的目录项按顺序一一对应
+    std::string text;
+    std::vector<size_t> childOffsets;
+    IgnoreScopePtr parentScope;  // 父目录的嵌套忽略作用域 (重新读取本目录时的起点)
+    IgnoreScopePtr scope;        // 本目录的作用域，子目录由此继承
+    int watch = -1;
+    bool alive = true;
+};
+
+class WatchTree {
+    std::deque<WatchNode> _nodes;  // deque 保证扩容时已有节点的引用不失效
+    std::vector<uint32_t> _free;
+    std::unordered_map<std::wstring, uint32_t> _byRel;
+    const TreeIgnore& _ignore;
+    DirWatcher& _watcher;
+    fs::path _rootPath;
+    LinkTargets _links;
+    uint32_t _root = NO_NODE;
+
+    // 实际列出的条目数 (--max-entries-per-dir)；entries 始终保存完整列表以便比较变化
+    static size_t shown(const WatchNode& n) {
+        return g_limits.maxEntries ? std::min(n.entries.size(), g_limits.maxEntries) : n.entries.size();
+    }
+
+    void render(WatchNode& n) {
+        n.text.clear();
+        n.childOffsets.clear();
+        const bool expand = expand_children(n.relDir);
+        const size_t count = shown(n);
+        for (size_t i = 0; i < count; ++i) {
+            append_tree_line(n.text, n.prefix, i == n.entries.size() - 1, n.entries[i].name, n.entries[i].isDir);
+            if (n.entries[i].isDir && expand) n.childOffsets.push_back(n.text.size());
+        }
+        if (count < n.entries.size()) append_more_line(n.text, n.prefix, n.entries.size() - count);
+    }
+
+    // 读取 n 的目录；列出的链接按读取顺序确认 (重新读取时，由同一链接展开的目标仍归该链接)
+    std::vector<TreeEntry> list(const WatchNode& n, DirScan& scan) {
+        scan.links = &_links;
+        std::vector<TreeEntry> entries = collect_entries(n.path, n.relDir, _ignore, &scan);
+        const size_t count = expand_children(n.relDir) ? (g_limits.maxEntries ? std::min(entries.size(), g_limits.maxEntries) : entries.size()) : 0;
+        for (size_t i = 0; i < count; ++i) claim_link(entries[i], entries[i].p, _links);
+        return entries;
+    }
+
+    uint32_t alloc() {
+        if (!_free.empty()) { uint32_t id = _free.back(); _free.pop_back(); _nodes[id] = WatchNode{}; return id; }
+        _nodes.emplace_back();
+        return (uint32_t)_nodes.size() - 1;
+    }
+
+    uint32_t build(fs::path path, std::wstring relDir, std::wstring prefix, IgnoreScopePtr parentScope) {
+        uint32_t id = alloc();
+        WatchNode& n = _nodes[id];
+        n.path = std::move(path);
+        n.relDir = std::move(relDir);
+        n.prefix = std::move(prefix);
+        n.parentScope = std::move(parentScope);
+        n.watch = _watcher.add(n.path, id);
+        _byRel[n.relDir] = id;
+        DirScan scan{ n.parentScope };
+        n.entries = list(n, scan);
+        n.scope = std::move(scan.scope);
+        render(n);
+        if (!expand_children(n.relDir)) return id;
+        for (size_t i = 0, count = shown(n); i < count; ++i) {
+            if (!n.entries[i].isDir) continue;
+            bool isLast = (i == n.entries.size() - 1);
+            n.children.push_back(build(n.entries[i].p, child_rel_path(n.relDir, n.entries[i].name), n.prefix + (isLast ? U_SPACE : U_PIPE), n.scope));
+        }
+        return id;
+    }
+
+    void release(uint32_t id) {
+        WatchNode& n = _nodes[id];
+        for (uint32_t c : n.children) release(c);
+        _watcher.remove(n.watch, id);
+        auto it = _byRel.find(n.relDir);
+        if (it != _byRel.end() && it->second == id) _byRel.erase(it);
+        n = WatchNode{};
+        n.alive = false;
+        _free.push_back(id);
+    }
+
+    void set_prefix(uint32_t id, const std::wstring& prefix) {
+        WatchNode& n = _nodes[id];
+        if (n.prefix == prefix) return;
+        n.prefix = prefix;
+        render(n);
+        size_t k = 0;
+        for (size_t i = 0, count = shown(n); i < count && k < n.children.size(); ++i) {
+            if (!n.entries[i].isDir) continue;
+            set_prefix(n.children[k++], prefix + (i == n.entries.size() - 1 ? U_SPACE : U_PIPE));
+        }
+    }
+
+    void write_node(std::string& out, const WatchNode& n) const {
+        size_t pos = 0;
+        for (size_t k = 0; k < n.children.size(); ++k) {
+            out.append(n.text, pos, n.childOffsets[k] - pos);
+            pos = n.childOffsets[k];
+            write_node(out, _nodes[n.children[k]]);
+        }
+        out.append(n.text, pos, std::string::npos);
+    }
+
+public:
+    WatchTree(const fs::path& root, const TreeIgnore& ignore, DirWatcher& watcher) : _ignore(ignore), _watcher(watcher), _rootPath(root), _links(root) {}
+
+    void rebuild() {
+        if (_root != NO_NODE) release(_root);
+        _links = LinkTargets(_rootPath);
+        _root = build(_rootPath, L"", L"", nullptr);
+    }
+
+    bool alive(uint32_t id) const { return id < _nodes.size() && _nodes[id].alive; }
+
+    // 父目录节点 (根节点返回 NO_NODE)
+    uint32_t parent_of(uint32_t id) const {
+        const std::wstring& relDir = _nodes[id].relDir;
+        if (relDir.empty()) return NO_NODE;
+        size_t cut = relDir.find_last_of(L'\\');
+        auto it = _byRel.find(cut == std::wstring::npos ? std::wstring() : relDir.substr(0, cut));
+        return it != _byRel.end() ? it->second : NO_NODE;
+    }
+    size_t depth(uint32_t id) const { return std::count(_nodes[id].relDir.begin(), _nodes[id].relDir.end(), L'\\'); }
+
+    // 将事件映射到需要重新读取的目录节点；返回 NO_NODE 表示可忽略 (本程序自身写出的文件)
+    uint32_t resolve(const WatchEvent& ev) const {
+        std::wstring relDir, name;
+        if (ev.node != NO_NODE) {
+            relDir = _nodes[ev.node].relDir;
+            name = ev.path;
+        }
+        else {
+            size_t cut = ev.path.find_last_of(L"\\/");
+            if (cut != std::wstring::npos) { relDir = ev.path.substr(0, cut); name = ev.path.substr(cut + 1); }
+            else name = ev.path;
+            std::replace(relDir.begin(), relDir.end(), L'/', L'\\');
+        }
+        if (_ignore.is_excluded(relDir, name)) return NO_NODE;
+        // 内容写入只关心嵌套忽略文件，它会改变所在目录及其子树的过滤结果；按时间/大小排序时任何写入都可能改变顺序
+        if (ev.modified && !sort_needs_stat() && !equals_folded(name, L".gitignore") && !equals_folded(name, IGNORE_FILENAME)) return NO_NODE;
+        if (ev.node != NO_NODE) return ev.node;
+
+        // 找不到时 (如位于被忽略目录内) 上溯到最近的已知目录
+        for (;;) {
+            auto it = _byRel.find(relDir);
+            if (it != _byRel.end()) return it->second;
+            if (relDir.empty()) return _root;
+            size_t cut = relDir.find_last_of(L'\\');
+            relDir = (cut == std::wstring::npos) ? std::wstring() : relDir.substr(0, cut);
+        }
     }
-    return 0;
+
+    // 重新读取单个目录；子项与嵌套忽略作用域均未变化时返回 false
+    bool refresh(uint32_t id) {
+        DirScan scan{ _nodes[id].parentScope };
+        std::vector<TreeEntry> fresh = list(_nodes[id], scan);
+        WatchNode& n = _nodes[id];
+        bool scopeChanged = (scan.scope ? scan.scope->key : 0) != (n.scope ? n.scope->key : 0);
+        n.scope = std::move(scan.scope);
+        bool same = fresh.size() == n.entries.size();
+        for (size_t i = 0; same && i < fresh.size(); ++i) {
+            same = fresh[i].isDir == n.entries[i].isDir && fresh[i].name == n.entries[i].name;
+        }
+        if (same && !scopeChanged) return false;
+
+        // 已存在的子目录保留其子树，仅在前缀变化时重绘；作用域变化时整个子树需按新规则重建
+        std::unordered_map<std::wstring, uint32_t> oldChildren;
+        for (size_t i = 0, k = 0; k < n.children.size(); ++i) {
+            if (n.entries[i].isDir) oldChildren.emplace(n.entries[i].name, n.children[k++]);
+        }
+        if (scopeChanged) {
+            for (auto& [name, child] : oldChildren) release(child);
+            oldChildren.clear();
+        }
+
+        n.entries = std::move(fresh);
+        n.children.clear();
+        render(n);
+        const size_t count = expand_children(n.relDir) ? shown(n) : 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (!n.entries[i].isDir) continue;
+            auto it = oldChildren.find(n.entries[i].name);
+            if (it != oldChildren.end()) {
+                n.children.push_back(it->second);
+                oldChildren.erase(it);
+            }
+            else {
+                n.children.push_back(NO_NODE);
+            }
+        }
+        for (auto& [name, child] : oldChildren) release(child);
+
+        // 新子目录完整构建，保留的子目录按新的 isLast 状态更新前缀
+        for (size_t i = 0, c = 0; i < count; ++i) {
+            if (!n.entries[i].isDir) continue;
+            std::wstring childPrefix = n.prefix + (i == n.entries.size() - 1 ? U_SPACE : U_PIPE);
+            if (n.children[c] == NO_NODE) n.children[c] = build(n.entries[i].p, child_rel_path(n.relDir, n.entries[i].name), childPrefix, n.scope);
+            else set_prefix(n.children[c], childPrefix);
+            ++c;
+        }
+        return true;
+    }
+
+    // 拼接全部节点的输出 (追加到 out)；--max-lines 在拼接后按行截断
+    void write(std::string& out) const {
+        const size_t start = out.size();
+        write_node(out, _nodes[_root]);
+        if (g_limits.maxLines == 0) return;
+        size_t pos = start;
+        for (size_t line = 0; line < g_limits.maxLines; ++line) {
+            pos = out.find('\n', pos);
+            if (pos == std::string::npos) return;
+            ++pos;
+        }
+        if (pos == out.size()) return;
+        out.resize(pos);
+        out += Strings::get(Msg::MSG_TRUNCATED);
+        out += LINE_ENDING;
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 目录大小统计 (--sizes)
+// ----------------------------------------------------------------------------
+
+constexpr uint32_t NO_SIZE_DIR = 0xFFFFFFFFu;
+
+// 已过滤的单个条目；目录的 size/files 在汇总后为整棵子树的合计
+struct SizeEntry {
+    std::wstring name;
+    uint64_t size = 0;
+    uint64_t files = 0;
+    int64_t mtime = 0;
+    uint64_t dev = 0, ino = 0;  // 仅多重硬链接的文件非零
+    uint32_t child = NO_SIZE_DIR;
+    bool isDir = false;
+};
+
+struct SizeDir {
+    std::vector<SizeEntry> entries;
+    uint64_t size = 0;
+    uint64_t files = 0;
+};
+
+// 先用线程池完整扫描 (每个目录一个任务：枚举过滤后批量取属性)，再单线程按输出顺序自底向上汇总
+// 汇总不受 --max-depth / --max-entries-per-dir / --max-lines 影响，这些限制只作用于输出
+// 同一 inode 的多个硬链接只有按输出顺序遇到的第一个计入大小，文件数仍逐个计入
+// 可展开的目录链接在扫描中只记录不扫描；每轮结束后按汇总顺序确认 (同一目标只展开第一个)，再扫描展开的目标
+// 目标中记录的链接在下一轮确认，直到没有新的链接 (safe 模式下经由链接到达的链接不再展开，至多再有一轮)
+class SizeTree {
+public:
+    explicit SizeTree(const TreeIgnore& ignore) : _ignore(ignore) {}
+
+    void scan(const fs::path& root, unsigned threads, size_t topCount) {
+        _topCount = topCount;
+        _links = std::make_unique<LinkTargets>(root);
+        std::atomic<size_t> pending{ 1 };
+        {
+            WorkStealingPool pool(threads);
+            uint32_t rootId;
+            SizeDir* rootDir = alloc(rootId);
+            pool.submit([this, &pool, &pending, root, rootDir] { scan_dir(pool, pending, root, L"", nullptr, rootDir); });
+            pool.wait_until([&] { return pending.load(std::memory_order_acquire) == 0; });
+
+            std::vector<std::pair<SizeDir*, LinkDir>> follow;
+            while (!_pendingLinks.empty()) {
+                claim_links(0, follow);
+                pending.store(follow.size(), std::memory_order_relaxed);
+                for (auto& [child, link] : follow) {
+                    pool.submit([this, &pool, &pending, child = child, link = std::move(link)] {
+                        scan_dir(pool, pending, link.path, link.relDir, link.scope, child);
+                    });
+                }
+                follow.clear();
+                pool.wait_until([&] { return pending.load(std::memory_order_acquire) == 0; });
+            }
+        }
+        ScopedPhase phase(PHASE_SORT);
+        aggregate(0, L"");
+    }
+
+    uint64_t total_size() const { return _dirs[0].size; }
+    uint64_t total_files() const { return _dirs[0].files; }
+
+    // 按输出顺序交给输出器 (见 TextEmitter)，每项都带大小，目录另带子树文件数
+    template <class Emitter>
+    void emit(const std::wstring& rootName, Emitter& out, LineBudget* budget) {
+        NodeInfo root{ rootName, true };
+        root.hasSize = root.hasFiles = true;
+        root.size = total_size();
+        root.files = total_files();
+        out.open_dir(root, true);
+        emit_dir(0, L"", out, budget);
+        out.close_dir();
+        out.finish(budget && budget->truncated);
+    }
+
+    // 占用空间最大的 topCount 个目录 (按大小降序，同大小按路径)
+    template <class Writer>
+    void write_top(Writer& writer) {
+        if (_top.empty()) return;
+        const size_t n = std::min(_topCount, _top.size());
+        std::partial_sort(_top.begin(), _top.begin() + n, _top.end(), [](const TopDir& a, const TopDir& b) {
+            return a.size != b.size ? a.size > b.size : a.relPath < b.relPath;
+        });
+        writer.writeLine();
+        writer.writeLine(Strings::get(Msg::SIZE_TOP));
+        std::string col, note;
+        for (size_t i = 0; i < n; ++i) {
+            col.clear();
+            append_size(col, _top[i].size);
+            if (col.size() < 10) col.insert(0, 10 - col.size(), ' ');
+            note.assign("  (");
+            append_file_count(note, _top[i].files);
+            note += ')';
+            writer.writeLine(std::string_view("  "), std::string_view(col), std::string_view("  "),
+                             std::wstring_view(display_rel_path(_top[i].relPath)), std::string_view(note));
+        }
+    }
+
+private:
+    struct TopDir {
+        std::wstring relPath;
+        uint64_t size;
+        uint64_t files;
+    };
+
+    const TreeIgnore& _ignore;
+    std::deque<SizeDir> _dirs;  // 扫描期间只在持锁时追加；任务通过 alloc 返回的指针访问各自的目录
+    std::mutex _mutex;
+    // 扫描中记录、尚未扫描的可展开链接
+    struct LinkDir {
+        fs::path path;
+        FileKey target;
+        std::wstring relDir;
+        IgnoreScopePtr scope;
+    };
+
+    std::set<std::pair<uint64_t, uint64_t>> _hardLinks;
+    std::unique_ptr<LinkTargets> _links;
+    std::unordered_map<const SizeEntry*, LinkDir> _pendingLinks;  // 扫描中记录、尚未确认的可展开链接 (持锁追加)
+    std::vector<TopDir> _top;
+    size_t _topCount = 0;
+
+    SizeDir* alloc(uint32_t& id) {
+        std::lock_guard<std::mutex> lk(_mutex);
+        id = (uint32_t)_dirs.size();
+        return &_dirs.emplace_back();
+    }
+
+    void scan_dir(WorkStealingPool& pool, std::atomic<size_t>& pending, const fs::path& path, const std::wstring& relDir,
+                  IgnoreScopePtr scope, SizeDir* dir) {
+        DirScan scan{ std::move(scope) };
+        scan.deferStat = true;
+        scan.links = _links.get();
+        std::vector<TreeEntry> entries = collect_entries(path, relDir, _ignore, &scan);
+        std::vector<EntryMeta> meta;
+        fetch_metadata(path, entries, meta);
+
+        dir->entries.resize(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            TreeEntry& e = entries[i];
+            SizeEntry& s = dir->entries[i];
+            s.isDir = e.isDir;
+            s.size = meta[i].size;
+            s.mtime = meta[i].mtime;
+            s.dev = meta[i].dev;
+            s.ino = meta[i].ino;
+            if (e.isLink) {
+                std::lock_guard<std::mutex> lk(_mutex);
+                _pendingLinks.emplace(&s, LinkDir{ std::move(e.p), e.target, child_rel_path(relDir, e.name), scan.scope });
+            }
+            else if (e.isDir) {
+                SizeDir* child = alloc(s.child);
+                pending.fetch_add(1, std::memory_order_relaxed);
+                pool.submit([this, &pool, &pending, p = std::move(e.p), rel = child_rel_path(relDir, e.name), sc = scan.scope, child] {
+                    scan_dir(pool, pending, p, rel, sc, child);
+                });
+            }
+            s.name = std::move(e.name);
+        }
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) pool.notify_done();
+    }
+
+    // 按汇总顺序确认上一轮记录的链接：展开的链接分配子目录并交给 follow，其余改按链接计为文件
+    void claim_links(uint32_t id, std::vector<std::pair<SizeDir*, LinkDir>>& follow) {
+        for (SizeEntry& e : _dirs[id].entries) {
+            if (e.child != NO_SIZE_DIR) {
+                claim_links(e.child, follow);
+                continue;
+            }
+            auto it = _pendingLinks.find(&e);
+            if (it == _pendingLinks.end()) continue;
+            LinkDir& link = it->second;
+            if (_links->claim(link.path, link.target)) {
+                follow.emplace_back(alloc(e.child), std::move(link));
+            }
+            else {
+                e.isDir = false;
+                e.name += link_suffix(link.path);
+            }
+            _pendingLinks.erase(it);
+        }
+    }
+
+    void aggregate(uint32_t id, const std::wstring& relDir) {
+        SizeDir& d = _dirs[id];
+        for (SizeEntry& e : d.entries) {
+            if (e.isDir) {
+                if (e.child != NO_SIZE_DIR) {
+                    aggregate(e.child, child_rel_path(relDir, e.name));
+                    e.size = _dirs[e.child].size;
+                    e.files = _dirs[e.child].files;
+                }
+                d.size += e.size;
+                d.files += e.files;
+                continue;
+            }
+            ++d.files;
+            if (e.ino == 0 || _hardLinks.insert({ e.dev, e.ino }).second) d.size += e.size;
+        }
+        if (_topCount && !relDir.empty()) _top.push_back({ relDir, d.size, d.files });
+
+        // 大小要到汇总后才知道，因此 size / mtime 排序在此重新进行 (目录在前，与树形输出一致)
+        if (g_sortMode == SORT_SIZE) {
+            std::stable_sort(d.entries.begin(), d.entries.end(), [](const SizeEntry& a, const SizeEntry& b) {
+                return a.isDir != b.isDir ? a.isDir : a.size > b.size;
+            });
+        }
+        else if (g_sortMode == SORT_MTIME) {
+            std::stable_sort(d.entries.begin(), d.entries.end(), [](const SizeEntry& a, const SizeEntry& b) {
+                return a.isDir != b.isDir ? a.isDir : a.mtime > b.mtime;
+            });
+        }
+    }
+
+    template <class Emitter>
+    void emit_dir(uint32_t id, const std::wstring& relDir, Emitter& out, LineBudget* budget) {
+        const SizeDir& d = _dirs[id];
+        const size_t n = d.entries.size();
+        const size_t shown = g_limits.maxEntries ? std::min(g_limits.maxEntries, n) : n;
+        const bool expand = expand_children(relDir);
+        for (size_t i = 0; i < shown; ++i) {
+            if (budget && !budget->take()) return;
+            const SizeEntry& e = d.entries[i];
+            const bool isLast = (i == n - 1);
+            NodeInfo info{ e.name, e.isDir };
+            info.hasSize = info.hasMtime = true;
+            info.hasFiles = e.isDir;
+            info.size = e.size;
+            info.mtime = e.mtime;
+            info.files = e.files;
+            if (e.isDir && expand && e.child != NO_SIZE_DIR) {
+                out.open_dir(info, isLast);
+                emit_dir(e.child, child_rel_path(relDir, e.name), out, budget);
+                out.close_dir();
+            }
+            else {
+                out.leaf(info, isLast);
+            }
+        }
+        if (shown < n && (!budget || budget->take())) out.more(n - shown);
+    }
+};
+
+// ----------------------------------------------------------------------------
+// 目录比较 (--diff / --snapshot)
+// ----------------------------------------------------------------------------
+
+// XXH64：非加密 64 位哈希 (按公开规范实现，按小端读取输入，结果与平台无关)
+namespace xxh64_detail {
+constexpr uint64_t P1 = 11400714785074694791ull;
+constexpr uint64_t P2 = 14029467366897019727ull;
+constexpr uint64_t P3 = 1609587929392839161ull;
+constexpr uint64_t P4 = 9650029242287828579ull;
+constexpr uint64_t P5 = 2870177450012600261ull;
+
+inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+inline uint64_t read64(const unsigned char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; }
+inline uint32_t read32(const unsigned char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; }
+inline uint64_t round(uint64_t acc, uint64_t input) { return rotl(acc + input * P2, 31) * P1; }
+inline uint64_t merge(uint64_t acc, uint64_t val) { return (acc ^ round(0, val)) * P1 + P4; }
+}
+
+uint64_t xxh64(const void* data, size_t len, uint64_t seed = 0) {
+    using namespace xxh64_detail;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* const end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        const unsigned char* const limit = end - 32;
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        do {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    }
+    else {
+        h = seed + P5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) { h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3; p += 4; }
+    for (; p < end; ++p) h = rotl(h ^ (*p * P5), 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+// 单个文件的大小、修改时间与内容哈希 (内存映射后计算)，由线程池填写
+struct FileDigest {
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+    bool ok = false;
+    std::atomic<bool> done{ false };
+};
+
+inline void digest_file(const fs::path& path, FileDigest& d) {
+    MappedFile file;
+    if (!file.open(path) || !get_mtime(path, d.mtime)) return;
+    d.size = file.size();
+    d.hash = xxh64(file.data(), file.size());
+    d.ok = true;
+}
+
+// --snapshot：以 --format bin 的格式写出整棵树 (按名称排序、不受输出限制)，每个文件附带大小、修改时间与哈希
+// 哈希在线程池中并行计算；记录按树的顺序排队，队首就绪或超出预读窗口时才写出，内存只取决于窗口大小
+template <class Writer>
+class SnapshotEmitter {
+    enum OpKind : uint8_t { OP_LEAF, OP_OPEN, OP_CLOSE, OP_MORE };
+    struct Op {
+        OpKind kind;
+        std::wstring name;
+        bool isDir = false;
+        size_t count = 0;
+        std::unique_ptr<FileDigest> digest;
+    };
+
+    BinEmitter<Writer> _bin;
+    WorkStealingPool& _pool;
+    const size_t _window;
+    std::deque<Op> _queue;
+    std::basic_string<fs::path::value_type> _path;  // 当前目录的完整路径
+    std::vector<size_t> _lens;
+
+    void replay(Op& op) {
+        NodeInfo info{ op.name, op.isDir };
+        if (op.digest && op.digest->ok) {
+            info.hasSize = info.hasMtime = info.hasHash = true;
+            info.size = op.digest->size;
+            info.mtime = op.digest->mtime;
+            info.hash = op.digest->hash;
+        }
+        switch (op.kind) {
+        case OP_LEAF: _bin.leaf(info, false); break;
+        case OP_OPEN: _bin.open_dir(info, false); break;
+        case OP_CLOSE: _bin.close_dir(); break;
+        case OP_MORE: _bin.more(op.count); break;
+        }
+    }
+
+    // 写出队首已就绪的记录；all 为 true 时等待全部完成，否则只在队列超出窗口时等待
+    void drain(bool all) {
+        while (!_queue.empty()) {
+            Op& op = _queue.front();
+            if (op.digest && !op.digest->done.load(std::memory_order_acquire)) {
+                if (!all && _queue.size() <= _window) return;
+                FileDigest* d = op.digest.get();
+                _pool.wait_until([d] { return d->done.load(std::memory_order_acquire); });
+            }
+            replay(op);
+            _queue.pop_front();
+        }
+    }
+
+    void push(OpKind kind, const NodeInfo* info, size_t count = 0) {
+        Op op;
+        op.kind = kind;
+        if (info) { op.name = info->name; op.isDir = info->isDir; }
+        op.count = count;
+        if (kind == OP_LEAF && info && !info->isDir) {
+            op.digest = std::make_unique<FileDigest>();
+            fs::path full(_path);
+            full /= info->native;
+            _pool.submit([this, d = op.digest.get(), full = std::move(full)] {
+                digest_file(full, *d);
+                d->done.store(true, std::memory_order_release);
+                _pool.notify_done();
+            });
+        }
+        _queue.push_back(std::move(op));
+        drain(false);
+    }
+
+public:
+    SnapshotEmitter(Writer& w, WorkStealingPool& pool, const fs::path& root, size_t window)
+        : _bin(w), _pool(pool), _window(window), _path(root.native()) {}
+    ~SnapshotEmitter() { drain(true); }
+
+    void leaf(const NodeInfo& info, bool) { push(OP_LEAF, &info); }
+    void open_dir(const NodeInfo& info, bool) {
+        push(OP_OPEN, &info);
+        _lens.push_back(_path.size());
+        if (_lens.size() > 1) {
+            if (!_path.empty() && !is_path_separator(_path.back())) _path += fs::path::preferred_separator;
+            _path += info.native;
+        }
+    }
+    void close_dir() {
+        _path.resize(_lens.back());
+        _lens.pop_back();
+        push(OP_CLOSE, nullptr);
+    }
+    void more(size_t omitted) { push(OP_MORE, nullptr, omitted); }
+    void finish(bool truncated) {
+        drain(true);
+        _bin.finish(truncated);
+    }
+};
+
+// 读取 --snapshot 写出的快照 (内存映射，按记录长度顺序跳读)
+struct SnapshotRecord {
+    uint8_t type = 0;
+    uint8_t flags = 0;
+    uint32_t depth = 0;
+    std::string_view name;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    uint64_t hash = 0;
+    size_t next = 0;  // 下一条记录的位置
+};
+
+class SnapshotReader {
+    MappedFile _file;
+
+    uint64_t le(size_t off, int bytes) const {
+        uint64_t v = 0;
+        for (int i = 0; i < bytes; ++i) v |= (uint64_t)(unsigned char)_file.data()[off + i] << (8 * i);
+        return v;
+    }
+
+public:
+    static bool is_snapshot(const fs::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        char magic[8] = {};
+        return in.read(magic, 8) && std::memcmp(magic, "CTREEBIN", 8) == 0;
+    }
+
+    bool open(const fs::path& path) {
+        return _file.open(path) && _file.size() >= BIN_HEADER_SIZE && std::memcmp(_file.data(), "CTREEBIN", 8) == 0;
+    }
+
+    size_t first() const { return (size_t)le(12, 4); }
+
+    // off 处的记录；越界或格式错误时返回 false (视为快照结束)
+    bool read(size_t off, SnapshotRecord& r) const {
+        if (off + 16 > _file.size()) return false;
+        const size_t len = (size_t)le(off, 4);
+        if (len < 16 || len > _file.size() - off) return false;
+        r.type = (uint8_t)le(off + 4, 1);
+        r.flags = (uint8_t)le(off + 5, 1);
+        r.depth = (uint32_t)le(off + 8, 4);
+        const size_t nameLen = (size_t)le(off + 12, 4);
+        size_t p = off + 16;
+        auto field = [&](uint8_t flag) -> uint64_t {
+            if (!(r.flags & flag)) return 0;
+            p += 8;
+            return p <= off + len ? le(p - 8, 8) : 0;
+        };
+        r.size = field(BIN_HAS_SIZE);
+        r.mtime = (int64_t)field(BIN_HAS_MTIME);
+        field(BIN_HAS_COUNT);
+        r.hash = field(BIN_HAS_HASH);
+        if (p + nameLen > off + len) return false;
+        r.name = std::string_view(_file.data() + p, nameLen);
+        r.next = off + len;
+        return true;
+    }
+};
+
+enum DiffKind : uint8_t { DIFF_SAME, DIFF_ADDED, DIFF_REMOVED, DIFF_MODIFIED };
+constexpr uint32_t NO_HASH_JOB = 0xFFFFFFFFu;
+
+// 比较一侧目录中的一项：实际目录记录完整路径，快照记录子项起始位置与深度
+struct DiffItem {
+    std::string key;
+    std::wstring name;
+    bool isDir = false;
+    bool hasHash = false;
+    uint64_t size = 0;
+    uint64_t hash = 0;
+    fs::path path;
+    IgnoreScopePtr scope;  // 实际目录：所在目录的忽略作用域 (列出本目录后变为本目录的作用域)
+    size_t offset = 0;
+    uint32_t depth = 0;
+};
+
+// 结果树只保留有变化的条目及其所在目录；大小相同的文件先挂起，哈希算完后再决定保留与否
+struct DiffNode {
+    std::wstring name;
+    bool isDir = false;
+    DiffKind kind = DIFF_SAME;
+    uint32_t job = NO_HASH_JOB;
+    std::vector<DiffNode> children;
+};
+
+// 大小相同的一对文件：旧侧为快照时 oldPath 为空，oldDigest 取自快照，只需计算新侧哈希
+struct HashJob {
+    fs::path oldPath, newPath;
+    FileDigest oldDigest, newDigest;
+    std::atomic<bool> done{ false };
+};
+
+// 比较两棵树：old 为实际目录或快照 (snapshot 非空)，new 总是实际目录
+// 两侧每个目录的条目都按名称排序 (目录在前，与树形输出相同)，一次归并即可找出新增、删除与同名条目
+// 同名文件大小不同即为修改；大小相同时由线程池比较内容哈希 (与归并并行进行)
+class TreeDiff {
+public:
+    TreeDiff(const TreeIgnore& ignore, const SnapshotReader* snapshot, unsigned threads) : _ignore(ignore), _snapshot(snapshot), _pool(threads) {}
+
+    void run(const fs::path& oldRoot, const fs::path& newRoot) {
+        DiffItem oldDir, newDir;
+        oldDir.isDir = newDir.isDir = true;
+        oldDir.path = oldRoot;
+        newDir.path = newRoot;
+        _oldLinks = std::make_unique<LinkTargets>(oldRoot);
+        _newLinks = std::make_unique<LinkTargets>(newRoot);
+        SnapshotRecord root;
+        if (_snapshot && _snapshot->read(_snapshot->first(), root)) oldDir.offset = root.next;
+        diff_dir(oldDir, newDir, L"", _root.children);
+        _pool.wait_until([this] { return _pending.load(std::memory_order_acquire) == 0; });
+        resolve(_root);
+    }
+
+    template <class Writer>
+    void write(const std::wstring& rootName, Writer& writer) {
+        TextEmitter<Writer> out(writer);
+        out.open_dir(NodeInfo{ rootName, true }, true);
+        emit_nodes(_root.children, out);
+        out.close_dir();
+        writer.writeLine();
+        if (_counts[DIFF_ADDED] + _counts[DIFF_REMOVED] + _counts[DIFF_MODIFIED] == 0) {
+            writer.writeLine(Strings::get(Msg::DIFF_NONE));
+            return;
+        }
+        writer.writeLine(
+            Strings::get(Msg::DIFF_ADDED), group_thousands(_counts[DIFF_ADDED]),
+            Strings::get(Msg::DIFF_REMOVED), group_thousands(_counts[DIFF_REMOVED]),
+            Strings::get(Msg::DIFF_MODIFIED), group_thousands(_counts[DIFF_MODIFIED]));
+    }
+
+private:
+    const TreeIgnore& _ignore;
+    const SnapshotReader* _snapshot;
+    WorkStealingPool _pool;
+    std::deque<HashJob> _jobs;  // 只由归并线程追加；任务通过指针访问各自的条目
+    std::atomic<size_t> _pending{ 0 };
+    DiffNode _root;
+    size_t _counts[4] = {};
+    std::unique_ptr<LinkTargets> _oldLinks, _newLinks;
+
+    // 链接按读取顺序确认 (同一目标只展开第一个)
+    std::vector<DiffItem> list_live(DiffItem& dir, const std::wstring& relDir, LinkTargets& links) {
+        DirScan scan{ dir.scope };
+        scan.withStat = true;
+        scan.links = &links;
+        std::vector<TreeEntry> entries = collect_entries(dir.path, relDir, _ignore, &scan);
+        std::vector<DiffItem> items(entries.size());
+        for (size_t i = 0; i < entries.size(); ++i) {
+            claim_link(entries[i], entries[i].p, links);
+            DiffItem& item = items[i];
+            item.key = std::move(entries[i].key);
+            item.name = std::move(entries[i].name);
+            item.isDir = entries[i].isDir;
+            item.size = entries[i].size;
+            item.path = std::move(entries[i].p);
+            item.scope = scan.scope;
+        }
+        dir.scope = std::move(scan.scope);
+        return items;
+    }
+
+    // 快照中 dir 的直接子项：顺序扫过其整棵子树，跳过更深的记录
+    // 同样经过忽略规则过滤；嵌套忽略文件取自新侧同一目录的作用域 (scope)
+    std::vector<DiffItem> list_snapshot(const DiffItem& dir, const std::wstring& relDir, const IgnoreScope* scope) {
+        std::vector<DiffItem> items;
+        std::wstring relPath = relDir;
+        if (!relPath.empty()) relPath += L'\\';
+        const size_t base = relPath.size();
+        const bool checkExcluded = _ignore.has_excluded_in(relDir);
+        SnapshotRecord r;
+        for (size_t off = dir.offset; _snapshot->read(off, r) && r.depth > dir.depth && (r.type == BIN_FILE || r.type == BIN_DIR || r.type == BIN_MORE); off = r.next) {
+            if (r.depth != dir.depth + 1 || r.type == BIN_MORE) continue;
+            DiffItem item;
+            item.name = to_wide(r.name);
+            item.isDir = r.type == BIN_DIR;
+            if (checkExcluded && !item.isDir && _ignore.is_excluded(relDir, item.name)) continue;
+            relPath.resize(base);
+            relPath += item.name;
+            if (_ignore.should_ignore(scope, relPath, item.name, item.isDir)) continue;
+            build_sort_key(item.key, item.name, item.isDir, 0, 0);
+            item.size = r.size;
+            item.hash = r.hash;
+            item.hasHash = (r.flags & BIN_HAS_HASH) != 0;
+            item.offset = r.next;
+            item.depth = r.depth;
+            items.push_back(std::move(item));
+        }
+        std::sort(items.begin(), items.end(), [](const DiffItem& a, const DiffItem& b) { return a.key < b.key; });
+        return items;
+    }
+
+    static DiffNode node(const DiffItem& item, DiffKind kind) {
+        DiffNode n;
+        n.name = item.name;
+        n.isDir = item.isDir;
+        n.kind = kind;
+        return n;
+    }
+
+    uint32_t submit_hash(const DiffItem& oldItem, const DiffItem& newItem) {
+        HashJob& job = _jobs.emplace_back();
+        if (_snapshot) {
+            job.oldDigest.ok = oldItem.hasHash;
+            job.oldDigest.hash = oldItem.hash;
+        }
+        else {
+            job.oldPath = oldItem.path;
+        }
+        job.newPath = newItem.path;
+        _pending.fetch_add(1, std::memory_order_relaxed);
+        _pool.submit([this, j = &job] {
+            if (!j->oldPath.empty()) digest_file(j->oldPath, j->oldDigest);
+            digest_file(j->newPath, j->newDigest);
+            j->done.store(true, std::memory_order_release);
+            if (_pending.fetch_sub(1, std::memory_order_acq_rel) == 1) _pool.notify_done();
+        });
+        return (uint32_t)(_jobs.size() - 1);
+    }
+
+    void diff_dir(DiffItem& oldDir, DiffItem& newDir, const std::wstring& relDir, std::vector<DiffNode>& out) {
+        std::vector<DiffItem> b = list_live(newDir, relDir, *_newLinks);
+        std::vector<DiffItem> a = _snapshot ? list_snapshot(oldDir, relDir, newDir.scope.get()) : list_live(oldDir, relDir, *_oldLinks);
+        size_t i = 0, j = 0;
+        while (i < a.size() || j < b.size()) {
+            const int c = (i == a.size()) ? 1 : (j == b.size()) ? -1 : a[i].key.compare(b[j].key);
+            if (c < 0) { out.push_back(node(a[i++], DIFF_REMOVED)); continue; }
+            if (c > 0) { out.push_back(node(b[j++], DIFF_ADDED)); continue; }
+
+            DiffItem& oldItem = a[i++];
+            DiffItem& newItem = b[j++];
+            DiffNode n = node(newItem, DIFF_SAME);
+            if (newItem.isDir) {
+                diff_dir(oldItem, newItem, child_rel_path(relDir, newItem.name), n.children);
+                if (n.children.empty()) continue;
+            }
+            else if (oldItem.size != newItem.size && (!_snapshot || oldItem.hasHash)) {  // 快照中无法读取的文件没有大小，交给哈希判断
+                n.kind = DIFF_MODIFIED;
+            }
+            else {
+                n.job = submit_hash(oldItem, newItem);
+            }
+            out.push_back(std::move(n));
+        }
+    }
+
+    // 按哈希结果确定挂起的文件，去掉未变化的文件与不再含变化的目录，并统计各类数量
+    // 两侧都无法读取 (如失效的符号链接) 时没有内容可比，按未变化处理
+    void resolve(DiffNode& dir) {
+        size_t kept = 0;
+        for (DiffNode& n : dir.children) {
+            if (n.job != NO_HASH_JOB) {
+                const FileDigest& a = _jobs[n.job].oldDigest;
+                const FileDigest& b = _jobs[n.job].newDigest;
+                if (a.ok == b.ok && (!a.ok || a.hash == b.hash)) continue;
+                n.kind = DIFF_MODIFIED;
+            }
+            if (n.kind == DIFF_SAME) {
+                resolve(n);
+                if (n.children.empty()) continue;
+            }
+            else {
+                ++_counts[n.kind];
+            }
+            if (&dir.children[kept] != &n) dir.children[kept] = std::move(n);
+            ++kept;
+        }
+        dir.children.resize(kept);
+    }
+
+    template <class Emitter>
+    void emit_nodes(const std::vector<DiffNode>& nodes, Emitter& out) {
+        static const wchar_t* const MARKS[] = { L"", L"[+] ", L"[-] ", L"[~] " };
+        std::wstring label;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const DiffNode& n = nodes[i];
+            const bool isLast = (i == nodes.size() - 1);
+            label.assign(MARKS[n.kind]);
+            label += n.name;
+            NodeInfo info{ label, n.isDir };
+            if (n.kind == DIFF_SAME && n.isDir) {
+                out.open_dir(info, isLast);
+                emit_nodes(n.children, out);
+                out.close_dir();
+            }
+            else {
+                out.leaf(info, isLast);
+            }
+        }
+    }
+};
+
+// 写出快照文件 (不含 BOM 的二进制)
+bool write_snapshot(const fs::path& root, const fs::path& file, const std::wstring& rootName, const TreeIgnore& ignore, unsigned threads) {
+    std::ofstream os(file, std::ios::binary);
+    if (!os.is_open()) return false;
+    MultiWriter<AsyncSink<FileSink>> writer(FileSink{ &os });
+    WorkStealingPool pool(threads);
+    SnapshotEmitter<MultiWriter<AsyncSink<FileSink>>> out(writer, pool, root, (size_t)threads * 8);
+    out.open_dir(NodeInfo{ rootName, true }, true);
+    walk_tree(root, out, ignore);
+    out.close_dir();
+    out.finish(false);
+    writer.finish();
+    return true;
+}
+
+// ----------------------------------------------------------------------------
+// 文件内容打包 (--bundle)
+// ----------------------------------------------------------------------------
+
+// 0 表示不限制
+struct BundleOptions {
+    size_t maxBytes = 0;  // 所有文件内容的总字节数 (UTF-8)
+    size_t maxLines = 0;  // 所有文件内容的总行数
+    unsigned threads = 0;
+};
+
+struct BundleFile {
+    fs::path path;
+    std::wstring relPath;
+};
+
+// 按目录树的输出顺序收集待打包文件：过滤、排序、深度与每目录上限均与树形输出一致
+// include 非空时只保留命中其规则的文件 (--include，语法同忽略规则)；链接同样按输出顺序确认，与树形输出展开的相同
+void collect_bundle_files(const fs::path& path, const std::wstring& relDir, const TreeIgnore& ignore, const TreeIgnore* include,
+                          IgnoreScopePtr scope, LinkTargets& links, std::vector<BundleFile>& files) {
+    DirScan scan{ std::move(scope) };
+    scan.limit = entry_limit(nullptr);
+    scan.links = &links;
+    std::vector<TreeEntry> entries = collect_entries(path, relDir, ignore, &scan);
+    const bool expand = expand_children(relDir);
+    for (auto& e : entries) {
+        if (expand) claim_link(e, e.p, links);
+        std::wstring rel = child_rel_path(relDir, e.name);
+        if (e.isDir) {
+            if (expand) collect_bundle_files(e.p, rel, ignore, include, scan.scope, links, files);
+            continue;
+        }
+        if (e.linkShown) continue;
+        if (include) {
+            uint32_t r = include->match_rule(rel, e.name, false);
+            if (r == NO_RULE || include->rules[r].negate) continue;
+        }
+        files.push_back({ std::move(e.p), std::move(rel) });
+    }
+}
+
+// 单个文件的读取结果，由读取线程填写，写出线程按顺序取用
+struct BundleSlot {
+    std::string text;  // UTF-8 内容
+    bool ok = false;
+    bool binary = false;
+    std::atomic<bool> done{ false };
+};
+
+// 与 Git 相同：前 8000 字节中出现 NUL 即视为二进制 (带 BOM 或可识别的 UTF-16 除外)
+constexpr size_t BUNDLE_SNIFF_BYTES = 8000;
+
+// 先读取开头做二进制嗅探，二进制文件不再读取其余部分；文本按识别出的编码转为 UTF-8
+void read_bundle_file(const fs::path& path, BundleSlot& slot) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return;
+    std::error_code ec;
+    uintmax_t size = fs::file_size(path, ec);
+    if (ec) return;
+
+    std::string raw((size_t)std::min<uintmax_t>(size, BUNDLE_SNIFF_BYTES), '\0');
+    in.read(&raw[0], (std::streamsize)raw.size());
+    raw.resize((size_t)in.gcount());
+    if (std::memchr(raw.data(), 0, raw.size())) {
+        TextEncoding head = detect_encoding(raw);
+        if (head != ENC_UTF16LE && head != ENC_UTF16BE) { slot.binary = true; slot.ok = true; return; }
+    }
+    if (raw.size() == BUNDLE_SNIFF_BYTES && size > BUNDLE_SNIFF_BYTES) {
+        raw.resize((size_t)size);
+        in.read(&raw[BUNDLE_SNIFF_BYTES], (std::streamsize)(size - BUNDLE_SNIFF_BYTES));
+        raw.resize(BUNDLE_SNIFF_BYTES + (size_t)in.gcount());
+    }
+
+    std::string_view content(raw);
+    TextEncoding enc = detect_encoding(content);
+    content.remove_prefix(bom_length(content, enc));
+    if (enc == ENC_UTF8 || enc == ENC_UTF8_BOM) {
+        raw.erase(0, raw.size() - content.size());
+        slot.text = std::move(raw);
+    }
+    else {
+        transcode_to_utf8(content, enc, [&](const char* data, size_t n) { slot.text.append(data, n); return true; });
+    }
+    slot.ok = true;
+}
+
+// 在预算内截取 text 的长度 (SIZE_MAX 为不限)：尽量在行尾截断，单行超出预算时按字节截断但不拆开 UTF-8 字符
+inline size_t bundle_cut(std::string_view text, size_t maxBytes, size_t maxLines) {
+    size_t cut = std::min(text.size(), maxBytes);
+    if (maxLines != SIZE_MAX) {
+        size_t pos = 0;
+        for (size_t line = 0; line < maxLines && pos != std::string_view::npos; ++line) {
+            pos = text.find('\n', pos);
+            if (pos != std::string_view::npos) ++pos;
+        }
+        if (pos != std::string_view::npos) cut = std::min(cut, pos);
+    }
+    if (cut == text.size() || cut == 0) return cut;
+    size_t nl = text.rfind('\n', cut - 1);
+    if (nl != std::string_view::npos) return nl + 1;
+    while (cut > 0 && ((unsigned char)text[cut] & 0xC0) == 0x80) --cut;
+    return cut;
+}
+
+// 目录树之后依次写出每个文件的内容：读取线程池按顺序预读有限窗口内的文件，写出线程按树的顺序输出
+// 超出 --bundle-bytes / --bundle-lines 时截断当前文件并汇总其余文件数
+template <class Writer>
+void write_bundle(const fs::path& root, Writer& writer, const TreeIgnore& ignore, const TreeIgnore* include, const BundleOptions& opt) {
+    std::vector<BundleFile> files;
+    LinkTargets links(root);
+    collect_bundle_files(root, L"", ignore, include, nullptr, links, files);
+    if (files.empty()) return;
+
+    const unsigned threads = opt.threads ? opt.threads : std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+    const size_t window = (size_t)threads * 8;
+    std::vector<BundleSlot> slots(files.size());
+    WorkStealingPool pool(threads);
+    size_t submitted = 0;
+    auto refill = [&](size_t upTo) {
+        for (; submitted < std::min(upTo, files.size()); ++submitted) {
+            pool.submit([&pool, &file = files[submitted], &slot = slots[submitted]] {
+                read_bundle_file(file.path, slot);
+                slot.done.store(true, std::memory_order_release);
+                pool.notify_done();
+            });
+        }
+    };
+
+    size_t bytesLeft = opt.maxBytes ? opt.maxBytes : SIZE_MAX;
+    size_t linesLeft = opt.maxLines ? opt.maxLines : SIZE_MAX;
+    size_t i = 0;
+    for (; i < files.size() && bytesLeft > 0 && linesLeft > 0; ++i) {
+        refill(i + window);
+        BundleSlot& slot = slots[i];
+        pool.wait_until([&] { return slot.done.load(std::memory_order_acquire); });
+        if (!slot.ok || slot.binary) {
+            if (slot.binary) stat_add(STAT_BUNDLE_BINARY);
+            continue;
+        }
+
+        std::string_view text(slot.text);
+        size_t cut = bundle_cut(text, bytesLeft, linesLeft);
+        writer.writeLine();
+        writer.writeLine(std::wstring_view(L"==== "), std::wstring_view(display_rel_path(files[i].relPath)), std::wstring_view(L" ===="));
+        writer.writeRaw(text.substr(0, cut));
+        const bool openLine = cut > 0 && text[cut - 1] != '\n';
+        if (openLine) writer.writeLine();
+        if (cut < text.size()) writer.writeLine(Strings::get(Msg::BUNDLE_TRUNCATED));
+        stat_add(STAT_BUNDLE_FILES);
+        stat_add(STAT_BUNDLE_BYTES, cut);
+
+        if (bytesLeft != SIZE_MAX) bytesLeft -= cut;
+        if (linesLeft != SIZE_MAX) linesLeft -= std::min<size_t>(linesLeft, std::count(text.begin(), text.begin() + cut, '\n') + openLine);
+        if (cut < text.size()) { ++i; break; }
+        std::string().swap(slot.text);
+    }
+
+    // 等待已提交的读取结束 (slots 由其引用)，其余文件只计数
+    pool.wait_until([&] {
+        for (size_t k = i; k < submitted; ++k) if (!slots[k].done.load(std::memory_order_acquire)) return false;
+        return true;
+    });
+    if (i < files.size()) {
+        writer.writeLine();
+        writer.writeLine(Strings::get(Msg::BUNDLE_OMITTED), std::wstring_view(group_thousands(files.size() - i)),
+                         Strings::get(files.size() - i == 1 ? Msg::BUNDLE_OMITTED_ONE : Msg::BUNDLE_OMITTED_TAIL));
+    }
+}
+
+// ----------------------------------------------------------------------------
+// 嵌入式接口 (ctree.h)
+// ----------------------------------------------------------------------------
+
+// 一层目录的条目：原生文件名与排序键各自拼接在本层复用的缓冲中，按下标排序
+// 各层缓冲在同深度的兄弟目录间复用，遍历过程中条目不产生独立分配
+struct VisitLevel {
+    struct Slot {
+        uint32_t nameOff, nameLen;
+        uint32_t keyOff, keyLen;
+        bool isDir;
+        uint64_t size;
+        int64_t mtime;
+        bool isLink;
+        bool enter;     // 目录 (含按 followLinks 可进入的目录链接)
+        FileKey target; // 链接目标的身份
+    };
+    std::basic_string<fs::path::value_type> names;
+    std::string keys;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> order;
+    size_t next = 0;      // order 中下一个待访问的位置
+    size_t pathLen = 0;   // 本目录在路径缓冲中的长度
+    size_t relLen = 0;    // 本目录在 relDir 中的长度
+    IgnoreScopePtr scope;
+    ctree::EntryView self{};  // 本目录 (供 leave 回调；名称指向上一层的缓冲，路径在回调前重新指向)
+
+    NativeStringView name_of(const Slot& s) const { return NativeStringView(names.data() + s.nameOff, s.nameLen); }
+    std::string_view key_of(const Slot& s) const { return std::string_view(keys.data() + s.keyOff, s.keyLen); }
+};
+
+class EntryVisitWalker {
+public:
+    EntryVisitWalker(const fs::path& root, const TreeIgnore& ignore, const ctree::WalkOptions& options, ctree::Visitor& visitor)
+        : _ignore(ignore), _options(options), _visitor(visitor), _links(root, link_policy(options.followLinks)), _path(root.native()) {
+        static const SortMode MODES[] = { SORT_NAME, SORT_NATURAL, SORT_ICASE, SORT_MTIME, SORT_SIZE, SORT_NONE };
+        _mode = MODES[(int)options.sort];
+        _withStat = options.withMeta || _mode == SORT_MTIME || _mode == SORT_SIZE;
+        _relStart = _path.size() + (_path.empty() || is_path_separator(_path.back()) ? 0 : 1);
+    }
+
+    bool run() {
+        if (!fill(level(0), nullptr)) return false;
+        size_t top = 0;
+        for (;;) {
+            VisitLevel& dir = level(top);
+            if (dir.next == dir.order.size()) {
+                if (top == 0) return true;
+                // 路径缓冲可能已扩容，路径视图按长度重新指向
+                _path.resize(dir.pathLen);
+                dir.self.path = NativeStringView(_path);
+                dir.self.relPath = dir.self.path.substr(std::min(_relStart, _path.size()));
+                _visitor.leave(dir.self);
+                --top;
+                continue;
+            }
+            const VisitLevel::Slot& slot = dir.slots[dir.order[dir.next++]];
+            const NativeStringView name = dir.name_of(slot);
+            _path.resize(dir.pathLen);
+            if (!_path.empty() && !is_path_separator(_path.back())) _path += fs::path::preferred_separator;
+            _path += name;
+
+            ctree::EntryView view{};
+            view.name = name;
+            view.path = NativeStringView(_path);
+            view.relPath = view.path.substr(std::min(_relStart, _path.size()));
+            view.depth = (uint32_t)top + 1;
+            view.type = slot.isDir ? ctree::EntryType::Directory : ctree::EntryType::File;
+            view.isLink = slot.isLink;
+            view.hasMeta = _withStat;
+            view.size = slot.size;
+            view.mtime = _withStat ? unix_time_ns(slot.mtime) : 0;
+
+            const ctree::VisitAction action = _visitor.visit(view);
+            if (action == ctree::VisitAction::Stop) return true;
+            if (!slot.enter || action == ctree::VisitAction::SkipChildren) continue;
+            if (_options.maxDepth && view.depth >= _options.maxDepth) continue;
+            // 可展开的链接：同一目标只进入输出顺序中第一个进入它的链接
+            if (slot.isLink && !_links.claim(fs::path(_path), slot.target)) continue;
+
+            // 进入子目录：_path 此时即为子目录路径
+            _relDir.resize(dir.relLen);
+            if (!_relDir.empty()) _relDir += L'\\';
+            append_native_wide(_relDir, name);
+            VisitLevel& child = level(top + 1);
+            child.self = view;
+            fill(child, &dir);
+            ++top;
+        }
+    }
+
+private:
+    const TreeIgnore& _ignore;
+    const ctree::WalkOptions& _options;
+    ctree::Visitor& _visitor;
+    SortMode _mode;
+    LinkTargets _links;
+    bool _withStat;
+    std::basic_string<fs::path::value_type> _path;  // 当前条目的完整路径
+    size_t _relStart;
+    std::wstring _relDir;                           // 当前目录相对根目录的路径 (交给忽略规则)
+    std::wstring _relPath, _name;
+    std::string _key;
+    std::deque<VisitLevel> _levels;                 // deque：新增层时已有层的地址不变
+
+    static LinkPolicy link_policy(ctree::FollowLinks follow) {
+        static const LinkPolicy LINKS[] = { LINKS_NEVER, LINKS_SAFE, LINKS_ALWAYS };
+        return LINKS[(int)follow];
+    }
+
+    VisitLevel& level(size_t depth) {
+        while (_levels.size() <= depth) _levels.emplace_back();
+        return _levels[depth];
+    }
+
+    // 读取 _path 指向的目录：先完整枚举到本层缓冲 (嵌套忽略需先知道本目录的忽略文件)，再就地过滤并生成排序键
+    bool fill(VisitLevel& dir, const VisitLevel* parent) {
+        dir.names.clear();
+        dir.keys.clear();
+        dir.slots.clear();
+        dir.order.clear();
+        dir.next = 0;
+        dir.pathLen = _path.size();
+        dir.relLen = _relDir.size();
+
+        stat_add(STAT_DIRS);
+        uint32_t ignoreFiles = 0;
+        const bool nested = _ignore.nested();
+        const bool isRoot = parent == nullptr;
+        const fs::path dirPath(_path);
+        const bool ok = enumerate_directory(dirPath, [&](const DirEntryInfo& e) {
+            stat_add(STAT_ENTRIES);
+            if (nested && !e.isDir) ignoreFiles |= nested_ignore_file(e.name, isRoot);
+            dir.slots.push_back({ (uint32_t)dir.names.size(), (uint32_t)e.name.size(), 0, 0, e.isDir, e.size, e.mtime, e.isLink, e.isDir, e.target });
+            dir.names += e.name;
+        }, _withStat);
+        if (nested) dir.scope = _ignore.enter_dir(parent ? parent->scope : nullptr, dirPath, _relDir, ignoreFiles);
+
+        _relPath = _relDir;
+        if (!_relPath.empty()) _relPath += L'\\';
+        const size_t base = _relPath.size();
+        const bool checkExcluded = _ignore.has_excluded_in(_relDir);
+        const bool sorted = _mode != SORT_NONE;
+        DirLinkCheck links(_path, &_links);
+        size_t kept = 0;
+        for (const VisitLevel::Slot& slot : dir.slots) {
+            _name.clear();
+            append_native_wide(_name, dir.name_of(slot));
+            if (checkExcluded && !slot.isDir && _ignore.is_excluded(_relDir, _name)) continue;
+            _relPath.resize(base);
+            _relPath += _name;
+            if (nested ? _ignore.should_ignore(dir.scope.get(), _relPath, _name, slot.isDir) : _ignore.should_ignore(_relPath, _name, slot.isDir)) {
+                stat_add(slot.isDir ? STAT_PRUNED_SUBTREES : STAT_PRUNED_ENTRIES);
+                continue;
+            }
+            VisitLevel::Slot& out = dir.slots[kept++];
+            out = slot;
+            if (out.isLink && out.isDir) out.enter = links.follow(dir.name_of(out));
+            if (sorted) {
+                build_sort_key(_key, _name, slot.isDir, slot.mtime, slot.size, _mode);
+                out.keyOff = (uint32_t)dir.keys.size();
+                out.keyLen = (uint32_t)_key.size();
+                dir.keys += _key;
+            }
+        }
+        dir.slots.resize(kept);
+
+        dir.order.resize(kept);
+        for (size_t i = 0; i < kept; ++i) dir.order[i] = (uint32_t)i;
+        if (sorted) {
+            std::sort(dir.order.begin(), dir.order.end(), [&](uint32_t a, uint32_t b) { return dir.key_of(dir.slots[a]) < dir.key_of(dir.slots[b]); });
+        }
+        return ok;
+    }
+};
+
+}  // namespace ctree::detail
+
+ctree::IgnoreSet::IgnoreSet() : _impl(std::make_unique<detail::TreeIgnore>()) {}
+ctree::IgnoreSet::~IgnoreSet() = default;
+ctree::IgnoreSet::IgnoreSet(IgnoreSet&&) noexcept = default;
+ctree::IgnoreSet& ctree::IgnoreSet::operator=(IgnoreSet&&) noexcept = default;
+
+bool ctree::IgnoreSet::load_file(const fs::path& file) {
+    std::error_code ec;
+    return fs::is_regular_file(file, ec) && _impl->load_file(file);
+}
+
+void ctree::IgnoreSet::add_rule(std::wstring_view pattern) { _impl->add_rule(std::wstring(pattern)); }
+
+void ctree::IgnoreSet::set_nested(bool nested) { _impl->set_nested(nested); }
+
+bool ctree::IgnoreSet::matches(std::wstring_view relPath, bool isDir) const {
+    std::wstring rel(relPath);
+    std::replace(rel.begin(), rel.end(), L'/', L'\\');
+    while (!rel.empty() && rel.back() == L'\\') rel.pop_back();
+    const size_t slash = rel.rfind(L'\\');
+    return _impl->should_ignore(rel, std::wstring_view(rel).substr(slash == std::wstring::npos ? 0 : slash + 1), isDir);
+}
+
+bool ctree::walk(const fs::path& root, const IgnoreSet& ignore, const WalkOptions& options, Visitor& visitor) {
+    return detail::EntryVisitWalker(root, *ignore._impl, options, visitor).run();
 }
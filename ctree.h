@@ -0,0 +1,117 @@
+// ============================================================================
+// libctree - CTree 的嵌入式接口
+// ============================================================================
+// 在进程内遍历目录树，无需启动 CTree 再解析其文本输出：
+//
+//   ctree::IgnoreSet ignore;                 // 编译一次，可在多次 (及多线程并发的) 遍历间共享
+//   ignore.load_file(root / ".treeignore");
+//   ctree::walk(root, ignore, {}, [&](const ctree::EntryView& e) {
+//       index(e.relPath, e.depth, e.is_dir());
+//       return ctree::VisitAction::Continue;
+//   });
+//
+// 条目以视图形式交给回调：名称与路径指向遍历器内部复用的缓冲，不为每项分配 fs::path 或 std::wstring
+// 顺序与忽略语义与命令行输出一致 (目录在前、按 --sort 的规则排序)
+// ============================================================================
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+
+namespace ctree {
+
+namespace detail { class TreeIgnore; }
+
+using NativeChar = std::filesystem::path::value_type;
+using NativeStringView = std::basic_string_view<NativeChar>;
+
+enum class EntryType : uint8_t { File, Directory };
+
+// 同 --sort
+enum class SortOrder : uint8_t { Name, Natural, ICase, MTime, Size, None };
+
+// 同 --follow-links：指向目录的符号链接 (Windows 下含目录联接) 是否进入
+// Safe 只进入目标在根目录之外、且不是经由其他链接到达的链接，同一目标只进入一次，不会成环
+// Always 可重复进入同一目标，但回到根目录或本分支上已进入的目标时停止
+enum class FollowLinks : uint8_t { Never, Safe, Always };
+
+// 一个条目；name / path / relPath 仅在回调期间有效
+struct EntryView {
+    NativeStringView name;     // 文件名 (原生编码：Windows 为 UTF-16，POSIX 为字节串)
+    NativeStringView path;     // 完整路径 (根目录 + 原生分隔符)
+    NativeStringView relPath;  // 相对根目录的路径 (path 的后缀)
+    uint32_t depth;            // 根目录的直接子项为 1
+    EntryType type;            // 指向目录的链接为 Directory (是否进入由 WalkOptions::followLinks 决定，Safe 下同一目标只进入一次)
+    bool isLink;               // 符号链接 (Windows 下含目录联接)
+    bool hasMeta;              // WalkOptions::withMeta 或按修改时间/大小排序时为 true
+    uint64_t size;
+    int64_t mtime;             // Unix 纪元起的纳秒
+
+    bool is_dir() const { return type == EntryType::Directory; }
+};
+
+enum class VisitAction : uint8_t {
+    Continue,      // 继续 (目录则进入)
+    SkipChildren,  // 不进入该目录
+    Stop,          // 结束整个遍历
+};
+
+class Visitor {
+public:
+    virtual ~Visitor() = default;
+    virtual VisitAction visit(const EntryView& entry) = 0;
+    // 已进入的目录全部子项访问完毕 (entry 与进入时相同)
+    virtual void leave(const EntryView& dir) { (void)dir; }
+};
+
+struct WalkOptions {
+    SortOrder sort = SortOrder::Name;
+    uint32_t maxDepth = 0;  // 0 为不限；depth 等于 maxDepth 的目录仍会访问，但不进入
+    bool withMeta = false;  // 附带大小与修改时间 (POSIX 下每项多一次 stat)
+    FollowLinks followLinks = FollowLinks::Safe;
+};
+
+class IgnoreSet;
+
+// 深度优先遍历 root (root 本身不访问)；root 无法打开时返回 false
+bool walk(const std::filesystem::path& root, const IgnoreSet& ignore, const WalkOptions& options, Visitor& visitor);
+
+// 编译后的忽略规则 (.gitignore 语法，同 -n / -f)
+// add_rule / load_file / set_nested 须在开始遍历前完成；之后只读，可被任意多个线程的遍历同时使用
+class IgnoreSet {
+public:
+    IgnoreSet();
+    ~IgnoreSet();
+    IgnoreSet(IgnoreSet&&) noexcept;
+    IgnoreSet& operator=(IgnoreSet&&) noexcept;
+
+    // 文件不存在时返回 false
+    bool load_file(const std::filesystem::path& file);
+    void add_rule(std::wstring_view pattern);
+    // 同 --gitignore：遍历时读取各级目录中的 .gitignore / .treeignore
+    void set_nested(bool nested);
+
+    // relPath 相对遍历根目录，分隔符 / 或 \ 均可 (只检查本对象中的规则，不含嵌套忽略文件)
+    bool matches(std::wstring_view relPath, bool isDir) const;
+
+private:
+    friend bool walk(const std::filesystem::path&, const IgnoreSet&, const WalkOptions&, Visitor&);
+    std::unique_ptr<detail::TreeIgnore> _impl;
+};
+
+// 以可调用对象代替 Visitor：fn(const EntryView&) 返回 VisitAction
+template <class Fn, class = std::enable_if_t<!std::is_base_of_v<Visitor, std::decay_t<Fn>>>>
+bool walk(const std::filesystem::path& root, const IgnoreSet& ignore, const WalkOptions& options, Fn&& fn) {
+    struct FnVisitor : Visitor {
+        Fn& fn;
+        explicit FnVisitor(Fn& f) : fn(f) {}
+        VisitAction visit(const EntryView& entry) override { return fn(entry); }
+    } visitor(fn);
+    return walk(root, ignore, options, static_cast<Visitor&>(visitor));
+}
+
+}  // namespace ctree
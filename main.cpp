@@ -0,0 +1,1186 @@
+// ============================================================================
+// CTree 命令行：剪贴板、右键菜单、参数解析与各模式的调度 (含 --serve 常驻服务)
+// ============================================================================
+// 以源码方式引入 CTree.cpp (同 bench/ctree_bench.cpp)：命令行不属于 libctree，库只对外提供 ctree.h 的接口
+// ============================================================================
+
+#include "CTree.cpp"
+
+namespace ctree::cli {
+
+using namespace ctree::detail;
+
+// ============================================================================
+// [Section 1] 剪贴板
+// ============================================================================
+
+#ifdef _WIN32
+// 分配 wlen 个 UTF-16 码元的剪贴板内存，由 fill 直接写入并返回实际码元数
+template <class Fill>
+bool set_clipboard_utf16(size_t wlen, Fill&& fill) {
+    if (!OpenClipboard(nullptr)) return false;
+    EmptyClipboard();
+    bool ok = false;
+    HGLOBAL hGlob = GlobalAlloc(GMEM_MOVEABLE, (wlen + 1) * sizeof(wchar_t));
+    if (hGlob) {
+        wchar_t* pLocked = (wchar_t*)GlobalLock(hGlob);
+        if (pLocked) {
+            pLocked[fill(pLocked)] = L'\0';
+            GlobalUnlock(hGlob);
+            ok = SetClipboardData(CF_UNICODETEXT, hGlob) != nullptr;
+        }
+        if (!ok) GlobalFree(hGlob);
+    }
+    CloseClipboard();
+    return ok;
+}
+#else
+// POSIX 无统一剪贴板 API：依次尝试常见的剪贴板工具，直到某个工具收下全部内容并正常退出
+// 工具不存在时 shell 以 127 退出，pclose 的状态非零即换用下一个；全部失败时返回 false
+// produce(sink) 把 UTF-8 内容分块交给 sink；换用下一个工具时会重新调用
+template <class Produce>
+bool pipe_to_clipboard(Produce&& produce) {
+    // 工具不存在时 shell 提前退出，继续写入管道会触发 SIGPIPE
+    auto oldHandler = std::signal(SIGPIPE, SIG_IGN);
+    bool copied = false;
+    for (const char* cmd : { "wl-copy 2>/dev/null", "xclip -selection clipboard 2>/dev/null",
+                             "xsel --clipboard --input 2>/dev/null", "pbcopy 2>/dev/null" }) {
+        FILE* pipe = popen(cmd, "w");
+        if (!pipe) continue;
+        bool written = produce([&](const char* data, size_t size) { return std::fwrite(data, 1, size, pipe) == size; });
+        const int status = pclose(pipe);
+        if (written && status != -1 && WIFEXITED(status) && WEXITSTATUS(status) == 0) { copied = true; break; }
+    }
+    std::signal(SIGPIPE, oldHandler);
+    return copied;
+}
+#endif
+
+// 写入剪贴板：按 enc 从原始字节直接转码到最终缓冲 (Windows 为剪贴板内存，POSIX 为管道)，不经过中间宽字符串
+// UTF-8 内容在 POSIX 下原样写出，不产生任何副本
+void CopyToClipboard(std::string_view content, TextEncoding enc = ENC_UTF8) {
+    content.remove_prefix(std::min(bom_length(content, enc), content.size()));
+    if (content.empty()) return;
+    bool copied = false;
+#ifdef _WIN32
+    if (enc == ENC_UTF16LE || enc == ENC_UTF16BE) {
+        const size_t units = content.size() / 2;
+        copied = set_clipboard_utf16(units, [&](wchar_t* out) {
+            std::memcpy(out, content.data(), units * 2);
+            if (enc == ENC_UTF16BE) {
+                for (size_t i = 0; i < units; ++i) out[i] = (wchar_t)(((uint16_t)out[i] >> 8) | ((uint16_t)out[i] << 8));
+            }
+            return units;
+        });
+    }
+    else if (content.size() <= (size_t)INT_MAX) {
+        const UINT codePage = (enc == ENC_GB18030) ? 54936 : CP_UTF8;
+        int wlen = MultiByteToWideChar(codePage, 0, content.data(), (int)content.size(), nullptr, 0);
+        if (wlen > 0) {
+            copied = set_clipboard_utf16((size_t)wlen, [&](wchar_t* out) {
+                return (size_t)MultiByteToWideChar(codePage, 0, content.data(), (int)content.size(), out, wlen);
+            });
+        }
+    }
+#else
+    copied = pipe_to_clipboard([&](auto&& sink) { return transcode_to_utf8(content, enc, sink); });
+#endif
+    if (copied) std::cout << Strings::get(Msg::MSG_CLIPBOARD) << std::endl;
+    else std::cerr << Strings::get(Msg::ERR_CLIPBOARD) << std::endl;
+}
+
+// ============================================================================
+// [Section 2] 系统集成：Windows 注册表菜单管理
+// ============================================================================
+
+#ifdef _WIN32
+std::wstring GetExePath() {
+    wchar_t buf[MAX_PATH];
+    GetModuleFileNameW(NULL, buf, MAX_PATH);
+    return std::wstring(buf);
+}
+
+void RegMenuKey(HKEY hRoot, const std::wstring& parentPath, const std::wstring& keyName, const std::wstring& menuName, const std::wstring& cmd) {
+    HKEY hParent, hKey, hCmd;
+    std::wstring fullParent = parentPath + L"\\" + PARENT_MENU_NAME;
+
+    if (RegCreateKeyExW(hRoot, fullParent.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hParent, NULL) == ERROR_SUCCESS) {
+        std::wstring title = PARENT_MENU_NAME;
+        RegSetValueExW(hParent, L"MUIVerb", 0, REG_SZ, (BYTE*)title.c_str(), (DWORD)(title.size() + 1) * 2);
+        RegSetValueExW(hParent, L"SubCommands", 0, REG_SZ, (BYTE*)L"", 2);
+
+        std::wstring subKeyPath = L"shell\\" + keyName;
+        if (RegCreateKeyExW(hParent, subKeyPath.c_str(), 0, NULL, 0, KEY_WRITE, NULL, &hKey, NULL) == ERROR_SUCCESS) {
+            RegSetValueExW(hKey, L"MUIVerb", 0, REG_SZ, (BYTE*)menuName.c_str(), (DWORD)(menuName.size() + 1) * 2);
+            if (RegCreateKeyExW(hKey, L"command", 0, NULL, 0, KEY_WRITE, NULL, &hCmd, NULL) == ERROR_SUCCESS) {
+                RegSetValueExW(hCmd, NULL, 0, REG_SZ, (BYTE*)cmd.c_str(), (DWORD)(cmd.size() + 1) * 2);
+                RegCloseKey(hCmd);
+            }
+            RegCloseKey(hKey);
+        }
+        RegCloseKey(hParent);
+    }
+}
+
+void DeleteMenuKeySafe(HKEY hRoot, const std::wstring& parentRoot) {
+    std::wstring fullParent = parentRoot + L"\\" + PARENT_MENU_NAME;
+    std::wstring shellPath = fullParent + L"\\shell";
+    RegDeleteTreeW(hRoot, (shellPath + L"\\" + MENU_TREE_KEY).c_str());
+    RegDeleteTreeW(hRoot, (shellPath + L"\\" + MENU_COPY_KEY).c_str());
+
+    HKEY hShell; // 检查是否为空，若空则删除父菜单
+    if (RegOpenKeyExW(hRoot, shellPath.c_str(), 0, KEY_READ, &hShell) == ERROR_SUCCESS) {
+        DWORD subKeyCount = 0;
+        RegQueryInfoKeyW(hShell, NULL, NULL, NULL, &subKeyCount, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+        RegCloseKey(hShell);
+        if (subKeyCount == 0) RegDeleteTreeW(hRoot, fullParent.c_str());
+    }
+    else {
+        RegDeleteTreeW(hRoot, fullParent.c_str());
+    }
+}
+
+void InstallMenus() {
+    std::wstring exe = L"\"" + GetExePath() + L"\"";
+    std::wstring cmdTree = exe + L" -i \"%V\" -o";
+    std::wstring nameTree = to_wide(Strings::get(Msg::CTX_TREE_NAME));
+    RegMenuKey(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\Background\\shell", MENU_TREE_KEY, nameTree, cmdTree);
+    RegMenuKey(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\shell", MENU_TREE_KEY, nameTree, cmdTree);
+
+    std::wstring cmdCopy = exe + L" -c \"%1\"";
+    std::wstring nameCopy = to_wide(Strings::get(Msg::CTX_COPY_NAME));
+    RegMenuKey(HKEY_CURRENT_USER, L"Software\\Classes\\SystemFileAssociations\\text\\shell", MENU_COPY_KEY, nameCopy, cmdCopy);
+}
+
+void UninstallMenus() {
+    DeleteMenuKeySafe(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\Background\\shell");
+    DeleteMenuKeySafe(HKEY_CURRENT_USER, L"Software\\Classes\\Directory\\shell");
+    DeleteMenuKeySafe(HKEY_CURRENT_USER, L"Software\\Classes\\SystemFileAssociations\\text\\shell");
+}
+
+void ShowInteractiveMenu() {
+    system("cls");
+    std::cout << Strings::get(Msg::MENU_TITLE) << "\n-------------------------\n";
+    std::cout << Strings::get(Msg::MENU_OPT_1) << '\n' << Strings::get(Msg::MENU_OPT_2) << "\n-------------------------\n";
+    std::cout << Strings::get(Msg::INPUT_PROMPT);
+    char choice;
+    while (std::cin >> choice) {
+        if (choice == '1') { InstallMenus(); std::cout << Strings::get(Msg::SUCCESS_ADD) << std::endl; system("pause"); break; }
+        else if (choice == '2') { UninstallMenus(); std::cout << Strings::get(Msg::SUCCESS_REM) << std::endl; system("pause"); break; }
+        else std::cout << Strings::get(Msg::MENU_OPT_ERROR) << std::endl;
+    }
+}
+#else
+// 右键菜单仅适用于 Windows 资源管理器，其他平台无参数启动时显示帮助
+void ShowInteractiveMenu() {
+    std::cout << Strings::get(Msg::HELP_MSG);
+}
+#endif
+
+// ============================================================================
+// [Section 3] 流程控制：配置解析与业务分发
+// ============================================================================
+
+struct AppConfig {
+    bool showMenu = false;
+    bool showHelp = false;
+    bool showVersion = false;
+    bool isValid = true;
+    bool createGlobal = false;
+    bool deleteGlobal = false;
+    bool createLocal = false;
+
+    fs::path inputPath;
+    bool OutputFlag = false;
+    fs::path outputPath;
+
+    bool CopyFlag = false;
+    fs::path copyFilePath;
+
+    fs::path specifiedIgnoreFile;
+    std::vector<std::wstring> tempIgnores;
+
+    unsigned threadCount = 1;
+    fs::path cachePath;
+    bool watch = false;
+    int statsMode = 0;  // 0: 关闭, 1: 文本, 2: JSON
+    bool nestedIgnore = false;
+    TreeLimits limits;
+    ScanBudget scanBudget;
+    SortMode sortMode = SORT_NAME;
+    LinkPolicy linkPolicy = LINKS_SAFE;
+    bool sizes = false;
+    size_t topCount = 0;
+    OutputFormat format = FORMAT_TEXT;
+    bool bundle = false;
+    std::vector<std::wstring> includes;
+    BundleOptions bundleOpt;
+    fs::path diffPath;      // 比较对象：目录或 --snapshot 写出的快照
+    fs::path snapshotPath;
+    fs::path servePath;     // 常驻服务的套接字路径 (Windows 为命名管道名)
+    bool gitTracked = false;  // 由 Git 索引建树，不遍历磁盘
+    bool gitOthers = false;   // 另外列出未跟踪的条目
+
+    void parse(int argc, wchar_t* argv[]) {
+        if (argc < 2) { showMenu = true; return; }
+        for (int i = 1; i < argc; ++i) {
+            std::wstring arg = argv[i];
+            if (arg == L"-h" || arg == L"--help") { showHelp = true; return; }
+            if (arg == L"-v" || arg == L"--version") { showVersion = true; return; }
+
+            if (arg == L"-i" || arg == L"--input") {
+                if (i + 1 < argc) inputPath = wide_to_path(argv[++i]); else isValid = false;
+            }
+            else if (arg == L"-o" || arg == L"--output") {
+                OutputFlag = true;
+                if (i + 1 < argc && argv[i + 1][0] != L'-') outputPath = wide_to_path(argv[++i]);
+            }
+            else if (arg == L"-c" || arg == L"--copy") {
+                CopyFlag = true;
+                if (i + 1 < argc && argv[i + 1][0] != L'-') copyFilePath = wide_to_path(argv[++i]);
+            }
+            else if (arg == L"-n" || arg == L"--ignore") {
+                while (i + 1 < argc) {
+                    std::wstring next = argv[i + 1];
+                    if (!next.empty() && next[0] == L'-') break;
+                    tempIgnores.push_back(next);
+                    i++;
+                }
+            }
+            else if (arg == L"-f" || arg == L"--file") {
+                if (i + 1 < argc) specifiedIgnoreFile = wide_to_path(argv[++i]);
+            }
+            else if (arg == L"-t" || arg == L"--threads") {
+                threadCount = std::max(1u, std::thread::hardware_concurrency());
+                if (i + 1 < argc && argv[i + 1][0] != L'-') {
+                    wchar_t* end = nullptr;
+                    unsigned long n = std::wcstoul(argv[++i], &end, 10);
+                    if (*end != L'\0' || n == 0 || n > 256) isValid = false;
+                    else threadCount = (unsigned)n;
+                }
+            }
+            else if (arg == L"--cache") {
+                if (i + 1 < argc) cachePath = wide_to_path(argv[++i]); else isValid = false;
+            }
+            else if (arg == L"--watch") { watch = true; OutputFlag = true; }
+            else if (arg == L"--stats") {
+                statsMode = 1;
+                if (i + 1 < argc && std::wstring(argv[i + 1]) == L"json") { statsMode = 2; ++i; }
+            }
+            else if (arg == L"--max-depth" || arg == L"--max-entries-per-dir" || arg == L"--max-lines") {
+                size_t& limit = (arg == L"--max-depth") ? limits.maxDepth : (arg == L"--max-lines") ? limits.maxLines : limits.maxEntries;
+                wchar_t* end = nullptr;
+                unsigned long long n = (i + 1 < argc) ? std::wcstoull(argv[++i], &end, 10) : 0;
+                if (n == 0 || *end != L'\0') isValid = false;
+                else limit = (size_t)n;
+            }
+            else if (arg == L"--time-budget" || arg == L"--entry-budget") {
+                wchar_t* end = nullptr;
+                unsigned long long n = (i + 1 < argc) ? std::wcstoull(argv[++i], &end, 10) : 0;
+                if (n == 0 || *end != L'\0') isValid = false;
+                else if (arg == L"--time-budget") scanBudget.timeMs = n;
+                else scanBudget.entries = (size_t)n;
+            }
+            else if (arg == L"--gitignore") nestedIgnore = true;
+            else if (arg == L"--git-tracked") gitTracked = true;
+            else if (arg == L"--others") { gitOthers = true; gitTracked = true; }
+            else if (arg == L"--sizes") sizes = true;
+            else if (arg == L"--top") {
+                wchar_t* end = nullptr;
+                unsigned long long n = (i + 1 < argc) ? std::wcstoull(argv[++i], &end, 10) : 0;
+                if (n == 0 || *end != L'\0') isValid = false;
+                else { topCount = (size_t)n; sizes = true; }
+            }
+            else if (arg == L"--bundle") bundle = true;
+            else if (arg == L"--include") {
+                while (i + 1 < argc) {
+                    std::wstring next = argv[i + 1];
+                    if (!next.empty() && next[0] == L'-') break;
+                    includes.push_back(next);
+                    i++;
+                }
+            }
+            else if (arg == L"--bundle-bytes" || arg == L"--bundle-lines") {
+                size_t& limit = (arg == L"--bundle-bytes") ? bundleOpt.maxBytes : bundleOpt.maxLines;
+                wchar_t* end = nullptr;
+                unsigned long long n = (i + 1 < argc) ? std::wcstoull(argv[++i], &end, 10) : 0;
+                if (n == 0 || *end != L'\0') isValid = false;
+                else limit = (size_t)n;
+            }
+            else if (arg == L"--format") {
+                if (i + 1 >= argc || !parse_output_format(argv[++i], format)) isValid = false;
+            }
+            else if (arg == L"--diff") {
+                if (i + 1 < argc) diffPath = wide_to_path(argv[++i]); else isValid = false;
+            }
+            else if (arg == L"--snapshot") {
+                if (i + 1 < argc) snapshotPath = wide_to_path(argv[++i]); else isValid = false;
+            }
+            else if (arg == L"--serve") {
+                if (i + 1 < argc) servePath = wide_to_path(argv[++i]); else isValid = false;
+            }
+            else if (arg == L"--sort") {
+                if (i + 1 >= argc || !parse_sort_mode(argv[++i], sortMode)) isValid = false;
+            }
+            else if (arg == L"--follow-links" || arg.compare(0, 15, L"--follow-links=") == 0) {
+                // 也接受 --follow-links=<mode> 的写法
+                std::wstring mode = arg.size() > 14 ? arg.substr(15) : (i + 1 < argc ? std::wstring(argv[++i]) : std::wstring());
+                if (!parse_link_policy(mode, linkPolicy)) isValid = false;
+            }
+            else if (arg == L"-g" || arg == L"--global") createGlobal = true;
+            else if (arg == L"-d" || arg == L"--delete-global") deleteGlobal = true;
+            else if (arg == L"-l" || arg == L"--local") createLocal = true;
+        }
+
+        // 二进制格式无法作为文本放入剪贴板
+        if (format == FORMAT_BIN && CopyFlag && copyFilePath.empty()) isValid = false;
+        // 比较结果只有文本形式
+        if (!diffPath.empty() && format != FORMAT_TEXT) isValid = false;
+        // 限时遍历只输出已读到的目录树，无法与需要完整扫描的功能同时使用
+        if (scanBudget.enabled() && (sizes || bundle || watch || !cachePath.empty() || !diffPath.empty() || !snapshotPath.empty())) isValid = false;
+        // 索引建树只有目录结构，同样不能与读取磁盘属性或内容的功能同时使用
+        if (gitTracked && (sizes || bundle || watch || scanBudget.enabled() || !cachePath.empty() || !diffPath.empty() || !snapshotPath.empty())) isValid = false;
+
+        std::error_code ec;
+        if (!inputPath.empty()) { fs::path abs = fs::absolute(inputPath, ec); if (!ec) inputPath = abs; }
+        if (OutputFlag && !outputPath.empty()) { fs::path abs = fs::absolute(outputPath, ec); if (!ec) outputPath = abs; }
+        if (!cachePath.empty()) { fs::path abs = fs::absolute(cachePath, ec); if (!ec) cachePath = abs; }
+        if (!diffPath.empty()) { fs::path abs = fs::absolute(diffPath, ec); if (!ec) diffPath = abs; }
+        if (!snapshotPath.empty()) { fs::path abs = fs::absolute(snapshotPath, ec); if (!ec) snapshotPath = abs; }
+        // 归档文件同样只有条目列表
+        if (!inputPath.empty() && fs::is_regular_file(inputPath, ec) && (gitTracked || sizes || bundle || watch || scanBudget.enabled() || !cachePath.empty() || !diffPath.empty() || !snapshotPath.empty())) isValid = false;
+    }
+};
+
+// 忽略配置文件：指定 (-f) > 扫描目录下的 > 当前目录下的 > 全局；都不存在时返回全局路径 (加载失败即无规则)
+fs::path select_ignore_file(const AppConfig& cfg) {
+    if (!cfg.specifiedIgnoreFile.empty()) return cfg.specifiedIgnoreFile;
+    std::error_code ec;
+    if (fs::exists(cfg.inputPath / IGNORE_FILENAME, ec)) return cfg.inputPath / IGNORE_FILENAME;
+    if (fs::exists(fs::current_path(ec) / IGNORE_FILENAME, ec)) return fs::current_path(ec) / IGNORE_FILENAME;
+    return get_global_ignore_path();
+}
+
+// file 位于 root 之内时，将其 (所在目录相对路径, 文件名) 交给忽略管理器精确排除
+void exclude_own_file(TreeIgnore& ignore, const fs::path& root, const fs::path& file) {
+    fs::path rel = file.parent_path().lexically_normal().lexically_relative(root.lexically_normal());
+    if (rel.empty()) return;
+    std::wstring relDir;
+    for (const auto& part : rel) {
+        std::wstring s = path_to_wide(part);
+        if (s == L"..") return;
+        if (s == L"." || s.empty()) continue;
+        if (!relDir.empty()) relDir += L'\\';
+        relDir += s;
+    }
+    ignore.exclude_file(relDir, path_to_wide(file.filename()));
+}
+
+// 监视模式：常驻内存的目录树，按变化的目录增量重绘，输出先写入临时文件再原子替换
+void RunWatch(const fs::path& root, const fs::path& outPath, const std::wstring& rootName, const TreeIgnore& ignore) {
+    DirWatcher watcher;
+    if (!watcher.open(root, ignore.nested() || sort_needs_stat())) { std::cerr << Strings::get(Msg::ERR_WATCH_UNSUPPORTED) << std::endl; return; }
+    WatchTree tree(root, ignore, watcher);
+    tree.rebuild();
+
+    fs::path tmpPath = outPath;
+    tmpPath += ".tmp";
+    std::string head = "\xEF\xBB\xBF";
+    append_utf8(head, rootName);
+    append_utf8(head, U_FOLDER);
+    head += LINE_ENDING;
+    std::string text;  // 复用的整份输出缓冲，一次写出
+
+    auto save = [&] {
+        text.assign(head);
+        tree.write(text);
+        std::error_code ec;
+        {
+            std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) { std::cerr << Strings::get(Msg::ERR_FILE_OPEN) << to_utf8(path_to_wide(tmpPath)) << std::endl; return false; }
+            out.write(text.data(), text.size());
+        }
+        fs::rename(tmpPath, outPath, ec);
+        if (ec) { std::cerr << Strings::get(Msg::ERR_FILE_OPEN) << to_utf8(path_to_wide(outPath)) << std::endl; return false; }
+        return true;
+    };
+
+    if (save()) std::cout << Strings::get(Msg::MSG_SAVED) << to_utf8(path_to_wide(outPath)) << std::endl;
+    std::cout << Strings::get(Msg::MSG_WATCHING) << std::endl;
+
+    std::vector<uint32_t> dirty;
+    bool overflow = false;
+    auto onEvent = [&](const WatchEvent& ev) {
+        if (ev.overflow) { overflow = true; return; }
+        uint32_t node = tree.resolve(ev);
+        if (node == NO_NODE) return;
+        dirty.push_back(node);
+        // 目录的修改时间随其内容变化，按时间排序时父目录中的位置也要更新
+        if (g_sortMode == SORT_MTIME) {
+            uint32_t parent = tree.parent_of(node);
+            if (parent != NO_NODE) dirty.push_back(parent);
+        }
+    };
+
+    for (;;) {
+        if (!watcher.wait(-1, onEvent)) continue;
+
+        // 合并突发事件 (如 git checkout)：持续收取直到 50ms 内无新事件，最长等待 1s
+        auto burstStart = std::chrono::steady_clock::now();
+        while (watcher.wait(50, onEvent) && std::chrono::steady_clock::now() - burstStart < std::chrono::seconds(1)) {}
+
+        auto start = std::chrono::steady_clock::now();
+        bool changed = false;
+        if (overflow) {
+            tree.rebuild();
+            changed = true;
+        }
+        else {
+            // 先处理上层目录：其子树可能被整体替换，下层节点随之失效
+            std::sort(dirty.begin(), dirty.end(), [&](uint32_t a, uint32_t b) {
+                size_t da = tree.depth(a), db = tree.depth(b);
+                return da != db ? da < db : a < b;
+            });
+            dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+            for (uint32_t node : dirty) {
+                if (tree.alive(node) && tree.refresh(node)) changed = true;
+            }
+        }
+        dirty.clear();
+        overflow = false;
+
+        if (changed && save()) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            std::cout << Strings::get(Msg::MSG_WATCH_UPDATED) << ms << std::endl;
+        }
+    }
+}
+
+// 顶层阶段的墙钟与 CPU 时间：每次 mark 记录自上次 mark 以来的耗时
+class StatsTimeline {
+    struct Phase { const char* name; double wallMs; double cpuMs; };
+    std::vector<Phase> _phases;
+    std::chrono::steady_clock::time_point _wall = std::chrono::steady_clock::now();
+    double _cpu = process_cpu_seconds();
+
+public:
+    void mark(const char* name) {
+        if (!g_statsEnabled) return;
+        auto wall = std::chrono::steady_clock::now();
+        double cpu = process_cpu_seconds();
+        _phases.push_back({ name, std::chrono::duration<double, std::milli>(wall - _wall).count(), (cpu - _cpu) * 1000 });
+        _wall = wall;
+        _cpu = cpu;
+    }
+    const std::vector<Phase>& phases() const { return _phases; }
+};
+
+void PrintStats(int mode, const StatsTimeline& timeline, const TreeIgnore& ignore, unsigned threadCount) {
+    static const char* const COUNTER_NAMES[STAT_COUNTER_COUNT] = {
+        "dirs_read", "entries_enumerated", "entries_pruned", "subtrees_pruned", "dirs_from_cache", "cache_revalidations",
+        "dir_open_calls", "dir_read_calls", "stat_calls", "uring_submits", "bundle_files", "bundle_binary_skipped", "bundle_bytes", "links_not_followed",
+        "dirs_not_scanned", "arena_blocks", "arena_bytes", "git_index_entries", "archive_entries",
+#ifdef CTREE_COUNT_ALLOCATIONS
+        "walk_heap_allocs", "walk_heap_bytes",
+#endif
+    };
+    static const char* const STAGE_NAMES[STAGE_COUNT] = { "literal", "suffix", "anchored", "floating", "glob" };
+
+    StatsShard s = RunStats::instance().merged(ignore.rules.size());
+    const double enumMs = (s.phaseNs[PHASE_ENUMERATE] - std::min(s.phaseNs[PHASE_ENUMERATE], s.phaseNs[PHASE_IGNORE])) / 1e6;
+    const double ignoreMs = s.phaseNs[PHASE_IGNORE] / 1e6;
+    const double sortMs = s.phaseNs[PHASE_SORT] / 1e6;
+
+    // 非 glob 规则共用所在阶段的一次查找：检查次数取阶段次数，耗时按阶段内规则数均摊
+    size_t stageRules[STAGE_COUNT] = {};
+    for (size_t i = 0; i < ignore.rules.size(); ++i) stageRules[ignore.rule_stage(i)]++;
+    auto rule_evals = [&](size_t i) {
+        RuleStage st = ignore.rule_stage(i);
+        return st == STAGE_GLOB ? s.rules[i].evals : s.stageEvals[st];
+    };
+    auto rule_us = [&](size_t i) {
+        RuleStage st = ignore.rule_stage(i);
+        return (st == STAGE_GLOB ? s.rules[i].ns : s.stageNs[st] / stageRules[st]) / 1e3;
+    };
+
+    std::ostringstream os;
+    os << std::fixed << std::setprecision(3);
+    if (mode == 2) {
+        os << "{\n  \"phases\": [";
+        for (size_t i = 0; i < timeline.phases().size(); ++i) {
+            const auto& p = timeline.phases()[i];
+            os << (i ? ", " : "") << "{\"name\": \"" << p.name << "\", \"wall_ms\": " << p.wallMs << ", \"cpu_ms\": " << p.cpuMs << "}";
+        }
+        os << "],\n  \"threads\": " << threadCount
+           << ",\n  \"traversal_ms\": {\"enumerate\": " << enumMs << ", \"ignore\": " << ignoreMs << ", \"sort\": " << sortMs << "}"
+           << ",\n  \"counters\": {";
+        for (int i = 0; i < STAT_COUNTER_COUNT; ++i) os << (i ? ", " : "") << "\"" << COUNTER_NAMES[i] << "\": " << s.counters[i];
+        os << "},\n  \"peak_rss_kb\": " << peak_rss_kb() << ",\n  \"rules\": [";
+        for (size_t i = 0; i < ignore.rules.size(); ++i) {
+            std::string pattern;
+            for (char c : to_utf8(ignore.describe_rule(i))) {
+                if (c == '"' || c == '\\') pattern += '\\';
+                pattern += c;
+            }
+            os << (i ? "," : "") << "\n    {\"index\": " << i << ", \"pattern\": \"" << pattern << "\", \"stage\": \"" << STAGE_NAMES[ignore.rule_stage(i)]
+               << "\", \"evals\": " << rule_evals(i) << ", \"hits\": " << s.rules[i].hits << ", \"time_us\": " << rule_us(i) << "}";
+        }
+        os << (ignore.rules.empty() ? "" : "\n  ") << "]\n}\n";
+    }
+    else {
+        os << Strings::get(Msg::STATS_TITLE) << "\n" << Strings::get(Msg::STATS_PHASES) << "\n";
+        for (const auto& p : timeline.phases()) os << "  " << std::left << std::setw(12) << p.name << std::right << std::setw(12) << p.wallMs << " / " << p.cpuMs << "\n";
+        os << Strings::get(Msg::STATS_BREAKDOWN) << "\n"
+           << "  enumerate   " << std::setw(12) << enumMs << "\n"
+           << "  ignore      " << std::setw(12) << ignoreMs << "\n"
+           << "  sort        " << std::setw(12) << sortMs << "\n";
+        os << Strings::get(Msg::STATS_COUNTERS) << "\n";
+        for (int i = 0; i < STAT_COUNTER_COUNT; ++i) os << "  " << std::left << std::setw(24) << COUNTER_NAMES[i] << std::right << s.counters[i] << "\n";
+        os << "  " << std::left << std::setw(24) << "peak_rss_kb" << std::right << peak_rss_kb() << "\n";
+        if (!ignore.rules.empty()) os << Strings::get(Msg::STATS_RULES) << "\n";
+        for (size_t i = 0; i < ignore.rules.size(); ++i) {
+            os << "  [" << std::setw(3) << i << "] " << std::left << std::setw(9) << STAGE_NAMES[ignore.rule_stage(i)] << std::setw(28) << to_utf8(ignore.describe_rule(i)) << std::right
+               << std::setw(10) << rule_evals(i) << std::setw(10) << s.rules[i].hits << std::setw(12) << rule_us(i)
+               << (s.rules[i].hits == 0 ? Strings::get(Msg::STATS_NEVER) : "") << "\n";
+        }
+    }
+    std::cerr << os.str();
+}
+
+void RunTreeGeneration(const AppConfig& cfg) {
+    if (!fs::exists(cfg.inputPath)) { std::cout << Strings::get(Msg::ERR_PATH) << std::endl; return; }
+    g_statsEnabled = cfg.statsMode != 0 && !cfg.watch;
+    g_limits = cfg.limits;
+    g_sortMode = cfg.sortMode;
+    g_linkPolicy = cfg.linkPolicy;
+    StatsTimeline timeline;
+
+    // 1. 加载忽略规则
+    TreeIgnore ignoreMgr;
+    fs::path ignoreFile = select_ignore_file(cfg);
+    if (ignoreMgr.load_file(ignoreFile)) std::cout << Strings::get(Msg::USING_IGNORE) << to_utf8(path_to_wide(ignoreFile)) << '\n';
+    for (const auto& r : cfg.tempIgnores) ignoreMgr.add_rule(r);
+    ignoreMgr.set_nested(cfg.nestedIgnore);
+
+    // 2. 准备输出
+    fs::path finalOutPath = cfg.outputPath;
+    if (cfg.OutputFlag && finalOutPath.empty()) {
+        auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+        std::tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &now);
+#else
+        localtime_r(&now, &tm);
+#endif
+        std::wstringstream wss; wss << L"tree_" << std::put_time(&tm, L"%Y%m%d_%H%M%S") << L".txt";
+        finalOutPath = fs::current_path() / wide_to_path(wss.str());
+    }
+    // 输出文件与索引文件若位于扫描目录内，仅精确排除该文件本身
+    if (!finalOutPath.empty()) exclude_own_file(ignoreMgr, cfg.inputPath, finalOutPath);
+    if (!cfg.cachePath.empty()) exclude_own_file(ignoreMgr, cfg.inputPath, cfg.cachePath);
+
+    // 3. 监视模式：常驻运行，不经过下面的一次性输出流程
+    std::wstring rootName = path_to_wide(cfg.inputPath.filename());
+    if (rootName.empty()) rootName = path_to_wide(cfg.inputPath);
+    if (cfg.watch) {
+        fs::path tmpPath = finalOutPath;
+        tmpPath += ".tmp";
+        exclude_own_file(ignoreMgr, cfg.inputPath, tmpPath);
+        std::cout << Strings::get(Msg::PROCESSING) << std::endl;
+        RunWatch(cfg.inputPath, finalOutPath, rootName, ignoreMgr);
+        return;
+    }
+
+    // --sizes、--snapshot 与 --diff 需读取整棵树的属性或内容，总是使用线程池 (未指定 -t 时最多 8 线程)
+    const unsigned poolThreads = cfg.threadCount > 1 ? cfg.threadCount : std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+
+    // 4. 快照：完整的名称序树 (不受 --sort 与输出限制影响)，写出后结束
+    if (!cfg.snapshotPath.empty()) {
+        exclude_own_file(ignoreMgr, cfg.inputPath, cfg.snapshotPath);
+        g_sortMode = SORT_NAME;
+        g_limits = TreeLimits{};
+        std::cout << Strings::get(Msg::PROCESSING) << std::endl;
+        if (!write_snapshot(cfg.inputPath, cfg.snapshotPath, rootName, ignoreMgr, poolThreads)) {
+            std::cerr << Strings::get(Msg::ERR_FILE_OPEN) << to_utf8(path_to_wide(cfg.snapshotPath)) << std::endl;
+            return;
+        }
+        std::cout << Strings::get(Msg::MSG_SAVED) << to_utf8(path_to_wide(cfg.snapshotPath)) << std::endl;
+        return;
+    }
+
+    // 比较：两侧按同一名称序归并，同样不受 --sort 与输出限制影响
+    SnapshotReader snapshot;
+    bool diffSnapshot = false;
+    if (!cfg.diffPath.empty()) {
+        if (!fs::exists(cfg.diffPath)) { std::cout << Strings::get(Msg::ERR_PATH) << std::endl; return; }
+        diffSnapshot = !fs::is_directory(cfg.diffPath);
+        if (diffSnapshot && !snapshot.open(cfg.diffPath)) { std::cerr << Strings::get(Msg::ERR_SNAPSHOT) << to_utf8(path_to_wide(cfg.diffPath)) << std::endl; return; }
+        if (!diffSnapshot && !finalOutPath.empty()) exclude_own_file(ignoreMgr, cfg.diffPath, finalOutPath);
+        g_sortMode = SORT_NAME;
+        g_limits = TreeLimits{};
+    }
+
+    // 索引与归档的建树在开始输出前完成，出错时不留下空的输出文件
+    GitTree gitTree(ignoreMgr);
+    if (cfg.gitTracked) {
+        Msg error;
+        if (!gitTree.build(cfg.inputPath, cfg.gitOthers, error)) { std::cerr << Strings::get(error) << std::endl; return; }
+        timeline.mark("git index");
+    }
+    ArchiveTree archiveTree(ignoreMgr);
+    const bool archive = !fs::is_directory(cfg.inputPath);
+    if (archive) {
+        if (!archiveTree.build(cfg.inputPath)) { std::cerr << Strings::get(Msg::ERR_ARCHIVE) << to_utf8(path_to_wide(cfg.inputPath)) << std::endl; return; }
+        timeline.mark("archive");
+    }
+
+    // 结构化格式输出到终端时保持标准输出只含数据本身
+    if (cfg.format == FORMAT_TEXT || cfg.OutputFlag) std::cout << Strings::get(Msg::PROCESSING) << std::endl;
+
+    std::ofstream outFile;
+    if (cfg.OutputFlag) {
+        outFile.open(finalOutPath, std::ios::binary);
+        if (!outFile.is_open()) std::cerr << Strings::get(Msg::ERR_FILE_OPEN) << to_utf8(path_to_wide(finalOutPath)) << std::endl;
+        else if (cfg.format == FORMAT_TEXT) outFile << "\xEF\xBB\xBF";
+    }
+    const bool toFile = outFile.is_open();
+    std::string clipText;
+
+    // 5. 执行
+    // --max-lines 需按输出顺序计数，因此总是单线程遍历，到达上限即停止
+    LineBudget budget{ cfg.limits.maxLines };
+    LineBudget* lineBudget = cfg.limits.maxLines ? &budget : nullptr;
+    TreeIgnore includeMgr;
+    for (const auto& glob : cfg.includes) includeMgr.add_rule(glob);
+    BundleOptions bundleOpt = cfg.bundleOpt;
+    if (cfg.threadCount > 1) bundleOpt.threads = cfg.threadCount;
+#ifdef _WIN32
+    if (cfg.format == FORMAT_BIN && !cfg.OutputFlag) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    // 结构化格式只输出目录树本身 (不附加 --top 排行与 --bundle 内容)，总是单线程边遍历边写出
+    auto emit = [&](auto& out) {
+        if (cfg.sizes) {
+            SizeTree sizeTree(ignoreMgr);
+            sizeTree.scan(cfg.inputPath, poolThreads, 0);
+            sizeTree.emit(rootName, out, lineBudget);
+            return;
+        }
+        if (cfg.scanBudget.enabled()) {
+            BudgetTree tree(ignoreMgr, cfg.scanBudget);
+            tree.scan(cfg.inputPath, poolThreads);
+            tree.emit(rootName, out, lineBudget);
+            return;
+        }
+        if (cfg.gitTracked) {
+            gitTree.emit(rootName, out, lineBudget, sort_needs_stat());
+            return;
+        }
+        if (archive) {
+            archiveTree.emit(rootName, out, lineBudget, true);
+            return;
+        }
+        out.open_dir(NodeInfo{ rootName, true }, true);
+        generate_tree_records(cfg.inputPath, out, ignoreMgr, lineBudget);
+        out.close_dir();
+        out.finish(budget.truncated);
+    };
+    auto run = [&](auto& writer) {
+        using Writer = std::decay_t<decltype(writer)>;
+        timeline.mark("setup");
+        if (cfg.format == FORMAT_JSON) { JsonEmitter<Writer> out(writer); emit(out); }
+        else if (cfg.format == FORMAT_NDJSON) { NdjsonEmitter<Writer> out(writer); emit(out); }
+        else if (cfg.format == FORMAT_BIN) { BinEmitter<Writer> out(writer); emit(out); }
+        else if (!cfg.diffPath.empty()) {
+            TreeDiff diff(ignoreMgr, diffSnapshot ? &snapshot : nullptr, poolThreads);
+            diff.run(cfg.diffPath, cfg.inputPath);
+            diff.write(rootName, writer);
+        }
+        else if (cfg.sizes) {
+            SizeTree sizeTree(ignoreMgr);
+            sizeTree.scan(cfg.inputPath, poolThreads, cfg.topCount);
+            TextEmitter<Writer> out(writer);
+            sizeTree.emit(rootName, out, lineBudget);
+            sizeTree.write_top(writer);
+        }
+        else if (cfg.scanBudget.enabled()) {
+            BudgetTree tree(ignoreMgr, cfg.scanBudget);
+            tree.scan(cfg.inputPath, poolThreads);
+            TextEmitter<Writer> out(writer);
+            tree.emit(rootName, out, lineBudget);
+            tree.write_summary(writer);
+        }
+        else if (cfg.gitTracked) {
+            TextEmitter<Writer> out(writer);
+            gitTree.emit(rootName, out, lineBudget);
+        }
+        else if (archive) {
+            TextEmitter<Writer> out(writer);
+            archiveTree.emit(rootName, out, lineBudget);
+        }
+        else {
+            writer.writeLine(rootName, U_FOLDER);
+            if (!cfg.cachePath.empty()) generate_tree_with_cache(cfg.inputPath, cfg.cachePath, writer, ignoreMgr, lineBudget);
+            else if (cfg.threadCount > 1 && !lineBudget) generate_tree_parallel(cfg.inputPath, writer, ignoreMgr, cfg.threadCount);
+            else if (g_sortMode == SORT_NONE && !ignoreMgr.nested()) {
+                LinkTargets links(cfg.inputPath);
+                generate_tree_streaming(cfg.inputPath, L"", L"", writer, ignoreMgr, links, lineBudget);
+            }
+            else generate_tree_serial(cfg.inputPath, writer, ignoreMgr, lineBudget);
+            if (budget.truncated) writer.writeLine(Strings::get(Msg::MSG_TRUNCATED));
+        }
+        timeline.mark("traverse");
+        if (cfg.bundle && cfg.format == FORMAT_TEXT && cfg.diffPath.empty()) {
+            write_bundle(cfg.inputPath, writer, ignoreMgr, cfg.includes.empty() ? nullptr : &includeMgr, bundleOpt);
+            timeline.mark("bundle");
+        }
+        writer.finish();
+    };
+
+    // 按输出组合选择编译期确定的写出器；文件写入交给后台线程
+    if (!cfg.OutputFlag && !cfg.CopyFlag) { MultiWriter<ConsoleSink> w; run(w); }
+    else if (!cfg.OutputFlag) { MultiWriter<ConsoleSink, ClipboardSink> w(ConsoleSink{}, ClipboardSink{ &clipText }); run(w); }
+    else if (toFile && !cfg.CopyFlag) { MultiWriter<AsyncSink<FileSink>> w(FileSink{ &outFile }); run(w); }
+    else if (toFile) { MultiWriter<AsyncSink<FileSink>, ClipboardSink> w(FileSink{ &outFile }, ClipboardSink{ &clipText }); run(w); }
+    else if (cfg.CopyFlag) { MultiWriter<ClipboardSink> w(ClipboardSink{ &clipText }); run(w); }
+
+    if (toFile) {
+        outFile.close();
+        std::cout << Strings::get(Msg::MSG_SAVED) << to_utf8(path_to_wide(finalOutPath)) << std::endl;
+    }
+    if (cfg.CopyFlag) CopyToClipboard(clipText);
+
+    if (g_statsEnabled) {
+        timeline.mark("finish");
+        PrintStats(cfg.statsMode, timeline, ignoreMgr, cfg.sizes || cfg.scanBudget.enabled() || !cfg.diffPath.empty() ? poolThreads : cfg.cachePath.empty() && !cfg.gitTracked && !archive && !lineBudget && cfg.format == FORMAT_TEXT ? cfg.threadCount : 1);
+    }
+}
+
+// 内存映射后识别编码，直接从映射区转码到剪贴板
+void RunFileContentCopy(const fs::path& filePath) {
+    if (!fs::exists(filePath)) { std::cout << Strings::get(Msg::ERR_PATH) << std::endl; return; }
+    MappedFile file;
+    if (!file.open(filePath)) { std::cout << Strings::get(Msg::ERR_FILE_READ) << to_utf8(path_to_wide(filePath)) << std::endl; return; }
+
+    std::string_view content(file.data(), file.size());
+    TextEncoding enc = detect_encoding(content);
+    std::cout << Strings::get(Msg::MSG_ENCODING) << encoding_name(enc) << std::endl;
+    CopyToClipboard(content, enc);
+}
+
+// ----------------------------------------------------------------------------
+// 常驻服务 (--serve)
+// ----------------------------------------------------------------------------
+// 监听本地套接字 (Windows 为命名管道)，每个连接一个请求：
+//   请求：命令行参数，每行一个 (UTF-8)，以空行或关闭写端结束；路径按服务进程的工作目录解析
+//   响应：首行 "OK" 或 "ERR <原因>"，其后为输出内容 (与命令行写到终端的相同)，写完即关闭连接
+// 编译后的忽略规则按内容缓存，规则集上保留最近读取的目录列表，相同或重叠的请求无需重新读取未变化的目录
+
+constexpr size_t SERVE_IGNORE_SETS = 16;         // 缓存的规则集数
+constexpr size_t SERVE_LISTING_DIRS = 1 << 16;   // 每个规则集保留的目录列表数
+constexpr size_t SERVE_MAX_REQUEST = 64 * 1024;  // 请求的最大字节数
+
+// 编译后的忽略规则集，按最近使用淘汰
+// key 为忽略配置文件内容、-n 规则与 --gitignore 的哈希：文件被修改后按新内容重新编译，旧规则集 (及其目录列表) 随之淘汰
+class IgnoreSetCache {
+    struct Slot { uint64_t key; std::shared_ptr<const TreeIgnore> set; };
+    std::mutex _mutex;
+    std::list<Slot> _lru;  // 最近使用的在前
+
+public:
+    std::shared_ptr<const TreeIgnore> get(const AppConfig& cfg) {
+        std::string text;
+        {
+            std::ifstream file(select_ignore_file(cfg), std::ios::binary);
+            if (file.is_open()) {
+                std::ostringstream content;
+                content << file.rdbuf();
+                text = content.str();
+            }
+        }
+        uint64_t key = xxh64(text.data(), text.size(), cfg.nestedIgnore ? 1 : 0);
+        for (const auto& r : cfg.tempIgnores) {
+            std::string rule = to_utf8(r);
+            key = xxh64(rule.data(), rule.size(), key);
+        }
+
+        auto find = [&]() -> std::shared_ptr<const TreeIgnore> {
+            for (auto it = _lru.begin(); it != _lru.end(); ++it) {
+                if (it->key != key) continue;
+                _lru.splice(_lru.begin(), _lru, it);
+                return it->set;
+            }
+            return nullptr;
+        };
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (auto set = find()) return set;
+        }
+
+        // 编译在锁外进行；并发请求同时编译同一组规则时保留先放入的一份
+        auto set = std::make_shared<TreeIgnore>();
+        set->add_rules_from(text);
+        for (const auto& r : cfg.tempIgnores) set->add_rule(r);
+        set->set_nested(cfg.nestedIgnore);
+        set->keep_listings(SERVE_LISTING_DIRS);
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (auto existing = find()) return existing;
+        _lru.push_front(Slot{ key, set });
+        if (_lru.size() > SERVE_IGNORE_SETS) _lru.pop_back();
+        return set;
+    }
+};
+
+#ifdef _WIN32
+using ServeConnection = HANDLE;
+#else
+using ServeConnection = int;
+#endif
+
+// 连接的写端；对方提前断开后丢弃其余输出
+struct ConnectionSink {
+    ServeConnection conn;
+    bool* broken;
+
+    void write(std::string_view data) {
+        while (!*broken && !data.empty()) {
+#ifdef _WIN32
+            DWORD n = 0;
+            if (!WriteFile(conn, data.data(), (DWORD)std::min<size_t>(data.size(), 1 << 30), &n, nullptr)) { *broken = true; return; }
+#else
+            ssize_t n = ::write(conn, data.data(), data.size());
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) { *broken = true; return; }
+#endif
+            data.remove_prefix((size_t)n);
+        }
+    }
+    void close() {}
+};
+
+// 读取请求并拆分为参数；超出 SERVE_MAX_REQUEST 时返回 false
+bool read_serve_request(ServeConnection conn, std::vector<std::wstring>& args) {
+    std::string buf;
+    char chunk[4096];
+    for (;;) {
+        size_t end = buf.find("\n\n");
+        if (end == std::string::npos) end = buf.find("\n\r\n");
+        if (end != std::string::npos) { buf.resize(end + 1); break; }
+        if (buf.size() > SERVE_MAX_REQUEST) return false;
+#ifdef _WIN32
+        DWORD n = 0;
+        if (!ReadFile(conn, chunk, sizeof(chunk), &n, nullptr) || n == 0) break;
+#else
+        ssize_t n = ::read(conn, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+#endif
+        buf.append(chunk, (size_t)n);
+    }
+
+    std::string_view text(buf);
+    while (!text.empty()) {
+        size_t eol = text.find('\n');
+        std::string_view line = text.substr(0, eol);
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        if (!line.empty()) args.push_back(to_wide(std::string(line)));
+        if (eol == std::string_view::npos) break;
+        text.remove_prefix(eol + 1);
+    }
+    return true;
+}
+
+// 处理一个请求：输出写入 writer (首行为状态)
+// 只生成目录树与打包内容；写文件、剪贴板、监视、索引与比较等命令行专用选项视为参数错误
+template <class Writer>
+void serve_request(const std::vector<std::wstring>& args, IgnoreSetCache& ignores, Writer& writer) {
+    std::vector<std::wstring> argvStore;
+    argvStore.reserve(args.size() + 1);
+    argvStore.push_back(L"CTree");
+    argvStore.insert(argvStore.end(), args.begin(), args.end());
+    std::vector<wchar_t*> argv;
+    for (auto& a : argvStore) argv.push_back(a.data());
+    argv.push_back(nullptr);
+
+    AppConfig cfg;
+    cfg.parse((int)argvStore.size(), argv.data());
+    if (!cfg.isValid || cfg.showMenu || cfg.showHelp || cfg.showVersion || cfg.inputPath.empty() || cfg.OutputFlag || cfg.CopyFlag ||
+        cfg.watch || cfg.statsMode || !cfg.cachePath.empty() || !cfg.diffPath.empty() || !cfg.snapshotPath.empty() || !cfg.servePath.empty() ||
+        cfg.createGlobal || cfg.createLocal || cfg.deleteGlobal) {
+        writer.writeRaw("ERR ");
+        writer.writeRaw(Strings::get(Msg::ERR_ARGS));
+        writer.writeRaw("\n");
+        return;
+    }
+    std::error_code ec;
+    const bool archive = fs::is_regular_file(cfg.inputPath, ec);
+    if (!archive && !fs::is_directory(cfg.inputPath, ec)) {
+        writer.writeRaw("ERR ");
+        writer.writeRaw(Strings::get(Msg::ERR_PATH));
+        writer.writeRaw("\n");
+        return;
+    }
+
+    // 设置只对本线程 (及本请求创建的线程池) 生效
+    g_sortMode = cfg.sortMode;
+    g_linkPolicy = cfg.linkPolicy;
+    g_limits = cfg.limits;
+    std::shared_ptr<const TreeIgnore> ignore = ignores.get(cfg);
+    std::wstring rootName = path_to_wide(cfg.inputPath.filename());
+    if (rootName.empty()) rootName = path_to_wide(cfg.inputPath);
+    const unsigned poolThreads = cfg.threadCount > 1 ? cfg.threadCount : std::min(8u, std::max(1u, std::thread::hardware_concurrency()));
+    LineBudget budget{ cfg.limits.maxLines };
+    LineBudget* lineBudget = cfg.limits.maxLines ? &budget : nullptr;
+    GitTree gitTree(*ignore);
+    if (Msg error; cfg.gitTracked && !gitTree.build(cfg.inputPath, cfg.gitOthers, error)) {
+        writer.writeRaw("ERR ");
+        writer.writeRaw(Strings::get(error));
+        writer.writeRaw("\n");
+        return;
+    }
+    ArchiveTree archiveTree(*ignore);
+    if (archive && !archiveTree.build(cfg.inputPath)) {
+        writer.writeRaw("ERR ");
+        writer.writeRaw(Strings::get(Msg::ERR_ARCHIVE));
+        writer.writeRaw(to_utf8(path_to_wide(cfg.inputPath)));
+        writer.writeRaw("\n");
+        return;
+    }
+
+    writer.writeRaw("OK\n");
+    auto emit = [&](auto& out) {
+        if (cfg.sizes) {
+            SizeTree sizeTree(*ignore);
+            sizeTree.scan(cfg.inputPath, poolThreads, 0);
+            sizeTree.emit(rootName, out, lineBudget);
+            return;
+        }
+        if (cfg.scanBudget.enabled()) {
+            BudgetTree tree(*ignore, cfg.scanBudget);
+            tree.scan(cfg.inputPath, poolThreads);
+            tree.emit(rootName, out, lineBudget);
+            return;
+        }
+        if (cfg.gitTracked) {
+            gitTree.emit(rootName, out, lineBudget, sort_needs_stat());
+            return;
+        }
+        if (archive) {
+            archiveTree.emit(rootName, out, lineBudget, true);
+            return;
+        }
+        out.open_dir(NodeInfo{ rootName, true }, true);
+        generate_tree_records(cfg.inputPath, out, *ignore, lineBudget);
+        out.close_dir();
+        out.finish(budget.truncated);
+    };
+    if (cfg.format == FORMAT_JSON) { JsonEmitter<Writer> out(writer); emit(out); }
+    else if (cfg.format == FORMAT_NDJSON) { NdjsonEmitter<Writer> out(writer); emit(out); }
+    else if (cfg.format == FORMAT_BIN) { BinEmitter<Writer> out(writer); emit(out); }
+    else if (cfg.sizes) {
+        SizeTree sizeTree(*ignore);
+        sizeTree.scan(cfg.inputPath, poolThreads, cfg.topCount);
+        TextEmitter<Writer> out(writer);
+        sizeTree.emit(rootName, out, lineBudget);
+        sizeTree.write_top(writer);
+    }
+    else if (cfg.scanBudget.enabled()) {
+        BudgetTree tree(*ignore, cfg.scanBudget);
+        tree.scan(cfg.inputPath, poolThreads);
+        TextEmitter<Writer> out(writer);
+        tree.emit(rootName, out, lineBudget);
+        tree.write_summary(writer);
+    }
+    else if (cfg.gitTracked) {
+        TextEmitter<Writer> out(writer);
+        gitTree.emit(rootName, out, lineBudget);
+    }
+    else if (archive) {
+        TextEmitter<Writer> out(writer);
+        archiveTree.emit(rootName, out, lineBudget);
+    }
+    else {
+        // --sort none 同样走缓冲整个目录的遍历，以便复用目录列表
+        writer.writeLine(rootName, U_FOLDER);
+        if (cfg.threadCount > 1 && !lineBudget) generate_tree_parallel(cfg.inputPath, writer, *ignore, cfg.threadCount);
+        else generate_tree_serial(cfg.inputPath, writer, *ignore, lineBudget);
+        if (budget.truncated) writer.writeLine(Strings::get(Msg::MSG_TRUNCATED));
+    }
+    if (cfg.bundle && cfg.format == FORMAT_TEXT) {
+        TreeIgnore includeMgr;
+        for (const auto& glob : cfg.includes) includeMgr.add_rule(glob);
+        BundleOptions bundleOpt = cfg.bundleOpt;
+        if (cfg.threadCount > 1) bundleOpt.threads = cfg.threadCount;
+        write_bundle(cfg.inputPath, writer, *ignore, cfg.includes.empty() ? nullptr : &includeMgr, bundleOpt);
+    }
+}
+
+void handle_serve_connection(ServeConnection conn, IgnoreSetCache& ignores) {
+    bool broken = false;
+    MultiWriter<ConnectionSink> writer(ConnectionSink{ conn, &broken });
+    std::vector<std::wstring> args;
+    if (read_serve_request(conn, args)) serve_request(args, ignores, writer);
+    else {
+        writer.writeRaw("ERR ");
+        writer.writeRaw(Strings::get(Msg::ERR_ARGS));
+        writer.writeRaw("\n");
+    }
+    writer.finish();
+}
+
+// 已接受的连接按到达顺序交给固定数量的处理线程 (先到先服务，不用工作窃取池的 LIFO 队列)
+class ServeQueue {
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<ServeConnection> _pending;
+    std::vector<std::thread> _workers;
+
+public:
+    template <class Handler>
+    ServeQueue(unsigned threads, Handler handler) {
+        for (unsigned i = 0; i < threads; ++i) {
+            _workers.emplace_back([this, handler] {
+                for (;;) {
+                    ServeConnection conn;
+                    {
+                        std::unique_lock<std::mutex> lk(_mutex);
+                        _cv.wait(lk, [this] { return !_pending.empty(); });
+                        conn = _pending.front();
+                        _pending.pop_front();
+                    }
+                    handler(conn);
+                }
+            });
+        }
+    }
+    ~ServeQueue() { for (auto& t : _workers) t.detach(); }
+
+    void push(ServeConnection conn) {
+        {
+            std::lock_guard<std::mutex> lk(_mutex);
+            _pending.push_back(conn);
+        }
+        _cv.notify_one();
+    }
+};
+
+// 常驻运行直到进程被终止；threads 为同时处理的请求数
+int RunServe(const fs::path& endpoint, unsigned threads) {
+    IgnoreSetCache ignores;
+#ifdef _WIN32
+    // 命名管道：未写 \\.\pipe\ 前缀时自动补上；每个连接一个管道实例
+    std::wstring name = endpoint.wstring();
+    if (name.compare(0, 9, L"\\\\.\\pipe\\") != 0) name = L"\\\\.\\pipe\\" + name;
+    ServeQueue queue(threads, [&ignores](HANDLE pipe) {
+        handle_serve_connection(pipe, ignores);
+        FlushFileBuffers(pipe);
+        DisconnectNamedPipe(pipe);
+        CloseHandle(pipe);
+    });
+    bool first = true;
+    for (;;) {
+        HANDLE pipe = CreateNamedPipeW(name.c_str(), PIPE_ACCESS_DUPLEX | (first ? FILE_FLAG_FIRST_PIPE_INSTANCE : 0),
+                                       PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                       PIPE_UNLIMITED_INSTANCES, 1 << 16, 1 << 16, 0, nullptr);
+        if (pipe == INVALID_HANDLE_VALUE) {
+            if (!first) { Sleep(10); continue; }
+            std::cerr << Strings::get(Msg::ERR_SERVE) << to_utf8(name) << std::endl;
+            return 1;
+        }
+        if (first) std::cout << Strings::get(Msg::MSG_SERVING) << to_utf8(name) << std::endl;
+        first = false;
+        if (ConnectNamedPipe(pipe, nullptr) || GetLastError() == ERROR_PIPE_CONNECTED) queue.push(pipe);
+        else CloseHandle(pipe);
+    }
+#else
+    // 对方提前断开时 write 返回错误而不是终止进程
+    std::signal(SIGPIPE, SIG_IGN);
+    const std::string& path = endpoint.native();
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    int fd = path.size() < sizeof(addr.sun_path) ? ::socket(AF_UNIX, SOCK_STREAM, 0) : -1;
+    if (fd >= 0) {
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        // 上次运行遗留的套接字文件 (不删除其他类型的文件)
+        struct stat st;
+        if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) ::unlink(path.c_str());
+        if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 128) != 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0) {
+        std::cerr << Strings::get(Msg::ERR_SERVE) << to_utf8(path_to_wide(endpoint)) << std::endl;
+        return 1;
+    }
+    std::cout << Strings::get(Msg::MSG_SERVING) << to_utf8(path_to_wide(endpoint)) << std::endl;
+
+    ServeQueue queue(threads, [&ignores](int conn) {
+        handle_serve_connection(conn, ignores);
+        ::close(conn);
+    });
+    for (;;) {
+        int conn = ::accept(fd, nullptr, nullptr);
+        if (conn >= 0) queue.push(conn);
+        else if (errno != EINTR && errno != ECONNABORTED) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+#endif
+}
+
+// ============================================================================
+// [Section 4] 入口点
+// ============================================================================
+
+int run_cli(int argc, wchar_t* argv[]) {
+    AppConfig config;
+    config.parse(argc, argv);
+
+    if (config.showHelp) { std::cout << Strings::get(Msg::HELP_MSG); return 0; }
+    if (config.showVersion) { std::cout << to_utf8(VERSION); return 0; }
+    if (!config.isValid) { std::cout << Strings::get(Msg::ERR_ARGS) << std::endl; return 1; }
+    if (config.showMenu) { ShowInteractiveMenu(); return 0; }
+
+    if (config.createGlobal) create_ignore_template(get_global_ignore_path());
+    if (config.deleteGlobal) { fs::path p = get_global_ignore_path(); if (fs::exists(p)) fs::remove(p); else std::cout << Strings::get(Msg::INFO_REM_GLOBAL) << std::endl; }
+    if (config.createLocal) create_ignore_template((config.inputPath.empty() ? fs::current_path() : config.inputPath) / IGNORE_FILENAME);
+
+    if (!config.servePath.empty()) {
+        return RunServe(config.servePath, config.threadCount > 1 ? config.threadCount : std::min(16u, std::max(2u, std::thread::hardware_concurrency())));
+    }
+    if (config.CopyFlag && !config.copyFilePath.empty() && config.inputPath.empty()) {
+        RunFileContentCopy(config.copyFilePath);
+    }
+    else if (!config.inputPath.empty()) {
+        RunTreeGeneration(config);
+    }
+    return 0;
+}
+
+#ifndef _WIN32
+int run_cli(int argc, char* argv[]) {
+    // 命令行参数按 UTF-8 解码为宽字符，与 Windows 入口保持一致
+    std::vector<std::wstring> args(argc);
+    std::vector<wchar_t*> wargv;
+    for (int i = 0; i < argc; ++i) {
+        args[i] = to_wide(argv[i]);
+        wargv.push_back(args[i].data());
+    }
+    wargv.push_back(nullptr);
+    return run_cli(argc, wargv.data());
+}
+#endif
+
+}  // namespace ctree::cli
+
+#ifdef _WIN32
+int wmain(int argc, wchar_t* argv[]) {
+    // 启用 UTF-8 全流程支持
+    SetConsoleOutputCP(CP_UTF8);
+    SetConsoleCP(CP_UTF8);
+    return ctree::cli::run_cli(argc, argv);
+}
+#else
+int main(int argc, char* argv[]) {
+    return ctree::cli::run_cli(argc, argv);
+}
+#endif